@@ -8,19 +8,31 @@
  * The apu expects to receive the base address of a sample buffer that is
  * located in ddr3 memory. Once given to the APU, this buffer must not change
  * while it is in use by the APU. The APU uses interrupts to communicate when
- * a buffer has been fully consumed. We use these interrupts to inform
- * a user mode process, which currently owns the APU, that we need more
- * samples.
+ * a buffer has been fully consumed. We use these interrupts to wake the
+ * user mode process which currently owns the APU, which is either blocked
+ * in write() or waiting in poll() for the APU to need more samples.
+ *
+ * Samples are given to the driver either by write(), which copies them into
+ * the next free sample buffer, or by filling that buffer in place through an
+ * mmap() of the sample buffers and committing it with an ioctl.
  */
 
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/fs.h>
+#include <linux/mm.h>
 #include <linux/io-mapping.h>
 #include <linux/atomic.h>
 #include <linux/init.h>
 #include <linux/interrupt.h>
 #include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
 #include <linux/platform_device.h>
 #include <linux/io.h>
 #include <linux/of.h>
@@ -33,6 +45,9 @@
 
 #include <linux/fp-game/drv_apu.h>
 
+#define CREATE_TRACE_POINTS
+#include "apu_trace.h"
+
 /** @brief The address of the apu's memory mapped I/O. */
 //@{
 #define APU_MMIO_BASE 0xFF200010
@@ -52,7 +67,13 @@
 //@}
 
 /** @brief The size of each apu sample buffer. */
-#define APU_BUF_SIZE (sizeof(unsigned char) * 512)
+#define APU_BUF_SIZE APU_SLOT_SIZE
+
+/** @brief The time taken to play one sample buffer (512 samples at 32KHz). */
+#define APU_BUF_TIME_NS 16000000
+
+/** @brief The ring depth used until the user sets one. */
+#define APU_RING_DEFAULT 2
 
 /* Module Functions */
 static int apu_probe(struct platform_device *pdev);
@@ -62,12 +83,23 @@ static long apu_ioctl(struct file *file, unsigned ioctl_num,
                       unsigned long ioctl_param);
 static ssize_t apu_write(struct file *file, const char __user *buf,
                          size_t len, loff_t *offset);
+static __poll_t apu_poll(struct file *file, poll_table *wait);
+static int apu_mmap(struct file *file, struct vm_area_struct *vma);
 static int apu_release(struct inode *inode, struct file *file);
 static int apu_remove(struct platform_device *pdev);
 
 /* Helper Functions */
 static void mmio_write(unsigned addr, unsigned val);
-static void send_user_interrupt(pid_t pid, int code);
+static void ring_reset(unsigned depth);
+static unsigned ring_free(void);
+static int ring_wait(struct file *file);
+static void ring_commit(unsigned len);
+static long get_slot(struct file *file, u32 __user *slot);
+static long commit_slot(struct file *file,
+                        const struct apu_commit __user *arg);
+static void ring_send(void);
+static void ring_refilled(void);
+static long get_stats(struct apu_stats __user *stats);
 
 /** @brief The I/O mapping region for the apu driver. */
 static struct io_mapping *apu_io;
@@ -75,41 +107,75 @@ static struct io_mapping *apu_io;
 /** @brief The device structure for the apu. */
 static struct device *apu_dev;
 
+/** @brief Whether a process has the apu open. Protected by open_lock. */
+static bool apu_owned;
+
 /** @brief The lock used to protect the APU from multiple processes. */
-static atomic_t apu_lock;
+static DEFINE_MUTEX(open_lock);
+
+/** @brief Wait queue for writers waiting on the APU to request samples. */
+static DECLARE_WAIT_QUEUE_HEAD(sample_wait);
 
 /** @brief Device Class for this driver */
-struct class *cl;
+static struct class *cl;
+
+/**
+ * @brief The state of an open apu file, kept in its private_data.
+ *
+ * fill_lock is held while a slot is being filled, by write() or through the
+ * mapping, so that threads sharing the file take turns at the next free slot.
+ */
+struct apu_file {
+	struct mutex fill_lock;
+};
 
 /**
  * @brief The structure type used to manage apu sample sending/receiving.
  *
- * On initialization, the driver requests twice the apu buffer size
- * of dma-able memory. This memory is assigned to our double buffered
- * sample buffer, buf. dma_addr is also given the base physical address
- * that the apu should use to access samples by that request.
- *
- * active_buf denotes the buffer currently being used by the apu to play
- * samples (which should not be written to).
- *
- * sample_req and pid are used to coordinate communication with the user
- * mode part of the driver. The user mode portion must register its pid
- * with the driver after making a successful call to open on our device file.
- * Once that is done, interrupts will be enabled. The interrupt handler
- * will set sample_req to 1, which is exchanged to 0 during the write call
- * the user mode driver makes to send us new samples. This prevents us from
- * receiving multiple new sample buffers per sample frame.
+ * On initialization, the driver requests APU_RING_MAX apu buffers worth of
+ * dma-able memory, buf, which is used as a ring of sample buffers. dma_addr
+ * is the base physical address that the apu should use to access them.
+ *
+ * Each slot of the ring is in one of three states, in ring order:
+ *  - Given to the apu (hw slots, at most 2). The first is playing, and the
+ *    second (if any) is queued in the apu to play next.
+ *  - Filled by the user, waiting to be given to the apu (filled slots).
+ *  - Free, and available to the next write (the rest). The next free slot is
+ *    head.
+ *
+ * The apu raises its irq whenever it has no queued buffer. The irq handler
+ * frees the buffer which just finished (if any), and gives the apu the next
+ * filled slot. If there is none, requested is set, and the next write gives
+ * its buffer to the apu right away.
+ *
+ * All of the ring state is shared with the irq handler, and so is protected
+ * by lock.
  */
 struct apu_sample {
 	// Driver instance specific info.
-	unsigned char *buf[2];
-	unsigned active_buf;
+	unsigned char *buf;
 	dma_addr_t dma_addr;
+	spinlock_t lock;
 
 	// User instance specific info.
-	atomic_t req;
-	pid_t pid;
-} sample;
+	unsigned depth;
+	unsigned head;
+	unsigned filled;
+	unsigned hw;
+	bool started;
+	bool requested;
+	bool req_playing;  // Whether the apu was still playing at the request
+	ktime_t req_time;
+	ktime_t drain_time; // When the apu will run out of samples, at the latest
+
+	// Statistics, reported by IOCTL_APU_GET_STATS.
+	u32 underruns;
+	u32 overruns;
+	u32 latency[APU_LATENCY_BUCKETS];
+} sample = {
+	.lock = __SPIN_LOCK_UNLOCKED(sample.lock),
+	.depth = APU_RING_DEFAULT,
+};
 
 /**
  * @brief Interrupt table structure thing.
@@ -148,6 +214,8 @@ static struct file_operations fops = {
 	.open = apu_open,
 	.unlocked_ioctl = apu_ioctl,
 	.write = apu_write,
+	.poll = apu_poll,
+	.mmap = apu_mmap,
 	.release = apu_release,
 };
 
@@ -176,10 +244,9 @@ static int apu_probe(struct platform_device *pdev)
 
 	/* Allocate sample buffers */
 	apu_dev = &(pdev->dev);
-	sample.buf[0] = dma_alloc_coherent(apu_dev, APU_BUF_SIZE << 1,
-	                                   &sample.dma_addr, GFP_KERNEL);
-	sample.buf[1] = &(sample.buf[0][APU_BUF_SIZE]);
-	if (sample.buf[0] == NULL) {
+	sample.buf = dma_alloc_coherent(apu_dev, APU_BUF_SIZE * APU_RING_MAX,
+	                                &sample.dma_addr, GFP_KERNEL);
+	if (sample.buf == NULL) {
 		printk(KERN_ALERT "FP-GAme apu failed to alloc sample buffers");
 		return -1;
 	}
@@ -202,9 +269,10 @@ static int apu_probe(struct platform_device *pdev)
 /**
  * @brief Handles an apu irq.
  *
- * When an apu irq is received, a request for more samples will be sent
- * to the user (if a user has been specified) and the active apu buffer
- * will be switched. The next write to the apu module will fill the buffer
+ * When an apu irq is received, the buffer which finished playing is freed,
+ * and the next filled buffer (if any) is given to the apu. Otherwise, the
+ * request is left pending for the next write. Any writer waiting on a free
+ * slot is woken. The next write to the apu module will fill the buffer
  * that this interrupt signaled the emptying of.
  *
  * @param irq Ignored.
@@ -213,12 +281,32 @@ static int apu_probe(struct platform_device *pdev)
  */
 static irqreturn_t apu_irq(int irq, void *dev_id)
 {
+	unsigned long flags;
+	unsigned free;
+
+	spin_lock_irqsave(&sample.lock, flags);
+
 	/* Acknowledge the interrupt, dropping the IRQ line. */
 	mmio_write(APU_CONFIG_OFFSET, APU_IRQ_ACK | APU_ENABLE);
 
-	/* Signal the user process that we need more samples. */
-	atomic_set(&sample.req, 1);
-	if (sample.pid) { send_user_interrupt(sample.pid, APU_MAJOR_NUM); }
+	/*
+	 * The apu has taken its queued buffer, so the one it was playing
+	 * before that has finished.
+	 */
+	if (sample.hw == 2) { sample.hw--; }
+
+	sample.requested = true;
+	sample.req_playing = (sample.hw > 0);
+	sample.req_time = ktime_get();
+	trace_apu_ring_irq(sample.hw, sample.filled, sample.req_playing);
+	if (sample.filled > 0) { ring_refilled(); }
+	free = sample.depth - sample.filled - sample.hw;
+
+	spin_unlock_irqrestore(&sample.lock, flags);
+
+	/* Wake the user process, since there is room for more samples. */
+	trace_apu_wake(free);
+	wake_up_interruptible(&sample_wait);
 
 	return IRQ_HANDLED;
 }
@@ -229,54 +317,104 @@ static irqreturn_t apu_irq(int irq, void *dev_id)
  * If the APU has already been opened by another process, fails.
  *
  * @param inode Ignored.
- * @param file Ignored.
- * @return 0 on success, -1 on error.
+ * @param file The apu file being opened, which is given a fresh apu_file.
+ * @return 0 on success, or a negative integer on error.
  */
 static int apu_open(struct inode *inode, struct file *file)
 {
+	struct apu_file *ctx = kmalloc(sizeof(*ctx), GFP_KERNEL);
+
+	if (ctx == NULL) { return -ENOMEM; }
+	mutex_init(&ctx->fill_lock);
+
 	/* Acquire the apu. */
-	return (atomic_xchg(&apu_lock, 1) == 0) ? 0 : -EBUSY;
+	mutex_lock(&open_lock);
+	if (apu_owned) {
+		mutex_unlock(&open_lock);
+		kfree(ctx);
+		return -EBUSY;
+	}
+	apu_owned = true;
+	mutex_unlock(&open_lock);
+
+	file->private_data = ctx;
+	return 0;
 }
 
 /**
  * @brief Handles an IOCTL call to the apu module.
  *
- * Fails if the command is not the set callback pid command.
+ * Fails if the command is not one of the apu commands. The ring depth may
+ * only be changed before the apu is started.
  *
- * @param file Ignored.
+ * @param file The apu file, used to check for non-blocking mode.
  * @param ioctl_num The ioctl command number.
- * @param ioctl_param The PID to send the callback signal to.
- * @return 0 on success, or -1 on failure.
+ * @param ioctl_param The argument of the command.
+ * @return 0 on success, or a negative integer on failure.
  */
 static long apu_ioctl(struct file *file, unsigned ioctl_num,
                       unsigned long ioctl_param)
 {
-	if (ioctl_num != IOCTL_APU_SET_CALLBACK_PID) { return -EINVAL; }
-
-	sample.pid = ioctl_param;
-	mmio_write(APU_CONFIG_OFFSET, APU_ENABLE | APU_IRQ_REQ);
-	return 0;
+	unsigned long flags;
+
+	switch (ioctl_num) {
+	case IOCTL_APU_START:
+		spin_lock_irqsave(&sample.lock, flags);
+		sample.started = true;
+		sample.drain_time = ktime_add_ns(ktime_get(), (u64)sample.filled
+		                                              * APU_BUF_TIME_NS);
+		spin_unlock_irqrestore(&sample.lock, flags);
+
+		mmio_write(APU_CONFIG_OFFSET, APU_ENABLE | APU_IRQ_REQ);
+		return 0;
+	case IOCTL_APU_SET_DEPTH:
+		if ((ioctl_param < APU_RING_MIN) || (ioctl_param > APU_RING_MAX)) {
+			return -EINVAL;
+		}
+
+		spin_lock_irqsave(&sample.lock, flags);
+		if (sample.started) {
+			spin_unlock_irqrestore(&sample.lock, flags);
+			return -EBUSY;
+		}
+		ring_reset(ioctl_param);
+		spin_unlock_irqrestore(&sample.lock, flags);
+		return 0;
+	case IOCTL_APU_GET_STATS:
+		return get_stats((struct apu_stats __user *)ioctl_param);
+	case IOCTL_APU_GET_SLOT:
+		return get_slot(file, (u32 __user *)ioctl_param);
+	case IOCTL_APU_COMMIT:
+		return commit_slot(file,
+		                   (const struct apu_commit __user *)ioctl_param);
+	default:
+		return -EINVAL;
+	}
 }
 
 /**
  * @brief Reads user samples into the next sample buffer.
  *
- * This function may only be called once per sample request, and may only
- * be called from one process/thread at a time.
+ * Each write fills one slot of the ring. If the ring is full, the caller
+ * sleeps until the apu finishes a buffer (or fails with EAGAIN if the file is
+ * non-blocking), and an overrun is counted. Concurrent fills of the same file
+ * sleep until this one is done.
  *
  * Fails if the resulting size is larger than the APU sample buffer size,
  * or if the user supplied sample buffer is invalid.
  *
- * @param file Ignored.
+ * @param file The apu file being written to.
  * @param buf The user supplied sample buffer.
- * @param elt_size The size of the given buffer.
- * @param len Ignored.
- * @return 0 on success, or a negative integer on error.
+ * @param len The size of the given buffer.
+ * @param offset Ignored.
+ * @return len on success, or a negative integer on error.
  */
 static ssize_t apu_write(struct file *file, const char __user *buf,
                          size_t len, loff_t *offset)
 {
-	static atomic_t write_lock;
+	struct apu_file *ctx = file->private_data;
+	unsigned char *slot;
+	int ret;
 
 	/* Verify length arguments */
 	if ((len > APU_BUF_SIZE) || (buf == NULL)) {
@@ -284,61 +422,92 @@ static ssize_t apu_write(struct file *file, const char __user *buf,
 	}
 
 	/* Disallow concurrent writes to the sample buffer. */
-	if (atomic_xchg(&write_lock, 1) == 1) { return -EBUSY; }
+	if (mutex_lock_interruptible(&ctx->fill_lock) != 0) { return -EINTR; }
 
-	/* Ensure that the buffer is only written to once per sample request. */
-	if (atomic_xchg(&sample.req, 0) != 1) {
-		atomic_set(&write_lock, 0);
-		return -EBUSY;
+	/* Wait for a free slot. */
+	if ((ret = ring_wait(file)) != 0) {
+		mutex_unlock(&ctx->fill_lock);
+		return ret;
 	}
 
-	/* Copy from user memory. Clear unspecified samples. */
-	if (copy_from_user(sample.buf[!sample.active_buf], buf, len) != 0) {
-		memset(sample.buf[!sample.active_buf], 0, APU_BUF_SIZE);
-		atomic_set(&write_lock, 0);
+	/*
+	 * Copy from user memory. Only we touch free slots, so this is done
+	 * without the ring lock.
+	 */
+	slot = &sample.buf[sample.head * APU_BUF_SIZE];
+	if (copy_from_user(slot, buf, len) != 0) {
+		mutex_unlock(&ctx->fill_lock);
 		return -EFAULT;
-	} else {
-		memset(&sample.buf[!sample.active_buf][len],
-		       0, APU_BUF_SIZE - len);
 	}
+	ring_commit(len);
 
-	/* Ensure our changes are seen */
-	wmb();
+	mutex_unlock(&ctx->fill_lock);
+	return len;
+}
 
-	/* Send the new buffer. */
-	mmio_write(APU_BUF_OFFSET, sample.dma_addr
-	           + ((!sample.active_buf) ? APU_BUF_SIZE : 0));
-	sample.active_buf = !sample.active_buf;
+/**
+ * @brief Reports whether the APU is ready to accept more samples.
+ *
+ * The apu file is writable (POLLOUT) whenever the ring has a free slot.
+ *
+ * @param file The apu file being polled.
+ * @param wait The poll table to register our wait queue with.
+ * @return POLLOUT | POLLWRNORM if a slot is free, or 0 otherwise.
+ */
+static __poll_t apu_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &sample_wait, wait);
 
-	atomic_set(&write_lock, 0);
+	return (ring_free() > 0) ? (EPOLLOUT | EPOLLWRNORM) : 0;
+}
 
-	/* Enable IRQs now that we've released the lock. */
-	mmio_write(APU_CONFIG_OFFSET, APU_ENABLE | APU_IRQ_REQ);
-	return 0;
+/**
+ * @brief Maps the apu sample buffers into user memory.
+ *
+ * The whole ring is mapped, APU_RING_MAX buffers of APU_BUF_SIZE samples, so
+ * the mapping stays valid when the ring depth changes. The buffers are dma
+ * coherent, and so uncached.
+ *
+ * @param file Ignored.
+ * @param vma The user mapping to fill in.
+ * @return 0 on success, or a negative integer on failure.
+ */
+static int apu_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if (vma->vm_pgoff != 0) { return -EINVAL; }
+
+	return dma_mmap_coherent(apu_dev, vma, sample.buf, sample.dma_addr,
+	                         APU_BUF_SIZE * APU_RING_MAX);
 }
 
 /**
  * @brief Closes the apu device file.
  *
- * Calling this function releases the apu lock, allowing other processes
- * to use the apu.
+ * Calling this function releases the apu, allowing other processes to use
+ * it.
  *
- * @return 0 on success, -1 on error.
+ * @param inode Ignored.
+ * @param file The apu file being closed.
+ * @return 0.
  */
 static int apu_release(struct inode *inode, struct file *file)
 {
-	/* Reset user specific info. */
-	sample.pid = 0;
-	atomic_set(&sample.req, 0);
+	unsigned long flags;
 
 	/* Mute output and disable apu IRQs. */
 	mmio_write(APU_CONFIG_OFFSET, 0);
 
+	/* Reset user specific info. */
+	spin_lock_irqsave(&sample.lock, flags);
+	ring_reset(APU_RING_DEFAULT);
+	spin_unlock_irqrestore(&sample.lock, flags);
+
 	/* Release the apu. */
-	if (atomic_xchg(&apu_lock, 0) == 0) {
-		printk(KERN_ALERT "Close called on apu when it wasn't open!");
-	}
+	mutex_lock(&open_lock);
+	apu_owned = false;
+	mutex_unlock(&open_lock);
 
+	kfree(file->private_data);
 	return 0;
 }
 
@@ -354,13 +523,14 @@ static int apu_remove(struct platform_device *pdev)
     device_destroy(cl, dev);
     class_destroy(cl);
 
+	/* Stop the apu before its registers and buffers go away. */
+	mmio_write(APU_CONFIG_OFFSET, 0);
+	free_irq(platform_get_irq(pdev, 0), apu_irq);
+
 	unregister_chrdev(APU_MAJOR_NUM, APU_DEV_NAME);
 	io_mapping_free(apu_io);
-	dma_free_coherent(apu_dev, APU_BUF_SIZE << 1,
-	                  sample.buf[0], sample.dma_addr);
-
-	mmio_write(APU_CONFIG_OFFSET, 0);
-	free_irq(platform_get_irq(pdev, 0), NULL);
+	dma_free_coherent(apu_dev, APU_BUF_SIZE * APU_RING_MAX,
+	                  sample.buf, sample.dma_addr);
 
 	return 0;
 }
@@ -382,37 +552,242 @@ static void mmio_write(unsigned offset, unsigned val)
 }
 
 /**
- * @brief Sends an interrupt to a user space process via sigint.
- * @param pid The pid to send the signal to.
- * @param code The interrupt code to give the user in their handler.
+ * @brief Empties the ring, clears the statistics, and sets the ring depth.
+ *
+ * The apu must not be playing from the ring, and the ring lock must be held.
+ *
+ * @param depth The new depth of the ring.
+ * @return Void.
+ */
+static void ring_reset(unsigned depth)
+{
+	sample.depth = depth;
+	sample.head = 0;
+	sample.filled = 0;
+	sample.hw = 0;
+	sample.started = false;
+	sample.requested = false;
+	sample.underruns = 0;
+	sample.overruns = 0;
+	memset(sample.latency, 0, sizeof(sample.latency));
+}
+
+/**
+ * @brief Gets the number of free slots in the ring.
+ * @return The number of free slots.
+ */
+static unsigned ring_free(void)
+{
+	unsigned long flags;
+	unsigned free;
+
+	spin_lock_irqsave(&sample.lock, flags);
+	free = sample.depth - sample.filled - sample.hw;
+	spin_unlock_irqrestore(&sample.lock, flags);
+
+	return free;
+}
+
+/**
+ * @brief Waits for the ring to have a free slot.
+ *
+ * If the ring is full, an overrun is counted, and the caller sleeps until the
+ * apu finishes a buffer (or fails with EAGAIN if the file is non-blocking).
+ * The fill lock must be held.
+ *
+ * @param file The apu file being filled.
+ * @return 0 once a slot is free, or a negative integer on error.
+ */
+static int ring_wait(struct file *file)
+{
+	unsigned long flags;
+	unsigned queued;
+
+	if (ring_free() > 0) { return 0; }
+
+	spin_lock_irqsave(&sample.lock, flags);
+	sample.overruns++;
+	queued = sample.filled + sample.hw;
+	spin_unlock_irqrestore(&sample.lock, flags);
+
+	if (file->f_flags & O_NONBLOCK) {
+		trace_apu_reject(-EAGAIN, queued);
+		return -EAGAIN;
+	}
+
+	return wait_event_interruptible(sample_wait, ring_free() > 0);
+}
+
+/**
+ * @brief Adds the head slot to the ring, sending it now if the apu asked for
+ *        it.
+ *
+ * Clears the samples after len, so a full slot costs nothing extra. The fill
+ * lock must be held, and the ring must have a free slot.
+ *
+ * @param len The number of samples filled in the head slot.
  * @return Void.
  */
-static void send_user_interrupt(pid_t pid, int code)
+static void ring_commit(unsigned len)
 {
-	struct task_struct *task;
-
-	/* Construct the siginfo to be sent */
-	struct kernel_siginfo info = {
-		.si_signo = APU_CALLBACK_SIG,
-		.si_code = SI_KERNEL,
-		.si_int = 0,
-	};
-
-	/* Find the task associated with our current PID */
-	rcu_read_lock();
-	task = pid_task(find_pid_ns(pid, &init_pid_ns), PIDTYPE_PID);
-	rcu_read_unlock();
-
-	/* Bad task, probably the users fault. */
-	if (task == NULL) {
-		printk(KERN_ALERT "Could not send APU sig to invalid task!");
-		return;
+	unsigned long flags;
+	ktime_t now;
+
+	if (len < APU_BUF_SIZE) {
+		memset(&sample.buf[sample.head * APU_BUF_SIZE + len], 0,
+		       APU_BUF_SIZE - len);
 	}
 
-	/* Send the signal */
-	if (send_sig_info(APU_CALLBACK_SIG, &info, task) < 0) {
-		printk(KERN_ALERT "Failed to dispatch APU sig!");
+	/* Ensure our changes are seen */
+	wmb();
+
+	spin_lock_irqsave(&sample.lock, flags);
+	trace_apu_commit(sample.head, len, sample.filled + sample.hw + 1);
+	sample.head = (sample.head + 1) % sample.depth;
+	sample.filled++;
+	if (sample.requested) { ring_refilled(); }
+
+	/* Each slot given to the apu extends how long it can play for. */
+	if (sample.started) {
+		now = ktime_get();
+		if (ktime_after(now, sample.drain_time)) {
+			sample.drain_time = now;
+		}
+		sample.drain_time = ktime_add_ns(sample.drain_time,
+		                                 APU_BUF_TIME_NS);
+	}
+	spin_unlock_irqrestore(&sample.lock, flags);
+}
+
+/**
+ * @brief Waits for a free slot, and gives its index to the user.
+ * @param file The apu file being filled.
+ * @param slot Set to the index of the free slot.
+ * @return 0 on success, or a negative integer on error.
+ */
+static long get_slot(struct file *file, u32 __user *slot)
+{
+	struct apu_file *ctx = file->private_data;
+	int ret;
+
+	if (mutex_lock_interruptible(&ctx->fill_lock) != 0) { return -EINTR; }
+
+	if ((ret = ring_wait(file)) == 0) {
+		ret = put_user(sample.head, slot);
 	}
+
+	mutex_unlock(&ctx->fill_lock);
+	return ret;
+}
+
+/**
+ * @brief Adds a slot filled through the mapping to the ring.
+ *
+ * The slot must be the head slot, and must still be free, so a commit can
+ * never give the apu a buffer it is already playing.
+ *
+ * @param file The apu file being filled.
+ * @param arg The slot and the number of samples in it.
+ * @return 0 on success, or a negative integer on error.
+ */
+static long commit_slot(struct file *file,
+                        const struct apu_commit __user *arg)
+{
+	struct apu_file *ctx = file->private_data;
+	struct apu_commit commit;
+	long ret = 0;
+
+	if (copy_from_user(&commit, arg, sizeof(commit)) != 0) {
+		return -EFAULT;
+	}
+	if (commit.len > APU_BUF_SIZE) { return -EINVAL; }
+
+	if (mutex_lock_interruptible(&ctx->fill_lock) != 0) { return -EINTR; }
+
+	if ((commit.slot != sample.head) || (ring_free() == 0)) {
+		trace_apu_reject(-EINVAL, sample.filled + sample.hw);
+		ret = -EINVAL;
+	} else {
+		ring_commit(commit.len);
+	}
+
+	mutex_unlock(&ctx->fill_lock);
+	return ret;
+}
+
+/**
+ * @brief Gives the oldest filled slot to the apu, and re-enables its irq.
+ *
+ * The ring lock must be held, and there must be a filled slot.
+ *
+ * @return Void.
+ */
+static void ring_send(void)
+{
+	unsigned slot;
+
+	slot = (sample.head + sample.depth - sample.filled) % sample.depth;
+	sample.filled--;
+	sample.hw++;
+
+	mmio_write(APU_BUF_OFFSET, sample.dma_addr + slot * APU_BUF_SIZE);
+	mmio_write(APU_CONFIG_OFFSET, APU_ENABLE | APU_IRQ_REQ);
+}
+
+/**
+ * @brief Answers the pending apu request with a filled slot, recording how
+ *        long the request waited.
+ *
+ * If the apu was playing when it made the request, it had one buffer's worth
+ * of samples left. A request which waited longer than that left the apu
+ * without samples, and is counted as an underrun.
+ *
+ * The ring lock must be held, and there must be a filled slot.
+ *
+ * @return Void.
+ */
+static void ring_refilled(void)
+{
+	s64 wait_ns = ktime_to_ns(ktime_sub(ktime_get(), sample.req_time));
+	u64 wait_us = (wait_ns > 0) ? div_u64(wait_ns, NSEC_PER_USEC) : 0;
+	bool late = sample.req_playing && (wait_ns > APU_BUF_TIME_NS);
+	unsigned bucket;
+
+	trace_apu_refill(wait_us, late);
+
+	/* Bucket 0 is under 64us, and each bucket after it doubles. */
+	bucket = (wait_us < 64) ? 0 : ilog2(wait_us >> 6) + 1;
+	if (bucket >= APU_LATENCY_BUCKETS) { bucket = APU_LATENCY_BUCKETS - 1; }
+	sample.latency[bucket]++;
+
+	if (late) { sample.underruns++; }
+
+	sample.requested = false;
+	ring_send();
+}
+
+/**
+ * @brief Copies the ring statistics to the user.
+ * @param stats The user structure to fill in.
+ * @return 0 on success, or a negative integer on error.
+ */
+static long get_stats(struct apu_stats __user *stats)
+{
+	struct apu_stats kstats;
+	unsigned long flags;
+	ktime_t now = ktime_get();
+
+	spin_lock_irqsave(&sample.lock, flags);
+	kstats.depth = sample.depth;
+	kstats.queued = sample.filled + sample.hw;
+	kstats.underruns = sample.underruns;
+	kstats.overruns = sample.overruns;
+	kstats.drain_us = (sample.started && ktime_after(sample.drain_time, now))
+	                  ? (u32)ktime_us_delta(sample.drain_time, now) : 0;
+	memcpy(kstats.latency, sample.latency, sizeof(kstats.latency));
+	spin_unlock_irqrestore(&sample.lock, flags);
+
+	return copy_to_user(stats, &kstats, sizeof(kstats)) ? -EFAULT : 0;
 }
 
 module_platform_driver(apu_platform);
@@ -0,0 +1,119 @@
+/**
+ * @file apu_trace.h
+ * @author Andrew Spaulding
+ * @brief Tracepoints for the FP-GAme apu driver.
+ *
+ * These show up as the fpgame_apu event system in tracefs. See
+ * docs/tracing.md for the whole set of events.
+ *
+ * Slot counts (hw, filled) are the same as in struct apu_sample, and queued
+ * is their sum.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM fpgame_apu
+
+#if !defined(_APU_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _APU_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+/**
+ * @brief The apu irq arrived, asking for its next buffer, after the buffer
+ *        which finished was freed. playing is set if the apu still had a
+ *        buffer to play.
+ */
+TRACE_EVENT(apu_ring_irq,
+	TP_PROTO(unsigned hw, unsigned filled, bool playing),
+	TP_ARGS(hw, filled, playing),
+	TP_STRUCT__entry(
+		__field(unsigned, hw)
+		__field(unsigned, filled)
+		__field(bool, playing)
+	),
+	TP_fast_assign(
+		__entry->hw = hw;
+		__entry->filled = filled;
+		__entry->playing = playing;
+	),
+	TP_printk("hw=%u filled=%u playing=%d", __entry->hw,
+	          __entry->filled, __entry->playing)
+);
+
+/** @brief The irq woke the writers, with free slots in the ring. */
+TRACE_EVENT(apu_wake,
+	TP_PROTO(unsigned free),
+	TP_ARGS(free),
+	TP_STRUCT__entry(
+		__field(unsigned, free)
+	),
+	TP_fast_assign(
+		__entry->free = free;
+	),
+	TP_printk("free=%u", __entry->free)
+);
+
+/** @brief A slot was filled and added to the ring. */
+TRACE_EVENT(apu_commit,
+	TP_PROTO(unsigned slot, unsigned len, unsigned queued),
+	TP_ARGS(slot, len, queued),
+	TP_STRUCT__entry(
+		__field(unsigned, slot)
+		__field(unsigned, len)
+		__field(unsigned, queued)
+	),
+	TP_fast_assign(
+		__entry->slot = slot;
+		__entry->len = len;
+		__entry->queued = queued;
+	),
+	TP_printk("slot=%u len=%u queued=%u", __entry->slot, __entry->len,
+	          __entry->queued)
+);
+
+/**
+ * @brief The apu's request was answered with a filled slot, wait_us after
+ *        the irq. late is set if the apu ran out of samples meanwhile (an
+ *        underrun).
+ */
+TRACE_EVENT(apu_refill,
+	TP_PROTO(u64 wait_us, bool late),
+	TP_ARGS(wait_us, late),
+	TP_STRUCT__entry(
+		__field(u64, wait_us)
+		__field(bool, late)
+	),
+	TP_fast_assign(
+		__entry->wait_us = wait_us;
+		__entry->late = late;
+	),
+	TP_printk("wait_us=%llu late=%d",
+	          (unsigned long long)__entry->wait_us, __entry->late)
+);
+
+/**
+ * @brief A fill was turned away: with EAGAIN when the ring is full and the
+ *        file is non-blocking (an overrun), or EINVAL for a bad commit.
+ */
+TRACE_EVENT(apu_reject,
+	TP_PROTO(int err, unsigned queued),
+	TP_ARGS(err, queued),
+	TP_STRUCT__entry(
+		__field(int, err)
+		__field(unsigned, queued)
+	),
+	TP_fast_assign(
+		__entry->err = err;
+		__entry->queued = queued;
+	),
+	TP_printk("err=%d queued=%u", __entry->err, __entry->queued)
+);
+
+#endif /* _APU_TRACE_H_ */
+
+/* This part must be outside the include guard. */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE apu_trace
+#include <trace/define_trace.h>
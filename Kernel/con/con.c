@@ -6,20 +6,46 @@
  * This kernel module implements the interface to the FP-GAme controller.
  * Calls will be made to it by the user-space FP-GAme library.
  *
- * The only system call which we implement is ioctl. Its return value gives
- * the current controller state.
+ * The IOCTL_CON_GET_STATE ioctl returns the current controller state.
+ *
+ * While the controller file is open, the driver also samples the controller
+ * from an hrtimer, at a rate set by IOCTL_CON_SET_RATE, and queues an event
+ * with a timestamp each time the state changes. This catches presses which are
+ * too short to be seen by polling once a frame. Each open file has its own
+ * queue, so processes reading events never take them from each other. The
+ * events are taken from the queue by read(), and poll() reports when there are
+ * any.
+ *
+ * Each sample is also published in a page which user processes may map
+ * read-only, so that the latest state can be read without a system call. The
+ * page is a seqlock: the driver makes its sequence number odd while updating
+ * it, so readers retry if the number is odd or changed while they read.
  */
 
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/io-mapping.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/uaccess.h>
 #include <asm-generic/io.h>
 #include <linux/device.h>
 #include <linux/kdev_t.h>
 
 #include <linux/fp-game/drv_con.h>
 
+#define CREATE_TRACE_POINTS
+#include "con_trace.h"
+
 /** @brief The address of the controllers memory mapped i/o */
 #define CON_MMIO_ADDR 0xFF200000
 
@@ -29,12 +55,73 @@
 /** @brief The I/O mapping region for the controller driver. */
 static struct io_mapping *con_io;
 
+/**
+ * @brief The state of an open controller file, kept in its private_data.
+ *
+ * The event queue is a ring of CON_EVENT_QUEUE events, where head counts the
+ * events read and tail counts the events queued, both allowed to wrap. The
+ * queue is filled by the hrtimer callback, and so is protected by the sampler
+ * lock. Readers of the file sleep on wait.
+ */
+struct con_file {
+	struct list_head node;
+	wait_queue_head_t wait;
+
+	struct con_event queue[CON_EVENT_QUEUE];
+	unsigned head;
+	unsigned tail;
+};
+
+/**
+ * @brief The controller sampler.
+ *
+ * files lists the open controller files, each of which is given every event.
+ * The list, last and period are shared with the hrtimer callback, and so are
+ * protected by lock.
+ *
+ * users counts the open controller files, and is protected by open_lock. The
+ * timer runs while it is non-zero.
+ */
+static struct con_sampler {
+	struct hrtimer timer;
+	ktime_t period;
+	u16 last;
+
+	spinlock_t lock;
+	struct list_head files;
+
+	unsigned users;
+} sampler = {
+	.lock = __SPIN_LOCK_UNLOCKED(sampler.lock),
+	.files = LIST_HEAD_INIT(sampler.files),
+};
+
+/** @brief The page holding the latest sample, mapped by user processes. */
+static struct con_shared *shared;
+
+/** @brief Protects the count of open controller files. */
+static DEFINE_MUTEX(open_lock);
+
 /* Functions */
 int con_init(void);
+int con_open(struct inode *inode, struct file *file);
 long con_ioctl(struct file *file, unsigned ioctl_num,
                unsigned long ioctl_param);
+ssize_t con_read(struct file *file, char __user *buf, size_t len,
+                 loff_t *offset);
+__poll_t con_poll(struct file *file, poll_table *wait);
+int con_mmap(struct file *file, struct vm_area_struct *vma);
+int con_release(struct inode *inode, struct file *file);
 void con_clean(void);
 
+/* Helper Functions */
+static u16 read_state(void);
+static void publish(u16 state, u64 time);
+static enum hrtimer_restart con_sample(struct hrtimer *timer);
+static void queue_push(struct con_file *ctx, u16 state, u64 time);
+static bool queue_empty(struct con_file *ctx);
+static bool queue_pop(struct con_file *ctx, struct con_event *event);
+
 /**
  * @brief File operations structure.
  *
@@ -42,11 +129,16 @@ void con_clean(void);
  * device driver implements.
  */
 struct file_operations fops = {
-	.unlocked_ioctl = con_ioctl
+	.open = con_open,
+	.unlocked_ioctl = con_ioctl,
+	.read = con_read,
+	.poll = con_poll,
+	.mmap = con_mmap,
+	.release = con_release,
 };
 
 /** @brief Device Class for this driver */
-struct class *cl;
+static struct class *cl;
 
 /**
  * @brief Initializes the controller kernel module.
@@ -68,6 +160,18 @@ int con_init(void)
 	/* Map the controller I/O. */
 	con_io = io_mapping_create_wc(CON_MMIO_ADDR, sizeof(int));
 
+	/* Allocate the page user processes read the latest state from. */
+	shared = (struct con_shared *)get_zeroed_page(GFP_KERNEL);
+	if (shared == NULL) {
+		printk(KERN_ALERT "FP-GAme controller failed to alloc state page");
+		io_mapping_free(con_io);
+		unregister_chrdev(CON_MAJOR_NUM, CON_DEV_NAME);
+		return -ENOMEM;
+	}
+
+	hrtimer_init(&sampler.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	sampler.timer.function = con_sample;
+
     // Create the device in /dev
     cl = class_create(THIS_MODULE, CON_DEV_NAME);
     dev = MKDEV(CON_MAJOR_NUM, 0);
@@ -76,35 +180,190 @@ int con_init(void)
 	return 0;
 }
 
+/**
+ * @brief Opens the controller file, giving it an empty event queue.
+ *
+ * The first open starts sampling the controller at the default rate.
+ *
+ * @param inode Ignored.
+ * @param file The controller file being opened.
+ * @return 0 on success, or a negative integer on failure.
+ */
+int con_open(struct inode *inode, struct file *file)
+{
+	struct con_file *ctx;
+	unsigned long flags;
+	bool first;
+
+	ctx = kmalloc(sizeof(*ctx), GFP_KERNEL);
+	if (ctx == NULL) { return -ENOMEM; }
+	init_waitqueue_head(&ctx->wait);
+	ctx->head = 0;
+	ctx->tail = 0;
+	file->private_data = ctx;
+
+	mutex_lock(&open_lock);
+
+	first = (sampler.users++ == 0);
+	spin_lock_irqsave(&sampler.lock, flags);
+	list_add_tail(&ctx->node, &sampler.files);
+	if (first) {
+		sampler.last = read_state();
+		sampler.period = ns_to_ktime(NSEC_PER_SEC / CON_RATE_DEFAULT);
+	}
+	spin_unlock_irqrestore(&sampler.lock, flags);
+
+	if (first) {
+		/* The timer is stopped, so nothing else is publishing. */
+		publish(sampler.last, ktime_get_ns());
+
+		hrtimer_start(&sampler.timer, sampler.period, HRTIMER_MODE_REL);
+	}
+
+	mutex_unlock(&open_lock);
+	return 0;
+}
+
 /**
  * @brief Handles an IOCTL call to the controller module.
  * @param file Ignored.
  * @param ioctl_num The ioctl command number.
- * @param ioctl_param Ignored.
+ * @param ioctl_param The sampling rate, for IOCTL_CON_SET_RATE.
  *
- * Fails if the command is not the controller read command.
+ * Fails if the command is not one of the controller commands.
  *
- * @return The current controller state on success, or -1 on failure.
+ * @return The current controller state for IOCTL_CON_GET_STATE, 0 for
+ *         IOCTL_CON_SET_RATE, or a negative integer on failure.
  */
 long con_ioctl(struct file *file, unsigned ioctl_num,
                unsigned long ioctl_param)
 {
-	void *con_addr;
-	int state;
+	unsigned long flags;
+	u16 state;
 	(void)file;
-	(void)ioctl_param;
 
-	if (ioctl_num != IOCTL_CON_GET_STATE) { return -1; }
+	switch (ioctl_num) {
+	case IOCTL_CON_GET_STATE:
+		state = read_state();
+		trace_con_get_state(state);
+		return state;
+	case IOCTL_CON_SET_RATE:
+		if ((ioctl_param < CON_RATE_MIN) || (ioctl_param > CON_RATE_MAX)) {
+			return -EINVAL;
+		}
 
-	/*
-	 * Map our address. This holds a lock, so we must unmap it after
-	 * reading the controller state.
-	 */
-	con_addr = io_mapping_map_atomic_wc(con_io, 0);
-	state = readl(con_addr);
-	io_mapping_unmap_atomic(con_addr);
+		/* The timer picks up the new period when it next fires. */
+		spin_lock_irqsave(&sampler.lock, flags);
+		sampler.period = ns_to_ktime(NSEC_PER_SEC / ioctl_param);
+		spin_unlock_irqrestore(&sampler.lock, flags);
+		return 0;
+	default:
+		return -1;
+	}
+}
 
-	return state;
+/**
+ * @brief Reads controller events, oldest first.
+ *
+ * Returns as many whole events as fit in the buffer. If there are none, the
+ * caller sleeps until there are (or fails with EAGAIN, if the file is
+ * non-blocking).
+ *
+ * @param file The controller file being read.
+ * @param buf The user buffer to read events into.
+ * @param len The size of the buffer, which must hold at least one event.
+ * @param offset Ignored.
+ * @return The number of bytes read, or a negative integer on error.
+ */
+ssize_t con_read(struct file *file, char __user *buf, size_t len,
+                 loff_t *offset)
+{
+	struct con_file *ctx = file->private_data;
+	struct con_event event;
+	size_t done = 0;
+	int ret;
+
+	if (len < sizeof(event)) { return -EINVAL; }
+
+	if (queue_empty(ctx)) {
+		if (file->f_flags & O_NONBLOCK) { return -EAGAIN; }
+		ret = wait_event_interruptible(ctx->wait, !queue_empty(ctx));
+		if (ret != 0) { return ret; }
+	}
+
+	while ((done + sizeof(event) <= len) && queue_pop(ctx, &event)) {
+		if (copy_to_user(&buf[done], &event, sizeof(event)) != 0) {
+			return -EFAULT;
+		}
+		done += sizeof(event);
+	}
+	trace_con_events_read(done / sizeof(event));
+
+	return done;
+}
+
+/**
+ * @brief Reports whether there are controller events to read.
+ * @param file The controller file being polled.
+ * @param wait The poll table to register our wait queue with.
+ * @return POLLIN | POLLRDNORM if events are queued, or 0 otherwise.
+ */
+__poll_t con_poll(struct file *file, poll_table *wait)
+{
+	struct con_file *ctx = file->private_data;
+
+	poll_wait(file, &ctx->wait, wait);
+
+	return queue_empty(ctx) ? 0 : (EPOLLIN | EPOLLRDNORM);
+}
+
+/**
+ * @brief Maps the state page into user memory, read-only.
+ * @param file Ignored.
+ * @param vma The user mapping to fill in, which must be one page at most.
+ * @return 0 on success, or a negative integer on failure.
+ */
+int con_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if ((vma->vm_pgoff != 0) || (vma->vm_end - vma->vm_start > PAGE_SIZE)) {
+		return -EINVAL;
+	}
+	if (vma->vm_flags & VM_WRITE) { return -EPERM; }
+
+	/* Keep the mapping from being made writable by mprotect(). */
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_pfn_range(vma, vma->vm_start,
+	                       virt_to_phys(shared) >> PAGE_SHIFT,
+	                       vma->vm_end - vma->vm_start, vma->vm_page_prot);
+}
+
+/**
+ * @brief Closes the controller file, freeing its event queue.
+ *
+ * The last close stops sampling the controller.
+ *
+ * @param inode Ignored.
+ * @param file The controller file being closed.
+ * @return 0.
+ */
+int con_release(struct inode *inode, struct file *file)
+{
+	struct con_file *ctx = file->private_data;
+	unsigned long flags;
+
+	mutex_lock(&open_lock);
+
+	spin_lock_irqsave(&sampler.lock, flags);
+	list_del(&ctx->node);
+	spin_unlock_irqrestore(&sampler.lock, flags);
+
+	if (--sampler.users == 0) { hrtimer_cancel(&sampler.timer); }
+
+	mutex_unlock(&open_lock);
+
+	kfree(ctx);
+	return 0;
 }
 
 /**
@@ -118,8 +377,149 @@ void con_clean(void)
     device_destroy(cl, dev);
     class_destroy(cl);
 
+	hrtimer_cancel(&sampler.timer);
 	unregister_chrdev(CON_MAJOR_NUM, CON_DEV_FILE);
 	io_mapping_free(con_io);
+	free_page((unsigned long)shared);
+}
+
+/**
+ * @brief Reads the controller register.
+ * @return The current controller state.
+ */
+static u16 read_state(void)
+{
+	void *con_addr;
+	u16 state;
+
+	/*
+	 * Map our address. This holds a lock, so we must unmap it after
+	 * reading the controller state.
+	 */
+	con_addr = io_mapping_map_atomic_wc(con_io, 0);
+	state = readl(con_addr);
+	io_mapping_unmap_atomic(con_addr);
+
+	return state;
+}
+
+/**
+ * @brief Publishes a sample in the state page.
+ *
+ * Only one publisher may run at a time; this is the sampling timer, once it
+ * has started.
+ *
+ * @param state The controller state.
+ * @param time The CLOCK_MONOTONIC time of the sample, in nanoseconds.
+ */
+static void publish(u16 state, u64 time)
+{
+	WRITE_ONCE(shared->seq, shared->seq + 1);
+	smp_wmb();
+
+	WRITE_ONCE(shared->state, state);
+	WRITE_ONCE(shared->time, time);
+
+	smp_wmb();
+	WRITE_ONCE(shared->seq, shared->seq + 1);
+}
+
+/**
+ * @brief Samples the controller, publishing the sample in the state page and
+ *        queueing an event for every open file if its state changed.
+ *
+ * Runs from the sampling hrtimer.
+ *
+ * @param timer The sampling timer.
+ * @return HRTIMER_RESTART, having moved the timer on by one period.
+ */
+static enum hrtimer_restart con_sample(struct hrtimer *timer)
+{
+	u16 state = read_state();
+	u64 now = ktime_get_ns();
+	struct con_file *ctx;
+	unsigned long flags;
+	ktime_t period;
+
+	spin_lock_irqsave(&sampler.lock, flags);
+
+	if (state != sampler.last) {
+		trace_con_change(state, state ^ sampler.last);
+		list_for_each_entry(ctx, &sampler.files, node) {
+			queue_push(ctx, state, now);
+			wake_up_interruptible(&ctx->wait);
+		}
+		sampler.last = state;
+	}
+	period = sampler.period;
+
+	spin_unlock_irqrestore(&sampler.lock, flags);
+
+	publish(state, now);
+
+	hrtimer_forward_now(timer, period);
+	return HRTIMER_RESTART;
+}
+
+/**
+ * @brief Adds an event for a change from the last sampled state to a file's
+ *        queue.
+ *
+ * If the queue is full, the oldest event is dropped, since every event holds
+ * the whole state. The sampler lock must be held.
+ *
+ * @param ctx The controller file to queue the event for.
+ * @param state The new controller state.
+ * @param time The CLOCK_MONOTONIC time of the sample, in nanoseconds.
+ */
+static void queue_push(struct con_file *ctx, u16 state, u64 time)
+{
+	struct con_event *event;
+
+	if (ctx->tail - ctx->head == CON_EVENT_QUEUE) { ctx->head++; }
+
+	event = &ctx->queue[ctx->tail % CON_EVENT_QUEUE];
+	event->time = time;
+	event->state = state;
+	event->changed = state ^ sampler.last;
+	event->reserved = 0;
+	ctx->tail++;
+}
+
+/**
+ * @brief Checks whether a file's event queue is empty.
+ * @param ctx The controller file.
+ * @return True if there are no events to read.
+ */
+static bool queue_empty(struct con_file *ctx)
+{
+	unsigned long flags;
+	bool empty;
+
+	spin_lock_irqsave(&sampler.lock, flags);
+	empty = (ctx->head == ctx->tail);
+	spin_unlock_irqrestore(&sampler.lock, flags);
+
+	return empty;
+}
+
+/**
+ * @brief Takes the oldest event from a file's queue.
+ * @param ctx The controller file.
+ * @param event Set to the event.
+ * @return True if there was an event to take.
+ */
+static bool queue_pop(struct con_file *ctx, struct con_event *event)
+{
+	unsigned long flags;
+	bool found;
+
+	spin_lock_irqsave(&sampler.lock, flags);
+	found = (ctx->head != ctx->tail);
+	if (found) { *event = ctx->queue[ctx->head++ % CON_EVENT_QUEUE]; }
+	spin_unlock_irqrestore(&sampler.lock, flags);
+
+	return found;
 }
 
 module_init(con_init);
@@ -0,0 +1,69 @@
+/**
+ * @file con_trace.h
+ * @author Andrew Spaulding
+ * @brief Tracepoints for the FP-GAme controller driver.
+ *
+ * These show up as the fpgame_con event system in tracefs. See
+ * docs/tracing.md for the whole set of events.
+ *
+ * States are raw controller states, as IOCTL_CON_GET_STATE (active low).
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM fpgame_con
+
+#if !defined(_CON_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _CON_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+/** @brief The sampler saw the state change, and queued an event. */
+TRACE_EVENT(con_change,
+	TP_PROTO(u16 state, u16 changed),
+	TP_ARGS(state, changed),
+	TP_STRUCT__entry(
+		__field(u16, state)
+		__field(u16, changed)
+	),
+	TP_fast_assign(
+		__entry->state = state;
+		__entry->changed = changed;
+	),
+	TP_printk("state=0x%04x changed=0x%04x", __entry->state,
+	          __entry->changed)
+);
+
+/** @brief Events were taken from a file's queue by read(). */
+TRACE_EVENT(con_events_read,
+	TP_PROTO(unsigned count),
+	TP_ARGS(count),
+	TP_STRUCT__entry(
+		__field(unsigned, count)
+	),
+	TP_fast_assign(
+		__entry->count = count;
+	),
+	TP_printk("count=%u", __entry->count)
+);
+
+/** @brief The state was read through IOCTL_CON_GET_STATE. */
+TRACE_EVENT(con_get_state,
+	TP_PROTO(u16 state),
+	TP_ARGS(state),
+	TP_STRUCT__entry(
+		__field(u16, state)
+	),
+	TP_fast_assign(
+		__entry->state = state;
+	),
+	TP_printk("state=0x%04x", __entry->state)
+);
+
+#endif /* _CON_TRACE_H_ */
+
+/* This part must be outside the include guard. */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE con_trace
+#include <trace/define_trace.h>
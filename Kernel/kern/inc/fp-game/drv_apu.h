@@ -21,11 +21,96 @@
  */
 #define APU_MAJOR_NUM 0x1FA
 
-/** @brief The IOCTL command which informs the driver of the owners PID. */
-#define IOCTL_APU_SET_CALLBACK_PID _IOR(APU_MAJOR_NUM, 0, pid_t)
+/**
+ * @brief The IOCTL command which starts playback and enables APU IRQs.
+ *
+ * Once started, write() blocks until the APU requests a buffer, and poll()
+ * reports POLLOUT while a request is pending.
+ */
+#define IOCTL_APU_START _IO(APU_MAJOR_NUM, 1)
+
+/** @brief The smallest and largest number of sample buffers in the ring. */
+//@{
+#define APU_RING_MIN 2
+#define APU_RING_MAX 16
+//@}
+
+/**
+ * @brief The IOCTL command which sets the number of sample buffers in the
+ *        driver's ring, [APU_RING_MIN, APU_RING_MAX].
+ *
+ * Each buffer holds 512 samples (16ms), so the depth sets how far ahead of
+ * the apu writes may get. It may only be set before IOCTL_APU_START, and is
+ * reset to 2 when the apu file is closed.
+ */
+#define IOCTL_APU_SET_DEPTH _IOW(APU_MAJOR_NUM, 2, __u32)
+
+/** @brief The number of buckets in the refill latency histogram. */
+#define APU_LATENCY_BUCKETS 16
+
+/** @brief The ring statistics reported by IOCTL_APU_GET_STATS. */
+struct apu_stats {
+	__u32 depth;     ///< Number of buffers in the ring.
+	__u32 queued;    ///< Buffers written and not yet finished playing.
+	__u32 underruns; ///< Times the apu ran out of samples.
+	__u32 overruns;  ///< Writes which found the ring full.
+
+	/**
+	 * @brief Time until the apu runs out of samples, in us, or 0 if it has
+	 *        none left to play (or has not been given any yet).
+	 */
+	__u32 drain_us;
+
+	/**
+	 * @brief Histogram of the time from the apu asking for a buffer to the
+	 *        driver giving it one.
+	 *
+	 * Bucket 0 counts waits under 64us, and bucket i counts waits in
+	 * [64us << (i - 1), 64us << i). The last bucket also counts anything
+	 * longer.
+	 */
+	__u32 latency[APU_LATENCY_BUCKETS];
+};
+
+/** @brief The IOCTL command which reads the ring statistics. */
+#define IOCTL_APU_GET_STATS _IOR(APU_MAJOR_NUM, 3, struct apu_stats)
 
-/** @brief The signal which is used to launch the callback function. */
-#define APU_CALLBACK_SIG 64 /* <-- SIGRTMAX */
+/** @brief The size of each sample buffer in the ring, in samples (and bytes). */
+#define APU_SLOT_SIZE 512
+
+/**
+ * @brief The size of the mapping made by mmap() of the apu file.
+ *
+ * The mapping holds every buffer the ring can use, with slot i at offset
+ * i * APU_SLOT_SIZE, so samples can be rendered straight into the memory the
+ * apu plays from. The mapping is uncached, so it should be written
+ * sequentially and never read. The apu file must be opened for reading and
+ * writing to be mapped.
+ */
+#define APU_MMAP_SIZE (APU_SLOT_SIZE * APU_RING_MAX)
+
+/**
+ * @brief The IOCTL command which gets the next free slot of the ring.
+ *
+ * Waits for a free slot just as write() does (failing with EAGAIN instead if
+ * the file is non-blocking), and returns its index. The slot may then be
+ * filled through the mapping and handed back with IOCTL_APU_COMMIT.
+ */
+#define IOCTL_APU_GET_SLOT _IOR(APU_MAJOR_NUM, 4, __u32)
+
+/** @brief The argument of IOCTL_APU_COMMIT. */
+struct apu_commit {
+	__u32 slot; ///< The slot returned by IOCTL_APU_GET_SLOT.
+	__u32 len;  ///< Samples written to the slot; the rest are silenced.
+};
+
+/**
+ * @brief The IOCTL command which queues a slot filled through the mapping.
+ *
+ * Behaves as a write() of len samples, without the copy. Fails with EINVAL if
+ * the slot is not the one returned by IOCTL_APU_GET_SLOT.
+ */
+#define IOCTL_APU_COMMIT _IOW(APU_MAJOR_NUM, 5, struct apu_commit)
 
 /** @brief The device file used to access the apu driver. */
 #define APU_DEV_FILE "/dev/fp_game_apu"
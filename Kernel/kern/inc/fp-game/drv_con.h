@@ -8,6 +8,7 @@
 #define _FP_GAME_DRV_CON_H_
 
 #include <linux/ioctl.h>
+#include <linux/types.h>
 
 /**
  * @brief The major number for the controller driver.
@@ -23,6 +24,60 @@
 /** @brief The IOCTL command which reads the current controller input. */
 #define IOCTL_CON_GET_STATE _IO(CON_MAJOR_NUM, 0)
 
+/** @brief The range and default of the controller sampling rate, in Hz. */
+//@{
+#define CON_RATE_MIN 60
+#define CON_RATE_MAX 8000
+#define CON_RATE_DEFAULT 1000
+//@}
+
+/**
+ * @brief The IOCTL command which sets the controller sampling rate, in Hz.
+ *
+ * While the controller file is open, the driver samples the controller at
+ * this rate, and queues an event each time the state changes. The rate is
+ * reset to CON_RATE_DEFAULT once the file is closed by everyone.
+ */
+#define IOCTL_CON_SET_RATE _IOW(CON_MAJOR_NUM, 1, __u32)
+
+/**
+ * @brief A change in the controller state, as returned by read().
+ *
+ * read() returns as many whole events as fit in the buffer, oldest first,
+ * blocking until there is at least one (or failing with EAGAIN, if the file
+ * is non-blocking). poll() reports POLLIN while events are queued. Once
+ * CON_EVENT_QUEUE events are queued, the oldest are dropped.
+ *
+ * Every open file has its own queue, holding the events since it was opened.
+ */
+struct con_event {
+	__u64 time;    ///< CLOCK_MONOTONIC time of the sample, in nanoseconds.
+	__u16 state;   ///< The state after the change, as IOCTL_CON_GET_STATE.
+	__u16 changed; ///< The buttons whose bits changed.
+	__u32 reserved;
+};
+
+/** @brief The number of events the driver can queue. */
+#define CON_EVENT_QUEUE 256
+
+/**
+ * @brief The latest controller sample, in the page mapped by mmap().
+ *
+ * The controller file may be mapped read-only, up to CON_MMAP_SIZE bytes. The
+ * driver updates the page with every sample, while the file is open. The page
+ * is a seqlock: seq is odd while the driver is updating the sample, so a
+ * reader must retry if seq was odd, or changed while the sample was read.
+ */
+struct con_shared {
+	__u32 seq;     ///< Incremented before and after each update.
+	__u16 state;   ///< The controller state, as IOCTL_CON_GET_STATE.
+	__u16 reserved;
+	__u64 time;    ///< CLOCK_MONOTONIC time of the sample, in nanoseconds.
+};
+
+/** @brief The size of the state page mapping. */
+#define CON_MMAP_SIZE 4096
+
 /** @brief The device file used to access the controller driver. */
 #define CON_DEV_FILE "/dev/fp_game_con"
 
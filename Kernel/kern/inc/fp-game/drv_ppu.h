@@ -32,8 +32,48 @@
 #define IOCTL_PPU_SET_FGSCROLL _IOW(PPU_MAJOR_NUM, 2, u_int32_t)
 #define IOCTL_PPU_SET_BGCOLOR  _IOW(PPU_MAJOR_NUM, 3, u_int32_t)
 #define IOCTL_PPU_SET_ENABLE   _IOW(PPU_MAJOR_NUM, 4, u_int8_t)
+#define IOCTL_PPU_WRITE_SEGS   _IOW(PPU_MAJOR_NUM, 5, struct ppu_write_segs)
+#define IOCTL_PPU_GET_FRAME    _IOR(PPU_MAJOR_NUM, 6, __u32)
+#define IOCTL_PPU_UPDATE_SYNC  _IOR(PPU_MAJOR_NUM, 7, __u32)
+#define IOCTL_PPU_UPDATE_REGIONS _IOW(PPU_MAJOR_NUM, 8, __u32)
 
 // Size of VRAM in Bytes. Do not write past VRAM_SIZE-1
 #define VRAM_SIZE 0xD140
 
+/**@brief VRAM regions, used as a mask by IOCTL_PPU_UPDATE_REGIONS.
+ *
+ * Only the selected regions are copied into the buffer the PPU's DMA reads, which shortens the
+ *   submission of a frame. The PPU still receives all of VRAM. Regions written through write() or
+ *   IOCTL_PPU_WRITE_SEGS since the last update are always added to the mask by the driver; the mask
+ *   only needs to name regions changed through the mmap'd VRAM.
+ */
+/**@{*/
+#define PPU_REGION_TILES    0x1 ///< Tile RAM (both layers)
+#define PPU_REGION_PATTERNS 0x2 ///< Pattern RAM
+#define PPU_REGION_PALETTES 0x4 ///< Palette RAM
+#define PPU_REGION_SPRITES  0x8 ///< Sprite RAM
+#define PPU_REGION_ALL      0xF ///< All of VRAM
+/**@}*/
+
+/**@brief Maximum number of segments accepted by a single IOCTL_PPU_WRITE_SEGS call. */
+#define PPU_WRITE_SEGS_MAX 1024
+
+/**@brief A single segment of a batched VRAM write. See IOCTL_PPU_WRITE_SEGS. */
+struct ppu_write_seg {
+    __u32 offset; ///< Byte offset into VRAM to write to.
+    __u32 len;    ///< Number of bytes to write.
+    __u64 buf;    ///< User pointer to the data to be written, cast to an integer.
+};
+
+/**@brief Argument to IOCTL_PPU_WRITE_SEGS.
+ *
+ * All segments are checked against VRAM_SIZE before any of them are written, and are then written
+ *   under a single acquisition of the VRAM lock.
+ */
+struct ppu_write_segs {
+    __u64 segs;  ///< User pointer to an array of struct ppu_write_seg, cast to an integer.
+    __u32 count; ///< Number of segments in segs. Must not exceed PPU_WRITE_SEGS_MAX.
+    __u32 pad;   ///< Unused. Keeps the structure the same size on 32 and 64-bit ABIs.
+};
+
 #endif /* _FP_GAME_DRV_PPU_H_ */
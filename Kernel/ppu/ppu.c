@@ -5,18 +5,22 @@
  * This kernel module implements the FP-GAme PPU driver.
  * To this kernel module, the PPU interface is simply a collection of MMIO-accessible control
  *   registers, plus one IRQ.
- * To the users, the PPU is interacted with by writing to a kernel-managed "virtual VRAM". When the
- *   user is finished making changes, they call the ppu_draw() user library function to have their
- *   frame displayed. In reality, when ppu_draw() is called, the kernel initiates DMA transfer when
- *   it is able.
+ * To the users, the PPU is interacted with by writing to a kernel-managed "virtual VRAM", either
+ *   through write() or directly through an mmap() of the virtual VRAM. When the
+ *   user is finished making changes, they call the ppu_update() user library function to have
+ *   their frame displayed. In reality, when ppu_update() is called, the kernel initiates DMA
+ *   transfer when it is able.
  * The most important two rules of CPU-to-PPU VRAM DMA:
  *   1. The kernel can only initiate DMA transfer of the virtual VRAM once per interrupt received.
  *      For example, the kernel can start a DMA transfer by writing the physical address of the
  *      virtual VRAM into an PPU control register, but must wait to do so again until after the PPU
  *      sends its IRQ, notifying this module that the frame has been transferred and will be drawn,
  *      and that the PPU is ready to accept a new DMA source address.
- *   2. After initiating the DMA transfer, this module must lock access to the virtual VRAM,
- *      preventing any users from making adjustments while DMA transfer is occuring.
+ *   2. The memory being read by the DMA transfer must not change while the transfer is occuring.
+ *      To keep users from being locked out of VRAM for the duration of the transfer, the virtual
+ *      VRAM is double buffered: users always write to a "work" VRAM, which is copied into a
+ *      separate, DMA-coherent VRAM when a frame is submitted. Only the DMA VRAM is locked while the
+ *      transfer is occuring, so users are free to start on the next frame straight away.
  *
  * @author Joseph Yankel
  * Credit to Andrew Spaulding: Lots of code was copied from APU and Controller Kernel Module
@@ -35,9 +39,20 @@
 #include <linux/interrupt.h>
 #include <linux/device.h>
 #include <linux/kdev_t.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
+#include <linux/completion.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/vmalloc.h>
 
 #include <linux/fp-game/drv_ppu.h>
 
+#define CREATE_TRACE_POINTS
+#include "ppu_trace.h"
+
 
 /* === Definitions === */
 /** @brief PPU MMIO Control Registers physical base address */
@@ -61,6 +76,23 @@
 /** @brief Size (in Bytes) of fpgaportrst register */
 #define FPGAPORTRST_SIZE 0x4
 
+/** @brief How long to wait for the PPU IRQ before giving up on a frame, a few frames' worth */
+#define DMA_TIMEOUT msecs_to_jiffies(100)
+
+
+/* === Types === */
+/** @brief State of an open PPU file, kept in its private_data.
+ *
+ * The control register values are sent to the PPU alongside the next frame submitted through the
+ *   file. They start at their defaults (0) for every process that opens the PPU.
+ */
+struct ppu_file {
+    u32 ctrl_bgscroll;
+    u32 ctrl_fgscroll;
+    u32 ctrl_bgcolor;
+    u32 ctrl_enable;
+};
+
 
 /* === Module Functions === */
 static int ppu_probe(struct platform_device *pdev);
@@ -69,20 +101,39 @@ static int ppu_open(struct inode *inode, struct file *file);
 static int ppu_release(struct inode *inode, struct file *file);
 static ssize_t ppu_write(struct file *file, const char __user *buf, size_t len, loff_t *offset);
 static long ppu_ioctl(struct file *file, unsigned ioctl_num, unsigned long ioctl_param);
+static int ppu_mmap(struct file *file, struct vm_area_struct *vma);
+static __poll_t ppu_poll(struct file *file, poll_table *wait);
 static irqreturn_t ppu_irq(int irq, void *dev_id);
 
 
 /* === Helper Functions === */
 static void mmio_write(unsigned addr, unsigned val);
+static long write_segs(const struct ppu_write_segs __user *arg);
+static long update_sync(const struct ppu_file *ctx, u32 __user *frame);
+static void submit_frame(const struct ppu_file *ctx, u32 regions);
+static bool dma_lock_wait(void);
+static void dma_unlock(void);
+static void dma_lock_reset(void);
+static void mark_dirty(unsigned offset, unsigned len);
 
 
 /* === Static Variables === */
 static struct io_mapping *ppu_io;
 
-/** @brief The original pointer to the kernel's VRAM copy. Guaranteed to be 8B-aligned */
+/** @brief The device structure for the PPU. */
+static struct device *ppu_dev;
+
+/** @brief The work VRAM, which is written by users and mapped into user space.
+ *
+ * This is plain (cached) kernel memory. It is never read by the DMA Engine directly; a frame is
+ *   copied out of it into the DMA VRAM when the frame is submitted.
+ */
+static u8 *vram_work;
+
+/** @brief The original pointer to the kernel's DMA VRAM copy. Guaranteed to be 8B-aligned */
 static u64 *vram_base_v;
 
-/** @brief Base address to the kernel's VRAM copy, aligned to 16B */
+/** @brief Base address to the kernel's DMA VRAM copy, aligned to 16B */
 static u64 *vram_addr_v; // A virtual address
 
 /** @brief Original DMA Address handle to the base of kernel VRAM. Guaranteed to be 8B-aligned
@@ -98,17 +149,50 @@ static dma_addr_t vram_base_p;
  */
 static dma_addr_t vram_addr_p; // A physical address
 
-/** @brief PPU IRQ which signals that it is safe to unlock the kernel VRAM and/or begin a new DMA */
+/** @brief PPU IRQ which signals that it is safe to unlock the DMA VRAM and/or begin a new DMA */
 static int dma_rdy_irq;
 
-/** @brief Lock for accessing the PPU */
-static atomic_t ppu_lock;
+/** @brief Whether a process has the PPU open. Protected by open_lock */
+static bool ppu_owned;
+
+/** @brief Lock for opening and closing the PPU */
+static DEFINE_MUTEX(open_lock);
+
+/** @brief Lock for the work VRAM. Only held while a write or frame submission copies data */
+static DEFINE_MUTEX(vram_lock);
+
+/** @brief Lock for the DMA VRAM, as a completion which is done while the lock is free.
+ *
+ * Taken by a frame submission (consuming the completion), and released by the PPU IRQ once the
+ *   frame has been transferred (completing it again).
+ */
+static struct completion dma_done;
+
+/** @brief Wait queue for processes polling on the DMA lock to be released by the PPU IRQ */
+static DECLARE_WAIT_QUEUE_HEAD(dma_wait);
+
+/** @brief Number of frames the PPU has accepted (DMA-ready IRQs received) since module load */
+static atomic_t frame_seq;
+
+/** @brief Layout of the VRAM regions selected by a PPU_REGION_* mask, in bit order. */
+static const struct {
+    unsigned offset;
+    unsigned len;
+} vram_regions[] = {
+    { 0x0000, 0x4000 }, // PPU_REGION_TILES
+    { 0x4000, 0x8000 }, // PPU_REGION_PATTERNS
+    { 0xC000, 0x1000 }, // PPU_REGION_PALETTES
+    { 0xD000, 0x0140 }, // PPU_REGION_SPRITES
+};
 
-/** @brief Lock for VRAM writes during DMA transfer */
-static atomic_t vram_lock;
+/** @brief PPU_REGION_* mask of the regions written since the last frame submission.
+ *
+ * Only accessed while holding the work VRAM lock.
+ */
+static u32 dirty_regions;
 
 /** @brief Device Class for this driver */
-struct class *cl;
+static struct class *cl;
 
 /** @brief Device Tree Devices Support List
  *
@@ -144,6 +228,8 @@ static struct file_operations fops = {
     .release = ppu_release,
     .write = ppu_write,
     .unlocked_ioctl = ppu_ioctl,
+    .mmap = ppu_mmap,
+    .poll = ppu_poll,
 };
 
 
@@ -168,8 +254,17 @@ static int ppu_probe(struct platform_device *pdev)
 
     ppu_io = io_mapping_create_wc(PPU_MMIO_BASE, PPU_MMIO_SIZE);
 
-    // Allocate Virtual VRAM. Must be coherent so that changes are immediately readable by the PPU's
+    // Allocate the work VRAM. This one is never touched by the DMA Engine, and must be suitable for
+    //   mapping into user space.
+    vram_work = vmalloc_user(VRAM_SIZE);
+    if (vram_work == NULL) {
+        printk(KERN_ALERT "FP-GAme PPU Driver failed to alloc work VRAM");
+        return -1;
+    }
+
+    // Allocate DMA VRAM. Must be coherent so that changes are immediately readable by the PPU's
     //   DMA Engine.
+    ppu_dev = &pdev->dev;
     vram_base_v = dma_alloc_coherent(&pdev->dev, VRAM_SIZE+8, &vram_base_p, GFP_KERNEL);
     if (vram_base_v == NULL) {
         printk(KERN_ALERT "FP-GAme PPU Driver failed to alloc virtual VRAM");
@@ -182,7 +277,7 @@ static int ppu_probe(struct platform_device *pdev)
         // The DMA address is not aligned! Increment both the kernel's VRAM base address and the
         //   DMA address by 8B to achieve alignment.
         vram_addr_v = vram_base_v+1;
-        vram_addr_p = vram_base_p+1;
+        vram_addr_p = vram_base_p+8; // Note: not a pointer, so this must be in Bytes.
         // Note that it doesn't matter that the kernel's virtual VRAM address is 16B aligned, only
         //   that the DMA's physical VRAM address is 16B aligned.
     }
@@ -193,9 +288,10 @@ static int ppu_probe(struct platform_device *pdev)
         vram_addr_p = vram_base_p;
     }
 
-    // initialize VRAM and PPU write locks to 0 (available for write)
-    atomic_set(&ppu_lock, 0);
-    atomic_set(&vram_lock, 0);
+    // The DMA VRAM starts out free
+    init_completion(&dma_done);
+    complete(&dma_done);
+    atomic_set(&frame_seq, 0);
 
     dma_rdy_irq = platform_get_irq(pdev, 0);
     if (request_irq(dma_rdy_irq, ppu_irq, 0, PPU_DEV_NAME, ppu_irq) < 0)
@@ -235,8 +331,9 @@ static int ppu_remove(struct platform_device *pdev)
 
     unregister_chrdev(PPU_MAJOR_NUM, PPU_DEV_NAME);
     io_mapping_free(ppu_io);
-    dma_free_coherent(&pdev->dev, VRAM_SIZE+8, vram_base_v, vram_base_p);
-    free_irq(dma_rdy_irq, NULL);
+    dma_free_coherent(ppu_dev, VRAM_SIZE+8, vram_base_v, vram_base_p);
+    vfree(vram_work);
+    free_irq(dma_rdy_irq, ppu_irq);
 
     return 0;
 }
@@ -246,62 +343,81 @@ static int ppu_remove(struct platform_device *pdev)
  * If the PPU has already been opened by another process, fails.
  *
  * @param inode Ignored.
- * @param file Ignored.
- * @return 0 on success, -1 on error.
+ * @param file The PPU file being opened, which is given a fresh ppu_file.
+ * @return 0 on success, or a negative integer on error.
  */
 static int ppu_open(struct inode *inode, struct file *file)
 {
-    return (atomic_xchg(&ppu_lock, 1) == 0) ? 0 : -EBUSY;
+    struct ppu_file *ctx;
+
+    ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+    if (ctx == NULL) { return -ENOMEM; }
+
+    mutex_lock(&open_lock);
+    if (ppu_owned)
+    {
+        mutex_unlock(&open_lock);
+        kfree(ctx);
+        return -EBUSY;
+    }
+    ppu_owned = true;
+    mutex_unlock(&open_lock);
+
+    file->private_data = ctx;
+    return 0;
 }
 
 /** @brief Closes the PPU device file.
  *
- * Calling this function releases the PPU lock, allowing other processes to use the PPU.
+ * Calling this function releases the PPU, allowing other processes to use it. VRAM is reset first,
+ *   leaving the PPU in a ready-to-write state for the next process.
  *
- * If the calling process owned the PPU lock, then this function is guaranteed to reset VRAM and
- *   leave the PPU in a ready-to-write state.
+ * Sleeps until the PPU has accepted the frame in flight (if any), and then the blank frame. If the
+ *   PPU never accepts one of them, the DMA VRAM may still be being read, so it is left alone (and
+ *   the screen is not blanked), and the DMA lock is reset for the next process instead.
  *
- * @return 0 on success, -1 on error.
+ * @param inode Ignored.
+ * @param file The PPU file being closed.
+ * @return 0.
  */
 static int ppu_release(struct inode *inode, struct file *file)
 {
-    if (atomic_xchg(&ppu_lock, 1) == 0) { // Do not unlock yet, but check if it was already unlocked
-        atomic_set(&ppu_lock, 0); // reset lock
-        printk(KERN_ALERT "Close called on PPU when it wasn't open!");
-        return -1;
-    }
-    else
+    struct ppu_file *ctx = file->private_data;
+    bool blanked = false;
+
+    // properly reset VRAM for the next program to grab the PPU. The DMA Engine never reads the work
+    //   VRAM, so this does not need the DMA lock.
+    mutex_lock(&vram_lock);
+    memset(vram_work, 0, VRAM_SIZE);
+    mutex_unlock(&vram_lock);
+    memset(ctx, 0, sizeof(*ctx));
+
+    // Once the DMA VRAM is not busy, reset control registers to their defaults (0), and DMA the
+    //   changes to the PPU (blanking out the screen)
+    if (dma_lock_wait())
     {
-        // Spin until the VRAM is not busy
-        while (atomic_xchg(&vram_lock, 1) == 1);
-
-        // properly reset VRAM for the next program to grab the PPU
-        memset(vram_base_v, 0, VRAM_SIZE+8);
+        submit_frame(ctx, PPU_REGION_ALL);
 
-        // reset control registers to their defaults (0)
-        mmio_write(PPU_BGSCROLL_OFFSET, 0);
-        mmio_write(PPU_FGSCROLL_OFFSET, 0);
-        mmio_write(PPU_BGCOLOR_OFFSET, 0);
-        mmio_write(PPU_ENABLE_OFFSET, 0);
+        // Wait until the blank frame is transferred
+        blanked = dma_lock_wait();
+    }
 
-        // DMA the changes to the PPU (blanking out the screen)
-        mmio_write(PPU_DMA_ADDR_OFFSET, vram_addr_p);
+    // Release the DMA lock, which we only hold if the blank frame got through
+    if (blanked) { dma_unlock(); }
+    else { dma_lock_reset(); }
 
-        // Spin until the VRAM is not busy
-        while (atomic_xchg(&vram_lock, 1) == 1);
-
-        // release the locks
-        atomic_set(&vram_lock, 0); // reset vram lock
-        atomic_set(&ppu_lock, 0); // reset ppu lock
-    }
+    mutex_lock(&open_lock);
+    ppu_owned = false;
+    mutex_unlock(&open_lock);
 
+    kfree(ctx);
     return 0;
 }
 
-/** @brief Writes to the kernel's VRAM
+/** @brief Writes to the kernel's work VRAM
  *
- * This function returns with a failure condition when this module has locked PPU writes (during DMA
- *   transfer).
+ * If another write or frame submission is copying data in or out of the work VRAM at the same
+ *   time, this function sleeps until it is done. An in-progress DMA transfer does not block writes.
  *
  * @param file Ignored.
  * @param buf The user-supplied write data.
@@ -319,78 +435,128 @@ static ssize_t ppu_write(struct file *file, const char __user *buf, size_t len,
         return -EINVAL;
     }
 
-    // Try to acquire the VRAM write lock. If we cannot, tell the user we are busy.
-    if (atomic_xchg(&vram_lock, 1) == 1) {
-        return -EBUSY;
-    }
+    mutex_lock(&vram_lock);
 
     // Write user's data to the Kernel VRAM at the specified offset
-    addr = (u8*)vram_addr_v + (unsigned)(*offset);
+    addr = vram_work + (unsigned)(*offset);
     if (copy_from_user(addr, buf, len) != 0)
     {
         printk(KERN_ALERT "FP-GAme PPU Driver write failed!");
-        atomic_xchg(&vram_lock, 0);
+        mutex_unlock(&vram_lock);
         return -EFAULT; // THIS SHOULD NEVER HAPPEN, since we checked offset earlier.
     }
-
-    // Ensure our changes are seen before any other write occurs (especially the DMA_ADDR MMIO!)
-    wmb();
+    mark_dirty((unsigned)(*offset), len);
+    trace_ppu_vram_write((u32)(*offset), len, 0);
 
     // increment current position in file
     *offset += len;
 
-    atomic_xchg(&vram_lock, 0);
+    mutex_unlock(&vram_lock);
 
     return len; // We will have written exactly len bytes on success
 }
 
 /** @brief Handles an IOCTL call to the PPU module.
  *
- * @param file Ignored.
+ * @param file The PPU file, holding the control register values.
  * @param ioctl_num The ioctl command number.
  * @param ioctl_param ioctl parameter.
  * @return 0 on success, or -1 on failure.
  */
 static long ppu_ioctl(struct file *file, unsigned ioctl_num, unsigned long ioctl_param)
 {
-    int ret;
-
-    // Try to acquire the VRAM write lock. If we cannot, tell the user we are busy.
-    if (atomic_xchg(&vram_lock, 1) == 1) { return -EBUSY; }
+    struct ppu_file *ctx = file->private_data;
 
-    ret = 0;
+    // Control registers are only sent to the PPU along with the next frame, since the PPU latches
+    //   them when it syncs VRAM. Setting them never has to wait on a DMA transfer.
     switch (ioctl_num)
     {
         case IOCTL_PPU_UPDATE:
-            mmio_write(PPU_DMA_ADDR_OFFSET, vram_addr_p);
-            // After writing the DMA address, we must leave the vram write lock locked.
-            // We should not be able to write again until the IRQ unlocks it for us.
-            return ret; // Simply return without unlocking.
+            trace_ppu_update(PPU_REGION_ALL, false);
+            // Try to acquire the DMA VRAM lock. If we cannot, tell the user we are busy.
+            if (!try_wait_for_completion(&dma_done))
+            {
+                trace_ppu_update_busy(PPU_REGION_ALL);
+                return -EBUSY;
+            }
+            // After starting the DMA, the DMA lock is left locked. Only the IRQ unlocks it.
+            // Changes made through mmap are invisible to us, so a plain update sends everything.
+            submit_frame(ctx, PPU_REGION_ALL);
+            return 0;
+        case IOCTL_PPU_UPDATE_REGIONS:
+            if ((u32)ioctl_param & ~PPU_REGION_ALL) { return -EINVAL; }
+            trace_ppu_update((u32)ioctl_param, false);
+            if (!try_wait_for_completion(&dma_done))
+            {
+                trace_ppu_update_busy((u32)ioctl_param);
+                return -EBUSY;
+            }
+            submit_frame(ctx, (u32)ioctl_param);
+            return 0;
+        case IOCTL_PPU_UPDATE_SYNC:
+            return update_sync(ctx, (u32 __user *)ioctl_param);
+        case IOCTL_PPU_WRITE_SEGS:
+            return write_segs((const struct ppu_write_segs __user *)ioctl_param);
+        case IOCTL_PPU_GET_FRAME:
+            return put_user((u32)atomic_read(&frame_seq), (u32 __user *)ioctl_param);
         case IOCTL_PPU_SET_BGSCROLL:
-            mmio_write(PPU_BGSCROLL_OFFSET, (unsigned)ioctl_param);
-            break;
+            ctx->ctrl_bgscroll = (u32)ioctl_param;
+            return 0;
         case IOCTL_PPU_SET_FGSCROLL:
-            mmio_write(PPU_FGSCROLL_OFFSET, (unsigned)ioctl_param);
-            break;
+            ctx->ctrl_fgscroll = (u32)ioctl_param;
+            return 0;
         case IOCTL_PPU_SET_BGCOLOR:
-            mmio_write(PPU_BGCOLOR_OFFSET, (unsigned)ioctl_param);
-            break;
+            ctx->ctrl_bgcolor = (u32)ioctl_param;
+            return 0;
         case IOCTL_PPU_SET_ENABLE:
-            mmio_write(PPU_ENABLE_OFFSET, (unsigned)ioctl_param);
-            break;
+            ctx->ctrl_enable = (u32)ioctl_param;
+            return 0;
         default:
-            ret = -EINVAL;
-            break;
+            return -EINVAL;
     }
+}
 
-    atomic_set(&vram_lock, 0);
-    return ret;
+/** @brief Maps the kernel's work VRAM into the calling process' address space.
+ *
+ * This lets the user library build tiles, patterns, palettes and sprites in place instead of
+ *   paying for a pwrite() (and a trip through the VRAM lock) per change. Since the DMA Engine only
+ *   ever reads the DMA VRAM, writes made through the mapping are safe at any time, except while
+ *   the same process is submitting a frame.
+ *
+ * Only a mapping starting at offset 0 and no larger than the VRAM allocation is allowed.
+ *
+ * @param file Ignored.
+ * @param vma The user virtual memory area to map VRAM into.
+ * @return 0 on success, or a negative integer on error.
+ */
+static int ppu_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > PAGE_ALIGN(VRAM_SIZE)) {
+        return -EINVAL;
+    }
+
+    return remap_vmalloc_range(vma, vram_work, 0);
+}
+
+/** @brief Reports whether the PPU is ready to accept a new frame.
+ *
+ * The PPU file becomes writable (POLLOUT) once the DMA lock is released by the DMA-ready IRQ.
+ *
+ * @param file The PPU file being polled.
+ * @param wait The poll table to register our wait queue with.
+ * @return POLLOUT | POLLWRNORM if the DMA VRAM is not locked, or 0 otherwise.
+ */
+static __poll_t ppu_poll(struct file *file, poll_table *wait)
+{
+    poll_wait(file, &dma_wait, wait);
+
+    return completion_done(&dma_done) ? (EPOLLOUT | EPOLLWRNORM) : 0;
 }
 
 /** @brief Handles the PPU IRQ
  *
- * The PPU sends only 1 IRQ, the dma_rdy_irq. This IRQ tells us that we can unlock user access to
- *   the kernel's VRAM copy, and also that we can start another DMA transfer when we please.
+ * The PPU sends only 1 IRQ, the dma_rdy_irq. This IRQ tells us that the DMA VRAM may be reused,
+ *   and that we can start another DMA transfer when we please.
  *
  * @param irq Ignored.
  * @param dev_id Ignored.
@@ -398,8 +564,13 @@ static long ppu_ioctl(struct file *file, unsigned ioctl_num, unsigned long ioctl
  */
 static irqreturn_t ppu_irq(int irq, void *dev_id)
 {
-    // unlock VRAM writes
-    atomic_set(&vram_lock, 0);
+    bool in_flight = !completion_done(&dma_done);
+
+    trace_ppu_dma_irq((u32)atomic_inc_return(&frame_seq), in_flight);
+
+    // unlock the DMA VRAM. It is only locked while a transfer is in flight, so an IRQ arriving with
+    //   the lock free is ignored rather than letting a second frame in.
+    if (in_flight) { dma_unlock(); }
 
     return IRQ_HANDLED;
 }
@@ -421,6 +592,207 @@ static void mmio_write(unsigned offset, unsigned val)
     io_mapping_unmap_atomic(addr);
 }
 
+/** @brief Sleeps until the DMA VRAM lock can be taken, and takes it.
+ *
+ * Used where the caller cannot give up, such as when the file is closing. If the PPU does not
+ *   raise its IRQ within DMA_TIMEOUT, gives up without the lock: the frame in flight was lost, and
+ *   the DMA VRAM must not be touched. See dma_lock_reset().
+ *
+ * @return true if the lock was taken, or false on a timeout.
+ */
+static bool dma_lock_wait(void)
+{
+    if (wait_for_completion_timeout(&dma_done, DMA_TIMEOUT) == 0)
+    {
+        printk(KERN_ALERT "FP-GAme PPU Driver timed out waiting for the DMA-ready IRQ");
+        return false;
+    }
+    return true;
+}
+
+/** @brief Releases the DMA VRAM lock and wakes anyone sleeping on it.
+ * @return Void.
+ */
+static void dma_unlock(void)
+{
+    complete(&dma_done);
+    wake_up_interruptible(&dma_wait);
+}
+
+/** @brief Frees the DMA VRAM lock after the PPU failed to accept a frame, whoever holds it.
+ *
+ * The PPU IRQ is disabled while the lock is reset, so that the IRQ for the lost frame cannot release
+ *   it at the same time. If the IRQ arrives later, it finds the lock free, and is ignored.
+ *
+ * @return Void.
+ */
+static void dma_lock_reset(void)
+{
+    disable_irq(dma_rdy_irq);
+    reinit_completion(&dma_done);
+    complete(&dma_done);
+    enable_irq(dma_rdy_irq);
+
+    wake_up_interruptible(&dma_wait);
+}
+
+/** @brief Copies regions of the work VRAM into the DMA VRAM and starts a DMA transfer of it.
+ *
+ * The regions written through write() or IOCTL_PPU_WRITE_SEGS since the last submission are always
+ *   copied, in addition to @p regions. Regions which are not copied keep the contents of the last
+ *   frame in the DMA VRAM, which is what the PPU already holds, so the whole DMA VRAM is sent.
+ *
+ * The caller must hold the DMA lock. It stays held, and is released by the next IRQ. If a write to
+ *   the work VRAM is in progress, this sleeps until it is done.
+ *
+ * @param ctx The submitting file, holding the control register values to send.
+ * @param regions PPU_REGION_* mask of extra regions to copy.
+ * @return Void.
+ */
+static void submit_frame(const struct ppu_file *ctx, u32 regions)
+{
+    unsigned i;
+
+    // Take a consistent snapshot of the work VRAM.
+    mutex_lock(&vram_lock);
+
+    regions |= dirty_regions;
+    dirty_regions = 0;
+
+    for (i = 0; i < ARRAY_SIZE(vram_regions); i++)
+    {
+        if (regions & (1 << i))
+        {
+            memcpy((u8 *)vram_addr_v + vram_regions[i].offset, vram_work + vram_regions[i].offset,
+                   vram_regions[i].len);
+        }
+    }
+    mutex_unlock(&vram_lock);
+
+    // These are latched by the PPU when it syncs the frame we are about to send.
+    mmio_write(PPU_BGSCROLL_OFFSET, ctx->ctrl_bgscroll);
+    mmio_write(PPU_FGSCROLL_OFFSET, ctx->ctrl_fgscroll);
+    mmio_write(PPU_BGCOLOR_OFFSET, ctx->ctrl_bgcolor);
+    mmio_write(PPU_ENABLE_OFFSET, ctx->ctrl_enable);
+
+    // Ensure our changes are seen before the DMA_ADDR MMIO write starts the transfer
+    wmb();
+
+    trace_ppu_dma_start(regions, (u32)atomic_read(&frame_seq) + 1);
+    mmio_write(PPU_DMA_ADDR_OFFSET, vram_addr_p);
+}
+
+/** @brief Marks the regions overlapping a range of the work VRAM as needing to be copied.
+ *
+ * The caller must hold the work VRAM lock.
+ *
+ * @param offset Byte offset of the range into VRAM.
+ * @param len Length of the range in bytes.
+ */
+static void mark_dirty(unsigned offset, unsigned len)
+{
+    unsigned i;
+
+    for (i = 0; i < ARRAY_SIZE(vram_regions); i++)
+    {
+        if (offset < vram_regions[i].offset + vram_regions[i].len
+            && offset + len > vram_regions[i].offset)
+        {
+            dirty_regions |= 1 << i;
+        }
+    }
+}
+
+/** @brief Performs a batched write of several user buffers to the kernel's VRAM.
+ *
+ * Every segment is bounds-checked before anything is written, so a bad segment leaves VRAM
+ *   untouched. The segments are then copied under a single acquisition of the VRAM lock, sleeping
+ *   until it is free.
+ *
+ * @param arg User pointer to the segment list description.
+ * @return 0 on success, or a negative integer on error.
+ */
+static long write_segs(const struct ppu_write_segs __user *arg)
+{
+    struct ppu_write_segs req;
+    struct ppu_write_seg *segs;
+    long ret;
+    unsigned i;
+    u32 total;
+
+    if (copy_from_user(&req, arg, sizeof(req)) != 0) { return -EFAULT; }
+    if (req.count == 0) { return 0; }
+    if (req.count > PPU_WRITE_SEGS_MAX) { return -EINVAL; }
+
+    segs = kmalloc_array(req.count, sizeof(*segs), GFP_KERNEL);
+    if (segs == NULL) { return -ENOMEM; }
+
+    if (copy_from_user(segs, u64_to_user_ptr(req.segs), req.count * sizeof(*segs)) != 0)
+    {
+        kfree(segs);
+        return -EFAULT;
+    }
+
+    // Check all segments against VRAM bounds up front, so that we never apply half a batch.
+    for (i = 0; i < req.count; i++)
+    {
+        if (segs[i].offset > VRAM_SIZE || segs[i].len > VRAM_SIZE - segs[i].offset)
+        {
+            kfree(segs);
+            return -EINVAL;
+        }
+    }
+
+    mutex_lock(&vram_lock);
+
+    ret = 0;
+    total = 0;
+    for (i = 0; i < req.count; i++)
+    {
+        mark_dirty(segs[i].offset, segs[i].len);
+        if (copy_from_user(vram_work + segs[i].offset, u64_to_user_ptr(segs[i].buf),
+                           segs[i].len) != 0)
+        {
+            ret = -EFAULT;
+            break;
+        }
+        total += segs[i].len;
+    }
+    trace_ppu_vram_write(segs[0].offset, total, i);
+
+    mutex_unlock(&vram_lock);
+    kfree(segs);
+
+    return ret;
+}
+
+/** @brief Sleeps until the DMA lock is free, then submits the work VRAM as the next frame.
+ *
+ * This is the blocking counterpart to IOCTL_PPU_UPDATE. Like IOCTL_PPU_UPDATE, the DMA lock is left
+ *   held until the PPU IRQ arrives.
+ *
+ * @param ctx The submitting file, holding the control register values to send.
+ * @param frame User pointer to store the sequence number of the submitted frame to. The frame is
+ *              on screen once IOCTL_PPU_GET_FRAME reports this number.
+ * @return 0 on success, or a negative integer on error (including being interrupted by a signal).
+ */
+static long update_sync(const struct ppu_file *ctx, u32 __user *frame)
+{
+    u32 seq;
+    long ret;
+
+    // Sleep until we are the ones to take the DMA lock.
+    trace_ppu_update(PPU_REGION_ALL, true);
+    ret = wait_for_completion_interruptible(&dma_done);
+    if (ret != 0) { return ret; }
+
+    // No IRQ can arrive while we hold the lock, so the next IRQ will be for this frame.
+    seq = (u32)atomic_read(&frame_seq) + 1;
+    submit_frame(ctx, PPU_REGION_ALL);
+
+    return put_user(seq, frame);
+}
+
 
 /* === Extra Kernel Module Stuff === */
 // Short-hand used to replace init and exit functions, since our module does nothing special there.
@@ -0,0 +1,107 @@
+/**@file ppu_trace.h
+ *
+ * @brief Tracepoints for the FP-GAme PPU driver
+ *
+ * These show up as the fpgame_ppu event system in tracefs, and can be recorded with perf or
+ *   trace-cmd alongside the APU and controller events and the user library's probes. See
+ *   docs/tracing.md for the whole set of events.
+ *
+ * Frame numbers are the value IOCTL_PPU_GET_FRAME reports once the frame has been accepted.
+ *
+ * @author Joseph Yankel
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM fpgame_ppu
+
+#if !defined(_PPU_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _PPU_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+/** @brief A frame update was requested, before the DMA lock is taken */
+TRACE_EVENT(ppu_update,
+    TP_PROTO(u32 regions, bool sync),
+    TP_ARGS(regions, sync),
+    TP_STRUCT__entry(
+        __field(u32, regions)
+        __field(bool, sync)
+    ),
+    TP_fast_assign(
+        __entry->regions = regions;
+        __entry->sync = sync;
+    ),
+    TP_printk("regions=0x%x sync=%d", __entry->regions, __entry->sync)
+);
+
+/** @brief A frame update was rejected with EBUSY, since the previous frame is still in flight */
+TRACE_EVENT(ppu_update_busy,
+    TP_PROTO(u32 regions),
+    TP_ARGS(regions),
+    TP_STRUCT__entry(
+        __field(u32, regions)
+    ),
+    TP_fast_assign(
+        __entry->regions = regions;
+    ),
+    TP_printk("regions=0x%x", __entry->regions)
+);
+
+/** @brief A frame was copied into the DMA VRAM, and its transfer started */
+TRACE_EVENT(ppu_dma_start,
+    TP_PROTO(u32 regions, u32 frame),
+    TP_ARGS(regions, frame),
+    TP_STRUCT__entry(
+        __field(u32, regions)
+        __field(u32, frame)
+    ),
+    TP_fast_assign(
+        __entry->regions = regions;
+        __entry->frame = frame;
+    ),
+    TP_printk("regions=0x%x frame=%u", __entry->regions, __entry->frame)
+);
+
+/** @brief The DMA-ready IRQ arrived. in_flight is false if no frame was waiting on it */
+TRACE_EVENT(ppu_dma_irq,
+    TP_PROTO(u32 frame, bool in_flight),
+    TP_ARGS(frame, in_flight),
+    TP_STRUCT__entry(
+        __field(u32, frame)
+        __field(bool, in_flight)
+    ),
+    TP_fast_assign(
+        __entry->frame = frame;
+        __entry->in_flight = in_flight;
+    ),
+    TP_printk("frame=%u in_flight=%d", __entry->frame, __entry->in_flight)
+);
+
+/** @brief Bytes were written to the work VRAM, by write() (segs=0) or IOCTL_PPU_WRITE_SEGS
+ *
+ * For IOCTL_PPU_WRITE_SEGS, offset is that of the first segment and len is the total of them all.
+ */
+TRACE_EVENT(ppu_vram_write,
+    TP_PROTO(u32 offset, u32 len, u32 segs),
+    TP_ARGS(offset, len, segs),
+    TP_STRUCT__entry(
+        __field(u32, offset)
+        __field(u32, len)
+        __field(u32, segs)
+    ),
+    TP_fast_assign(
+        __entry->offset = offset;
+        __entry->len = len;
+        __entry->segs = segs;
+    ),
+    TP_printk("offset=0x%x len=%u segs=%u", __entry->offset, __entry->len, __entry->segs)
+);
+
+#endif /* _PPU_TRACE_H_ */
+
+/* This part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ppu_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,636 @@
+/**
+ * @file kstub.h
+ * @author Andrew Spaulding
+ * @brief A stand-in for the parts of the kernel the drivers use, so that their
+ *        logic can be built and tested on the host.
+ *
+ * Every kernel header a driver includes (linux/hrtimer.h and so on) includes
+ * this file instead. Nothing here runs concurrently: a test calls the driver's
+ * functions, and fires its timers and interrupts, by hand, one at a time.
+ *
+ * I/O mappings are plain memory, which a test reads and writes to play the
+ * part of the hardware, and every register write is also logged in
+ * kstub_writes. The clock only moves when a test sets kstub_now. Interrupts
+ * are delivered by kstub_raise(), unless disabled.
+ *
+ * Wait queues count their wake ups. A wait which would sleep calls
+ * kstub_sleep, if a test set it, in which the test may do what the hardware
+ * would have done meanwhile (such as raise an interrupt). If the wait still
+ * can not finish, it fails as if a signal had arrived, or times out, since
+ * nothing else could end it. Locks count how often they are held, so a test
+ * can check they were all released.
+ */
+
+#ifndef _KSTUB_H_
+#define _KSTUB_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+
+/* === Types === */
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int32_t s32;
+typedef int64_t s64;
+
+#define __user
+#define __iomem
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define READ_ONCE(x) (*(volatile typeof(x) *)&(x))
+#define WRITE_ONCE(x, val) (*(volatile typeof(x) *)&(x) = (val))
+#define smp_wmb() __sync_synchronize()
+#define smp_rmb() __sync_synchronize()
+#define wmb() __sync_synchronize()
+
+typedef struct { int counter; } atomic_t;
+
+#define atomic_set(v, i) ((v)->counter = (i))
+#define atomic_read(v) ((v)->counter)
+#define atomic_inc(v) ((v)->counter++)
+#define atomic_inc_return(v) (++(v)->counter)
+
+static inline unsigned ilog2(u64 x) { return 63 - __builtin_clzll(x); }
+static inline u64 div_u64(u64 dividend, u32 divisor) { return dividend / divisor; }
+
+#define ERESTARTSYS 512
+
+/* === Modules and devices === */
+
+#define THIS_MODULE NULL
+#define module_init(fn)
+#define module_exit(fn)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_LICENSE(x)
+#define module_platform_driver(drv) \
+	static struct platform_driver *kstub_driver __attribute__((unused)) = &(drv)
+
+#define KERN_ALERT ""
+#define printk(...) \
+	(fputs("printk: ", stderr), fprintf(stderr, __VA_ARGS__), fputc('\n', stderr))
+
+#define MKDEV(major, minor) (((major) << 20) | (minor))
+
+struct class { int unused; };
+struct device { int unused; };
+
+struct of_device_id { const char *compatible; };
+
+#define of_match_ptr(table) (table)
+
+/** @brief A platform device, with the one interrupt the drivers use. */
+struct platform_device {
+	struct device dev;
+	int irq;
+};
+
+struct platform_driver {
+	struct {
+		const char *name;
+		void *owner;
+		const struct of_device_id *of_match_table;
+	} driver;
+	int (*probe)(struct platform_device *);
+	int (*remove)(struct platform_device *);
+};
+
+static inline int platform_get_irq(struct platform_device *pdev, unsigned n)
+{
+	(void)n;
+	return pdev->irq;
+}
+
+static inline struct class *class_create(void *owner, const char *name)
+{
+	static struct class cl;
+	(void)owner; (void)name;
+	return &cl;
+}
+
+static inline void class_destroy(struct class *cl) { (void)cl; }
+
+static inline struct device *device_create(struct class *cl,
+                                           struct device *parent, dev_t dev,
+                                           void *data, const char *name)
+{
+	static struct device device;
+	(void)cl; (void)parent; (void)dev; (void)data; (void)name;
+	return &device;
+}
+
+static inline void device_destroy(struct class *cl, dev_t dev)
+{
+	(void)cl; (void)dev;
+}
+
+/* === Files === */
+
+struct inode { int unused; };
+
+struct file {
+	unsigned f_flags;
+	void *private_data;
+};
+
+typedef unsigned __poll_t;
+typedef struct { int unused; } poll_table;
+
+#define EPOLLIN 0x0001
+#define EPOLLOUT 0x0004
+#define EPOLLRDNORM 0x0040
+#define EPOLLWRNORM 0x0100
+
+struct vm_area_struct;
+
+struct file_operations {
+	int (*open)(struct inode *, struct file *);
+	long (*unlocked_ioctl)(struct file *, unsigned, unsigned long);
+	ssize_t (*read)(struct file *, char __user *, size_t, loff_t *);
+	ssize_t (*write)(struct file *, const char __user *, size_t, loff_t *);
+	__poll_t (*poll)(struct file *, poll_table *);
+	int (*mmap)(struct file *, struct vm_area_struct *);
+	int (*release)(struct inode *, struct file *);
+};
+
+static inline int register_chrdev(unsigned major, const char *name,
+                                  const struct file_operations *fops)
+{
+	(void)major; (void)name; (void)fops;
+	return 0;
+}
+
+static inline void unregister_chrdev(unsigned major, const char *name)
+{
+	(void)major; (void)name;
+}
+
+static inline unsigned long copy_to_user(void __user *to, const void *from,
+                                         unsigned long len)
+{
+	memcpy(to, from, len);
+	return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void __user *from,
+                                           unsigned long len)
+{
+	memcpy(to, from, len);
+	return 0;
+}
+
+#define put_user(x, ptr) (*(ptr) = (x), 0)
+#define get_user(x, ptr) ((x) = *(ptr), 0)
+#define u64_to_user_ptr(x) ((void __user *)(uintptr_t)(x))
+
+/* === Memory === */
+
+#define GFP_KERNEL 0
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define PAGE_ALIGN(x) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+#define VM_WRITE 0x0002
+#define VM_MAYWRITE 0x0020
+
+struct vm_area_struct {
+	unsigned long vm_start;
+	unsigned long vm_end;
+	unsigned long vm_pgoff;
+	unsigned long vm_flags;
+	int vm_page_prot;
+};
+
+static inline void *kmalloc(size_t size, int flags)
+{
+	(void)flags;
+	return malloc(size);
+}
+
+static inline void *kzalloc(size_t size, int flags)
+{
+	(void)flags;
+	return calloc(1, size);
+}
+
+static inline void kfree(const void *ptr) { free((void *)ptr); }
+
+static inline void *kmalloc_array(size_t n, size_t size, int flags)
+{
+	(void)flags;
+	return malloc(n * size);
+}
+
+static inline void *vmalloc_user(unsigned long size) { return calloc(1, size); }
+static inline void vfree(const void *ptr) { free((void *)ptr); }
+
+static inline int remap_vmalloc_range(struct vm_area_struct *vma, void *addr,
+                                      unsigned long pgoff)
+{
+	(void)vma; (void)addr; (void)pgoff;
+	return 0;
+}
+
+static inline unsigned long get_zeroed_page(int flags)
+{
+	(void)flags;
+	return (unsigned long)calloc(1, PAGE_SIZE);
+}
+
+static inline void free_page(unsigned long addr) { free((void *)addr); }
+
+static inline unsigned long virt_to_phys(const volatile void *addr)
+{
+	return (unsigned long)addr;
+}
+
+static inline int remap_pfn_range(struct vm_area_struct *vma,
+                                  unsigned long addr, unsigned long pfn,
+                                  unsigned long size, int prot)
+{
+	(void)vma; (void)addr; (void)pfn; (void)size; (void)prot;
+	return 0;
+}
+
+/* === DMA === */
+
+typedef u32 dma_addr_t;
+
+/**
+ * @brief The bus address given to the next coherent allocation. A test may
+ *        set it before probing a driver, such as to misalign it.
+ */
+static dma_addr_t kstub_dma_next = 0x30000000;
+
+static inline void *dma_alloc_coherent(struct device *dev, size_t size,
+                                       dma_addr_t *handle, int flags)
+{
+	(void)dev; (void)flags;
+	*handle = kstub_dma_next;
+	kstub_dma_next += (size + 15) & ~15;
+	return calloc(1, size);
+}
+
+static inline void dma_free_coherent(struct device *dev, size_t size,
+                                     void *addr, dma_addr_t handle)
+{
+	(void)dev; (void)size; (void)handle;
+	free(addr);
+}
+
+static inline int dma_mmap_coherent(struct device *dev,
+                                    struct vm_area_struct *vma, void *addr,
+                                    dma_addr_t handle, size_t size)
+{
+	(void)dev; (void)vma; (void)addr; (void)handle; (void)size;
+	return 0;
+}
+
+/* === I/O === */
+
+/**
+ * @brief An I/O mapping, which is plain memory on the host.
+ *
+ * A test plays the hardware by reading and writing regs, as kstub_reg().
+ */
+struct io_mapping {
+	unsigned long base;
+	unsigned long size;
+	u8 regs[];
+};
+
+static inline struct io_mapping *io_mapping_create_wc(unsigned long base,
+                                                      unsigned long size)
+{
+	struct io_mapping *map = calloc(1, sizeof(*map) + size);
+
+	map->base = base;
+	map->size = size;
+	return map;
+}
+
+static inline void io_mapping_free(struct io_mapping *map) { free(map); }
+
+static inline void *io_mapping_map_atomic_wc(struct io_mapping *map,
+                                             unsigned long offset)
+{
+	return &map->regs[offset];
+}
+
+static inline void io_mapping_unmap_atomic(void *addr) { (void)addr; }
+
+/** @brief Gets the word of an I/O mapping at the given offset. */
+static inline volatile u32 *kstub_reg(struct io_mapping *map,
+                                      unsigned long offset)
+{
+	return (volatile u32 *)&map->regs[offset];
+}
+
+static inline void __iomem *ioremap(unsigned long addr, unsigned long size)
+{
+	(void)addr;
+	return calloc(1, size);
+}
+
+static inline void iounmap(volatile void __iomem *addr) { free((void *)addr); }
+
+/** @brief A register write, as logged in kstub_writes. */
+struct kstub_write {
+	volatile void *addr;
+	u32 value;
+};
+
+/** @brief The register writes since a test last cleared kstub_write_count. */
+static struct kstub_write kstub_writes[64];
+static unsigned kstub_write_count;
+
+static inline u32 readl(const volatile void *addr)
+{
+	return *(const volatile u32 *)addr;
+}
+
+static inline void writel(u32 value, volatile void *addr)
+{
+	if (kstub_write_count < ARRAY_SIZE(kstub_writes)) {
+		kstub_writes[kstub_write_count].addr = addr;
+		kstub_writes[kstub_write_count].value = value;
+	}
+	kstub_write_count++;
+	*(volatile u32 *)addr = value;
+}
+
+/* === Locks === */
+
+typedef struct { int held; } spinlock_t;
+
+#define __SPIN_LOCK_UNLOCKED(name) { 0 }
+#define spin_lock_init(lock) ((lock)->held = 0)
+#define spin_lock_irqsave(lock, flags) ((flags) = 0, (lock)->held++)
+#define spin_unlock_irqrestore(lock, flags) ((void)(flags), (lock)->held--)
+
+struct mutex { int held; };
+
+#define DEFINE_MUTEX(name) struct mutex name = { 0 }
+#define mutex_init(lock) ((lock)->held = 0)
+#define mutex_lock(lock) ((lock)->held++)
+#define mutex_lock_interruptible(lock) ((lock)->held++, 0)
+#define mutex_unlock(lock) ((lock)->held--)
+
+/* === Lists === */
+
+struct list_head {
+	struct list_head *next;
+	struct list_head *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void list_add_tail(struct list_head *node,
+                                 struct list_head *head)
+{
+	node->prev = head->prev;
+	node->next = head;
+	head->prev->next = node;
+	head->prev = node;
+}
+
+static inline void list_del(struct list_head *node)
+{
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+}
+
+static inline bool list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+
+#define list_for_each_entry(pos, head, member)                             \
+	for (pos = list_entry((head)->next, typeof(*pos), member);         \
+	     &pos->member != (head);                                       \
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+
+/* === Time === */
+
+typedef s64 ktime_t;
+
+#define NSEC_PER_SEC 1000000000L
+
+/** @brief The time, in nanoseconds. Only moved by tests. */
+static u64 kstub_now;
+
+static inline u64 ktime_get_ns(void) { return kstub_now; }
+static inline ktime_t ktime_get(void) { return kstub_now; }
+static inline ktime_t ns_to_ktime(u64 ns) { return ns; }
+static inline s64 ktime_to_ns(ktime_t time) { return time; }
+static inline ktime_t ktime_add_ns(ktime_t time, u64 ns) { return time + ns; }
+static inline ktime_t ktime_sub(ktime_t a, ktime_t b) { return a - b; }
+static inline bool ktime_after(ktime_t a, ktime_t b) { return a > b; }
+static inline s64 ktime_us_delta(ktime_t a, ktime_t b) { return (a - b) / 1000; }
+
+#define NSEC_PER_USEC 1000L
+
+/** @brief Jiffies are milliseconds here; only timeouts use them. */
+#define msecs_to_jiffies(ms) ((unsigned long)(ms))
+
+enum hrtimer_restart { HRTIMER_NORESTART, HRTIMER_RESTART };
+enum hrtimer_mode { HRTIMER_MODE_REL };
+
+/**
+ * @brief A high resolution timer. It never fires by itself: a test fires it
+ *        with kstub_fire() once kstub_now has passed expires.
+ */
+struct hrtimer {
+	enum hrtimer_restart (*function)(struct hrtimer *);
+	ktime_t expires;
+	bool active;
+};
+
+static inline void hrtimer_init(struct hrtimer *timer, clockid_t clock,
+                                enum hrtimer_mode mode)
+{
+	(void)clock; (void)mode;
+	timer->active = false;
+}
+
+static inline void hrtimer_start(struct hrtimer *timer, ktime_t time,
+                                 enum hrtimer_mode mode)
+{
+	(void)mode;
+	timer->expires = kstub_now + time;
+	timer->active = true;
+}
+
+static inline int hrtimer_cancel(struct hrtimer *timer)
+{
+	bool active = timer->active;
+
+	timer->active = false;
+	return active;
+}
+
+static inline u64 hrtimer_forward_now(struct hrtimer *timer, ktime_t period)
+{
+	u64 overruns = 0;
+
+	while (timer->expires <= (ktime_t)kstub_now) {
+		timer->expires += period;
+		overruns++;
+	}
+	return overruns;
+}
+
+/**
+ * @brief Fires a timer, as its expiry would.
+ * @return False if the timer was not running.
+ */
+static inline bool kstub_fire(struct hrtimer *timer)
+{
+	if (!timer->active) { return false; }
+	if (timer->function(timer) == HRTIMER_NORESTART) { timer->active = false; }
+	return true;
+}
+
+/* === Interrupts === */
+
+typedef enum { IRQ_NONE, IRQ_HANDLED } irqreturn_t;
+typedef irqreturn_t (*irq_handler_t)(int, void *);
+
+/** @brief An interrupt line, which is raised by a test with kstub_raise(). */
+struct kstub_irq {
+	irq_handler_t handler;
+	void *dev_id;
+	unsigned depth;    ///< How many times the line is disabled.
+	unsigned disables; ///< How many times it was ever disabled.
+	bool pending;      ///< Raised while disabled.
+};
+
+static struct kstub_irq kstub_irqs[8];
+
+static inline int request_irq(unsigned irq, irq_handler_t handler,
+                              unsigned long flags, const char *name,
+                              void *dev_id)
+{
+	(void)flags; (void)name;
+	if (irq >= ARRAY_SIZE(kstub_irqs)) { return -EINVAL; }
+	kstub_irqs[irq].handler = handler;
+	kstub_irqs[irq].dev_id = dev_id;
+	return 0;
+}
+
+/* As in the kernel, the dev_id must be the one the irq was requested with. */
+static inline void free_irq(unsigned irq, void *dev_id)
+{
+	if (kstub_irqs[irq].dev_id == dev_id) { kstub_irqs[irq].handler = NULL; }
+}
+
+/**
+ * @brief Raises an interrupt. A disabled line holds it until enabled.
+ * @return False if the line has no handler.
+ */
+static inline bool kstub_raise(unsigned irq)
+{
+	struct kstub_irq *line = &kstub_irqs[irq];
+
+	if (line->handler == NULL) { return false; }
+	if (line->depth > 0) {
+		line->pending = true;
+	} else {
+		line->handler(irq, line->dev_id);
+	}
+	return true;
+}
+
+static inline void disable_irq(unsigned irq)
+{
+	kstub_irqs[irq].depth++;
+	kstub_irqs[irq].disables++;
+}
+
+static inline void enable_irq(unsigned irq)
+{
+	if ((--kstub_irqs[irq].depth == 0) && kstub_irqs[irq].pending) {
+		kstub_irqs[irq].pending = false;
+		kstub_raise(irq);
+	}
+}
+
+/* === Wait queues and completions === */
+
+/**
+ * @brief Called when a wait would sleep, if set, to play the part of whatever
+ *        would have ended the wait.
+ */
+static void (*kstub_sleep)(void);
+
+/** @brief A wait queue, which counts the wake ups since it was set up. */
+typedef struct { unsigned wakes; } wait_queue_head_t;
+
+#define DECLARE_WAIT_QUEUE_HEAD(name) wait_queue_head_t name = { 0 }
+#define init_waitqueue_head(wq) ((wq)->wakes = 0)
+#define wake_up_interruptible(wq) ((wq)->wakes++)
+
+#define wait_event_interruptible(wq, cond)                          \
+	({                                                          \
+		if (!(cond) && (kstub_sleep != NULL)) { kstub_sleep(); } \
+		(cond) ? 0 : -ERESTARTSYS;                          \
+	})
+
+struct completion { unsigned done; };
+
+#define init_completion(c) ((c)->done = 0)
+#define reinit_completion(c) ((c)->done = 0)
+#define complete(c) ((c)->done++)
+#define completion_done(c) ((c)->done > 0)
+
+static inline bool try_wait_for_completion(struct completion *c)
+{
+	if (c->done == 0) { return false; }
+	c->done--;
+	return true;
+}
+
+/** @return The time left (at least 1), or 0 if the wait timed out. */
+static inline unsigned long wait_for_completion_timeout(struct completion *c,
+                                                        unsigned long timeout)
+{
+	if ((c->done == 0) && (kstub_sleep != NULL)) { kstub_sleep(); }
+	return try_wait_for_completion(c) ? (timeout ? timeout : 1) : 0;
+}
+
+static inline int wait_for_completion_interruptible(struct completion *c)
+{
+	if ((c->done == 0) && (kstub_sleep != NULL)) { kstub_sleep(); }
+	return try_wait_for_completion(c) ? 0 : -ERESTARTSYS;
+}
+
+static inline void poll_wait(struct file *file, wait_queue_head_t *wq,
+                             poll_table *wait)
+{
+	(void)file; (void)wq; (void)wait;
+}
+
+#endif /* _KSTUB_H_ */
@@ -0,0 +1,2 @@
+/* Stand-in for the kernel header; see kstub.h. */
+#include <kstub.h>
@@ -0,0 +1,19 @@
+/**
+ * @file tracepoint.h
+ * @brief Stand-in for the kernel header; see kstub.h.
+ *
+ * Each TRACE_EVENT() becomes a trace_<event>() which does nothing.
+ */
+
+#ifndef _KSTUB_TRACEPOINT_H_
+#define _KSTUB_TRACEPOINT_H_
+
+#include <kstub.h>
+
+#define TP_PROTO(args...) args
+#define TP_ARGS(args...) args
+
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) {}
+
+#endif /* _KSTUB_TRACEPOINT_H_ */
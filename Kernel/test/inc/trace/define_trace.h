@@ -0,0 +1 @@
+/* Stand-in for the kernel header; the tracepoints need nothing defined. */
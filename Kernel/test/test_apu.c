@@ -0,0 +1,285 @@
+/**
+ * @file test_apu.c
+ * @author Andrew Spaulding
+ * @brief Host test of the apu driver's sample ring and irq handling.
+ *
+ * Usage: test-apu
+ *
+ * Builds apu.c against the stand-in kernel in inc/kstub.h, where the apu
+ * registers are plain memory and the apu irq is raised by hand. Checks that:
+ *  - Each fill of a slot clears the samples after its length, and is held
+ *    in the ring until the apu asks for a buffer.
+ *  - A full ring rejects non-blocking writes and counts an overrun, and a
+ *    blocking write sleeps until the irq frees a slot.
+ *  - The irq acknowledges itself, frees the buffer which finished, and gives
+ *    the apu the oldest filled slot, or leaves the request for the next fill.
+ *  - The refill latency histogram and the underrun count follow the time
+ *    from the irq to the next fill, and an apu which was not playing at the
+ *    irq has no underrun from it.
+ *  - Closing the file mutes the apu and resets the ring.
+ */
+
+#include "../apu/apu.c"
+
+/** @brief The apu's irq number. */
+#define IRQ 4
+
+static int failed;
+
+/** @brief Reports a failed check, and carries on. */
+#define check(cond)                                                       \
+	do {                                                              \
+		if (!(cond)) {                                            \
+			fprintf(stderr, "test-apu:%d: %s\n", __LINE__, #cond); \
+			failed = 1;                                       \
+		}                                                         \
+	} while (0)
+
+/** @brief Raises the apu irq, as the apu does whenever it has no queued buffer. */
+static void raise_irq(void)
+{
+	check(kstub_raise(IRQ));
+}
+
+/** @brief Gets the value of the config register. */
+static u32 config(void)
+{
+	return *kstub_reg(apu_io, APU_CONFIG_OFFSET);
+}
+
+/** @brief Gets the bus address of a slot, as given to the apu. */
+static u32 slot_addr(unsigned slot)
+{
+	return sample.dma_addr + slot * APU_BUF_SIZE;
+}
+
+/** @brief Checks the irq gave the apu a slot, and re-enabled itself. */
+static void check_sent(unsigned slot)
+{
+	check(*kstub_reg(apu_io, APU_BUF_OFFSET) == slot_addr(slot));
+	check(config() == (APU_ENABLE | APU_IRQ_REQ));
+}
+
+/** @brief Writes len samples of value, and returns what write() did. */
+static ssize_t write_samples(struct file *file, unsigned len, char value)
+{
+	char buf[APU_BUF_SIZE];
+
+	memset(buf, value, len);
+	return apu_write(file, buf, len, NULL);
+}
+
+/** @brief Reads the ring statistics. */
+static struct apu_stats stats(struct file *file)
+{
+	struct apu_stats s;
+
+	check(apu_ioctl(file, IOCTL_APU_GET_STATS, (unsigned long)&s) == 0);
+	return s;
+}
+
+/** @brief Checks every lock was released. */
+static void check_unlocked(struct file *file)
+{
+	struct apu_file *ctx = file->private_data;
+
+	check((sample.lock.held == 0) && (open_lock.held == 0));
+	check(ctx->fill_lock.held == 0);
+}
+
+/** @brief The irq is registered, and the ring starts at its default depth. */
+static void test_probe(struct platform_device *pdev)
+{
+	pdev->irq = IRQ;
+	check(apu_probe(pdev) == 0);
+
+	check(sample.buf != NULL);
+	check(sample.depth == APU_RING_DEFAULT);
+	check(kstub_irqs[IRQ].handler == apu_irq);
+}
+
+/** @brief Fills are held in the ring until the apu is started. */
+static void test_commit(struct file *file)
+{
+	unsigned char *slot0 = &sample.buf[0];
+
+	check(apu_ioctl(file, IOCTL_APU_SET_DEPTH, 4) == 0);
+	check(apu_ioctl(file, IOCTL_APU_SET_DEPTH, APU_RING_MIN - 1) == -EINVAL);
+	check(apu_ioctl(file, IOCTL_APU_SET_DEPTH, APU_RING_MAX + 1) == -EINVAL);
+	check(sample.depth == 4);
+
+	/* A short fill silences the rest of its slot, and is not sent yet. */
+	kstub_write_count = 0;
+	memset(slot0, 0x11, APU_BUF_SIZE);
+	check(write_samples(file, 100, 0x7F) == 100);
+	check((slot0[0] == 0x7F) && (slot0[99] == 0x7F));
+	check((slot0[100] == 0) && (slot0[APU_BUF_SIZE - 1] == 0));
+	check(kstub_write_count == 0);
+
+	/* Every slot may be filled before the apu is started. */
+	check(write_samples(file, APU_BUF_SIZE, 0x22) == APU_BUF_SIZE);
+	check(write_samples(file, APU_BUF_SIZE, 0x33) == APU_BUF_SIZE);
+	check(write_samples(file, APU_BUF_SIZE, 0x44) == APU_BUF_SIZE);
+	check(ring_free() == 0);
+	check(apu_poll(file, NULL) == 0);
+	file->f_flags |= O_NONBLOCK;
+	check(write_samples(file, APU_BUF_SIZE, 0x55) == -EAGAIN);
+	file->f_flags &= ~O_NONBLOCK;
+	check(stats(file).overruns == 1);
+	check(stats(file).queued == 4);
+	check(kstub_write_count == 0);
+
+	/* Starting enables the apu, and the ring may no longer change. */
+	kstub_now = 1000000000;
+	check(apu_ioctl(file, IOCTL_APU_START, 0) == 0);
+	check(config() == (APU_ENABLE | APU_IRQ_REQ));
+	check(apu_ioctl(file, IOCTL_APU_SET_DEPTH, 8) == -EBUSY);
+	check(stats(file).drain_us == 4 * APU_BUF_TIME_NS / 1000);
+	check_unlocked(file);
+}
+
+/** @brief The irq sends the oldest filled slot, and frees the one which finished. */
+static void test_irq(struct file *file)
+{
+	struct apu_commit commit;
+	struct apu_stats s;
+	u32 slot = 0;
+
+	/* The idle apu asks at once, and takes slot 0 into its queue. */
+	kstub_write_count = 0;
+	sample_wait.wakes = 0;
+	raise_irq();
+	check(kstub_write_count == 3);
+	check(kstub_writes[0].value == (APU_IRQ_ACK | APU_ENABLE));
+	check_sent(0);
+	check(sample_wait.wakes == 1);
+
+	/* It starts slot 0 right away, and asks for the next one. */
+	raise_irq();
+	check_sent(1);
+	check(ring_free() == 0);
+
+	/* Slot 0 is freed once slot 1 starts. */
+	kstub_now += APU_BUF_TIME_NS;
+	raise_irq();
+	check_sent(2);
+	check(ring_free() == 1);
+	check(apu_poll(file, NULL) == (EPOLLOUT | EPOLLWRNORM));
+
+	/* Once slot 3 starts, there is nothing left to send. */
+	kstub_now += APU_BUF_TIME_NS;
+	raise_irq();
+	check_sent(3);
+	kstub_now += APU_BUF_TIME_NS;
+	kstub_write_count = 0;
+	raise_irq();
+	check(kstub_write_count == 1);
+	check(sample.requested && sample.req_playing);
+	s = stats(file);
+	check((s.queued == 1) && (s.drain_us == APU_BUF_TIME_NS / 1000));
+	check((s.latency[0] == 4) && (s.underruns == 0));
+
+	/* A refill 100us later is sent at once, and lands in bucket 1. */
+	kstub_now += 100000;
+	check(write_samples(file, APU_BUF_SIZE, 0x66) == APU_BUF_SIZE);
+	check_sent(0);
+	s = stats(file);
+	check((s.latency[1] == 1) && (s.underruns == 0));
+	check(s.drain_us == 2 * APU_BUF_TIME_NS / 1000 - 100);
+
+	/* Filling through the mapping must use the next free slot. */
+	check(apu_ioctl(file, IOCTL_APU_GET_SLOT, (unsigned long)&slot) == 0);
+	check(slot == 1);
+	commit = (struct apu_commit){ .slot = 2, .len = 10 };
+	check(apu_ioctl(file, IOCTL_APU_COMMIT, (unsigned long)&commit) == -EINVAL);
+	commit.slot = slot;
+	check(apu_ioctl(file, IOCTL_APU_COMMIT, (unsigned long)&commit) == 0);
+	check(write_samples(file, APU_BUF_SIZE, 0x77) == APU_BUF_SIZE);
+	check(ring_free() == 0);
+
+	/* A blocking write sleeps until the irq, and is interrupted without it. */
+	check(write_samples(file, APU_BUF_SIZE, 0x88) == -ERESTARTSYS);
+	kstub_sleep = raise_irq;
+	kstub_now += APU_BUF_TIME_NS;
+	check(write_samples(file, APU_BUF_SIZE, 0x88) == APU_BUF_SIZE);
+	kstub_sleep = NULL;
+	check_sent(1);
+	check(stats(file).overruns == 3);
+	check_unlocked(file);
+}
+
+/** @brief A refill after the apu ran dry is an underrun, unless it was idle. */
+static void test_underrun(struct file *file)
+{
+	struct inode inode;
+	struct apu_stats s;
+
+	/* Play out the filled slots, leaving the last one playing. */
+	kstub_now += APU_BUF_TIME_NS;
+	raise_irq();
+	kstub_now += APU_BUF_TIME_NS;
+	raise_irq();
+	kstub_now += APU_BUF_TIME_NS;
+	raise_irq();
+	check(sample.requested && (sample.filled == 0));
+
+	/* 40ms is longer than the playing slot lasts. */
+	kstub_now += 40000000;
+	check(write_samples(file, APU_BUF_SIZE, 0x99) == APU_BUF_SIZE);
+	s = stats(file);
+	check(s.underruns == 1);
+	check(s.latency[10] == 1); /* 40000us >> 6 is 625, whose log2 is 9. */
+
+	/* Closing mutes the apu and resets the ring. */
+	kstub_write_count = 0;
+	check(apu_release(&inode, file) == 0);
+	check(kstub_write_count == 1);
+	check(kstub_writes[0].value == 0);
+	check((sample.depth == APU_RING_DEFAULT) && !sample.started);
+	check((sample.filled == 0) && (sample.hw == 0) && !sample.requested);
+	check(!apu_owned);
+
+	/* Started empty, the first fill is late by no fault of the writer. */
+	file->private_data = NULL;
+	check(apu_open(&inode, file) == 0);
+	check(apu_ioctl(file, IOCTL_APU_START, 0) == 0);
+	check(stats(file).drain_us == 0);
+	raise_irq();
+	check(sample.requested && !sample.req_playing);
+	kstub_now += 100000000;
+	check(write_samples(file, APU_BUF_SIZE, 0x11) == APU_BUF_SIZE);
+	check_sent(0);
+	check(stats(file).underruns == 0);
+	check(stats(file).drain_us == APU_BUF_TIME_NS / 1000);
+
+	/* But once fed, running dry counts. */
+	raise_irq();
+	kstub_now += APU_BUF_TIME_NS + 1000;
+	check(write_samples(file, APU_BUF_SIZE, 0x11) == APU_BUF_SIZE);
+	check(stats(file).underruns == 1);
+
+	check_unlocked(file);
+	check(apu_release(&inode, file) == 0);
+}
+
+int main(void)
+{
+	struct platform_device pdev = { 0 };
+	struct file file = { 0 };
+	struct inode inode;
+
+	test_probe(&pdev);
+
+	check(apu_open(&inode, &file) == 0);
+	check(apu_open(&inode, &(struct file){ 0 }) == -EBUSY);
+	test_commit(&file);
+	test_irq(&file);
+	test_underrun(&file);
+
+	check(apu_remove(&pdev) == 0);
+	check(kstub_irqs[IRQ].handler == NULL);
+
+	if (failed) { return EXIT_FAILURE; }
+	printf("test-apu: passed\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,262 @@
+/**
+ * @file test_con.c
+ * @author Andrew Spaulding
+ * @brief Host test of the controller driver's sampler and event queues.
+ *
+ * Usage: test-con
+ *
+ * Builds con.c against the stand-in kernel in inc/kstub.h, where the
+ * controller register is a plain word the test writes, and fires the sampling
+ * timer by hand. Checks that:
+ *  - A sample queues an event only when the state changed, holding the new
+ *    state, the time of the sample and the buttons which changed, in every
+ *    file which was open at the time.
+ *  - Every sample is published in the state page, which maps read-only.
+ *  - A full queue drops its oldest events, and keeps the newest in order.
+ *  - read() returns whole events oldest first, and fails when there are none.
+ *  - The sampling rate is checked, and used from the next sample on.
+ *  - The timer runs only while a file is open, and a file only sees the
+ *    changes made after it was opened.
+ */
+
+#include "../con/con.c"
+
+/** @brief The controller state with no buttons held (it is active low). */
+#define IDLE 0xFFFF
+
+static int failed;
+
+/** @brief Reports a failed check, and carries on. */
+#define check(cond)                                                       \
+	do {                                                              \
+		if (!(cond)) {                                            \
+			fprintf(stderr, "test-con:%d: %s\n", __LINE__, #cond); \
+			failed = 1;                                       \
+		}                                                         \
+	} while (0)
+
+/** @brief Sets the controller register, as the hardware would. */
+static void set_state(u16 state)
+{
+	*kstub_reg(con_io, 0) = state;
+}
+
+/** @brief Samples the controller at the given time. */
+static void sample(u64 time)
+{
+	kstub_now = time;
+	check(kstub_fire(&sampler.timer));
+	check(sampler.lock.held == 0);
+}
+
+/** @brief Reads up to max events from a file, without blocking. */
+static int read_events(struct file *file, struct con_event *events, int max)
+{
+	ssize_t ret;
+
+	file->f_flags |= O_NONBLOCK;
+	ret = con_read(file, (char *)events, max * sizeof(*events), NULL);
+	if (ret == -EAGAIN) { return 0; }
+	check(ret >= 0);
+	check(ret % sizeof(*events) == 0);
+	return (ret < 0) ? 0 : ret / sizeof(*events);
+}
+
+/** @brief Checks whether poll() reports events to read. */
+static bool poll_ready(struct file *file)
+{
+	return con_poll(file, NULL) == (EPOLLIN | EPOLLRDNORM);
+}
+
+/** @brief Checks an event holds what was sampled. */
+static void check_event(const struct con_event *event, u64 time, u16 state,
+                        u16 changed)
+{
+	check(event->time == time);
+	check(event->state == state);
+	check(event->changed == changed);
+	check(event->reserved == 0);
+}
+
+/** @brief Events are queued on changes only, with the right changed mask. */
+static void test_edges(void)
+{
+	struct file a = { 0 }, b = { 0 };
+	struct con_event events[8];
+	struct con_file *ctx;
+	u32 seq;
+
+	set_state(IDLE);
+	kstub_now = 1000;
+	check(con_open(NULL, &a) == 0);
+	check(sampler.timer.active);
+	check((shared->seq % 2 == 0) && (shared->state == IDLE));
+	check(shared->time == 1000);
+
+	/* Nothing changed, so there is nothing to read, but it is published. */
+	ctx = a.private_data;
+	seq = shared->seq;
+	sample(2000);
+	check(read_events(&a, events, 8) == 0);
+	check(ctx->wait.wakes == 0);
+	check(shared->seq == seq + 2);
+	check((shared->state == IDLE) && (shared->time == 2000));
+
+	/* Press A (bit 0). */
+	set_state(IDLE & ~0x0001);
+	sample(3000);
+	check(ctx->wait.wakes == 1);
+	check(poll_ready(&a));
+	check(read_events(&a, events, 8) == 1);
+	check_event(&events[0], 3000, IDLE & ~0x0001, 0x0001);
+	check(!poll_ready(&a));
+	check((shared->state == (IDLE & ~0x0001)) && (shared->time == 3000));
+
+	/* A second file only sees the changes made after it was opened. */
+	check(con_open(NULL, &b) == 0);
+	check(sampler.users == 2);
+
+	/* Press B (bit 2) while holding A, then let go of both at once. */
+	set_state(IDLE & ~0x0005);
+	sample(4000);
+	sample(5000);
+	set_state(IDLE);
+	sample(6000);
+
+	check(read_events(&a, events, 8) == 2);
+	check_event(&events[0], 4000, IDLE & ~0x0005, 0x0004);
+	check_event(&events[1], 6000, IDLE, 0x0005);
+	check(read_events(&b, events, 8) == 2);
+	check_event(&events[0], 4000, IDLE & ~0x0005, 0x0004);
+	check_event(&events[1], 6000, IDLE, 0x0005);
+
+	/* A blocking read of an empty queue can only be interrupted here. */
+	b.f_flags &= ~O_NONBLOCK;
+	check(con_read(&b, (char *)events, sizeof(events), NULL) == -ERESTARTSYS);
+	check(con_read(&b, (char *)events, sizeof(events[0]) - 1, NULL) == -EINVAL);
+
+	check(con_release(NULL, &b) == 0);
+	check(sampler.timer.active);
+	check(con_release(NULL, &a) == 0);
+	check(!sampler.timer.active);
+	check(list_empty(&sampler.files) && (open_lock.held == 0));
+}
+
+/** @brief A full queue drops the oldest events, and keeps the newest. */
+static void test_overflow(void)
+{
+	static struct con_event events[CON_EVENT_QUEUE + 1];
+	const unsigned extra = 10, total = CON_EVENT_QUEUE + extra;
+	struct file file = { 0 };
+	u16 state = IDLE;
+	int n;
+
+	set_state(IDLE);
+	kstub_now = 0;
+	check(con_open(NULL, &file) == 0);
+
+	/* Every sample changes some bits, each time a different set of them. */
+	for (unsigned i = 1; i <= total; i++) {
+		set_state(state ^ i);
+		sample(i * 1000);
+		state ^= i;
+	}
+
+	/* The first `extra` events were dropped; the rest come oldest first. */
+	n = read_events(&file, events, CON_EVENT_QUEUE + 1);
+	check(n == CON_EVENT_QUEUE);
+	state = IDLE;
+	for (unsigned i = 1; i <= extra; i++) { state ^= i; }
+	for (int j = 0; j < n; j++) {
+		unsigned i = extra + 1 + j;
+
+		state ^= i;
+		check_event(&events[j], i * 1000, state, i);
+	}
+	check(read_events(&file, events, CON_EVENT_QUEUE + 1) == 0);
+
+	/* A buffer which holds two and a half events reads two. */
+	set_state(IDLE);
+	sample((total + 1) * 1000);
+	set_state(IDLE & ~0x0010);
+	sample((total + 2) * 1000);
+	set_state(IDLE & ~0x0020);
+	sample((total + 3) * 1000);
+	file.f_flags |= O_NONBLOCK;
+	check(con_read(&file, (char *)events, sizeof(events[0]) * 5 / 2, NULL)
+	      == 2 * sizeof(events[0]));
+	check_event(&events[0], (total + 1) * 1000, IDLE, state ^ IDLE);
+	check_event(&events[1], (total + 2) * 1000, IDLE & ~0x0010, 0x0010);
+	check(read_events(&file, events, 8) == 1);
+	check_event(&events[0], (total + 3) * 1000, IDLE & ~0x0020, 0x0030);
+
+	check(con_release(NULL, &file) == 0);
+}
+
+/** @brief The sampling rate is checked, and taken up by the next sample. */
+static void test_rate(void)
+{
+	struct file file = { 0 };
+
+	set_state(IDLE);
+	kstub_now = 0;
+	check(con_open(NULL, &file) == 0);
+	check(sampler.timer.expires == NSEC_PER_SEC / CON_RATE_DEFAULT);
+
+	check(con_ioctl(&file, IOCTL_CON_SET_RATE, CON_RATE_MIN - 1) == -EINVAL);
+	check(con_ioctl(&file, IOCTL_CON_SET_RATE, CON_RATE_MAX + 1) == -EINVAL);
+	check(con_ioctl(&file, IOCTL_CON_GET_STATE, 0) == IDLE);
+
+	/* The timer already set keeps its expiry; the one after uses the rate. */
+	check(con_ioctl(&file, IOCTL_CON_SET_RATE, 8000) == 0);
+	check(sampler.timer.expires == NSEC_PER_SEC / CON_RATE_DEFAULT);
+	sample(NSEC_PER_SEC / CON_RATE_DEFAULT);
+	check(sampler.timer.expires
+	      == NSEC_PER_SEC / CON_RATE_DEFAULT + NSEC_PER_SEC / 8000);
+
+	/* Closing the file forgets the rate. */
+	check(con_release(NULL, &file) == 0);
+	kstub_now = 0;
+	check(con_open(NULL, &file) == 0);
+	check(sampler.timer.expires == NSEC_PER_SEC / CON_RATE_DEFAULT);
+	check(con_release(NULL, &file) == 0);
+	check(sampler.lock.held == 0);
+}
+
+/** @brief The state page maps read-only, and only as a single page. */
+static void test_mmap(void)
+{
+	struct vm_area_struct vma = { .vm_start = 0x10000, .vm_end = 0x11000,
+	                              .vm_flags = VM_MAYWRITE };
+	struct file file = { 0 };
+
+	check(con_mmap(&file, &vma) == 0);
+	check(!(vma.vm_flags & VM_MAYWRITE));
+
+	vma.vm_flags = VM_WRITE | VM_MAYWRITE;
+	check(con_mmap(&file, &vma) == -EPERM);
+
+	vma.vm_flags = 0;
+	vma.vm_end = vma.vm_start + 2 * PAGE_SIZE;
+	check(con_mmap(&file, &vma) == -EINVAL);
+
+	vma.vm_end = vma.vm_start + PAGE_SIZE;
+	vma.vm_pgoff = 1;
+	check(con_mmap(&file, &vma) == -EINVAL);
+}
+
+int main(void)
+{
+	check(con_init() == 0);
+
+	test_edges();
+	test_overflow();
+	test_rate();
+	test_mmap();
+
+	con_clean();
+
+	if (failed) { return EXIT_FAILURE; }
+	printf("test-con: passed\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,285 @@
+/**
+ * @file test_ppu.c
+ * @author Joseph Yankel
+ * @brief Host test of the PPU driver's frame submission, DMA lock and release.
+ *
+ * Usage: test-ppu
+ *
+ * Builds ppu.c against the stand-in kernel in inc/kstub.h, where the PPU control registers are
+ *   plain memory and the DMA-ready IRQ is raised by hand. Checks that:
+ *  - A frame submission copies the requested and written regions (and only those) into the DMA
+ *    VRAM, writes the control registers, and starts the DMA of the whole DMA VRAM last, from its
+ *    16B-aligned address.
+ *  - The DMA lock is held until the IRQ, so a second update fails with EBUSY, and an IRQ with no
+ *    frame in flight does not let a second frame in.
+ *  - IOCTL_PPU_UPDATE_SYNC sleeps until the IRQ, and reports the frame it submitted.
+ *  - Closing the file blanks the screen once the PPU takes the frame in flight, and if the PPU
+ *    never does, leaves the DMA VRAM alone and resets the DMA lock, with the IRQ disabled.
+ */
+
+#include "../ppu/ppu.c"
+
+/** @brief The PPU's IRQ number. */
+#define IRQ 3
+
+static int failed;
+
+/** @brief Reports a failed check, and carries on. */
+#define check(cond)                                                                             \
+    do {                                                                                        \
+        if (!(cond)) {                                                                          \
+            fprintf(stderr, "test-ppu:%d: %s\n", __LINE__, #cond);                              \
+            failed = 1;                                                                         \
+        }                                                                                       \
+    } while (0)
+
+
+/* === Helpers === */
+/** @brief Raises the DMA-ready IRQ, as the PPU does once it has taken a frame. */
+static void raise_irq(void)
+{
+    check(kstub_raise(IRQ));
+}
+
+/** @brief Gets a byte of the DMA VRAM. */
+static u8 dma_byte(unsigned offset)
+{
+    return ((u8 *)vram_addr_v)[offset];
+}
+
+/** @brief Checks whether poll() reports the PPU ready for a frame. */
+static bool poll_ready(struct file *file)
+{
+    return ppu_poll(file, NULL) == (EPOLLOUT | EPOLLWRNORM);
+}
+
+/** @brief Writes len bytes of value to the work VRAM through write(). */
+static void write_vram(struct file *file, unsigned offset, u8 value, unsigned len)
+{
+    static u8 buf[VRAM_SIZE];
+    loff_t pos = offset;
+
+    memset(buf, value, len);
+    check(ppu_write(file, (const char *)buf, len, &pos) == (ssize_t)len);
+    check(pos == offset + len);
+}
+
+/** @brief Checks the last register writes were a frame submission, sending the whole DMA VRAM. */
+static void check_submit(u32 bgscroll, u32 fgscroll, u32 bgcolor, u32 enable)
+{
+    static const unsigned offsets[] = {
+        PPU_BGSCROLL_OFFSET, PPU_FGSCROLL_OFFSET, PPU_BGCOLOR_OFFSET, PPU_ENABLE_OFFSET,
+        PPU_DMA_ADDR_OFFSET,
+    };
+    const u32 values[] = { bgscroll, fgscroll, bgcolor, enable, vram_addr_p };
+    unsigned i;
+
+    check(kstub_write_count == ARRAY_SIZE(offsets));
+    for (i = 0; (i < ARRAY_SIZE(offsets)) && (i < kstub_write_count); i++)
+    {
+        check(kstub_writes[i].addr == kstub_reg(ppu_io, offsets[i]));
+        check(kstub_writes[i].value == values[i]);
+    }
+    kstub_write_count = 0;
+}
+
+/** @brief Checks every lock was released. */
+static void check_unlocked(void)
+{
+    check((vram_lock.held == 0) && (open_lock.held == 0));
+    check(kstub_irqs[IRQ].depth == 0);
+}
+
+
+/* === Tests === */
+/** @brief The DMA VRAM is aligned to 16B on the bus, and starts out free. */
+static void test_probe(struct platform_device *pdev)
+{
+    // Misalign the allocation, which the driver must correct.
+    kstub_dma_next = 0x30000008;
+    pdev->irq = IRQ;
+    check(ppu_probe(pdev) == 0);
+
+    check((vram_addr_p & 0xF) == 0);
+    check((vram_addr_p == vram_base_p + 8) && (vram_addr_v == vram_base_v + 1));
+    check(dma_done.done == 1);
+    check(kstub_irqs[IRQ].handler == ppu_irq);
+}
+
+/** @brief Frames send the right regions and registers, and hold the DMA lock until the IRQ. */
+static void test_submit(void)
+{
+    struct file file = { 0 };
+    unsigned i;
+
+    check(ppu_open(NULL, &file) == 0);
+    check(ppu_open(NULL, &(struct file){ 0 }) == -EBUSY);
+    check(poll_ready(&file));
+
+    check(ppu_ioctl(&file, IOCTL_PPU_SET_BGSCROLL, 0x11) == 0);
+    check(ppu_ioctl(&file, IOCTL_PPU_SET_FGSCROLL, 0x22) == 0);
+    check(ppu_ioctl(&file, IOCTL_PPU_SET_BGCOLOR, 0x33) == 0);
+    check(ppu_ioctl(&file, IOCTL_PPU_SET_ENABLE, 0x1) == 0);
+
+    // A palette written through write() is sent along with the tiles asked for, but the patterns,
+    //   changed behind the driver's back as through mmap(), are not.
+    write_vram(&file, 0xC000, 0xAA, 0x20);
+    memset(vram_work + 0x4000, 0xBB, 0x20);
+    memset(vram_work + 0x0000, 0xCC, 0x20);
+    kstub_write_count = 0;
+    check(ppu_ioctl(&file, IOCTL_PPU_UPDATE_REGIONS, PPU_REGION_TILES) == 0);
+    check_submit(0x11, 0x22, 0x33, 0x1);
+    check((dma_byte(0x0000) == 0xCC) && (dma_byte(0x001F) == 0xCC));
+    check((dma_byte(0xC000) == 0xAA) && (dma_byte(0xC01F) == 0xAA));
+    check(dma_byte(0x4000) == 0);
+
+    // The frame is in flight, so nothing else may touch the DMA VRAM.
+    check(!poll_ready(&file));
+    check(ppu_ioctl(&file, IOCTL_PPU_UPDATE, 0) == -EBUSY);
+    check(ppu_ioctl(&file, IOCTL_PPU_UPDATE_REGIONS, PPU_REGION_SPRITES) == -EBUSY);
+    check(ppu_ioctl(&file, IOCTL_PPU_UPDATE_REGIONS, 0x10) == -EINVAL);
+    check(kstub_write_count == 0);
+
+    // The IRQ frees the lock once, and an IRQ with nothing in flight changes nothing.
+    dma_wait.wakes = 0;
+    raise_irq();
+    check(poll_ready(&file) && (dma_wait.wakes == 1));
+    raise_irq();
+    check(dma_done.done == 1);
+
+    // A plain update sends everything, now including the patterns.
+    check(ppu_ioctl(&file, IOCTL_PPU_UPDATE, 0) == 0);
+    check_submit(0x11, 0x22, 0x33, 0x1);
+    check(dma_byte(0x4000) == 0xBB);
+    raise_irq();
+
+    // With nothing written or asked for, nothing is copied, but the frame is still sent.
+    check(ppu_ioctl(&file, IOCTL_PPU_UPDATE_REGIONS, 0) == 0);
+    check_submit(0x11, 0x22, 0x33, 0x1);
+    raise_irq();
+
+    // Every frame's contents were copied out of the work VRAM, which writes no longer wait on.
+    for (i = 0; i < VRAM_SIZE; i++) { check(dma_byte(i) == vram_work[i]); }
+
+    kstub_sleep = raise_irq;
+    check(ppu_release(NULL, &file) == 0);
+    kstub_sleep = NULL;
+    check_unlocked();
+}
+
+/** @brief IOCTL_PPU_UPDATE_SYNC sleeps until the lock is free, and reports its frame. */
+static void test_sync(void)
+{
+    struct file file = { 0 };
+    u32 frame = 0, seq;
+
+    check(ppu_open(NULL, &file) == 0);
+    check(ppu_ioctl(&file, IOCTL_PPU_UPDATE, 0) == 0);
+    seq = (u32)atomic_read(&frame_seq);
+
+    // Interrupted while the frame is in flight: nothing is sent.
+    kstub_write_count = 0;
+    check(ppu_ioctl(&file, IOCTL_PPU_UPDATE_SYNC, (unsigned long)&frame) == -ERESTARTSYS);
+    check(kstub_write_count == 0);
+
+    // Woken by the IRQ for the frame in flight, it sends the next, which is the frame after it.
+    kstub_sleep = raise_irq;
+    check(ppu_ioctl(&file, IOCTL_PPU_UPDATE_SYNC, (unsigned long)&frame) == 0);
+    check(frame == seq + 2);
+    check_submit(0, 0, 0, 0);
+    check(ppu_ioctl(&file, IOCTL_PPU_GET_FRAME, (unsigned long)&frame) == 0);
+    check(frame == seq + 1);
+    raise_irq();
+    check(ppu_ioctl(&file, IOCTL_PPU_GET_FRAME, (unsigned long)&frame) == 0);
+    check(frame == seq + 2);
+
+    check(ppu_release(NULL, &file) == 0);
+    kstub_sleep = NULL;
+    check_unlocked();
+}
+
+/** @brief Closing the file waits for the frame in flight, then blanks the screen. */
+static void test_release(void)
+{
+    struct file file = { 0 };
+    unsigned i;
+
+    check(ppu_open(NULL, &file) == 0);
+    check(ppu_ioctl(&file, IOCTL_PPU_SET_BGCOLOR, 0x44) == 0);
+    write_vram(&file, 0, 0x55, VRAM_SIZE);
+    check(ppu_ioctl(&file, IOCTL_PPU_UPDATE, 0) == 0);
+    check(dma_byte(0) == 0x55);
+
+    kstub_sleep = raise_irq;
+    kstub_write_count = 0;
+    check(ppu_release(NULL, &file) == 0);
+    kstub_sleep = NULL;
+
+    check_submit(0, 0, 0, 0);
+    for (i = 0; i < VRAM_SIZE; i++) { check((dma_byte(i) == 0) && (vram_work[i] == 0)); }
+    check(dma_done.done == 1);
+    check(!ppu_owned);
+    check_unlocked();
+}
+
+/** @brief If the PPU never takes a frame, closing the file leaves the DMA VRAM alone. */
+static void test_release_lost(void)
+{
+    struct file file = { 0 };
+    unsigned disables = kstub_irqs[IRQ].disables;
+
+    // The frame in flight is lost: nothing may be sent, and the lock is reset with the IRQ off.
+    check(ppu_open(NULL, &file) == 0);
+    write_vram(&file, 0, 0x66, VRAM_SIZE);
+    check(ppu_ioctl(&file, IOCTL_PPU_UPDATE, 0) == 0);
+    kstub_write_count = 0;
+    check(ppu_release(NULL, &file) == 0);
+
+    check(kstub_write_count == 0);
+    check(dma_byte(0) == 0x66);
+    check(dma_done.done == 1);
+    check(kstub_irqs[IRQ].disables == disables + 1);
+    check(!ppu_owned);
+    check_unlocked();
+
+    // The late IRQ for the lost frame finds the lock free, and is ignored.
+    raise_irq();
+    check(dma_done.done == 1);
+
+    // The blank frame is lost: it was sent, but the lock is still reset for the next process.
+    check(ppu_open(NULL, &file) == 0);
+    kstub_write_count = 0;
+    check(ppu_release(NULL, &file) == 0);
+    check_submit(0, 0, 0, 0);
+    check(dma_done.done == 1);
+    check(kstub_irqs[IRQ].disables == disables + 2);
+    check_unlocked();
+
+    // The next process gets the PPU as usual.
+    check(ppu_open(NULL, &file) == 0);
+    check(ppu_ioctl(&file, IOCTL_PPU_UPDATE, 0) == 0);
+    kstub_sleep = raise_irq;
+    check(ppu_release(NULL, &file) == 0);
+    kstub_sleep = NULL;
+    check(dma_done.done == 1);
+}
+
+
+/* === Main === */
+int main(void)
+{
+    struct platform_device pdev = { 0 };
+
+    test_probe(&pdev);
+    test_submit();
+    test_sync();
+    test_release();
+    test_release_lost();
+
+    check(ppu_remove(&pdev) == 0);
+    check(kstub_irqs[IRQ].handler == NULL);
+
+    if (failed) { return EXIT_FAILURE; }
+    printf("test-ppu: passed\n");
+    return EXIT_SUCCESS;
+}
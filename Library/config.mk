@@ -18,4 +18,7 @@ OUTDIR = usr
 # The compiler to be used and its C flags.
 AR = ar
 CC = arm-none-linux-gnueabihf-gcc
-CFLAGS = -nostdinc -std=gnu99
+CFLAGS = -nostdinc -std=gnu99 -mfpu=neon
+
+# Uncomment to build in the USDT probes (see src/inc/probe.h). Needs <sys/sdt.h> in the SDK.
+# CFLAGS += -DFPGAME_PROBES
@@ -0,0 +1,179 @@
+/**
+ * @file adpcm.c
+ * @author Andrew Spaulding
+ * @brief IMA-ADPCM stream playback implementation.
+ *
+ * Streams are mapped read-only and advised as sequential, so the kernel reads
+ * ahead of the decoder and drops pages behind it. The decoder only keeps the
+ * current position and the decoder state, so decoding is a fixed amount of
+ * work per sample no matter where in the stream it starts.
+ */
+
+#include <fp-game/adpcm.h>
+#include <fp-game/apu.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <noway.h>
+#include <adpcm_codec.h>
+
+/** @brief An open stream. */
+struct adpcm_stream {
+	void *map;                    ///< The mapped stream file.
+	size_t size;                  ///< Size of the mapping in bytes.
+	const adpcm_header_t *header; ///< The stream header, at the start of the mapping.
+	const adpcm_block_t *blocks;  ///< The blocks, following the header.
+	uint32_t pos;                 ///< The next sample to decode.
+	int16_t predictor;            ///< Decoder predictor before decoding sample pos.
+	uint8_t index;                ///< Decoder step index before decoding sample pos.
+};
+
+/** @brief The stream played by adpcm_callback(), or NULL for silence. */
+static adpcm_stream_t *playing = NULL;
+
+adpcm_stream_t *adpcm_open(const char *file)
+{
+	adpcm_stream_t *stream;
+	const adpcm_header_t *header;
+	struct stat st;
+	uint64_t blocks;
+	void *map;
+	int fd;
+
+	nowaymsg(file == NULL, "ADPCM stream path is NULL!");
+
+	fd = open(file, O_RDONLY);
+	nowaymsg(fd == -1, strerror(errno));
+	nowaymsg(fstat(fd, &st) == -1, strerror(errno));
+	nowaymsg((size_t)st.st_size < sizeof(adpcm_header_t), "ADPCM stream is truncated!");
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	nowaymsg(map == MAP_FAILED, strerror(errno));
+	close(fd);
+
+	/* Only a hint; playback works the same if it is ignored. */
+	(void)madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	/* Check the header now, so decoding can trust it. */
+	header = map;
+	nowaymsg(header->magic != ADPCM_MAGIC, "File is not an ADPCM stream!");
+	nowaymsg(header->version != ADPCM_VERSION, "Unsupported ADPCM stream version!");
+	nowaymsg((header->flags & ADPCM_LOOP)
+	         && (header->loop_start >= header->length), "ADPCM loop start is malformed!");
+	nowaymsg(header->loop_index > ADPCM_MAX_INDEX, "ADPCM loop state is malformed!");
+
+	blocks = (header->length + ADPCM_BLOCK_SAMPLES - 1) / ADPCM_BLOCK_SAMPLES;
+	nowaymsg(sizeof(adpcm_header_t) + blocks * sizeof(adpcm_block_t) > (uint64_t)st.st_size,
+	         "ADPCM stream is truncated!");
+
+	nowaymsg((stream = malloc(sizeof(adpcm_stream_t))) == NULL, "ADPCM stream malloc failed!");
+	stream->map = map;
+	stream->size = st.st_size;
+	stream->header = header;
+	stream->blocks = (const adpcm_block_t *)(header + 1);
+	adpcm_rewind(stream);
+
+	return stream;
+}
+
+void adpcm_close(adpcm_stream_t *stream)
+{
+	nowaymsg(stream == NULL, "ADPCM stream is NULL!");
+	nowaymsg(stream == playing, "ADPCM stream is still playing!");
+
+	munmap(stream->map, stream->size);
+	free(stream);
+}
+
+void adpcm_rewind(adpcm_stream_t *stream)
+{
+	nowaymsg(stream == NULL, "ADPCM stream is NULL!");
+
+	stream->pos = 0;
+	if (stream->header->length > 0) {
+		stream->predictor = stream->blocks[0].predictor;
+		stream->index = stream->blocks[0].index;
+	}
+}
+
+unsigned adpcm_decode(adpcm_stream_t *stream, int8_t *out, unsigned len)
+{
+	const adpcm_header_t *header;
+	const adpcm_block_t *block;
+	int16_t predictor;
+	uint8_t index;
+	uint32_t pos;
+	unsigned i;
+
+	nowaymsg(stream == NULL, "ADPCM stream is NULL!");
+	nowaymsg(out == NULL, "ADPCM output is NULL!");
+
+	header = stream->header;
+	pos = stream->pos;
+	predictor = stream->predictor;
+	index = stream->index;
+
+	for (i = 0; i < len; i++) {
+		unsigned offset;
+		uint8_t byte;
+
+		if (pos == header->length) {
+			if (!(header->flags & ADPCM_LOOP)) { break; }
+
+			pos = header->loop_start;
+			predictor = header->loop_predictor;
+			index = header->loop_index;
+		}
+
+		block = &stream->blocks[pos / ADPCM_BLOCK_SAMPLES];
+		offset = pos % ADPCM_BLOCK_SAMPLES;
+
+		/*
+		 * The block state matches the carried state when decoding runs on
+		 * from the previous block, but reloading it is as cheap as checking,
+		 * and stops a damaged block from spoiling the rest of the stream.
+		 */
+		if (offset == 0) {
+			predictor = block->predictor;
+			index = (block->index > ADPCM_MAX_INDEX) ? ADPCM_MAX_INDEX : block->index;
+		}
+
+		byte = block->data[offset / 2];
+		out[i] = adpcm_step(&predictor, &index, (offset & 1) ? byte >> 4 : byte & 0xF)
+		         >> 8;
+		pos++;
+	}
+
+	stream->pos = pos;
+	stream->predictor = predictor;
+	stream->index = index;
+
+	return i;
+}
+
+void adpcm_play(adpcm_stream_t *stream)
+{
+	/* Keep the callback from running while the stream is swapped out. */
+	apu_callback_disable();
+	playing = stream;
+	apu_callback_enable();
+}
+
+void adpcm_callback(const int8_t **buf, int *buf_size)
+{
+	static int8_t samples[APU_BUF_MAX];
+	unsigned len = 0;
+
+	if (playing != NULL) { len = adpcm_decode(playing, samples, APU_BUF_MAX); }
+	memset(&samples[len], 0, APU_BUF_MAX - len);
+
+	*buf = samples;
+	*buf_size = APU_BUF_MAX;
+}
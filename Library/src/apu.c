@@ -4,20 +4,33 @@
  * @brief APU interface implementation.
  */
 
+#define _GNU_SOURCE /* For pthread_attr_setaffinity_np */
+
 #include <fp-game/apu.h>
 
 #include <sys/ioctl.h>
 #include <fp-game/drv_apu.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
-#include <signal.h>
+#include <errno.h>
 
 #include <noway.h>
+#include <probe.h>
+#include <apu_internal.h>
+
+_Static_assert(APU_STATS_BUCKETS == APU_LATENCY_BUCKETS,
+               "apu_stats_t does not match struct apu_stats");
+_Static_assert(APU_BUF_MAX == APU_SLOT_SIZE,
+               "APU_BUF_MAX does not match the driver's buffers");
 
 /** @brief The file descriptor for the apu device file. */
 static int apu_fd = -1;
@@ -25,29 +38,65 @@ static int apu_fd = -1;
 /** @brief The callback function given by the user when enabling the apu. */
 static void (*callback_fn)(const int8_t **buf, int *buf_size) = NULL;
 
+/** @brief The render function given by apu_enable_render(), or NULL. */
+static void (*render_fn)(int8_t *buf, unsigned len) = NULL;
+
+/** @brief The driver's sample buffers, mapped by apu_enable_render(). */
+static int8_t *slots = MAP_FAILED;
+
+/** @brief The thread which runs the callback and feeds the apu. */
+static pthread_t feeder;
+
+/** @brief Pipe used to tell the feeder thread to exit. */
+static int stop_pipe[2] = { -1, -1 };
+
+/**
+ * @brief Held by the feeder thread while it runs the callback.
+ *
+ * Holding this lock from another thread keeps the callback from running,
+ * which is how apu_callback_disable() works.
+ */
+static pthread_mutex_t callback_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* Helper Functions */
-static void apu_sig_handler(int sig);
+static void *apu_feeder(void *arg);
+static int apu_start(const apu_feeder_t *attr);
+static int apu_start_feeder(const apu_feeder_t *attr);
+static bool apu_refill(void);
+static void apu_render(void);
 
 int apu_enable(void (*callback)(const int8_t **buf, int *buf_size))
+{
+	const apu_feeder_t attr = { .priority = 0, .cpu = -1, .depth = 0 };
+	return apu_enable_feeder(callback, &attr);
+}
+
+int apu_enable_feeder(void (*callback)(const int8_t **buf, int *buf_size),
+                      const apu_feeder_t *attr)
 {
 	noway(callback == NULL);
 	noway(apu_fd != -1);
 
-	/* Open the apu device file */
-	apu_fd = open(APU_DEV_FILE, O_WRONLY);
-	if (apu_fd < 0) { return -1;}
-
-	/* Register our signal handler for APU interrupts. */
 	callback_fn = callback;
-	struct sigaction sig = {
-		.sa_handler = apu_sig_handler,
-		.sa_flags = SA_RESTART,
-	};
-	sigemptyset(&sig.sa_mask);
-	noway(sigaction(APU_CALLBACK_SIG, &sig, NULL) < 0);
+	if (apu_start(attr) != 0) {
+		callback_fn = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int apu_enable_render(void (*render)(int8_t *buf, unsigned len),
+                      const apu_feeder_t *attr)
+{
+	noway(render == NULL);
+	noway(apu_fd != -1);
 
-	/* Send the apu our pid so that it may send us interrupts. */
-	noway(ioctl(apu_fd, IOCTL_APU_SET_CALLBACK_PID, getpid()) < 0);
+	render_fn = render;
+	if (apu_start(attr) != 0) {
+		render_fn = NULL;
+		return -1;
+	}
 
 	return 0;
 }
@@ -56,45 +105,231 @@ void apu_disable(void)
 {
 	noway(apu_fd == -1);
 
+	/* Stop the feeder before closing the file it feeds. */
+	noway(write(stop_pipe[1], "", 1) != 1);
+	pthread_join(feeder, NULL);
+	close(stop_pipe[0]);
+	close(stop_pipe[1]);
+
+	if (slots != MAP_FAILED) {
+		munmap(slots, APU_MMAP_SIZE);
+		slots = MAP_FAILED;
+	}
 	close(apu_fd);
-	sigaction(APU_CALLBACK_SIG, NULL, NULL);
 
 	apu_fd = -1;
 	callback_fn = NULL;
+	render_fn = NULL;
+	apu_queue_release();
 }
 
 void apu_callback_enable(void)
 {
-	sigset_t mask;
-	sigemptyset(&mask);
-	sigaddset(&mask, APU_CALLBACK_SIG);
-	sigprocmask(SIG_UNBLOCK, &mask, NULL);
+	pthread_mutex_unlock(&callback_lock);
 }
 
 void apu_callback_disable(void)
 {
-	sigset_t mask;
-	sigemptyset(&mask);
-	sigaddset(&mask, APU_CALLBACK_SIG);
-	sigprocmask(SIG_BLOCK, &mask, NULL);
+	pthread_mutex_lock(&callback_lock);
+}
+
+void apu_get_stats(apu_stats_t *stats)
+{
+	struct apu_stats kstats;
+
+	noway(stats == NULL);
+	noway(apu_fd == -1);
+
+	noway(ioctl(apu_fd, IOCTL_APU_GET_STATS, &kstats) < 0);
+
+	stats->depth = kstats.depth;
+	stats->queued = kstats.queued;
+	stats->underruns = kstats.underruns;
+	stats->overruns = kstats.overruns;
+	stats->drain_us = kstats.drain_us;
+	for (int i = 0; i < APU_STATS_BUCKETS; i++) {
+		stats->latency[i] = kstats.latency[i];
+	}
 }
 
 /**
- * @brief Handles an apu interrupt by calling the users callback function.
- * @param sig Ignored.
+ * @brief Opens the apu and starts the feeder thread and playback.
+ *
+ * The feeder calls render_fn if it is set, and callback_fn otherwise.
+ *
+ * @param attr The ring depth and the scheduling of the feeder thread.
+ * @return 0 on success, or -1 if the apu could not be opened or the thread
+ *         could not be created.
  */
-static void apu_sig_handler(int sig)
+static int apu_start(const apu_feeder_t *attr)
 {
-	(void)sig;
-	noway(callback_fn == NULL);
+	noway(attr == NULL);
+	noway(attr->priority < 0);
+	noway((attr->depth != 0) && ((attr->depth < APU_RING_MIN)
+	                             || (attr->depth > APU_RING_MAX)));
 
-	/* Get new samples from the user. */
+	/* Open the apu device file. Mapping it requires read access too. */
+	apu_fd = open(APU_DEV_FILE, O_RDWR);
+	if (apu_fd < 0) { return -1;}
+
+	if (attr->depth != 0) {
+		noway(ioctl(apu_fd, IOCTL_APU_SET_DEPTH, attr->depth) < 0);
+	}
+
+	if (render_fn != NULL) {
+		slots = mmap(NULL, APU_MMAP_SIZE, PROT_WRITE, MAP_SHARED, apu_fd, 0);
+		noway(slots == MAP_FAILED);
+	}
+
+	/* Start the feeder thread, which waits for the apu to request samples. */
+	noway(pipe(stop_pipe) < 0);
+	if (apu_start_feeder(attr) != 0) {
+		close(stop_pipe[0]);
+		close(stop_pipe[1]);
+		if (slots != MAP_FAILED) {
+			munmap(slots, APU_MMAP_SIZE);
+			slots = MAP_FAILED;
+		}
+		close(apu_fd);
+		apu_fd = -1;
+		return -1;
+	}
+
+	/* Start playback, enabling the requests the feeder waits on. */
+	noway(ioctl(apu_fd, IOCTL_APU_START) < 0);
+
+	return 0;
+}
+
+/**
+ * @brief Creates the feeder thread with the requested scheduling.
+ * @param attr The scheduling policy and core of the thread.
+ * @return 0 on success, or -1 if the thread could not be created.
+ */
+static int apu_start_feeder(const apu_feeder_t *attr)
+{
+	pthread_attr_t pattr;
+	int ret;
+
+	pthread_attr_init(&pattr);
+
+	if (attr->priority > 0) {
+		struct sched_param param = { .sched_priority = attr->priority };
+
+		pthread_attr_setinheritsched(&pattr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&pattr, SCHED_FIFO);
+		noway(pthread_attr_setschedparam(&pattr, &param) != 0);
+	}
+
+	if (attr->cpu >= 0) {
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(attr->cpu, &cpus);
+		noway(pthread_attr_setaffinity_np(&pattr, sizeof(cpus), &cpus)
+		      != 0);
+	}
+
+	/* Fails with EPERM if we may not use SCHED_FIFO, or EINVAL for a bad core. */
+	ret = pthread_create(&feeder, &pattr, apu_feeder, NULL);
+	pthread_attr_destroy(&pattr);
+
+	return (ret == 0) ? 0 : -1;
+}
+
+/**
+ * @brief Feeds the apu by calling the users callback (or render) function
+ *        each time it requests more samples.
+ *
+ * The callback is only run once the apu has requested samples, so that the
+ * samples are as fresh as possible, and the write which follows never blocks.
+ * If the callback holds its samples back, it is called again APU_HOLD_MS
+ * later instead of as soon as the apu asks.
+ *
+ * @param arg Ignored.
+ * @return NULL, once told to stop by apu_disable().
+ */
+static void *apu_feeder(void *arg)
+{
+	struct pollfd fds[2] = {
+		{ .fd = apu_fd, .events = POLLOUT },
+		{ .fd = stop_pipe[0], .events = POLLIN },
+	};
+	bool held = false;
+	(void)arg;
+
+	while (true) {
+		/* While held, the apu is still asking, so only wait out the hold. */
+		fds[0].events = held ? 0 : POLLOUT;
+		if (poll(fds, 2, held ? APU_HOLD_MS : -1) < 0) {
+			noway(errno != EINTR);
+			continue;
+		}
+		if (fds[1].revents != 0) { break; }
+		if (!held && !(fds[0].revents & POLLOUT)) { continue; }
+
+		if (render_fn != NULL) {
+			apu_render();
+		} else {
+			held = !apu_refill();
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Gets samples from the callback, and writes them to the apu.
+ * @return false if the callback held its samples back, or true otherwise.
+ */
+static bool apu_refill(void)
+{
 	const int8_t *buf;
 	int len;
+
+	/* Get new samples from the user. */
+	PROBE(apu_refill_start);
+	pthread_mutex_lock(&callback_lock);
 	callback_fn(&buf, &len);
+	pthread_mutex_unlock(&callback_lock);
+
+	/* Nothing to send until the callback stops holding. */
+	if (buf == NULL) {
+		PROBE1(apu_refill_done, 0);
+		return false;
+	}
 
 	/* Send the new samples to the apu. */
-	if (write(apu_fd, buf, len)) {
+	if (write(apu_fd, buf, len) != len) {
 		perror("APU callback failed");
 	}
+	PROBE1(apu_refill_done, len);
+	return true;
+}
+
+/**
+ * @brief Renders samples straight into the apu's next free buffer, and
+ *        commits it.
+ *
+ * No samples are copied, and the buffer is always full, so the driver has
+ * nothing to clear.
+ */
+static void apu_render(void)
+{
+	struct apu_commit commit = { .len = APU_SLOT_SIZE };
+
+	if (ioctl(apu_fd, IOCTL_APU_GET_SLOT, &commit.slot) < 0) {
+		perror("APU render failed");
+		return;
+	}
+
+	PROBE1(apu_render_start, commit.slot);
+	pthread_mutex_lock(&callback_lock);
+	render_fn(&slots[commit.slot * APU_SLOT_SIZE], APU_SLOT_SIZE);
+	pthread_mutex_unlock(&callback_lock);
+
+	if (ioctl(apu_fd, IOCTL_APU_COMMIT, &commit) < 0) {
+		perror("APU render failed");
+	}
+	PROBE1(apu_render_done, commit.slot);
 }
@@ -0,0 +1,245 @@
+/**
+ * @file apu_queue.c
+ * @author Andrew Spaulding
+ * @brief APU sample queue implementation.
+ *
+ * The queue is a single-producer/single-consumer ring of samples. The game
+ * thread is the only producer, and the APU feeder thread (through the refill
+ * callback below) is the only consumer. Each side only ever writes its own
+ * index, so the indices are published with release stores and read with
+ * acquire loads, and no lock is needed.
+ *
+ * The indices count samples since the queue was created and are allowed to
+ * wrap; the ring size is a power of two, so the difference between them is
+ * always the fill level.
+ *
+ * The feeder only sends the APU full buffers while the driver's ring has
+ * buffers queued to play. A short buffer is held back until the game queues
+ * the rest of it, and only padded with silence once the ring is about to run
+ * dry, so a game which queues a frame's worth of samples at a time never
+ * hears silence between its frames. When the ring has nothing to play (at
+ * startup, or after an underrun), the feeder waits for PRIME_BUFS buffers of
+ * samples before sending any, so the first of them can not run dry while the
+ * game queues the next.
+ */
+
+#include <fp-game/apu.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <noway.h>
+#include <probe.h>
+#include <apu_internal.h>
+
+/** @brief The sample queue. */
+static struct {
+	int8_t *buf;     ///< Ring of samples, or NULL if there is no queue.
+	unsigned size;   ///< Size of buf in samples (a power of two).
+	unsigned head;   ///< Samples ever queued. Written by the producer.
+	unsigned tail;   ///< Samples ever consumed. Written by the consumer.
+
+	/* Counters, written by the consumer only. */
+	unsigned long underruns;
+	unsigned long silence;
+
+	/* When a held buffer must be sent, in ns, used by the consumer. */
+	uint64_t deadline; ///< 0 if none is held, or UINT64_MAX if priming.
+} queue;
+
+/** @brief Buffers of samples queued before feeding a ring with none to play. */
+#define PRIME_BUFS 2
+
+/**
+ * @brief How long before the ring runs dry a short buffer is padded and sent,
+ *        in ns.
+ *
+ * This covers the hold interval, the wakeup of the feeder and the irq latency
+ * in the driver's estimate of when the ring runs dry.
+ */
+#define DRAIN_MARGIN_NS 4000000ULL
+
+/* Helper Functions */
+static void apu_queue_refill(const int8_t **buf, int *buf_size);
+static bool hold_samples(unsigned len);
+static void ring_write(unsigned at, const int8_t *src, unsigned len);
+static void ring_read(unsigned at, int8_t *dst, unsigned len);
+
+int apu_queue_enable(unsigned ms, const apu_feeder_t *attr)
+{
+	unsigned samples, size;
+
+	noway(ms == 0);
+	noway(queue.buf != NULL);
+
+	/* Round up to a power of two of at least one APU buffer. */
+	samples = ms * (APU_SAMPLE_RATE / 1000);
+	for (size = APU_BUF_MAX; size < samples; size <<= 1);
+
+	noway((queue.buf = malloc(size)) == NULL);
+	queue.size = size;
+	queue.head = 0;
+	queue.tail = 0;
+	queue.underruns = 0;
+	queue.silence = 0;
+	queue.deadline = 0;
+
+	if (apu_enable_feeder(apu_queue_refill, attr) != 0) {
+		apu_queue_release();
+		return -1;
+	}
+
+	return 0;
+}
+
+unsigned apu_queue_samples(const int8_t *samples, unsigned len)
+{
+	unsigned head, tail;
+
+	noway(queue.buf == NULL);
+	noway(samples == NULL);
+
+	head = queue.head;
+	tail = __atomic_load_n(&queue.tail, __ATOMIC_ACQUIRE);
+
+	/* Queue as much as fits. */
+	if (len > queue.size - (head - tail)) { len = queue.size - (head - tail); }
+	ring_write(head, samples, len);
+
+	__atomic_store_n(&queue.head, head + len, __ATOMIC_RELEASE);
+	return len;
+}
+
+void apu_queue_stats(apu_queue_stats_t *stats)
+{
+	unsigned head, tail;
+
+	noway(queue.buf == NULL);
+	noway(stats == NULL);
+
+	tail = __atomic_load_n(&queue.tail, __ATOMIC_ACQUIRE);
+	head = __atomic_load_n(&queue.head, __ATOMIC_ACQUIRE);
+
+	stats->fill = head - tail;
+	stats->size = queue.size;
+	stats->underruns = __atomic_load_n(&queue.underruns, __ATOMIC_RELAXED);
+	stats->silence = __atomic_load_n(&queue.silence, __ATOMIC_RELAXED);
+}
+
+void apu_queue_release(void)
+{
+	free(queue.buf);
+	queue.buf = NULL;
+}
+
+/**
+ * @brief Refills the APU from the queue. This is the feeder callback.
+ *
+ * Takes APU_BUF_MAX samples. If fewer are queued, they are held back (by
+ * setting buf to NULL) until more are queued, unless the ring is about to run
+ * dry. Then the rest of the APU buffer is played as silence, and an underrun
+ * is counted. While the driver's ring is being primed, samples are held back
+ * until enough are queued.
+ *
+ * @param buf Set to the samples to send, or NULL to hold them back.
+ * @param buf_size Set to the number of samples to send.
+ */
+static void apu_queue_refill(const int8_t **buf, int *buf_size)
+{
+	static int8_t chunk[APU_BUF_MAX];
+	unsigned head, tail, len;
+
+	tail = queue.tail;
+	head = __atomic_load_n(&queue.head, __ATOMIC_ACQUIRE);
+
+	len = head - tail;
+	if (hold_samples(len)) {
+		*buf = NULL;
+		*buf_size = 0;
+		return;
+	}
+
+	queue.deadline = 0;
+	if (len > APU_BUF_MAX) { len = APU_BUF_MAX; }
+	ring_read(tail, chunk, len);
+
+	__atomic_store_n(&queue.tail, tail + len, __ATOMIC_RELEASE);
+
+	if (len < APU_BUF_MAX) {
+		PROBE1(apu_queue_underrun, len);
+		__atomic_store_n(&queue.underruns, queue.underruns + 1,
+		                 __ATOMIC_RELAXED);
+		__atomic_store_n(&queue.silence,
+		                 queue.silence + (APU_BUF_MAX - len),
+		                 __ATOMIC_RELAXED);
+	}
+
+	*buf = chunk;
+	*buf_size = len;
+}
+
+/**
+ * @brief Checks whether the queued samples must be held back for now.
+ *
+ * When the hold starts, the deadline is set from the driver's estimate of when
+ * its ring runs dry. A short buffer is held until the deadline, less a margin.
+ * If the ring has nothing to play, sending silence would only delay the
+ * samples still to come, so the samples are held until PRIME_BUFS buffers (or
+ * as many as the queue holds) are queued.
+ *
+ * @param len The number of samples queued.
+ * @return True if the samples must be held back.
+ */
+static bool hold_samples(unsigned len)
+{
+	unsigned prime = (queue.size < PRIME_BUFS * APU_BUF_MAX)
+	               ? queue.size : PRIME_BUFS * APU_BUF_MAX;
+	apu_stats_t stats;
+	struct timespec ts;
+	uint64_t now;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+	if (queue.deadline == 0) {
+		apu_get_stats(&stats);
+		queue.deadline = (stats.drain_us == 0) ? UINT64_MAX
+		               : now + stats.drain_us * 1000ULL - DRAIN_MARGIN_NS;
+	}
+
+	if (queue.deadline == UINT64_MAX) { return len < prime; }
+	return (len < APU_BUF_MAX) && (now < queue.deadline);
+}
+
+/**
+ * @brief Copies samples into the ring, wrapping as needed.
+ * @param at Index (before wrapping) of the first sample to write.
+ * @param src The samples to copy.
+ * @param len Number of samples to copy.
+ */
+static void ring_write(unsigned at, const int8_t *src, unsigned len)
+{
+	unsigned start = at & (queue.size - 1);
+	unsigned first = (queue.size - start < len) ? queue.size - start : len;
+
+	memcpy(&queue.buf[start], src, first);
+	memcpy(queue.buf, &src[first], len - first);
+}
+
+/**
+ * @brief Copies samples out of the ring, wrapping as needed.
+ * @param at Index (before wrapping) of the first sample to read.
+ * @param dst Where to copy the samples to.
+ * @param len Number of samples to copy.
+ */
+static void ring_read(unsigned at, int8_t *dst, unsigned len)
+{
+	unsigned start = at & (queue.size - 1);
+	unsigned first = (queue.size - start < len) ? queue.size - start : len;
+
+	memcpy(dst, &queue.buf[start], first);
+	memcpy(&dst[first], queue.buf, len - first);
+}
@@ -0,0 +1,185 @@
+/** @file asset.c
+ * @author Joseph Yankel
+ * @brief Binary asset pack loader implementation
+ */
+
+
+/* ================ */
+/* === Includes === */
+/* ================ */
+#include <fp-game/asset.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <noway.h>
+
+
+/* =================== */
+/* === Definitions === */
+/* =================== */
+/** @brief An open asset pack */
+struct asset_pack {
+    const uint8_t *base;              ///< Start of the mapped pack
+    size_t size;                      ///< Size of the mapping in bytes
+    const asset_pack_entry_t *index;  ///< Index of the pack, inside the mapping
+    uint32_t count;                   ///< Number of index entries
+};
+
+
+/* ========================= */
+/* === Helper Prototypes === */
+/* ========================= */
+static size_t asset_type_size(uint32_t type);
+static const asset_pack_entry_t *asset_find(const asset_pack_t *pack, const char *name,
+                                            asset_type_e type);
+
+
+/* ====================== */
+/* === Asset Pack API === */
+/* ====================== */
+asset_pack_t *asset_open(const char *file)
+{
+    int fd;
+    struct stat st;
+    void *map;
+    asset_pack_t *pack;
+    const asset_pack_header_t *header;
+    const asset_pack_entry_t *entry;
+    uint64_t end;
+    uint32_t i;
+
+    nowaymsg(file == NULL, "Asset pack path is NULL!");
+
+    fd = open(file, O_RDONLY);
+    nowaymsg(fd == -1, strerror(errno));
+    nowaymsg(fstat(fd, &st) == -1, strerror(errno));
+    nowaymsg((size_t)st.st_size < sizeof(asset_pack_header_t), "Asset pack is truncated!");
+
+    // The pack is only ever read, so a private read-only mapping lets the kernel page it in on
+    //   demand (and share the pages with the page cache) instead of copying it into a buffer.
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    nowaymsg(map == MAP_FAILED, strerror(errno));
+    close(fd); // The mapping stays valid after the file is closed
+
+    nowaymsg((pack = malloc(sizeof(asset_pack_t))) == NULL, "Asset pack malloc failed!");
+    pack->base = map;
+    pack->size = st.st_size;
+
+    // Check the header and the full index now so lookups can trust them.
+    header = map;
+    nowaymsg(header->magic != ASSET_PACK_MAGIC, "File is not an asset pack!");
+    nowaymsg(header->version != ASSET_PACK_VERSION, "Unsupported asset pack version!");
+    nowaymsg(header->index_offset % ASSET_PACK_ALIGN != 0, "Asset pack index is misaligned!");
+
+    end = (uint64_t)header->index_offset + (uint64_t)header->count * sizeof(asset_pack_entry_t);
+    nowaymsg(end > pack->size, "Asset pack index is truncated!");
+
+    pack->index = (const asset_pack_entry_t *)(pack->base + header->index_offset);
+    pack->count = header->count;
+
+    for (i = 0; i < pack->count; i++)
+    {
+        entry = &pack->index[i];
+
+        nowaymsg(memchr(entry->name, '\0', ASSET_NAME_MAX) == NULL, "Asset name is malformed!");
+        nowaymsg(asset_type_size(entry->type) == 0, "Asset type is malformed!");
+        nowaymsg(entry->offset % ASSET_PACK_ALIGN != 0, "Asset data is misaligned!");
+        nowaymsg(entry->type == ASSET_PATTERN && entry->count != (uint32_t)entry->width * entry->height,
+                 "Pattern asset size does not match its dimensions!");
+
+        end = (uint64_t)entry->offset + (uint64_t)entry->count * asset_type_size(entry->type);
+        nowaymsg(end > pack->size, "Asset data is truncated!");
+    }
+
+    return pack;
+}
+
+void asset_close(asset_pack_t *pack)
+{
+    nowaymsg(pack == NULL, "Asset pack is NULL!");
+
+    munmap((void *)pack->base, pack->size);
+    free(pack);
+}
+
+const tile_t *asset_tilemap(const asset_pack_t *pack, const char *name, unsigned *len)
+{
+    const asset_pack_entry_t *entry;
+
+    if ((entry = asset_find(pack, name, ASSET_TILEMAP)) == NULL) return NULL;
+
+    if (len != NULL) *len = entry->count;
+    return (const tile_t *)(pack->base + entry->offset);
+}
+
+const pattern_t *asset_patterns(const asset_pack_t *pack, const char *name, unsigned *width,
+                                unsigned *height)
+{
+    const asset_pack_entry_t *entry;
+
+    if ((entry = asset_find(pack, name, ASSET_PATTERN)) == NULL) return NULL;
+
+    if (width != NULL) *width = entry->width;
+    if (height != NULL) *height = entry->height;
+    return (const pattern_t *)(pack->base + entry->offset);
+}
+
+const palette_t *asset_palette(const asset_pack_t *pack, const char *name)
+{
+    const asset_pack_entry_t *entry;
+
+    if ((entry = asset_find(pack, name, ASSET_PALETTE)) == NULL) return NULL;
+
+    return (const palette_t *)(pack->base + entry->offset);
+}
+
+
+/* ======================== */
+/* === Helper Functions === */
+/* ======================== */
+/** @brief Returns the size of a single element of an asset type, or 0 if the type is unknown.
+ * @param type The asset_type_e to get the element size of.
+ */
+static size_t asset_type_size(uint32_t type)
+{
+    switch (type)
+    {
+        case ASSET_TILEMAP: return sizeof(tile_t);
+        case ASSET_PATTERN: return sizeof(pattern_t);
+        case ASSET_PALETTE: return sizeof(palette_t);
+        default: return 0;
+    }
+}
+
+/** @brief Finds the index entry of an asset by name and type.
+ * @param pack The pack to search.
+ * @param name Name of the asset.
+ * @param type Type of the asset.
+ * @return The entry; NULL if not found
+ */
+static const asset_pack_entry_t *asset_find(const asset_pack_t *pack, const char *name,
+                                            asset_type_e type)
+{
+    uint32_t i;
+
+    nowaymsg(pack == NULL, "Asset pack is NULL!");
+    nowaymsg(name == NULL, "Asset name is NULL!");
+
+    // Packs hold tens of assets at most, and lookups happen at load time, so a linear scan is fine.
+    for (i = 0; i < pack->count; i++)
+    {
+        if (pack->index[i].type == (uint32_t)type
+            && strncmp(pack->index[i].name, name, ASSET_NAME_MAX) == 0)
+        {
+            return &pack->index[i];
+        }
+    }
+
+    return NULL;
+}
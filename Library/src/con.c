@@ -2,6 +2,10 @@
  * @file con.c
  * @author Andrew Spaulding
  * @brief Implementation of the user controller driver interface.
+ *
+ * The controller state is read from the driver's state page, which is mapped
+ * when the device file is opened, so reading it takes no system call. If the
+ * page can't be mapped, the state is read with an ioctl instead.
  */
 
 #include <fp-game/con.h>
@@ -10,55 +14,159 @@
 #include <fp-game/drv_con.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <errno.h>
 
 #include <noway.h>
+#include <probe.h>
+
+/** @brief The number of events read from the driver at a time. */
+#define EVENT_BATCH 32
 
 /**
  * @brief The device file descriptor.
  *
- * Upon the first call to get_con_state, the function will attempt
+ * Upon the first call to a controller function, the function will attempt
  * to open the device file and store its fd here. The fd will be
  * closed by a function registered to atexit().
  *
- * Note that if close() fails or the program terminates abnormally
- * after atexit() succedes the fd may not be correctly closed. There
- * is little we can do about this, so we assume the kernel will deal
- * with it and move on with our lives.
+ * Note that if close() fails, atexit() fails, or the program terminates
+ * abnormally, the fd may not be correctly closed. There is little we can
+ * do about this, so we assume the kernel will deal with it and move on
+ * with our lives.
  */
 static int dev_file_fd = -1;
 
+/** @brief The driver's state page, or MAP_FAILED if it isn't mapped. */
+static const struct con_shared *shared = MAP_FAILED;
+
+/** @brief Ensures the device file is opened once, by whichever thread is first. */
+static pthread_once_t con_once = PTHREAD_ONCE_INIT;
+
 /* Helper functions */
+static void con_open(void);
+static int read_shared(uint64_t *time);
 void con_cleanup(void);
 
 int get_con_state(void)
 {
 	/* Open the device file, if it isn't already. */
-	bool close_fd = false;
-	if (dev_file_fd < 0) {
-		// FIXME: See apu.c (change to return -1?)
-		noway((dev_file_fd = open(CON_DEV_FILE, 0)) < 0);
-		if (dev_file_fd < 0) { return -1; }
-		close_fd = (atexit(con_cleanup) < 0);
-	}
+	pthread_once(&con_once, con_open);
+
+	if (shared != MAP_FAILED) { return read_shared(NULL); }
 
 	/* Ask the controller driver for the current state. */
-	int ret = ioctl(dev_file_fd, IOCTL_CON_GET_STATE);
+	return ioctl(dev_file_fd, IOCTL_CON_GET_STATE);
+}
+
+int get_con_state_time(uint64_t *time)
+{
+	noway(time == NULL);
 
-	/* If atexit failed, we have to cleanup. */
-	if (close_fd) { con_cleanup(); }
+	pthread_once(&con_once, con_open);
+	if (shared == MAP_FAILED) { return -1; }
 
-	return ret;
+	return read_shared(time);
+}
+
+int con_set_rate(unsigned rate)
+{
+	noway((rate < CON_RATE_MIN) || (rate > CON_RATE_MAX));
+
+	pthread_once(&con_once, con_open);
+	return (ioctl(dev_file_fd, IOCTL_CON_SET_RATE, rate) < 0) ? -1 : 0;
+}
+
+int con_get_events(con_event_t *events, int max)
+{
+	struct con_event kevents[EVENT_BATCH];
+	int count = 0;
+
+	noway((events == NULL) && (max > 0));
+	noway(max < 0);
+
+	pthread_once(&con_once, con_open);
+
+	while (count < max) {
+		int want = (max - count < EVENT_BATCH) ? max - count : EVENT_BATCH;
+		ssize_t len = read(dev_file_fd, kevents, want * sizeof(struct con_event));
+
+		if (len < 0) {
+			if (errno == EINTR) { continue; }
+			if (errno != EAGAIN) { count = -1; }
+			break;
+		}
+
+		for (size_t i = 0; i < len / sizeof(struct con_event); i++) {
+			con_event_t *e = &events[count++];
+
+			e->time = kevents[i].time;
+			e->state = kevents[i].state;
+			e->pressed = kevents[i].changed & ~kevents[i].state;
+			e->released = kevents[i].changed & kevents[i].state;
+		}
+		if (len / sizeof(struct con_event) < (size_t)want) { break; }
+	}
+	PROBE1(con_events, count);
+
+	return count;
+}
+
+/**
+ * @brief Opens the device file, and maps its state page.
+ *
+ * The file is non-blocking, so reading events never waits. Run once, through
+ * con_once.
+ */
+static void con_open(void)
+{
+	// FIXME: See apu.c (change to return -1?)
+	noway((dev_file_fd = open(CON_DEV_FILE, O_RDONLY | O_NONBLOCK)) < 0);
+
+	shared = mmap(NULL, CON_MMAP_SIZE, PROT_READ, MAP_SHARED, dev_file_fd, 0);
+	atexit(con_cleanup);
 }
 
 /**
- * @brief Closes the device file descriptor.
+ * @brief Reads the latest sample from the state page.
+ *
+ * Retries until it reads a sample the driver was not updating at the time.
+ *
+ * @param time If not NULL, set to the time of the sample.
+ * @return The controller state of the sample.
+ */
+static int read_shared(uint64_t *time)
+{
+	uint32_t seq;
+	uint64_t t;
+	int state;
+
+	do {
+		seq = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+		state = __atomic_load_n(&shared->state, __ATOMIC_RELAXED);
+		t = shared->time;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || (__atomic_load_n(&shared->seq, __ATOMIC_RELAXED) != seq));
+
+	if (time != NULL) { *time = t; }
+	return state;
+}
+
+/**
+ * @brief Unmaps the state page and closes the device file descriptor.
  */
 void con_cleanup(void)
 {
 	noway(dev_file_fd < 0);
+	if (shared != MAP_FAILED) {
+		munmap((void *)shared, CON_MMAP_SIZE);
+		shared = MAP_FAILED;
+	}
 	close(dev_file_fd);
 	dev_file_fd = -1;
 }
@@ -0,0 +1,173 @@
+/** @file encode.c
+ * @author Joseph Yankel
+ * @brief Bulk encoders for PPU tile, pattern and sprite data
+ *
+ * Each encoder has a NEON implementation, used when the library is built for a NEON-capable ARM
+ *   target (see config.mk), and a portable scalar implementation which produces identical output.
+ *
+ * Rather than checking every element as it is encoded, the encoders track the largest value seen
+ *   for each field and check those once at the end. Invalid input still exits the program, but the
+ *   checks no longer stand in the way of vectorizing the encoding itself.
+ */
+
+
+/* ================ */
+/* === Includes === */
+/* ================ */
+#include <fp-game/ppu.h>
+
+#include <stdint.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include <noway.h>
+#include <ppu_internal.h>
+
+
+/* ========================= */
+/* === Helper Prototypes === */
+/* ========================= */
+static uint32_t encode_pattern_row(uint32_t row);
+
+#ifdef __ARM_NEON
+static uint16_t max_u16x8(uint16x8_t v);
+#endif
+
+
+/* =========================== */
+/* === PPU Data Generators === */
+/* =========================== */
+void ppu_make_tiles(tile_t *tiles, const uint16_t *pattern_addrs, const uint8_t *palette_ids,
+                    const uint8_t *mirrors, unsigned len)
+{
+    unsigned i = 0;
+    unsigned max_pattern_addr = 0;
+    unsigned max_palette_id = 0;
+    unsigned max_mirror = 0;
+
+    nowaymsg(tiles == NULL, "Tile array is NULL!");
+    nowaymsg(pattern_addrs == NULL, "Pattern address array is NULL!");
+    nowaymsg(palette_ids == NULL, "Palette ID array is NULL!");
+    nowaymsg(mirrors == NULL, "Mirror array is NULL!");
+
+#ifdef __ARM_NEON
+    uint16x8_t vmax_pattern_addr = vdupq_n_u16(0);
+    uint16x8_t vmax_palette_id = vdupq_n_u16(0);
+    uint16x8_t vmax_mirror = vdupq_n_u16(0);
+
+    // 8 tiles at a time: widen the 8-bit fields to 16 bits, then shift and OR into place.
+    for (; i + 8 <= len; i += 8)
+    {
+        uint16x8_t pattern_addr = vld1q_u16(&pattern_addrs[i]);
+        uint16x8_t palette_id = vmovl_u8(vld1_u8(&palette_ids[i]));
+        uint16x8_t mirror = vmovl_u8(vld1_u8(&mirrors[i]));
+
+        vmax_pattern_addr = vmaxq_u16(vmax_pattern_addr, pattern_addr);
+        vmax_palette_id = vmaxq_u16(vmax_palette_id, palette_id);
+        vmax_mirror = vmaxq_u16(vmax_mirror, mirror);
+
+        vst1q_u16(&tiles[i], vorrq_u16(vorrq_u16(vshlq_n_u16(pattern_addr, 6),
+                                                 vshlq_n_u16(palette_id, 2)), mirror));
+    }
+
+    max_pattern_addr = max_u16x8(vmax_pattern_addr);
+    max_palette_id = max_u16x8(vmax_palette_id);
+    max_mirror = max_u16x8(vmax_mirror);
+#endif
+
+    // Scalar fallback, and the remainder of the NEON loop.
+    for (; i < len; i++)
+    {
+        max_pattern_addr = (pattern_addrs[i] > max_pattern_addr) ? pattern_addrs[i]
+                                                                 : max_pattern_addr;
+        max_palette_id = (palette_ids[i] > max_palette_id) ? palette_ids[i] : max_palette_id;
+        max_mirror = (mirrors[i] > max_mirror) ? mirrors[i] : max_mirror;
+
+        tiles[i] = (pattern_addrs[i] << 6) | (palette_ids[i] << 2) | mirrors[i];
+    }
+
+    nowaymsg(max_pattern_addr > PATTERN_MAXADDR, "Pattern address malformed!");
+    nowaymsg(max_palette_id >= TILELAYER_MAX_PALETTES, "Palette ID out of range!");
+    nowaymsg(max_mirror > MIRROR_MAXVAL, "Mirror argument malformed!");
+}
+
+void ppu_encode_patterns(pattern_t *patterns, const uint32_t *rows, unsigned count)
+{
+    unsigned i = 0;
+
+    nowaymsg(patterns == NULL, "Pattern array is NULL!");
+    nowaymsg(rows == NULL, "Pattern row array is NULL!");
+
+#ifdef __ARM_NEON
+    // One pattern (8 rows, 32B) at a time. Reversing the nibbles of a row is a byte reversal of
+    //   each 32-bit word followed by a nibble swap within each byte.
+    for (; i < count; i++)
+    {
+        uint8x16_t lo = vrev32q_u8(vld1q_u8((const uint8_t *)&rows[i * TILEPATTERN_HEIGHT]));
+        uint8x16_t hi = vrev32q_u8(vld1q_u8((const uint8_t *)&rows[i * TILEPATTERN_HEIGHT + 4]));
+
+        lo = vsliq_n_u8(vshrq_n_u8(lo, 4), lo, 4);
+        hi = vsliq_n_u8(vshrq_n_u8(hi, 4), hi, 4);
+
+        vst1q_u8((uint8_t *)&patterns[i].pxrow[0], lo);
+        vst1q_u8((uint8_t *)&patterns[i].pxrow[4], hi);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        for (unsigned row = 0; row < TILEPATTERN_HEIGHT; row++)
+        {
+            patterns[i].pxrow[row] = encode_pattern_row(rows[i * TILEPATTERN_HEIGHT + row]);
+        }
+    }
+}
+
+void ppu_pack_sprites(uint32_t *sprite_data, uint8_t *sprite_extra, const sprite_t *sprites,
+                      unsigned len)
+{
+    unsigned i;
+
+    nowaymsg(sprite_data == NULL, "Sprite data array is NULL!");
+    nowaymsg(sprite_extra == NULL, "Sprite extra data array is NULL!");
+    nowaymsg(sprites == NULL, "Sprite Array is NULL!");
+
+    // sprite_t is an array of mixed-width structs and Sprite RAM holds at most 64 sprites, so
+    //   there is nothing for NEON to gain here; this loop is the same on every target.
+    for (i = 0; i < len; i++)
+    {
+        ppu_check_sprite(&sprites[i]);
+
+        sprite_data[i] = (sprites[i].pattern_addr << 22) | (sprites[i].palette_id << 17) |
+                         (sprites[i].y << 9) | sprites[i].x;
+        sprite_extra[i] = (sprites[i].mirror << 6) | ((sprites[i].height - 1) << 4) |
+                          ((sprites[i].width - 1) << 2) | sprites[i].prio;
+    }
+}
+
+
+/* ======================== */
+/* === Helper Functions === */
+/* ======================== */
+/** @brief Converts a pattern row from text order (first pixel in the most significant nibble) to
+ *         PPU order (first pixel in the least significant nibble).
+ * @param row The row to convert.
+ */
+static uint32_t encode_pattern_row(uint32_t row)
+{
+    row = __builtin_bswap32(row);
+    return ((row & 0x0F0F0F0F) << 4) | ((row >> 4) & 0x0F0F0F0F);
+}
+
+#ifdef __ARM_NEON
+/** @brief Returns the largest of the 8 lanes of @p v. */
+static uint16_t max_u16x8(uint16x8_t v)
+{
+    uint16x4_t m = vpmax_u16(vget_low_u16(v), vget_high_u16(v));
+    m = vpmax_u16(m, m);
+    m = vpmax_u16(m, m);
+    return vget_lane_u16(m, 0);
+}
+#endif
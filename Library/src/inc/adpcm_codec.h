@@ -0,0 +1,63 @@
+/**
+ * @file adpcm_codec.h
+ * @author Andrew Spaulding
+ * @brief The IMA-ADPCM decoding step, shared by the library and fpgame-adpcm.
+ *
+ * The encoder in fpgame-adpcm runs this same step on every nibble it writes,
+ * so its state always matches the decoder's exactly.
+ */
+
+#ifndef _ADPCM_CODEC_H_
+#define _ADPCM_CODEC_H_
+
+#include <stdint.h>
+
+/** @brief The largest IMA-ADPCM step index. */
+#define ADPCM_MAX_INDEX 88
+
+/** @brief The IMA-ADPCM quantizer step sizes. */
+static const int16_t adpcm_steps[ADPCM_MAX_INDEX + 1] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37,
+	41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173,
+	190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+	724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+	7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500,
+	20350, 22385, 24623, 27086, 29794, 32767
+};
+
+/** @brief How each nibble moves the step index. */
+static const int8_t adpcm_index_moves[16] = {
+	-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+/**
+ * @brief Decodes one nibble, updating the decoder state.
+ * @param predictor The last decoded sample, updated to the new one.
+ * @param index The step index, updated for the next nibble.
+ * @param nibble The nibble to decode.
+ * @return The decoded sample.
+ */
+static inline int16_t adpcm_step(int16_t *predictor, uint8_t *index, unsigned nibble)
+{
+	int step = adpcm_steps[*index];
+	int diff = step >> 3;
+	int sample;
+	int next;
+
+	if (nibble & 1) { diff += step >> 2; }
+	if (nibble & 2) { diff += step >> 1; }
+	if (nibble & 4) { diff += step; }
+	if (nibble & 8) { diff = -diff; }
+
+	sample = *predictor + diff;
+	sample = (sample > INT16_MAX) ? INT16_MAX : (sample < INT16_MIN) ? INT16_MIN : sample;
+	*predictor = sample;
+
+	next = *index + adpcm_index_moves[nibble];
+	*index = (next < 0) ? 0 : (next > ADPCM_MAX_INDEX) ? ADPCM_MAX_INDEX : next;
+
+	return sample;
+}
+
+#endif /* _ADPCM_CODEC_H_ */
@@ -0,0 +1,28 @@
+/**
+ * @file apu_internal.h
+ * @author Andrew Spaulding
+ * @brief Definitions shared between the parts of the APU library.
+ */
+
+#ifndef _APU_INTERNAL_H_
+#define _APU_INTERNAL_H_
+
+/**
+ * @brief Frees the sample queue, if apu_queue_enable() created one.
+ *
+ * Called by apu_disable() once the feeder thread has stopped.
+ */
+void apu_queue_release(void);
+
+/**
+ * @brief How long the feeder waits, in ms, before calling a callback which
+ *        held its samples back again.
+ *
+ * A callback holds its samples back by setting *buf to NULL. The feeder then
+ * writes nothing, and calls it again after this long, even though the APU is
+ * still asking for samples. Only the sample queue's callback does this, while
+ * it waits for a full APU buffer of samples.
+ */
+#define APU_HOLD_MS 1
+
+#endif /* _APU_INTERNAL_H_ */
@@ -0,0 +1,35 @@
+/**
+ * @file ppu_internal.h
+ * @brief Definitions and helpers shared between the parts of the PPU library.
+ * @author Joseph Yankel
+ */
+
+#ifndef _PPU_INTERNAL_H_
+#define _PPU_INTERNAL_H_
+
+#include <fp-game/ppu.h>
+#include <fp-game/drv_ppu.h>
+
+/* ================== */
+/* === Anti-Magic === */
+/* ================== */
+#define PATTERN_MAXADDR 1023      ///< Maximum pattern_addr_t value
+#define MIRROR_MAXVAL 3           ///< Maximum allowable value for mirror_e
+#define SPRITE_MAXCOUNT 64        ///< Maximum supported sprites
+#define SPRITE_BSIZE 4            ///< Size of sprite data in bytes
+#define SPRITE_MAX_PRIO 2         ///< Maximum sprite priority (maximum render_prio_e value)
+#define SPRITE_MAXX 511           ///< Maximum allowable x position for a sprite.
+#define SPRITE_MAXY 255           ///< Maximum allowable y position for a sprite
+#define SPRITE_MAXWIDTH 4         ///< Maximum allowable width (in tiles) for multi-pattern sprites
+#define SPRITE_MAXHEIGHT 4        ///< Maximum allowable height (in tiles) for multi-pattern sprites
+
+/* For internal use only. */
+void ppu_make_seg(struct ppu_write_seg *seg, unsigned offset, unsigned len, const void *buf);
+
+int ppu_write_segs(const struct ppu_write_seg *segs, unsigned count);
+
+void ppu_check_sprite(const sprite_t *sprite);
+
+void ppu_sprite_reset(void);
+
+#endif /* _PPU_INTERNAL_H_ */
@@ -0,0 +1,35 @@
+/**
+ * @file probe.h
+ * @brief Static user-space probes (USDT) for tracing the library.
+ * @author Andrew Spaulding
+ *
+ * When the library is built with FPGAME_PROBES defined (see config.mk), each
+ * probe is a systemtap-style SDT note under the "fpgame" provider, which costs
+ * a single nop until perf, bpftrace or trace-cmd attaches to it. This lets the
+ * library's frame pipeline be recorded on the same timeline as the drivers'
+ * tracepoints. See docs/tracing.md for the probes and their arguments.
+ *
+ * Building with probes needs <sys/sdt.h> (from systemtap's SDT headers) in the
+ * SDK. Otherwise, the probes compile to nothing.
+ */
+
+#ifndef _PROBE_H_
+#define _PROBE_H_
+
+#ifdef FPGAME_PROBES
+
+#include <sys/sdt.h>
+
+#define PROBE(name) DTRACE_PROBE(fpgame, name)
+#define PROBE1(name, a) DTRACE_PROBE1(fpgame, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(fpgame, name, a, b)
+
+#else
+
+#define PROBE(name) do { } while (0)
+#define PROBE1(name, a) do { (void)(a); } while (0)
+#define PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+
+#endif /* FPGAME_PROBES */
+
+#endif /* _PROBE_H_ */
@@ -0,0 +1,289 @@
+/**
+ * @file input.c
+ * @author Andrew Spaulding
+ * @brief Input module implementation.
+ *
+ * Each frame is reduced to a sample of two masks, the buttons down and the
+ * buttons tapped (pressed and released again) since the last frame, and the
+ * input_t is derived from the sample and the input_t of the last frame alone.
+ * Recordings store the samples, so replaying them derives the same input_t.
+ *
+ * The edges and hold counters are computed with mask arithmetic, with no
+ * branches on the buttons.
+ */
+
+#include <fp-game/input.h>
+#include <fp-game/con.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <noway.h>
+#include <probe.h>
+
+/** @brief The bits of the controller state which hold buttons. */
+#define BUTTONS (CON_BUT_B | CON_BUT_Y | CON_BUT_SELECT | CON_BUT_START \
+                 | CON_BUT_UP | CON_BUT_DOWN | CON_BUT_LEFT | CON_BUT_RIGHT \
+                 | CON_BUT_A | CON_BUT_X | CON_BUT_L | CON_BUT_R)
+
+/** @brief The number of controller events taken from the driver at a time. */
+#define EVENT_BATCH 16
+
+/**
+ * @brief The controller events taken from the driver, of which those from
+ *        event_next on came after the last sample, and are left for the next.
+ */
+static con_event_t events[EVENT_BATCH];
+static int event_count = 0;
+static int event_next = 0;
+
+/** @brief The input of the last frame. */
+static input_t input;
+
+/** @brief The number of frames since input was reset. */
+static uint32_t frame_count;
+
+/** @brief The recording in progress, or NULL. */
+static FILE *record_file = NULL;
+
+/** @brief The run being recorded. Not yet written while frames is non-zero. */
+static input_run_t record_run;
+
+/** @brief The replay in progress, or NULL. */
+static FILE *replay_file = NULL;
+
+/** @brief The current run of the replay, with frames set to those left (at least 1). */
+static input_run_t replay_run;
+
+/** @brief Whether the replay in progress has run out of frames. */
+static bool replay_done;
+
+/* Helper Functions */
+static void sample(uint16_t *down, uint16_t *taps);
+static void replay_next(uint16_t *down, uint16_t *taps);
+static void replay_fetch(void);
+static void record_next(uint16_t down, uint16_t taps);
+static void record_flush(void);
+static void advance(uint16_t down, uint16_t taps);
+static void reset(void);
+
+const input_t *input_update(void)
+{
+	uint16_t down, taps;
+
+	if (replay_file != NULL) {
+		replay_next(&down, &taps);
+	} else {
+		sample(&down, &taps);
+	}
+
+	if (record_file != NULL) { record_next(down, taps); }
+
+	advance(down, taps);
+	PROBE2(input_frame, input.frame, input.down);
+	return &input;
+}
+
+int input_record(const char *file)
+{
+	const input_header_t header = { .magic = INPUT_MAGIC, .version = INPUT_VERSION };
+
+	noway(file == NULL);
+
+	input_stop();
+	if ((record_file = fopen(file, "wb")) == NULL) { return -1; }
+
+	nowaymsg(fwrite(&header, sizeof(header), 1, record_file) != 1,
+	         "Input recording write failed!");
+	record_run.frames = 0;
+
+	reset();
+	return 0;
+}
+
+int input_replay(const char *file)
+{
+	input_header_t header;
+
+	noway(file == NULL);
+
+	input_stop();
+	if ((replay_file = fopen(file, "rb")) == NULL) { return -1; }
+
+	nowaymsg((fread(&header, sizeof(header), 1, replay_file) != 1)
+	         || (header.magic != INPUT_MAGIC) || (header.version != INPUT_VERSION),
+	         "Malformed input replay!");
+	replay_done = false;
+	replay_fetch();
+
+	reset();
+	return 0;
+}
+
+bool input_replaying(void)
+{
+	return (replay_file != NULL) && !replay_done;
+}
+
+void input_stop(void)
+{
+	if (record_file != NULL) {
+		record_flush();
+		nowaymsg(fclose(record_file) != 0, "Input recording write failed!");
+		record_file = NULL;
+	}
+
+	if (replay_file != NULL) {
+		fclose(replay_file);
+		replay_file = NULL;
+	}
+}
+
+/**
+ * @brief Samples the controller.
+ *
+ * The controller events since the last sample are drained, to find the
+ * buttons which were pressed and released again in between.
+ *
+ * The state is read first, and only the events up to the time it was sampled
+ * are counted; later ones are kept for the next sample. So a press which
+ * comes in between is counted once, as down now or as an event next time,
+ * instead of as both. The driver queues the events of a sample before it
+ * publishes the sample, so those up to its time are all there to be taken.
+ *
+ * @param down Set to the buttons which are pressed.
+ * @param taps Set to the buttons which were pressed since the last sample,
+ *             but are no longer.
+ */
+static void sample(uint16_t *down, uint16_t *taps)
+{
+	bool drained = false;
+	uint64_t time;
+	int state;
+	int pressed = 0;
+
+	/* Without the state page there is no time, so every event counts. */
+	if ((state = get_con_state_time(&time)) < 0) {
+		state = get_con_state();
+		time = UINT64_MAX;
+	}
+
+	for (;;) {
+		if (event_next == event_count) {
+			if (drained) { break; }
+			event_count = con_get_events(events, EVENT_BATCH);
+			if (event_count < 0) { event_count = 0; }
+			event_next = 0;
+			drained = (event_count < EVENT_BATCH);
+			continue;
+		}
+
+		if (events[event_next].time > time) { break; }
+		pressed |= events[event_next++].pressed;
+	}
+
+	*down = (state < 0) ? 0 : (~state & BUTTONS);
+	*taps = pressed & ~*down & BUTTONS;
+}
+
+/**
+ * @brief Reads the next frame of the replay.
+ *
+ * Once the replay runs out, every frame has no buttons pressed.
+ *
+ * @param down Set to the buttons which are pressed.
+ * @param taps Set to the buttons which were tapped since the last frame.
+ */
+static void replay_next(uint16_t *down, uint16_t *taps)
+{
+	if (replay_done) {
+		*down = 0;
+		*taps = 0;
+		return;
+	}
+
+	*down = replay_run.down & BUTTONS;
+	*taps = replay_run.taps & BUTTONS;
+	if (--replay_run.frames == 0) { replay_fetch(); }
+}
+
+/**
+ * @brief Reads the next run of the replay, or marks the replay as done if
+ *        there are none left.
+ */
+static void replay_fetch(void)
+{
+	if (fread(&replay_run, sizeof(replay_run), 1, replay_file) != 1) {
+		nowaymsg(ferror(replay_file), "Input replay read failed!");
+		replay_done = true;
+		return;
+	}
+
+	nowaymsg(replay_run.frames == 0, "Malformed input replay!");
+}
+
+/**
+ * @brief Adds a frame to the recording, extending the current run if the
+ *        frame has the same sample.
+ * @param down The buttons which are pressed.
+ * @param taps The buttons which were tapped since the last frame.
+ */
+static void record_next(uint16_t down, uint16_t taps)
+{
+	if ((record_run.frames > 0) && (record_run.frames < UINT16_MAX)
+	    && (record_run.down == down) && (record_run.taps == taps)) {
+		record_run.frames++;
+		return;
+	}
+
+	record_flush();
+	record_run.down = down;
+	record_run.taps = taps;
+	record_run.frames = 1;
+}
+
+/**
+ * @brief Writes the current run of the recording, if it has any frames.
+ */
+static void record_flush(void)
+{
+	if (record_run.frames == 0) { return; }
+
+	nowaymsg(fwrite(&record_run, sizeof(record_run), 1, record_file) != 1,
+	         "Input recording write failed!");
+	record_run.frames = 0;
+}
+
+/**
+ * @brief Derives the input of the next frame from its sample.
+ * @param down The buttons which are pressed.
+ * @param taps The buttons which were tapped since the last frame.
+ */
+static void advance(uint16_t down, uint16_t taps)
+{
+	const uint16_t last = input.down;
+
+	input.frame = frame_count++;
+	input.down = down;
+	input.pressed = (down & ~last) | taps;
+	input.released = (last & ~down) | taps;
+	input.held = down & last;
+
+	/* Count up the buttons which are down, and zero the rest. */
+	for (int i = 0; i < INPUT_BITS; i++) {
+		uint32_t mask = -(uint32_t)((down >> i) & 1);
+
+		input.hold[i] = (input.hold[i] + 1) & mask;
+	}
+}
+
+/**
+ * @brief Resets the input, as if no buttons had been pressed before.
+ */
+static void reset(void)
+{
+	memset(&input, 0, sizeof(input));
+	frame_count = 0;
+}
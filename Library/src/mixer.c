@@ -0,0 +1,342 @@
+/**
+ * @file mixer.c
+ * @author Andrew Spaulding
+ * @brief Software mixer implementation.
+ *
+ * Each block is mixed in two steps per voice. First, the voice's samples are
+ * gathered into a block of int16 samples, stepping through the sound by the
+ * voice's pitch and mixing stereo down to mono. This step is scalar, since the
+ * pitch makes the reads irregular. Second, the block is scaled by the voice's
+ * gain and added to an int32 accumulator. Once every voice is mixed, the
+ * accumulator is narrowed to int8 with saturation.
+ *
+ * The second and last steps have NEON implementations (a widening multiply
+ * accumulate, and a pair of saturating narrowing shifts), used when the library
+ * is built for a NEON-capable ARM target. The scalar fallbacks produce identical
+ * output.
+ *
+ * Samples are handled as Q15 (int8 samples are shifted up by 8), and gains are
+ * Q8, so a voice at full volume contributes at most 2^23 to the accumulator and
+ * all MIXER_VOICES voices together can never overflow it.
+ */
+
+#include <fp-game/mixer.h>
+#include <fp-game/apu.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include <noway.h>
+
+/** @brief The number of bits of a handle used for the voice index. */
+#define VOICE_BITS 4
+
+_Static_assert((1 << VOICE_BITS) >= MIXER_VOICES, "VOICE_BITS is too small");
+
+/** @brief Mixer voice state. */
+struct voice {
+	mixer_voice_t id;      ///< Handle of the voice, or -1 if the voice is free.
+	mixer_sound_t sound;   ///< The sound being played.
+	mixer_params_t params; ///< The playback settings.
+	uint64_t pos;          ///< Position in the sound, in frames (16.16 fixed point).
+	unsigned long started; ///< Value of play_count when the voice was started.
+};
+
+/** @brief Protects all mixer state; held while mixing. */
+static pthread_mutex_t mixer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief The voices. All free until initialized. */
+static struct voice voices[MIXER_VOICES] = {
+	[0 ... MIXER_VOICES - 1] = { .id = -1 },
+};
+
+/** @brief The master volume. */
+static unsigned master = MIXER_VOLUME_MAX;
+
+/** @brief The number of sounds ever played, used to make handles unique. */
+static unsigned long play_count;
+
+/* Helper Functions */
+static struct voice *find_voice(mixer_voice_t voice);
+static void check_params(const mixer_params_t *params);
+static unsigned gather(struct voice *v, int16_t *block, unsigned len);
+static void accumulate(int32_t *acc, const int16_t *block, unsigned len,
+                       int16_t gain);
+static void narrow(int8_t *out, const int32_t *acc, unsigned len);
+
+void mixer_init(void)
+{
+	pthread_mutex_lock(&mixer_lock);
+
+	for (int i = 0; i < MIXER_VOICES; i++) { voices[i].id = -1; }
+	master = MIXER_VOLUME_MAX;
+
+	pthread_mutex_unlock(&mixer_lock);
+}
+
+mixer_voice_t mixer_play(const mixer_sound_t *sound, const mixer_params_t *params)
+{
+	struct voice *v = NULL;
+	mixer_voice_t id;
+
+	noway(sound == NULL);
+	noway(sound->samples == NULL);
+	noway((sound->format != MIXER_PCM8) && (sound->format != MIXER_PCM16));
+	noway((sound->channels != 1) && (sound->channels != 2));
+	noway(sound->length == 0);
+	noway(sound->loop && (sound->loop_start >= sound->length));
+	check_params(params);
+
+	pthread_mutex_lock(&mixer_lock);
+
+	/*
+	 * Take a free voice if there is one. Otherwise, steal the lowest
+	 * priority voice, picking the oldest of those.
+	 */
+	for (int i = 0; i < MIXER_VOICES; i++) {
+		struct voice *c = &voices[i];
+
+		if (c->id == -1) {
+			v = c;
+			break;
+		}
+		if ((v == NULL) || (c->params.priority < v->params.priority)
+		    || ((c->params.priority == v->params.priority)
+		        && (c->started < v->started))) {
+			v = c;
+		}
+	}
+
+	if ((v->id != -1) && (v->params.priority > params->priority)) {
+		pthread_mutex_unlock(&mixer_lock);
+		return -1;
+	}
+
+	/* Handles are never negative, and are unique until play_count wraps. */
+	play_count++;
+	id = (mixer_voice_t)(((play_count << VOICE_BITS) | (v - voices))
+	                     & INT32_MAX);
+
+	v->id = id;
+	v->sound = *sound;
+	v->params = *params;
+	v->pos = 0;
+	v->started = play_count;
+
+	pthread_mutex_unlock(&mixer_lock);
+	return id;
+}
+
+void mixer_set(mixer_voice_t voice, const mixer_params_t *params)
+{
+	struct voice *v;
+
+	check_params(params);
+
+	pthread_mutex_lock(&mixer_lock);
+	if ((v = find_voice(voice)) != NULL) { v->params = *params; }
+	pthread_mutex_unlock(&mixer_lock);
+}
+
+void mixer_stop(mixer_voice_t voice)
+{
+	struct voice *v;
+
+	pthread_mutex_lock(&mixer_lock);
+	if ((v = find_voice(voice)) != NULL) { v->id = -1; }
+	pthread_mutex_unlock(&mixer_lock);
+}
+
+bool mixer_playing(mixer_voice_t voice)
+{
+	bool playing;
+
+	pthread_mutex_lock(&mixer_lock);
+	playing = (find_voice(voice) != NULL);
+	pthread_mutex_unlock(&mixer_lock);
+
+	return playing;
+}
+
+void mixer_set_master(unsigned volume)
+{
+	noway(volume > MIXER_VOLUME_MAX);
+
+	pthread_mutex_lock(&mixer_lock);
+	master = volume;
+	pthread_mutex_unlock(&mixer_lock);
+}
+
+void mixer_render(int8_t *out, unsigned len)
+{
+	int32_t acc[APU_BUF_MAX] = { 0 };
+	int16_t block[APU_BUF_MAX];
+
+	noway(out == NULL);
+	noway(len > APU_BUF_MAX);
+
+	pthread_mutex_lock(&mixer_lock);
+
+	for (int i = 0; i < MIXER_VOICES; i++) {
+		struct voice *v = &voices[i];
+		int16_t gain;
+		unsigned n;
+
+		if (v->id == -1) { continue; }
+
+		gain = (v->params.volume * master) / MIXER_VOLUME_MAX;
+		n = gather(v, block, len);
+		if (gain != 0) { accumulate(acc, block, n, gain); }
+	}
+
+	pthread_mutex_unlock(&mixer_lock);
+
+	narrow(out, acc, len);
+}
+
+void mixer_callback(const int8_t **buf, int *buf_size)
+{
+	static int8_t samples[APU_BUF_MAX];
+
+	mixer_render(samples, APU_BUF_MAX);
+
+	*buf = samples;
+	*buf_size = APU_BUF_MAX;
+}
+
+/**
+ * @brief Finds the voice a handle refers to.
+ * @param voice The handle.
+ * @return The voice, or NULL if the handle's sound is no longer playing.
+ */
+static struct voice *find_voice(mixer_voice_t voice)
+{
+	struct voice *v;
+
+	if (voice < 0) { return NULL; }
+
+	v = &voices[voice & ((1 << VOICE_BITS) - 1)];
+	return (v->id == voice) ? v : NULL;
+}
+
+/**
+ * @brief Checks that voice playback settings are valid.
+ * @param params The settings to check.
+ */
+static void check_params(const mixer_params_t *params)
+{
+	noway(params == NULL);
+	noway(params->volume > MIXER_VOLUME_MAX);
+	noway((params->pan < -128) || (params->pan > 128));
+}
+
+/**
+ * @brief Reads the next samples of a voice as mono Q15 samples, advancing it.
+ *
+ * Frees the voice if its sound ends without looping.
+ *
+ * @param v The voice to read.
+ * @param block Where to store the samples.
+ * @param len The number of samples to read.
+ * @return The number of samples read, which is less than len only if the
+ *         sound ended.
+ */
+static unsigned gather(struct voice *v, int16_t *block, unsigned len)
+{
+	const mixer_sound_t *s = &v->sound;
+	const int8_t *pcm8 = s->samples;
+	const int16_t *pcm16 = s->samples;
+	const uint64_t end = (uint64_t)s->length << 16;
+	const uint64_t loop_len = (uint64_t)(s->length - s->loop_start) << 16;
+	const int left = 128 - v->params.pan, right = 128 + v->params.pan;
+	unsigned i;
+
+	for (i = 0; i < len; i++) {
+		unsigned frame;
+
+		if (v->pos >= end) {
+			if (!s->loop) {
+				v->id = -1;
+				break;
+			}
+			v->pos -= loop_len * ((v->pos - end) / loop_len + 1);
+		}
+
+		frame = v->pos >> 16;
+		if (s->channels == 1) {
+			block[i] = (s->format == MIXER_PCM8) ? pcm8[frame] * 256
+			                                     : pcm16[frame];
+		} else if (s->format == MIXER_PCM8) {
+			block[i] = (pcm8[2 * frame] * left
+			            + pcm8[2 * frame + 1] * right);
+		} else {
+			block[i] = (pcm16[2 * frame] * left
+			            + pcm16[2 * frame + 1] * right) >> 8;
+		}
+
+		v->pos += v->params.pitch;
+	}
+
+	return i;
+}
+
+/**
+ * @brief Adds a block of samples, scaled by a gain, to the accumulator.
+ * @param acc The accumulator.
+ * @param block The Q15 samples.
+ * @param len The number of samples.
+ * @param gain The Q8 gain, [0, MIXER_VOLUME_MAX].
+ */
+static void accumulate(int32_t *acc, const int16_t *block, unsigned len,
+                       int16_t gain)
+{
+	unsigned i = 0;
+
+#ifdef __ARM_NEON
+	for (; i + 8 <= len; i += 8) {
+		int16x8_t s = vld1q_s16(&block[i]);
+
+		vst1q_s32(&acc[i], vmlal_n_s16(vld1q_s32(&acc[i]),
+		                               vget_low_s16(s), gain));
+		vst1q_s32(&acc[i + 4], vmlal_n_s16(vld1q_s32(&acc[i + 4]),
+		                                   vget_high_s16(s), gain));
+	}
+#endif
+
+	for (; i < len; i++) { acc[i] += block[i] * gain; }
+}
+
+/**
+ * @brief Narrows the accumulator to int8 samples, saturating.
+ *
+ * The accumulator is Q23. It is narrowed to Q15 with saturation, and then to
+ * int8, which cannot overflow.
+ *
+ * @param out Where to store the samples.
+ * @param acc The accumulator.
+ * @param len The number of samples.
+ */
+static void narrow(int8_t *out, const int32_t *acc, unsigned len)
+{
+	unsigned i = 0;
+
+#ifdef __ARM_NEON
+	for (; i + 8 <= len; i += 8) {
+		int16x8_t s = vcombine_s16(vqshrn_n_s32(vld1q_s32(&acc[i]), 8),
+		                           vqshrn_n_s32(vld1q_s32(&acc[i + 4]), 8));
+		vst1_s8(&out[i], vqshrn_n_s16(s, 8));
+	}
+#endif
+
+	for (; i < len; i++) {
+		int32_t s = acc[i] >> 8;
+
+		s = (s > INT16_MAX) ? INT16_MAX : (s < INT16_MIN) ? INT16_MIN : s;
+		out[i] = s >> 8;
+	}
+}
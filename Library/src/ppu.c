@@ -12,11 +12,15 @@
 
 #include <stdlib.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <poll.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
 
 #include <noway.h>
+#include <probe.h>
+#include <ppu_internal.h>
 #include <errno.h>
 #include <assert.h>
 #include <string.h>
@@ -25,26 +29,21 @@
 /* ================== */
 /* === Anti-Magic === */
 /* ================== */
-#define PATTERN_MAXADDR 1023      ///< Maximum pattern_addr_t value
-#define MIRROR_MAXVAL 3           ///< Maximum allowable value for mirror_e
-#define SPRITE_MAXCOUNT 64        ///< Maximum supported sprites
 #define COLOR_24MASK 0xFFFFFF     ///< 24-bit color mask
 #define LAYER_ENMASK 0x7          ///< Enable Mask for layer_e
 #define TILEDATA_BSIZE 2          ///< Size of tile data in bytes
 #define PALETTE15_BSIZE 60        ///< Size of 15 colors (not counting the transparent color)
 #define PALETTE16_BSIZE 64        ///< Size of 16 colors (technically a full palette)
-#define SPRITE_BSIZE 4            ///< Size of sprite data in bytes
-#define SPRITE_MAX_PRIO 2         ///< Maximum sprite priority (maximum render_prio_e value)
-#define SPRITE_MAXX 511           ///< Maximum allowable x position for a sprite.
-#define SPRITE_MAXY 255           ///< Maximum allowable y position for a sprite
-#define SPRITE_MAXWIDTH 4        ///< Maximum allowable width (in tiles) for multi-pattern sprites
-#define SPRITE_MAXHEIGHT 4       ///< Maximum allowable height (in tiles) for multi-pattern sprites
+#define SHADOW_LINE_BSIZE 64      ///< Granularity (in Bytes) of shadow VRAM dirty tracking
+#define SHADOW_LINES ((VRAM_SIZE + SHADOW_LINE_BSIZE - 1) / SHADOW_LINE_BSIZE) ///< Lines in VRAM
 
 
 /* ========================= */
 /* === Helper Prototypes === */
 /* ========================= */
 unsigned unsigned_min(unsigned a, unsigned b);
+static void shadow_write(const void *buf, unsigned len, unsigned offset);
+static int shadow_flush(void);
 
 
 /* ========================= */
@@ -53,11 +52,26 @@ unsigned unsigned_min(unsigned a, unsigned b);
 /** @brief The file descriptor for the PPU device file. */
 static int ppu_fd = -1;
 
+/** @brief The user mapping of the kernel's VRAM, or NULL if VRAM has not been mapped. */
+static vram_t *ppu_vram = NULL;
+
+_Static_assert(sizeof(vram_t) == VRAM_SIZE, "vram_t does not match the VRAM layout!");
+_Static_assert(REGION_TILES == PPU_REGION_TILES && REGION_PATTERNS == PPU_REGION_PATTERNS
+               && REGION_PALETTES == PPU_REGION_PALETTES && REGION_SPRITES == PPU_REGION_SPRITES,
+               "region_e does not match the driver's region masks!");
+
+/** @brief Process-local copy of VRAM used while shadowing is enabled, or NULL if disabled. */
+static uint8_t *shadow_vram = NULL;
+
+/** @brief One bit per SHADOW_LINE_BSIZE line of shadow VRAM, set if the line needs flushing. */
+static uint32_t shadow_dirty[(SHADOW_LINES + 31) / 32];
+
 int ppu_enable(void)
 {
     nowaymsg(ppu_fd != -1, "PPU already enabled by this process!");
 
-    if ((ppu_fd = open(PPU_DEV_FILE, O_WRONLY)) < 0)
+    // VRAM may be mapped shared and writable later on, which requires read access to the file.
+    if ((ppu_fd = open(PPU_DEV_FILE, O_RDWR)) < 0)
     {
         assert(errno == EBUSY);
 
@@ -68,6 +82,9 @@ int ppu_enable(void)
         return -1;
     }
 
+    // The driver blanks VRAM between owners, so the sprite pool has to start over as well.
+    ppu_sprite_reset();
+
     return 0;
 }
 
@@ -75,6 +92,18 @@ void ppu_disable(void)
 {
     nowaymsg(ppu_fd == -1, "PPU already disabled or not owned by this process!");
 
+    if (shadow_vram != NULL)
+    {
+        free(shadow_vram);
+        shadow_vram = NULL;
+    }
+
+    if (ppu_vram != NULL)
+    {
+        munmap(ppu_vram, sizeof(vram_t));
+        ppu_vram = NULL;
+    }
+
     close(ppu_fd);
 
     ppu_fd = -1;
@@ -83,10 +112,35 @@ void ppu_disable(void)
 int ppu_update(void)
 {
     nowaymsg(ppu_fd == -1, "PPU not enabled or owned by this process!");
+    PROBE1(ppu_update, REGION_ALL);
+
+    // Send along any changes made to the shadow VRAM first. Nothing is sent if nothing changed.
+    if (shadow_vram != NULL && shadow_flush() < 0) return -1;
 
     if (ioctl(ppu_fd, IOCTL_PPU_UPDATE) < 0)
     {
         assert(errno == EBUSY); // Otherwise, it is an EINVAL, which is OUR fault.
+        PROBE1(ppu_update_busy, REGION_ALL);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+int ppu_update_regions(unsigned regions)
+{
+    nowaymsg(ppu_fd == -1, "PPU not enabled or owned by this process!");
+    nowaymsg(regions & ~REGION_ALL, "Region mask malformed!");
+    PROBE1(ppu_update, regions);
+
+    // The kernel adds the regions the shadow VRAM flush writes to, so flushing first is enough.
+    if (shadow_vram != NULL && shadow_flush() < 0) return -1;
+
+    if (ioctl(ppu_fd, IOCTL_PPU_UPDATE_REGIONS, (unsigned long)regions) < 0)
+    {
+        assert(errno == EBUSY); // Otherwise, it is an EINVAL, which is OUR fault.
+        PROBE1(ppu_update_busy, regions);
 
         return -1;
     }
@@ -94,21 +148,122 @@ int ppu_update(void)
     return 0;
 }
 
+int ppu_wait_ready(uint32_t *frame)
+{
+    struct pollfd pfd = {
+        .fd = ppu_fd,
+        .events = POLLOUT,
+    };
+
+    nowaymsg(ppu_fd == -1, "PPU not enabled or owned by this process!");
+    PROBE(ppu_wait_start);
+
+    // Sleep until the PPU accepts a new frame. Retry if a signal (e.g. the APU's) interrupts us.
+    while (poll(&pfd, 1, -1) < 0)
+    {
+        if (errno != EINTR) return -1;
+    }
+    PROBE(ppu_wait_done);
+
+    if (frame != NULL && ioctl(ppu_fd, IOCTL_PPU_GET_FRAME, frame) < 0) return -1;
+
+    return 0;
+}
+
+int ppu_update_sync(uint32_t *frame)
+{
+    uint32_t seq;
+
+    nowaymsg(ppu_fd == -1, "PPU not enabled or owned by this process!");
+    PROBE(ppu_sync_start);
+
+    // Send along any changes made to the shadow VRAM first. Writes never wait on the PPU, so only
+    //   the update itself has to sleep.
+    if (shadow_vram != NULL && shadow_flush() < 0) return -1;
+
+    while (ioctl(ppu_fd, IOCTL_PPU_UPDATE_SYNC, &seq) < 0)
+    {
+        if (errno != EINTR) return -1;
+    }
+    PROBE1(ppu_sync_done, seq);
+
+    if (frame != NULL) *frame = seq;
+
+    return 0;
+}
+
 int ppu_write_vram(const void *buf, size_t len, off_t offset)
 {
     nowaymsg(ppu_fd == -1, "PPU not enabled or owned by this process!");
 
+    if (shadow_vram != NULL)
+    {
+        nowaymsg(offset < 0 || (size_t)offset + len > VRAM_SIZE,
+                 "PPU vram write goes out of VRAM bounds!");
+
+        shadow_write(buf, len, offset);
+        return 0;
+    }
+
     if (pwrite(ppu_fd, buf, len, offset) != (ssize_t)len) {
-        assert(errno == EINVAL || errno == EBUSY); // Potentially nasty programming error (EFAULT)
+        assert(errno == EINVAL || errno == EFAULT); // Writes never wait on the PPU
 
         nowaymsg(errno == EINVAL, "PPU vram write goes out of VRAM bounds!");
 
-        return -1; // In this case, PPU is busy (errno == EBUSY)
+        return -1; // In this case, buf could not be read (errno == EFAULT)
     }
 
     return 0;
 }
 
+vram_t *ppu_map_vram(void)
+{
+    void *vram;
+
+    nowaymsg(ppu_fd == -1, "PPU not enabled or owned by this process!");
+
+    if (ppu_vram != NULL) return ppu_vram;
+
+    vram = mmap(NULL, sizeof(vram_t), PROT_READ | PROT_WRITE, MAP_SHARED, ppu_fd, 0);
+    if (vram == MAP_FAILED) return NULL;
+
+    ppu_vram = vram;
+    return ppu_vram;
+}
+
+int ppu_shadow_enable(void)
+{
+    vram_t *vram;
+
+    nowaymsg(ppu_fd == -1, "PPU not enabled or owned by this process!");
+
+    if (shadow_vram != NULL) return 0;
+
+    // Start from the current contents of VRAM. Dirty lines are flushed whole, so any bytes in them
+    //   which the user did not write must still hold what VRAM holds.
+    if ((vram = ppu_map_vram()) == NULL) return -1;
+
+    nowaymsg((shadow_vram = malloc(VRAM_SIZE)) == NULL, "Malloc failed!");
+    memcpy(shadow_vram, vram, VRAM_SIZE);
+    memset(shadow_dirty, 0, sizeof(shadow_dirty));
+
+    return 0;
+}
+
+int ppu_shadow_disable(void)
+{
+    nowaymsg(ppu_fd == -1, "PPU not enabled or owned by this process!");
+
+    if (shadow_vram == NULL) return 0;
+
+    if (shadow_flush() < 0) return -1;
+
+    free(shadow_vram);
+    shadow_vram = NULL;
+
+    return 0;
+}
+
 
 /* =========================== */
 /* === PPU Data Generators === */
@@ -195,17 +350,14 @@ void ppu_load_pattern(pattern_t *pattern, const char *file, unsigned width, unsi
                 nowaymsg(result != 1, strerror(errno));
 
                 // Source txt files have reversed nibble ordering (for ease of use) (per each 4B).
-                // We need to reverse them back:
-                row_pattern = ((row_pattern & 0x0F0F0F0F) << 4) | ((row_pattern & 0xF0F0F0F0) >> 4);
-                row_pattern = ((row_pattern & 0x00FF00FF) << 8) | ((row_pattern & 0xFF00FF00) >> 8);
-                row_pattern = ((row_pattern & 0x0000FFFF) << 16) | ((row_pattern & 0xFFFF0000) >> 16);
-                // Credit to https://stackoverflow.com/questions/58716959/reversing-the-nibbles
-
-                pattern[pxrow + tile * height].pxrow[row] = row_pattern;
+                // They are stored as-is here and reversed back in one pass below.
+                pattern[pxrow + tile * width].pxrow[row] = row_pattern;
             }
         }
     }
     result = fclose(fp);
+
+    ppu_encode_patterns(pattern, (const uint32_t *)pattern, width * height);
 }
 
 void ppu_load_palette(palette_t *palette, const char *file)
@@ -291,11 +443,11 @@ int ppu_write_tiles_horizontal(const tile_t *tiles, unsigned len, layer_e layer,
     // How many bytes to write for this writing iteration.
     unsigned bytes_towrite = tiles_towrite * TILEDATA_BSIZE;
 
-    if (pwrite(ppu_fd, write_tiles, bytes_towrite, start_addr) != (ssize_t)bytes_towrite)
+    if (ppu_write_vram(write_tiles, bytes_towrite, start_addr) < 0)
     {
-        assert(errno == EBUSY);
+        free(write_tiles);
 
-        return -1; // In this case, PPU is busy (errno == EBUSY)
+        return -1; // errno set by ppu_write_vram
     }
     tiles_written = tiles_towrite;
 
@@ -312,11 +464,11 @@ int ppu_write_tiles_horizontal(const tile_t *tiles, unsigned len, layer_e layer,
     // Wrap around to the start of the current row
     start_addr = tile_layer_offset + (y_i * TILELAYER_HEIGHT) * TILEDATA_BSIZE;
 
-    if (pwrite(ppu_fd, &write_tiles[tiles_written], bytes_towrite, start_addr) != (ssize_t)bytes_towrite)
+    if (ppu_write_vram(&write_tiles[tiles_written], bytes_towrite, start_addr) < 0)
     {
-        assert(errno == EBUSY);
+        free(write_tiles);
 
-        return -1; // In this case, PPU is busy (errno == EBUSY)
+        return -1; // errno set by ppu_write_vram
     }
     assert(count - (tiles_written + tiles_towrite) == 0); // No more tiles left to write
 
@@ -331,9 +483,10 @@ int ppu_write_tiles_vertical(const tile_t *tiles, unsigned len, layer_e layer, u
     unsigned i;            // Generic reusable loop iterator
     unsigned start_addr;   // Actual Byte-address in VRAM to write to.
     unsigned towrite;      // How many tiles to write for this writing iteration.
-    unsigned written;      // Keep track of how many tiles we have written so far.
+    unsigned written;      // Keep track of our place in the tiles array.
     tile_t *write_tiles;   // Buffer of tiles to write, taking into account tile repeat/loop.
     unsigned tile_layer_offset;
+    struct ppu_write_seg segs[TILELAYER_HEIGHT]; // One write segment per tile in the column
 
     // Catch input errors and tell the user
     nowaymsg(ppu_fd == -1, "PPU not enabled or owned by this process!");
@@ -349,10 +502,10 @@ int ppu_write_tiles_vertical(const tile_t *tiles, unsigned len, layer_e layer, u
     count = (count > TILELAYER_HEIGHT) ? TILELAYER_HEIGHT : count;
     len = (len > TILELAYER_HEIGHT) ? TILELAYER_HEIGHT : len;
 
-    // We split the tile writing operation into two writes:
+    // We split the tile writing operation into two runs:
     //   1. Write from y_i until either the end of the column, or until we've written count tiles.
     //   2. If we have reached the end of the column, but haven't written count tiles in total, we
-    //      must continue writing tiles by wrapping around to the start of the current row.
+    //      must continue writing tiles by wrapping around to the start of the current column.
 
     // Also importantly, if len < count, we need to repeat the sequence of tiles given by "tiles".
     // To do this, construct a write buffer of length (len) which takes into account repeats.
@@ -371,29 +524,28 @@ int ppu_write_tiles_vertical(const tile_t *tiles, unsigned len, layer_e layer, u
     // (64 tiles/row * y_i rows + x_i tiles) * 2B per tile.
     start_addr = tile_layer_offset + ((y_i << 6) + x_i) * TILEDATA_BSIZE;
 
-    // write up to the end of the current column (at most) initially
-    towrite = unsigned_min(TILELAYER_HEIGHT - y_i, count);
-    written = 0;                      // Keep track of how many tiles we've written so far
-    while (written < count) // This loop should run twice at most
+    // Column writes touch one 2B tile per row, so describe each tile as its own segment and hand
+    //   the whole column to the kernel at once.
+    towrite = unsigned_min(TILELAYER_HEIGHT - y_i, count); // Tiles until the end of the column
+    for (i = 0; i < count; i++)
     {
-        while(towrite != 0 && written < count)
+        if (i == towrite)
         {
-            // These column writes cause this function to be very inefficient.
-            // No real way around these single-tile writes, unfortunately.
-            if (pwrite(ppu_fd, &write_tiles[written], TILEDATA_BSIZE, start_addr) != TILEDATA_BSIZE)
-            {
-                assert(errno == EBUSY);
-
-                return -1; // In this case, PPU is busy (errno == EBUSY)
-            }
-            written++;
-            towrite--;
-            // Increment start address by an entire row
-            start_addr += TILELAYER_WIDTH * TILEDATA_BSIZE;
+            // Wrap around to 0th row, starting at the fixed column
+            start_addr = tile_layer_offset + x_i * TILEDATA_BSIZE;
         }
-        towrite = count - written; // Write the leftover tiles next (if any)
-        // Wrap around to 0th row, starting at the fixed column
-        start_addr = tile_layer_offset + x_i * TILEDATA_BSIZE;
+
+        ppu_make_seg(&segs[i], start_addr, TILEDATA_BSIZE, &write_tiles[i]);
+
+        // Increment start address by an entire row
+        start_addr += TILELAYER_WIDTH * TILEDATA_BSIZE;
+    }
+
+    if (ppu_write_segs(segs, count) < 0)
+    {
+        free(write_tiles);
+
+        return -1; // errno set by ppu_write_segs
     }
 
     free(write_tiles);
@@ -413,6 +565,14 @@ int ppu_write_pattern(const pattern_t *pattern, unsigned width, unsigned height,
 
     unsigned x_i = pattern_addr & 0x1F;        // Starting tile x coord. 1st 5 bits of pattern_addr
     unsigned y_i = (pattern_addr >> 5) & 0x1F; // Starting tile y coord. 2nd 5 bits of pattern_addr
+    struct ppu_write_seg *segs;                // Write segments, merged where VRAM is contiguous
+    unsigned nsegs = 0;
+    int ret;
+
+    // Each row of patterns needs at most two segments: one up to the right edge of Pattern RAM, and
+    //   one more if the row wraps back around to x = 0.
+    nowaymsg((segs = malloc(sizeof(*segs) * 2 * height)) == NULL, "Malloc failed!");
+
     for (unsigned row = 0; row < height; row++) // Write rows of tile-patterns
     {
         unsigned y_f = (y_i + row) & 0x1F; // This performs mod 32 to create wrap-around
@@ -423,17 +583,24 @@ int ppu_write_pattern(const pattern_t *pattern, unsigned width, unsigned height,
             unsigned wr_addr = VRAM_PATTERNOFFSET + TILEPATTERN_BSIZE * addr; // Byte address
             unsigned srcaddr = col + width * row; // Address into pattern array
 
-            // write a full 8x8 tile's worth of pattern data:
-            if (pwrite(ppu_fd, &(pattern[srcaddr].pxrow), TILEPATTERN_BSIZE, wr_addr) != TILEPATTERN_BSIZE)
+            // Extend the previous segment if this pattern directly follows it in both the source
+            //   array and Pattern RAM. Otherwise, start a new segment.
+            if (col != 0 && x_f != 0)
             {
-                assert(errno == EBUSY);
-
-                return -1; // In this case, PPU is busy (errno == EBUSY)
+                segs[nsegs - 1].len += TILEPATTERN_BSIZE;
+            }
+            else
+            {
+                ppu_make_seg(&segs[nsegs++], wr_addr, TILEPATTERN_BSIZE,
+                             &(pattern[srcaddr].pxrow));
             }
         }
     }
 
-    return 0;
+    ret = ppu_write_segs(segs, nsegs);
+    free(segs);
+
+    return ret; // On failure, errno set by ppu_write_segs
 }
 
 int ppu_write_palette(const palette_t *palette, layer_e layer_id, unsigned palette_id)
@@ -459,11 +626,9 @@ int ppu_write_palette(const palette_t *palette, layer_e layer_id, unsigned palet
     wr_addr = VRAM_PALETTEOFFSET + layer_offset + palette_id * PALETTE16_BSIZE + 4;
 
     // Only write the opaque 15 colors
-    if (pwrite(ppu_fd, &(palette->color), PALETTE15_BSIZE, wr_addr) != PALETTE15_BSIZE)
+    if (ppu_write_vram(&(palette->color), PALETTE15_BSIZE, wr_addr) < 0)
     {
-        assert(errno == EBUSY);
-
-        return -1; // In this case, PPU is busy (errno == EBUSY)
+        return -1; // errno set by ppu_write_vram
     }
 
     return 0;
@@ -471,14 +636,14 @@ int ppu_write_palette(const palette_t *palette, layer_e layer_id, unsigned palet
 
 int ppu_write_sprites(const sprite_t *sprites, unsigned len, unsigned sprite_id_i)
 {
-    unsigned i;
     uint32_t *sprite_buf;
-    uint32_t *sprite_extra_buf;
+    uint8_t *sprite_extra_buf;
     uint32_t wraddr;
     uint32_t wraddr_extra;
-    uint32_t sprite;
-    uint8_t extra;
+    struct ppu_write_seg segs[2];
+    int ret;
 
+    nowaymsg(ppu_fd == -1, "PPU not enabled or owned by this process!");
     nowaymsg(sprites == NULL, "Sprite Array is NULL!");
     nowaymsg(sprite_id_i + len > SPRITE_MAXCOUNT, "Sprite write would exceed Sprite RAM bounds!");
 
@@ -488,45 +653,18 @@ int ppu_write_sprites(const sprite_t *sprites, unsigned len, unsigned sprite_id_
     wraddr = VRAM_SPRITESOFFSET + sprite_id_i * SPRITE_BSIZE;
     wraddr_extra = VRAM_SPRITESOFFSET + SPRRAM_EXTRAOFFSET + sprite_id_i; // Size is 1B for extra
 
-    for (i=0; i < len; i++)
-    {
-        // Check for malformed inputs for this sprite
-        nowaymsg(sprites[i].pattern_addr > PATTERN_MAXADDR, "Pattern address malformed!");
-        nowaymsg(sprites[i].palette_id >= SPRLAYER_MAX_PALETTES, "Palette ID out of range!");
-        nowaymsg(sprites[i].y > SPRITE_MAXY, "Sprite y coord. out of range!");
-        nowaymsg(sprites[i].x > SPRITE_MAXX, "Sprite x coord. out of range!");
-        nowaymsg(sprites[i].mirror > MIRROR_MAXVAL, "Mirror argument malformed!");
-        nowaymsg(sprites[i].height > SPRITE_MAXHEIGHT, "Sprite height exceeds maximum (4)!");
-        nowaymsg(sprites[i].height == 0, "Sprite height cannot be 0!");
-        nowaymsg(sprites[i].width > SPRITE_MAXWIDTH, "Sprite width exceeds maximum (4)!");
-        nowaymsg(sprites[i].width == 0, "Sprite width cannot be 0!");
-        nowaymsg(sprites[i].prio > SPRITE_MAX_PRIO, "Sprite Priority exceeds maximum (2)!");
-
-        sprite = (sprites[i].pattern_addr << 22) | (sprites[i].palette_id << 17) | (sprites[i].y << 9) | sprites[i].x;
-        extra = (sprites[i].mirror << 6) | ((sprites[i].height - 1) << 4) | ((sprites[i].width - 1) << 2) | sprites[i].prio;
-
-        sprite_buf[i] = sprite;
-        sprite_extra_buf[i] = extra;
-    }
-
-    if (pwrite(ppu_fd, sprite_buf, len * SPRITE_BSIZE, wraddr) != (ssize_t)len * SPRITE_BSIZE)
-    {
-        assert(errno == EBUSY);
-
-        return -1; // In this case, PPU is busy (errno == EBUSY)
-    }
-
-    if (pwrite(ppu_fd, sprite_extra_buf, len, wraddr_extra) != (ssize_t)len)
-    {
-        assert(errno == EBUSY);
+    // Checks for malformed inputs while packing
+    ppu_pack_sprites(sprite_buf, sprite_extra_buf, sprites, len);
 
-        return -1; // In this case, PPU is busy (errno == EBUSY)
-    }
+    // Send both the main and extra sprite data in a single batch.
+    ppu_make_seg(&segs[0], wraddr, len * SPRITE_BSIZE, sprite_buf);
+    ppu_make_seg(&segs[1], wraddr_extra, len, sprite_extra_buf);
+    ret = ppu_write_segs(segs, 2);
 
     free(sprite_buf);
     free(sprite_extra_buf);
 
-    return 0;
+    return ret; // On failure, errno set by ppu_write_segs
 }
 
 int ppu_set_bgcolor(unsigned color)
@@ -535,9 +673,7 @@ int ppu_set_bgcolor(unsigned color)
 
     if (ioctl(ppu_fd, IOCTL_PPU_SET_BGCOLOR, color & COLOR_24MASK) < 0)
     {
-        assert(errno == EBUSY); // Otherwise, it is an EINVAL, which is OUR fault.
-
-        return -1;
+        return -1; // The register is only sent with the next frame, so this never waits on the PPU
     }
 
     return 0;
@@ -553,9 +689,7 @@ int ppu_set_scroll(layer_e tile_layer, unsigned scroll_x, unsigned scroll_y)
 
     if (ioctl(ppu_fd, ioctl_num, scroll) < 0)
     {
-        assert(errno == EBUSY); // Otherwise, it is an EINVAL, which is OUR fault.
-
-        return -1;
+        return -1; // The register is only sent with the next frame, so this never waits on the PPU
     }
     return 0;
 }
@@ -566,9 +700,7 @@ int ppu_set_layer_enable(unsigned enable_mask)
 
     if (ioctl(ppu_fd, IOCTL_PPU_SET_ENABLE, enable_mask & LAYER_ENMASK) < 0)
     {
-        assert(errno == EBUSY); // Otherwise, it is an EINVAL, which is OUR fault.
-
-        return -1;
+        return -1; // The register is only sent with the next frame, so this never waits on the PPU
     }
 
     return 0;
@@ -582,3 +714,159 @@ unsigned unsigned_min(unsigned a, unsigned b)
 {
     return (a < b) ? a : b;
 }
+
+/** @brief Checks a sprite for malformed inputs, exiting the program if any are found
+ * @param sprite The sprite to check.
+ */
+void ppu_check_sprite(const sprite_t *sprite)
+{
+    nowaymsg(sprite->pattern_addr > PATTERN_MAXADDR, "Pattern address malformed!");
+    nowaymsg(sprite->palette_id >= SPRLAYER_MAX_PALETTES, "Palette ID out of range!");
+    nowaymsg(sprite->y > SPRITE_MAXY, "Sprite y coord. out of range!");
+    nowaymsg(sprite->x > SPRITE_MAXX, "Sprite x coord. out of range!");
+    nowaymsg(sprite->mirror > MIRROR_MAXVAL, "Mirror argument malformed!");
+    nowaymsg(sprite->height > SPRITE_MAXHEIGHT, "Sprite height exceeds maximum (4)!");
+    nowaymsg(sprite->height == 0, "Sprite height cannot be 0!");
+    nowaymsg(sprite->width > SPRITE_MAXWIDTH, "Sprite width exceeds maximum (4)!");
+    nowaymsg(sprite->width == 0, "Sprite width cannot be 0!");
+    nowaymsg(sprite->prio > SPRITE_MAX_PRIO, "Sprite Priority exceeds maximum (2)!");
+}
+
+/** @brief Fills in a single VRAM write segment
+ * @param seg Segment to fill in.
+ * @param offset Byte offset into VRAM to write to.
+ * @param len Number of bytes to write.
+ * @param buf Data to be written.
+ */
+void ppu_make_seg(struct ppu_write_seg *seg, unsigned offset, unsigned len, const void *buf)
+{
+    seg->offset = offset;
+    seg->len = len;
+    seg->buf = (uintptr_t)buf;
+}
+
+/** @brief Writes a batch of segments to VRAM, using as few system calls as possible
+ *
+ * The kernel accepts at most PPU_WRITE_SEGS_MAX segments at a time. Larger batches are split up.
+ *
+ * @param segs Array of segments to write.
+ * @param count Number of segments in @p segs.
+ * @return 0 on success; -1 if the kernel is out of memory (ENOMEM) or cannot read a buffer (EFAULT)
+ */
+int ppu_write_segs(const struct ppu_write_seg *segs, unsigned count)
+{
+    struct ppu_write_segs req;
+    unsigned i;
+
+    if (shadow_vram != NULL)
+    {
+        for (i = 0; i < count; i++)
+        {
+            shadow_write((const void *)(uintptr_t)segs[i].buf, segs[i].len, segs[i].offset);
+        }
+
+        return 0;
+    }
+
+    while (count > 0)
+    {
+        req.segs = (uintptr_t)segs;
+        req.count = unsigned_min(count, PPU_WRITE_SEGS_MAX);
+        req.pad = 0;
+
+        if (ioctl(ppu_fd, IOCTL_PPU_WRITE_SEGS, &req) < 0)
+        {
+            // Writes never wait on the PPU, so there is no EBUSY here.
+            assert(errno == EINVAL || errno == ENOMEM || errno == EFAULT);
+
+            nowaymsg(errno == EINVAL, "PPU vram write goes out of VRAM bounds!");
+
+            return -1; // In this case, errno == ENOMEM or EFAULT
+        }
+
+        segs += req.count;
+        count -= req.count;
+    }
+
+    return 0;
+}
+
+/** @brief Copies data into the shadow VRAM and marks the lines it touches as dirty
+ * @param buf Data to be written.
+ * @param len Number of bytes to write.
+ * @param offset Byte offset into VRAM to write to. Must be in bounds.
+ */
+static void shadow_write(const void *buf, unsigned len, unsigned offset)
+{
+    unsigned line;
+
+    if (len == 0) return;
+
+    memcpy(&shadow_vram[offset], buf, len);
+
+    for (line = offset / SHADOW_LINE_BSIZE; line <= (offset + len - 1) / SHADOW_LINE_BSIZE; line++)
+    {
+        shadow_dirty[line >> 5] |= 1u << (line & 0x1F);
+    }
+}
+
+/** @brief Sends all dirty lines of the shadow VRAM to the kernel
+ *
+ * Runs of adjacent dirty lines are merged into a single segment, and all segments are sent with a
+ *   single system call. Nothing is sent if no line is dirty. Dirty lines are only forgotten once
+ *   the kernel has accepted them.
+ *
+ * @return 0 on success; -1 if the kernel is out of memory (errno == ENOMEM)
+ */
+static int shadow_flush(void)
+{
+    // Worst case is every other line being dirty.
+    struct ppu_write_seg segs[(SHADOW_LINES + 1) / 2];
+    unsigned nsegs = 0;
+    unsigned line = 0;
+    unsigned start;
+    unsigned end;
+
+    while (line < SHADOW_LINES)
+    {
+        // Skip over clean runs 32 lines at a time.
+        if (shadow_dirty[line >> 5] == 0)
+        {
+            line = (line | 0x1F) + 1;
+            continue;
+        }
+
+        if (!(shadow_dirty[line >> 5] & (1u << (line & 0x1F))))
+        {
+            line++;
+            continue;
+        }
+
+        start = line;
+        while (line < SHADOW_LINES && (shadow_dirty[line >> 5] & (1u << (line & 0x1F)))) line++;
+
+        end = unsigned_min(line * SHADOW_LINE_BSIZE, VRAM_SIZE);
+        ppu_make_seg(&segs[nsegs++], start * SHADOW_LINE_BSIZE, end - start * SHADOW_LINE_BSIZE,
+                 &shadow_vram[start * SHADOW_LINE_BSIZE]);
+    }
+
+    if (nsegs == 0) return 0;
+    PROBE1(ppu_shadow_flush, nsegs);
+
+    // Send the spans straight to the kernel; ppu_write_segs() would put them back into the shadow.
+    struct ppu_write_segs req = {
+        .segs = (uintptr_t)segs,
+        .count = nsegs,
+        .pad = 0,
+    };
+    if (ioctl(ppu_fd, IOCTL_PPU_WRITE_SEGS, &req) < 0)
+    {
+        assert(errno == ENOMEM); // Spans are always within VRAM and our own buffer.
+
+        return -1;
+    }
+
+    memset(shadow_dirty, 0, sizeof(shadow_dirty));
+
+    return 0;
+}
@@ -0,0 +1,442 @@
+/** @file ppu_ref.c
+ * @author Joseph Yankel
+ * @brief Software reference renderer implementation
+ *
+ * Each row is rendered the way the PPU renders it: the BG and FG Tile-Engines and the
+ *   Sprite-Engine each fill a row buffer, and the Pixel Mixer then picks between them one pixel at
+ *   a time and looks the result up in Palette RAM. Anything which is the same for every row (the
+ *   color lookup table and the decoded Sprite RAM) is prepared once per frame and shared by the
+ *   threads read-only, so rows can be rendered in any order and on any thread.
+ *
+ * Each renderer keeps its worker threads for its whole life. Between frames they sleep on a
+ *   condition variable, and each frame wakes them with a new frame number, so a frame costs a
+ *   wakeup per worker rather than a thread creation.
+ */
+
+
+/* ================ */
+/* === Includes === */
+/* ================ */
+#include <fp-game/ppu_ref.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <noway.h>
+#include <ppu_internal.h>
+
+
+/* ================== */
+/* === Anti-Magic === */
+/* ================== */
+#define REF_COLORS 1024           ///< Entries in Palette RAM (one per 10-bit pixel value)
+#define REF_SPRITES_PER_ROW 16    ///< Sprites the Sprite-Engine can hold for a single row
+#define REF_TILEROW_TILES 41      ///< Tiles covering a row when it is scrolled by 1 to 7 pixels
+#define REF_LAYER_WRAP 511        ///< Tile layers are 512x512 pixels, and wrap when scrolled
+#define REF_COLOR_MASK 0xFFFFFF   ///< Palette RAM entries are 24-bit colors
+#define REF_PATTERN_GRID 32       ///< Pattern RAM is a 32x32 grid of patterns
+
+// Pixel Mixer source addresses (the top bits of a 10-bit pixel value)
+#define SRC_FG 0x100
+#define SRC_SP 0x200
+
+
+/* =================== */
+/* === Definitions === */
+/* =================== */
+/** @brief A sprite, unpacked from Sprite RAM */
+typedef struct {
+    unsigned x;        ///< Leftmost column
+    unsigned y;        ///< Topmost row
+    unsigned width;    ///< Width in pixels
+    unsigned height;   ///< Height in pixels
+    unsigned tile_x;   ///< Pattern RAM column of the top-left pattern
+    unsigned tile_y;   ///< Pattern RAM row of the top-left pattern
+    unsigned palette;  ///< Palette, already in place for a 10-bit pixel value
+    unsigned mirror;   ///< mirror_e
+    unsigned prio;     ///< 2-bit priority, as seen by the Pixel Mixer
+    unsigned rank;     ///< Precedence in the sprite tournament (lower wins)
+} ref_sprite_t;
+
+/** @brief Everything needed to render any row of a frame, shared by the threads of a renderer */
+typedef struct {
+    const vram_t *vram;
+    uint32_t *frame;
+    unsigned scroll_x[2];             ///< BG then FG
+    unsigned scroll_y[2];             ///< BG then FG
+    unsigned enable;
+    uint32_t colors[REF_COLORS];      ///< 10-bit pixel value -> 24-bit color
+    ref_sprite_t sprites[SPRRAM_COUNT];
+} ref_frame_t;
+
+/** @brief A band of rows for one thread to render */
+typedef struct {
+    ppu_ref_t *ref;  ///< Renderer the band belongs to
+    unsigned row_i;  ///< First row to render
+    unsigned row_f;  ///< One past the last row to render
+} ref_job_t;
+
+/** @brief A reference renderer */
+struct ppu_ref {
+    ref_frame_t frame;                ///< State of the frame being rendered
+    unsigned threads;                 ///< Threads rendering each frame, including the caller
+    pthread_t tids[PPU_REF_HEIGHT];   ///< Worker threads (index 0 is unused: it is the caller)
+    ref_job_t jobs[PPU_REF_HEIGHT];   ///< Band of each thread
+
+    pthread_mutex_t lock;             ///< Protects the fields below
+    pthread_cond_t start;             ///< Signalled when a frame is ready, or the workers must quit
+    pthread_cond_t done;              ///< Signalled when the last worker finishes its band
+    unsigned frame_num;               ///< Bumped for each frame, to wake the workers
+    unsigned pending;                 ///< Workers still rendering the current frame
+    bool quit;                        ///< Set when the renderer is being destroyed
+};
+
+
+/* ========================= */
+/* === Helper Prototypes === */
+/* ========================= */
+static void ref_prepare(ref_frame_t *f, const vram_t *vram, const ppu_ref_regs_t *regs);
+static void *ref_worker(void *arg);
+static void ref_render_rows(const ref_job_t *job);
+static void ref_render_row(const ref_frame_t *f, unsigned row);
+static void ref_tile_row(const ref_frame_t *f, unsigned layer, unsigned row, uint8_t *line);
+static void ref_sprite_row(const ref_frame_t *f, unsigned row, uint16_t *line);
+
+
+/* ============================== */
+/* === Reference Renderer API === */
+/* ============================== */
+ppu_ref_t *ppu_ref_create(unsigned threads)
+{
+    ppu_ref_t *ref;
+    unsigned t;
+
+    if (threads == 0) threads = 1;
+    if (threads > PPU_REF_HEIGHT) threads = PPU_REF_HEIGHT;
+
+    nowaymsg((ref = malloc(sizeof(ppu_ref_t))) == NULL, "Reference renderer malloc failed!");
+    pthread_mutex_init(&ref->lock, NULL);
+    pthread_cond_init(&ref->start, NULL);
+    pthread_cond_init(&ref->done, NULL);
+    ref->frame_num = 0;
+    ref->pending = 0;
+    ref->quit = false;
+
+    // Thread 0 is the calling thread. If a worker can't be started, the renderer makes do with the
+    //   ones it has. The workers only look at their bands once woken for a frame, so the bands can
+    //   be set after they are started.
+    for (t = 1; t < threads; t++)
+    {
+        ref->jobs[t].ref = ref;
+        if (pthread_create(&ref->tids[t], NULL, ref_worker, &ref->jobs[t]) != 0) break;
+    }
+    ref->threads = t;
+
+    for (t = 0; t < ref->threads; t++)
+    {
+        ref->jobs[t].ref = ref;
+        ref->jobs[t].row_i = PPU_REF_HEIGHT * t / ref->threads;
+        ref->jobs[t].row_f = PPU_REF_HEIGHT * (t + 1) / ref->threads;
+    }
+
+    return ref;
+}
+
+void ppu_ref_destroy(ppu_ref_t *ref)
+{
+    nowaymsg(ref == NULL, "Reference renderer is NULL!");
+
+    pthread_mutex_lock(&ref->lock);
+    ref->quit = true;
+    pthread_cond_broadcast(&ref->start);
+    pthread_mutex_unlock(&ref->lock);
+
+    for (unsigned t = 1; t < ref->threads; t++) pthread_join(ref->tids[t], NULL);
+
+    pthread_cond_destroy(&ref->done);
+    pthread_cond_destroy(&ref->start);
+    pthread_mutex_destroy(&ref->lock);
+    free(ref);
+}
+
+void ppu_ref_render(ppu_ref_t *ref, const vram_t *vram, const ppu_ref_regs_t *regs,
+                    uint32_t *frame)
+{
+    nowaymsg(ref == NULL, "Reference renderer is NULL!");
+    nowaymsg(vram == NULL, "VRAM image is NULL!");
+    nowaymsg(regs == NULL, "PPU registers are NULL!");
+    nowaymsg(frame == NULL, "Frame buffer is NULL!");
+
+    // The workers are asleep between frames, so the frame state can be filled in without the lock.
+    //   Taking the lock to wake them publishes it.
+    ref_prepare(&ref->frame, vram, regs);
+    ref->frame.frame = frame;
+
+    pthread_mutex_lock(&ref->lock);
+    ref->frame_num++;
+    ref->pending = ref->threads - 1;
+    pthread_cond_broadcast(&ref->start);
+    pthread_mutex_unlock(&ref->lock);
+
+    ref_render_rows(&ref->jobs[0]);
+
+    pthread_mutex_lock(&ref->lock);
+    while (ref->pending > 0) pthread_cond_wait(&ref->done, &ref->lock);
+    pthread_mutex_unlock(&ref->lock);
+}
+
+
+/* ======================== */
+/* === Helper Functions === */
+/* ======================== */
+/** @brief Prepares the per-frame state: registers, the color lookup table and the sprites.
+ * @param f Frame state to fill in.
+ * @param vram The VRAM image being rendered.
+ * @param regs The control registers being rendered with.
+ */
+static void ref_prepare(ref_frame_t *f, const vram_t *vram, const ppu_ref_regs_t *regs)
+{
+    unsigned i, c;
+
+    f->vram = vram;
+    f->scroll_x[0] = regs->bg_scroll_x & REF_LAYER_WRAP;
+    f->scroll_y[0] = regs->bg_scroll_y & REF_LAYER_WRAP;
+    f->scroll_x[1] = regs->fg_scroll_x & REF_LAYER_WRAP;
+    f->scroll_y[1] = regs->fg_scroll_y & REF_LAYER_WRAP;
+    f->enable = regs->enable;
+
+    // Palette RAM is addressed by the full 10-bit pixel value, except that 0 (a transparent BG
+    //   pixel with nothing in front of it) shows the bgcolor instead.
+    for (i = 0; i < PALETTERAM_TILEMAX; i++)
+    {
+        for (c = 0; c < PALETTE_COLORS; c++)
+        {
+            f->colors[i * PALETTE_COLORS + c] = vram->bg_palettes[i][c] & REF_COLOR_MASK;
+            f->colors[SRC_FG + i * PALETTE_COLORS + c] = vram->fg_palettes[i][c] & REF_COLOR_MASK;
+        }
+    }
+    for (i = 0; i < PALETTERAM_SPRITEMAX; i++)
+    {
+        for (c = 0; c < PALETTE_COLORS; c++)
+        {
+            f->colors[SRC_SP + i * PALETTE_COLORS + c] = vram->spr_palettes[i][c] & REF_COLOR_MASK;
+        }
+    }
+    f->colors[0] = regs->bgcolor & REF_COLOR_MASK;
+
+    // Unpack Sprite RAM the same way the Sprite-Engine's OAM wrapper does.
+    for (i = 0; i < SPRRAM_COUNT; i++)
+    {
+        uint32_t data = vram->sprites[i];
+        uint8_t extra = vram->sprite_extra[i];
+        ref_sprite_t *s = &f->sprites[i];
+
+        s->x = data & 0x1FF;
+        s->y = (data >> 9) & 0xFF;
+        s->palette = SRC_SP | (((data >> 17) & 0x1F) << 4);
+        s->tile_x = (data >> 22) & 0x1F;
+        s->tile_y = (data >> 27) & 0x1F;
+        s->mirror = (extra >> 6) & MIRROR_XY;
+        s->height = (((extra >> 4) & 0x3) + 1) * TILEPATTERN_HEIGHT;
+        s->width = (((extra >> 2) & 0x3) + 1) * TILEPATTERN_HEIGHT;
+        s->prio = extra & 0x3;
+
+        // The tournament prefers sprites in front of the FG, then sprites in front of the BG,
+        //   then the rest.
+        s->rank = (s->prio & 0x2) ? 0 : (s->prio & 0x1) ? 1 : 2;
+    }
+}
+
+/** @brief Worker thread entry point, which renders its band of every frame until told to quit.
+ * @param arg The ref_job_t of the worker.
+ */
+static void *ref_worker(void *arg)
+{
+    const ref_job_t *job = arg;
+    ppu_ref_t *ref = job->ref;
+    unsigned frame_num = 0;
+
+    pthread_mutex_lock(&ref->lock);
+    for (;;)
+    {
+        while (!ref->quit && ref->frame_num == frame_num)
+        {
+            pthread_cond_wait(&ref->start, &ref->lock);
+        }
+        if (ref->quit) break;
+        frame_num = ref->frame_num;
+        pthread_mutex_unlock(&ref->lock);
+
+        ref_render_rows(job);
+
+        pthread_mutex_lock(&ref->lock);
+        if (--ref->pending == 0) pthread_cond_signal(&ref->done);
+    }
+    pthread_mutex_unlock(&ref->lock);
+
+    return NULL;
+}
+
+/** @brief Renders a band of rows.
+ * @param job The band to render.
+ */
+static void ref_render_rows(const ref_job_t *job)
+{
+    for (unsigned row = job->row_i; row < job->row_f; row++) ref_render_row(&job->ref->frame, row);
+}
+
+/** @brief Renders a single row, as the Pixel Mixer would.
+ * @param f The frame being rendered.
+ * @param row The row to render.
+ */
+static void ref_render_row(const ref_frame_t *f, unsigned row)
+{
+    // Row buffers, as filled by each Pixel-Engine. Tile layers are rendered from the first
+    //   (possibly partly scrolled off) tile, so their pixels start at the layer's pixel scroll.
+    uint8_t bg[REF_TILEROW_TILES * TILEPATTERN_HEIGHT];
+    uint8_t fg[REF_TILEROW_TILES * TILEPATTERN_HEIGHT];
+    uint16_t sp[PPU_REF_WIDTH];
+    const uint8_t *bg_px, *fg_px;
+    uint32_t *out = &f->frame[row * PPU_REF_WIDTH];
+
+    ref_tile_row(f, 0, row, bg);
+    ref_tile_row(f, 1, row, fg);
+    ref_sprite_row(f, row, sp);
+
+    bg_px = &bg[f->scroll_x[0] & 0x7];
+    fg_px = &fg[f->scroll_x[1] & 0x7];
+
+    for (unsigned col = 0; col < PPU_REF_WIDTH; col++)
+    {
+        unsigned bg_color = bg_px[col] & 0xF;
+        unsigned fg_color = fg_px[col] & 0xF;
+        unsigned sp_color = sp[col] & 0xF;
+        unsigned sp_prio = sp[col] >> 10;
+        unsigned px;
+
+        if (sp_color != 0 && ((sp_prio & 0x2) || (sp_prio == 1 && fg_color == 0)
+                              || (fg_color == 0 && bg_color == 0)))
+        {
+            px = sp[col] & 0x3FF;
+        }
+        else if (fg_color != 0)
+        {
+            px = SRC_FG | fg_px[col];
+        }
+        else
+        {
+            px = (bg_color == 0) ? 0 : bg_px[col];
+        }
+
+        out[col] = f->colors[px];
+    }
+}
+
+/** @brief Renders a row of a tile layer, as the Tile-Engine would.
+ *
+ * Each pixel is written as its 8-bit {palette, color} pair. Pixel 0 of @p line is the first pixel
+ *   of the leftmost tile, which is (scroll_x % 8) pixels left of the screen.
+ *
+ * @param f The frame being rendered.
+ * @param layer 0 for BG, 1 for FG.
+ * @param row The screen row to render.
+ * @param line Output row buffer of REF_TILEROW_TILES tiles.
+ */
+static void ref_tile_row(const ref_frame_t *f, unsigned layer, unsigned row, uint8_t *line)
+{
+    const tile_t *tiles;
+    unsigned pixelrow, tile_x;
+
+    // A disabled layer is fully transparent.
+    if (!(f->enable & (layer ? LAYER_FG : LAYER_BG)))
+    {
+        for (unsigned i = 0; i < REF_TILEROW_TILES * TILEPATTERN_HEIGHT; i++) line[i] = 0;
+        return;
+    }
+
+    pixelrow = (f->scroll_y[layer] + row) & REF_LAYER_WRAP;
+    tiles = layer ? f->vram->fg_tiles[pixelrow / TILEPATTERN_HEIGHT]
+                  : f->vram->bg_tiles[pixelrow / TILEPATTERN_HEIGHT];
+    tile_x = f->scroll_x[layer] / TILEPATTERN_HEIGHT;
+
+    for (unsigned t = 0; t < REF_TILEROW_TILES; t++)
+    {
+        tile_t tile = tiles[(tile_x + t) % TILELAYER_WIDTH];
+        unsigned palette = ((tile >> 2) & 0xF) << 4;
+        unsigned pxrow = pixelrow % TILEPATTERN_HEIGHT;
+        uint32_t pixels;
+        uint8_t *px = &line[t * TILEPATTERN_HEIGHT];
+
+        if (tile & MIRROR_Y) pxrow = TILEPATTERN_HEIGHT - 1 - pxrow;
+        pixels = f->vram->patterns[tile >> 6].pxrow[pxrow];
+
+        for (unsigned p = 0; p < TILEPATTERN_HEIGHT; p++)
+        {
+            unsigned nibble = (tile & MIRROR_X) ? TILEPATTERN_HEIGHT - 1 - p : p;
+            px[p] = palette | ((pixels >> (4 * nibble)) & 0xF);
+        }
+    }
+}
+
+/** @brief Renders a row of the sprite layer, as the Sprite-Engine would.
+ *
+ * Each pixel is written as its 10-bit pixel value (SRC_SP, palette, color) with the sprite's
+ *   priority in bits 11:10. Columns without an opaque sprite pixel are 0.
+ *
+ * @param f The frame being rendered.
+ * @param row The screen row to render.
+ * @param line Output row buffer of PPU_REF_WIDTH pixels.
+ */
+static void ref_sprite_row(const ref_frame_t *f, unsigned row, uint16_t *line)
+{
+    uint8_t rank[PPU_REF_WIDTH];
+    unsigned found = 0;
+
+    for (unsigned col = 0; col < PPU_REF_WIDTH; col++)
+    {
+        line[col] = 0;
+        rank[col] = 0xFF;
+    }
+
+    if (!(f->enable & LAYER_SPR)) return;
+
+    // The OAM scanner takes the first sprites in Sprite RAM order which cover the row, whether or
+    //   not any of their pixels are on screen. Sprites do not wrap around the bottom of the screen.
+    for (unsigned i = 0; i < SPRRAM_COUNT && found < REF_SPRITES_PER_ROW; i++)
+    {
+        const ref_sprite_t *s = &f->sprites[i];
+        unsigned row_index, tile_y, pxrow;
+        uint32_t pixels[SPRITE_MAXWIDTH];
+
+        if (row < s->y || row >= s->y + s->height) continue;
+        found++;
+
+        row_index = row - s->y;
+        if (s->mirror & MIRROR_Y) row_index = s->height - 1 - row_index;
+        tile_y = (s->tile_y + row_index / TILEPATTERN_HEIGHT) % REF_PATTERN_GRID;
+        pxrow = row_index % TILEPATTERN_HEIGHT;
+
+        // Pattern addresses wrap within the 32x32 grid of Pattern RAM.
+        for (unsigned t = 0; t < s->width / TILEPATTERN_HEIGHT; t++)
+        {
+            unsigned tile_x = (s->tile_x + t) % REF_PATTERN_GRID;
+            pixels[t] = f->vram->patterns[tile_y * REF_PATTERN_GRID + tile_x].pxrow[pxrow];
+        }
+
+        for (unsigned p = 0; p < s->width && s->x + p < PPU_REF_WIDTH; p++)
+        {
+            unsigned col = s->x + p;
+            unsigned index = (s->mirror & MIRROR_X) ? s->width - 1 - p : p;
+            unsigned color = (pixels[index / 8] >> (4 * (index % 8))) & 0xF;
+
+            // Earlier sprites win ties, so only a strictly better rank replaces a pixel.
+            if (color != 0 && s->rank < rank[col])
+            {
+                rank[col] = s->rank;
+                line[col] = (s->prio << 10) | s->palette | color;
+            }
+        }
+    }
+}
@@ -0,0 +1,342 @@
+/**
+ * @file resample.c
+ * @author Andrew Spaulding
+ * @brief Polyphase resampler implementation.
+ *
+ * Converting from rate to APU_SAMPLE_RATE is the same as upsampling by L,
+ * low-pass filtering, and downsampling by M, where L / M is APU_SAMPLE_RATE /
+ * rate in lowest terms. Only every M'th filter output is needed, and only
+ * every L'th upsampled input is non-zero, so each output sample is the dot
+ * product of the last RESAMPLE_TAPS input samples with one of L "phases" of
+ * the filter. The phases are computed once, as Q15, when the resampler is
+ * created.
+ *
+ * The dot product has a NEON implementation, used when the library is built
+ * for a NEON-capable ARM target. The scalar fallback produces identical output.
+ */
+
+#include <fp-game/resample.h>
+#include <fp-game/apu.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include <noway.h>
+
+/** @brief The size of a resampler's input window, in samples. */
+#define WINDOW_SIZE (RESAMPLE_TAPS + APU_BUF_MAX)
+
+/**
+ * @brief The filter cutoff, as a fraction of the lower Nyquist frequency.
+ *
+ * With RESAMPLE_TAPS taps, this is low enough that tones from 16.5kHz up (which
+ * would alias) are attenuated by more than 70dB, and high enough that the
+ * passband is flat (within 0.1dB) to 10kHz. check-resample, in Library/tools,
+ * checks both.
+ */
+#define CUTOFF 0.82
+
+/** @brief Pi, since the library does not use libm. */
+#define PI 3.14159265358979323846
+
+/** @brief Resampler state. */
+struct resampler {
+	unsigned up;      ///< L; one filter phase per upsampled position.
+	unsigned down;    ///< M; upsampled positions advanced per output sample.
+	unsigned phase;   ///< The phase of the next output sample, [0, up).
+	unsigned pos;     ///< Index in window of the next output's first tap.
+	unsigned fill;    ///< The number of samples in window.
+	int16_t *coefs;   ///< up phases of RESAMPLE_TAPS Q15 coefficients.
+	int16_t window[WINDOW_SIZE]; ///< Recent input samples.
+};
+
+/* Helper Functions */
+static unsigned gcd(unsigned a, unsigned b);
+static double sine(double x);
+static void design(resampler_t *r);
+static int16_t dot(const int16_t *x, const int16_t *coefs);
+
+resampler_t *resample_create(unsigned rate)
+{
+	resampler_t *r;
+	unsigned g;
+
+	noway(rate == 0);
+
+	g = gcd(rate, APU_SAMPLE_RATE);
+	nowaymsg(APU_SAMPLE_RATE / g > RESAMPLE_MAX_PHASES, "Unsupported resample rate!");
+
+	nowaymsg((r = malloc(sizeof(resampler_t))) == NULL, "Resampler malloc failed!");
+	r->up = APU_SAMPLE_RATE / g;
+	r->down = rate / g;
+
+	r->coefs = malloc(r->up * RESAMPLE_TAPS * sizeof(int16_t));
+	nowaymsg(r->coefs == NULL, "Resampler malloc failed!");
+	design(r);
+
+	resample_reset(r);
+	return r;
+}
+
+void resample_destroy(resampler_t *r)
+{
+	noway(r == NULL);
+
+	free(r->coefs);
+	free(r);
+}
+
+void resample_reset(resampler_t *r)
+{
+	noway(r == NULL);
+
+	/* Start with a window of silence, so the first input is output at once. */
+	memset(r->window, 0, sizeof(r->window));
+	r->fill = RESAMPLE_TAPS - 1;
+	r->pos = 0;
+	r->phase = 0;
+}
+
+unsigned resample_process(resampler_t *r, const int16_t *in, unsigned in_len,
+                          unsigned *used, int16_t *out, unsigned out_len)
+{
+	unsigned in_pos = 0, out_pos = 0;
+
+	noway(r == NULL);
+	noway((in == NULL) && (in_len > 0));
+	noway(used == NULL);
+	noway((out == NULL) && (out_len > 0));
+
+	while (out_pos < out_len) {
+		/* Refill the window when the next output needs more input. */
+		if (r->pos + RESAMPLE_TAPS > r->fill) {
+			unsigned len;
+
+			if (in_pos == in_len) { break; }
+
+			r->fill -= r->pos;
+			memmove(r->window, &r->window[r->pos], r->fill * sizeof(int16_t));
+			r->pos = 0;
+
+			len = WINDOW_SIZE - r->fill;
+			if (len > in_len - in_pos) { len = in_len - in_pos; }
+			memcpy(&r->window[r->fill], &in[in_pos], len * sizeof(int16_t));
+			r->fill += len;
+			in_pos += len;
+			continue;
+		}
+
+		out[out_pos++] = dot(&r->window[r->pos],
+		                     &r->coefs[r->phase * RESAMPLE_TAPS]);
+
+		r->phase += r->down;
+		r->pos += r->phase / r->up;
+		r->phase %= r->up;
+	}
+
+	*used = in_pos;
+	return out_pos;
+}
+
+void resample_sound(const mixer_sound_t *in, unsigned rate, mixer_sound_t *out)
+{
+	int16_t block[APU_BUF_MAX];
+	unsigned done = 0, pos = 0;
+	unsigned block_len = 0, block_used = 0;
+	const int8_t *pcm8;
+	const int16_t *pcm16;
+	uint64_t length;
+	int16_t *samples;
+	resampler_t *r;
+
+	noway(in == NULL);
+	noway(out == NULL);
+	noway(in->samples == NULL);
+	noway((in->format != MIXER_PCM8) && (in->format != MIXER_PCM16));
+	noway((in->channels != 1) && (in->channels != 2));
+	noway(in->length == 0);
+	noway(in->loop && (in->loop_start >= in->length));
+
+	pcm8 = in->samples;
+	pcm16 = in->samples;
+	r = resample_create(rate);
+
+	length = ((uint64_t)in->length * r->up + r->down - 1) / r->down;
+	nowaymsg((samples = malloc(length * sizeof(int16_t))) == NULL,
+	         "Resampler malloc failed!");
+
+	/*
+	 * Skip the filter delay by starting the first output RESAMPLE_TAPS / 2
+	 * samples into the silence-primed window, so it lines up with input 0.
+	 */
+	r->pos = RESAMPLE_TAPS / 2;
+
+	while (done < length) {
+		unsigned want, used;
+
+		/* Read the next block as mono, padded with silence to flush the filter. */
+		if (block_used == block_len) {
+			for (block_len = 0; block_len < APU_BUF_MAX; block_len++, pos++) {
+				int16_t *b = &block[block_len];
+
+				if (pos >= in->length) {
+					*b = 0;
+				} else if (in->channels == 1) {
+					*b = (in->format == MIXER_PCM8) ? pcm8[pos] * 256 : pcm16[pos];
+				} else if (in->format == MIXER_PCM8) {
+					*b = (pcm8[2 * pos] + pcm8[2 * pos + 1]) * 128;
+				} else {
+					*b = (pcm16[2 * pos] + pcm16[2 * pos + 1]) / 2;
+				}
+			}
+			block_used = 0;
+		}
+
+		want = (length - done > APU_BUF_MAX) ? APU_BUF_MAX : length - done;
+		done += resample_process(r, &block[block_used], block_len - block_used, &used,
+		                         &samples[done], want);
+		block_used += used;
+	}
+
+	out->samples = samples;
+	out->format = MIXER_PCM16;
+	out->channels = 1;
+	out->length = length;
+	out->loop = in->loop;
+	out->loop_start = ((uint64_t)in->loop_start * r->up) / r->down;
+
+	resample_destroy(r);
+}
+
+/**
+ * @brief Computes the greatest common divisor of two numbers.
+ * @param a The first number.
+ * @param b The second number.
+ * @return The greatest common divisor.
+ */
+static unsigned gcd(unsigned a, unsigned b)
+{
+	while (b != 0) {
+		unsigned t = a % b;
+
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+/**
+ * @brief Computes sin(x), to well beyond Q15 precision.
+ *
+ * The library is not linked with libm, and the filter is only designed once
+ * per resampler, so a short Taylor series is enough.
+ *
+ * @param x The angle, in radians.
+ * @return sin(x).
+ */
+static double sine(double x)
+{
+	double term, sum;
+
+	/* Reduce to [-pi/2, pi/2], where the series converges quickly. */
+	x -= 2 * PI * (long)(x / (2 * PI) + ((x >= 0) ? 0.5 : -0.5));
+	if (x > PI / 2) { x = PI - x; }
+	if (x < -PI / 2) { x = -PI - x; }
+
+	term = x;
+	sum = x;
+	for (int i = 1; i < 10; i++) {
+		term *= -x * x / ((2 * i) * (2 * i + 1));
+		sum += term;
+	}
+
+	return sum;
+}
+
+/**
+ * @brief Designs the filter phases of a resampler.
+ *
+ * The prototype filter is a Blackman-Harris windowed sinc of
+ * up * RESAMPLE_TAPS taps at the upsampled rate, cut off below the lower of the
+ * two Nyquist frequencies. The window's sidelobes are below the rounding noise
+ * of the Q15 coefficients. It is centered on tap up * RESAMPLE_TAPS / 2, so its
+ * delay is exactly RESAMPLE_TAPS / 2 input samples. Phase p, tap t takes
+ * prototype tap p + (RESAMPLE_TAPS - 1 - t) * up, so that each phase is applied
+ * to the input in order. Each phase is scaled to a gain of exactly 1, so
+ * silence and DC pass through unchanged.
+ *
+ * @param r The resampler, with up and down set.
+ */
+static void design(resampler_t *r)
+{
+	const unsigned n = r->up * RESAMPLE_TAPS;
+	const double center = n / 2.0;
+	const double fc = CUTOFF / (2.0 * ((r->up > r->down) ? r->up : r->down));
+	double taps[RESAMPLE_TAPS];
+
+	for (unsigned p = 0; p < r->up; p++) {
+		double sum = 0;
+		int total = 0;
+		int16_t *c = &r->coefs[p * RESAMPLE_TAPS];
+
+		for (unsigned t = 0; t < RESAMPLE_TAPS; t++) {
+			unsigned i = p + (RESAMPLE_TAPS - 1 - t) * r->up;
+			double x = i - center;
+			double sinc = (x == 0) ? 2 * fc : sine(2 * PI * fc * x) / (PI * x);
+			double w = 0.35875 - 0.48829 * sine(2 * PI * i / n + PI / 2)
+			           + 0.14128 * sine(4 * PI * i / n + PI / 2)
+			           - 0.01168 * sine(6 * PI * i / n + PI / 2);
+
+			taps[t] = sinc * w;
+			sum += taps[t];
+		}
+
+		/* Round to Q15, putting the rounding error on the center tap. */
+		for (unsigned t = 0; t < RESAMPLE_TAPS; t++) {
+			double q = taps[t] * 32768 / sum;
+
+			c[t] = (int16_t)((q >= 0) ? q + 0.5 : q - 0.5);
+			total += c[t];
+		}
+		c[RESAMPLE_TAPS / 2] += 32768 - total;
+	}
+}
+
+/**
+ * @brief Filters one output sample.
+ * @param x The RESAMPLE_TAPS input samples, oldest first.
+ * @param coefs The Q15 coefficients of the filter phase.
+ * @return The output sample, rounded and saturated.
+ */
+static int16_t dot(const int16_t *x, const int16_t *coefs)
+{
+	int64_t sum = 0;
+	unsigned i = 0;
+
+#ifdef __ARM_NEON
+	int32x4_t acc = vdupq_n_s32(0);
+	int64x2_t wide = vdupq_n_s64(0);
+
+	/* No coefficient is -32768, so a sum of two products fits in 32 bits. */
+	for (; i + 8 <= RESAMPLE_TAPS; i += 8) {
+		int16x8_t s = vld1q_s16(&x[i]);
+		int16x8_t c = vld1q_s16(&coefs[i]);
+
+		acc = vmull_s16(vget_low_s16(s), vget_low_s16(c));
+		acc = vmlal_s16(acc, vget_high_s16(s), vget_high_s16(c));
+		wide = vpadalq_s32(wide, acc);
+	}
+	sum = vgetq_lane_s64(wide, 0) + vgetq_lane_s64(wide, 1);
+#endif
+
+	for (; i < RESAMPLE_TAPS; i++) { sum += x[i] * coefs[i]; }
+
+	sum = (sum + (1 << 14)) >> 15;
+	return (sum > INT16_MAX) ? INT16_MAX : (sum < INT16_MIN) ? INT16_MIN : sum;
+}
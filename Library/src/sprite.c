@@ -0,0 +1,304 @@
+/** @file sprite.c
+ * @author Joseph Yankel
+ * @brief Retained-mode sprite pool implementation
+ */
+
+
+/* ================ */
+/* === Includes === */
+/* ================ */
+#include <fp-game/ppu.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include <noway.h>
+#include <ppu_internal.h>
+
+
+/* ================== */
+/* === Anti-Magic === */
+/* ================== */
+#define SLOT_BITS 6 ///< Bits of a handle used for the slot; the rest hold the slot's generation
+
+_Static_assert((1 << SLOT_BITS) == SPRITE_MAXCOUNT, "SLOT_BITS does not match SPRITE_MAXCOUNT");
+
+
+/* ====================== */
+/* === Pool Variables === */
+/* ====================== */
+/** @brief Pool state, stored as one array per sprite field.
+ *
+ * Sprites are changed a field at a time (moving is by far the most common change), so only the
+ *   arrays touched by a change are written. The packed copies of Sprite RAM are kept alongside so a
+ *   flush only repacks the slots which changed, and the dirty masks are split by which packed word
+ *   each field lives in.
+ */
+static struct
+{
+    uint16_t x[SPRITE_MAXCOUNT];
+    uint8_t y[SPRITE_MAXCOUNT];
+    uint16_t pattern_addr[SPRITE_MAXCOUNT];
+    uint8_t palette_id[SPRITE_MAXCOUNT];
+    uint8_t mirror[SPRITE_MAXCOUNT];
+    uint8_t prio[SPRITE_MAXCOUNT];
+    uint8_t width[SPRITE_MAXCOUNT];
+    uint8_t height[SPRITE_MAXCOUNT];
+
+    uint32_t gen[SPRITE_MAXCOUNT]; ///< Bumped whenever a slot's handle stops being valid
+
+    uint64_t used;        ///< Bit i set if slot i belongs to a live handle
+    uint64_t dirty_main;  ///< Bit i set if x, y, pattern_addr or palette_id of slot i changed
+    uint64_t dirty_extra; ///< Bit i set if mirror, width, height or prio of slot i changed
+
+    uint32_t oam_main[SPRITE_MAXCOUNT]; ///< Packed main sprite data
+    uint8_t oam_extra[SPRITE_MAXCOUNT]; ///< Packed extra sprite data
+} pool;
+
+static bool pool_init = false;
+
+
+/* ========================= */
+/* === Helper Prototypes === */
+/* ========================= */
+static void pool_lazy_init(void);
+static sprite_handle_t make_handle(unsigned slot);
+static unsigned check_handle(sprite_handle_t handle);
+static void store_sprite(unsigned slot, const sprite_t *sprite);
+
+
+/* ======================= */
+/* === PPU Sprite Pool === */
+/* ======================= */
+sprite_handle_t ppu_sprite_create(const sprite_t *sprite)
+{
+    unsigned slot;
+
+    nowaymsg(sprite == NULL, "Sprite is NULL!");
+    ppu_check_sprite(sprite);
+    pool_lazy_init();
+
+    if (~pool.used == 0)
+    {
+        return -1; // All sprites in use
+    }
+
+    slot = __builtin_ctzll(~pool.used); // Lowest free slot
+    pool.used |= 1ULL << slot;
+    store_sprite(slot, sprite);
+
+    return make_handle(slot);
+}
+
+void ppu_sprite_free(sprite_handle_t handle)
+{
+    unsigned slot = check_handle(handle);
+
+    // Only y needs to change to hide the sprite; the other fields are left as they were. The
+    //   generation is bumped so that the handle can't be used on whichever sprite gets the slot next.
+    pool.used &= ~(1ULL << slot);
+    pool.gen[slot]++;
+    pool.y[slot] = SPRITE_HIDDEN_Y;
+    pool.dirty_main |= 1ULL << slot;
+}
+
+void ppu_sprite_set(sprite_handle_t handle, const sprite_t *sprite)
+{
+    unsigned slot = check_handle(handle);
+
+    nowaymsg(sprite == NULL, "Sprite is NULL!");
+    ppu_check_sprite(sprite);
+
+    store_sprite(slot, sprite);
+}
+
+void ppu_sprite_move(sprite_handle_t handle, unsigned x, unsigned y)
+{
+    unsigned slot = check_handle(handle);
+
+    nowaymsg(y > SPRITE_MAXY, "Sprite y coord. out of range!");
+    nowaymsg(x > SPRITE_MAXX, "Sprite x coord. out of range!");
+
+    pool.x[slot] = x;
+    pool.y[slot] = y;
+    pool.dirty_main |= 1ULL << slot;
+}
+
+void ppu_sprite_set_pattern(sprite_handle_t handle, pattern_addr_t pattern_addr,
+                            unsigned palette_id)
+{
+    unsigned slot = check_handle(handle);
+
+    nowaymsg(pattern_addr > PATTERN_MAXADDR, "Pattern address malformed!");
+    nowaymsg(palette_id >= SPRLAYER_MAX_PALETTES, "Palette ID out of range!");
+
+    pool.pattern_addr[slot] = pattern_addr;
+    pool.palette_id[slot] = palette_id;
+    pool.dirty_main |= 1ULL << slot;
+}
+
+void ppu_sprite_set_attr(sprite_handle_t handle, mirror_e mirror, render_prio_e prio)
+{
+    unsigned slot = check_handle(handle);
+
+    nowaymsg(mirror > MIRROR_MAXVAL, "Mirror argument malformed!");
+    nowaymsg(prio > SPRITE_MAX_PRIO, "Sprite Priority exceeds maximum (2)!");
+
+    pool.mirror[slot] = mirror;
+    pool.prio[slot] = prio;
+    pool.dirty_extra |= 1ULL << slot;
+}
+
+int ppu_sprite_flush(void)
+{
+    struct ppu_write_seg segs[2];
+    unsigned nsegs = 0;
+    unsigned first;
+    unsigned last;
+    unsigned slot;
+    uint64_t dirty;
+
+    pool_lazy_init();
+
+    // Repack only the changed slots. Each group is then sent as one contiguous run from the lowest
+    //   to the highest dirty slot, so the clean slots in between are resent from the packed copy.
+    if (pool.dirty_main != 0)
+    {
+        for (dirty = pool.dirty_main; dirty != 0; dirty &= dirty - 1)
+        {
+            slot = __builtin_ctzll(dirty);
+            pool.oam_main[slot] = ((uint32_t)pool.pattern_addr[slot] << 22) |
+                                  ((uint32_t)pool.palette_id[slot] << 17) |
+                                  ((uint32_t)pool.y[slot] << 9) | (uint32_t)pool.x[slot];
+        }
+
+        first = __builtin_ctzll(pool.dirty_main);
+        last = 63 - __builtin_clzll(pool.dirty_main);
+        ppu_make_seg(&segs[nsegs++], VRAM_SPRITESOFFSET + first * SPRITE_BSIZE,
+                     (last - first + 1) * SPRITE_BSIZE, &pool.oam_main[first]);
+    }
+
+    if (pool.dirty_extra != 0)
+    {
+        for (dirty = pool.dirty_extra; dirty != 0; dirty &= dirty - 1)
+        {
+            slot = __builtin_ctzll(dirty);
+            pool.oam_extra[slot] = (pool.mirror[slot] << 6) | ((pool.height[slot] - 1) << 4) |
+                                   ((pool.width[slot] - 1) << 2) | pool.prio[slot];
+        }
+
+        first = __builtin_ctzll(pool.dirty_extra);
+        last = 63 - __builtin_clzll(pool.dirty_extra);
+        ppu_make_seg(&segs[nsegs++], VRAM_SPRITESOFFSET + SPRRAM_EXTRAOFFSET + first,
+                     last - first + 1, &pool.oam_extra[first]);
+    }
+
+    if (nsegs == 0)
+    {
+        return 0; // Nothing changed
+    }
+
+    if (ppu_write_segs(segs, nsegs) == -1)
+    {
+        return -1; // Keep the dirty masks so the next flush retries (errno == ENOMEM or EFAULT)
+    }
+
+    pool.dirty_main = 0;
+    pool.dirty_extra = 0;
+
+    return 0;
+}
+
+void ppu_sprite_reset(void)
+{
+    unsigned i;
+
+    // Every handle handed out so far becomes invalid, and the pool starts over on its next use.
+    for (i = 0; i < SPRITE_MAXCOUNT; i++)
+    {
+        pool.gen[i]++;
+    }
+
+    pool_init = false;
+}
+
+
+/* ======================== */
+/* === Helper Functions === */
+/* ======================== */
+/** @brief Sets up the pool on first use, with every slot free, hidden and dirty.
+ *
+ * Marking every slot dirty makes the first flush overwrite whatever was left in Sprite RAM.
+ */
+static void pool_lazy_init(void)
+{
+    unsigned i;
+
+    if (pool_init)
+    {
+        return;
+    }
+
+    for (i = 0; i < SPRITE_MAXCOUNT; i++)
+    {
+        pool.y[i] = SPRITE_HIDDEN_Y;
+        pool.width[i] = 1;
+        pool.height[i] = 1;
+    }
+
+    pool.used = 0;
+    pool.dirty_main = ~0ULL;
+    pool.dirty_extra = ~0ULL;
+    pool_init = true;
+}
+
+/** @brief Makes the handle of the sprite currently in a slot.
+ *
+ * The slot is in the low SLOT_BITS of the handle, and its generation in the rest. Handles are never
+ *   negative, and are unique until a slot's generation wraps.
+ *
+ * @param slot The slot of the sprite.
+ */
+static sprite_handle_t make_handle(unsigned slot)
+{
+    return (sprite_handle_t)(((pool.gen[slot] << SLOT_BITS) | slot) & INT_MAX);
+}
+
+/** @brief Exits the program if a handle does not refer to a live sprite.
+ *
+ * Handles to freed sprites are caught even once their slot has been reused, since the slot's
+ *   generation has moved on.
+ *
+ * @param handle The handle to check.
+ * @return The slot of the sprite.
+ */
+static unsigned check_handle(sprite_handle_t handle)
+{
+    unsigned slot = (unsigned)handle & (SPRITE_MAXCOUNT - 1);
+
+    nowaymsg(handle < 0, "Sprite handle out of range!");
+    nowaymsg(!pool_init || !(pool.used & (1ULL << slot)) || make_handle(slot) != handle,
+             "Sprite handle is not in use!");
+
+    return slot;
+}
+
+/** @brief Copies every field of an already checked sprite into a pool slot.
+ * @param slot Slot to store the sprite into.
+ * @param sprite The sprite to store.
+ */
+static void store_sprite(unsigned slot, const sprite_t *sprite)
+{
+    pool.x[slot] = sprite->x;
+    pool.y[slot] = sprite->y;
+    pool.pattern_addr[slot] = sprite->pattern_addr;
+    pool.palette_id[slot] = sprite->palette_id;
+    pool.mirror[slot] = sprite->mirror;
+    pool.prio[slot] = sprite->prio;
+    pool.width[slot] = sprite->width;
+    pool.height[slot] = sprite->height;
+
+    pool.dirty_main |= 1ULL << slot;
+    pool.dirty_extra |= 1ULL << slot;
+}
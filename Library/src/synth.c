@@ -0,0 +1,507 @@
+/**
+ * @file synth.c
+ * @author Andrew Spaulding
+ * @brief Chiptune synthesizer implementation.
+ *
+ * Every channel is driven by a 32-bit phase accumulator, which wraps once per
+ * period of the note being played; its step is the note frequency scaled by
+ * 2^32 / APU_SAMPLE_RATE. The waveform is read from the top bits of the phase,
+ * so each channel's inner loop is an add and a select, with no branches on the
+ * phase.
+ *
+ * Channels add their samples, scaled by their volume, to an int32 accumulator.
+ * A channel's levels span [-128, 128], so at SYNTH_VOLUME_MAX it adds at most
+ * 1920. The accumulator is scaled by the master volume and narrowed to int8
+ * with saturation once every channel is rendered, using NEON when the library
+ * is built for a NEON-capable ARM target.
+ *
+ * Blocks are rendered in runs which end at tick boundaries, so that notes,
+ * envelopes and sweeps change at exact sample positions. A tick is
+ * APU_SAMPLE_RATE / SYNTH_TICK_RATE samples, with the remainder spread evenly.
+ */
+
+#include <fp-game/synth.h>
+#include <fp-game/apu.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include <noway.h>
+
+/** @brief The shift which narrows the master-scaled accumulator to int8. */
+#define OUT_SHIFT 13
+
+/** @brief The initial state of the noise LFSR. */
+#define LFSR_SEED 1
+
+/** @brief Synthesizer channel state. */
+struct channel {
+	synth_instrument_t inst; ///< The instrument notes are played with.
+	bool on;                 ///< True if a note is sounding.
+	uint32_t phase;          ///< Position in the waveform period.
+	uint32_t step;           ///< Phase added per sample, from the note and sweep.
+	int volume;              ///< Current envelope volume.
+	unsigned env_count;      ///< Ticks until the next envelope step.
+	unsigned sweep_count;    ///< Ticks until the next sweep step.
+	uint32_t lfsr;           ///< Noise shift register.
+};
+
+/** @brief Phase steps of the notes of octave 7, C to B. Lower octaves halve them. */
+static const uint32_t octave_steps[12] = {
+	280918312, 297622584, 315320144, 334070055, 353934894, 374980958,
+	397278486, 420901894, 445930023, 472446403, 500539528, 530303157,
+};
+
+/** @brief Phase below which a pulse is high, for each duty cycle. */
+static const uint32_t duty_thresholds[] = {
+	[SYNTH_DUTY_12] = 0x20000000,
+	[SYNTH_DUTY_25] = 0x40000000,
+	[SYNTH_DUTY_50] = 0x80000000,
+	[SYNTH_DUTY_75] = 0xC0000000,
+};
+
+/** @brief The instrument channels use until a song or note gives them one. */
+static const synth_instrument_t default_inst = {
+	.volume = SYNTH_VOLUME_MAX,
+	.duty = SYNTH_DUTY_50,
+};
+
+/** @brief Protects all synthesizer state; held while rendering. */
+static pthread_mutex_t synth_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief The channels. Silent until a note is played. */
+static struct channel channels[SYNTH_CHANNELS] = {
+	[0 ... SYNTH_CHANNELS - 1] = { .inst = { .volume = SYNTH_VOLUME_MAX,
+	                                         .duty = SYNTH_DUTY_50 },
+	                               .lfsr = LFSR_SEED },
+};
+
+/** @brief The master volume. */
+static unsigned master = SYNTH_MASTER_MAX;
+
+/** @brief Sequencer state. */
+static struct {
+	const synth_song_t *song; ///< The song playing, or NULL.
+	unsigned order;           ///< Order position of the next row.
+	unsigned row;             ///< Next row of the pattern.
+	unsigned row_ticks;       ///< Ticks until the next row.
+	unsigned tick_samples;    ///< Samples left in the current tick.
+	unsigned tick_error;      ///< Accumulated remainder of the tick length.
+} seq;
+
+/* Helper Functions */
+static void check_instrument(const synth_instrument_t *inst);
+static void check_song(const synth_song_t *song);
+static void start_note(struct channel *c, unsigned note);
+static void play_row(void);
+static void tick(void);
+static void render_pulse(struct channel *c, int32_t *acc, unsigned len);
+static void render_triangle(struct channel *c, int32_t *acc, unsigned len);
+static void render_noise(struct channel *c, int32_t *acc, unsigned len);
+static void render_wave(struct channel *c, int32_t *acc, unsigned len);
+static void narrow(int8_t *out, const int32_t *acc, unsigned len, int32_t gain);
+
+void synth_play(const synth_song_t *song)
+{
+	check_song(song);
+
+	pthread_mutex_lock(&synth_lock);
+
+	for (int i = 0; i < SYNTH_CHANNELS; i++) {
+		channels[i].inst = default_inst;
+		channels[i].on = false;
+	}
+
+	seq.song = song;
+	seq.order = 0;
+	seq.row = 0;
+	seq.row_ticks = 0;
+
+	pthread_mutex_unlock(&synth_lock);
+}
+
+void synth_stop(void)
+{
+	pthread_mutex_lock(&synth_lock);
+
+	seq.song = NULL;
+	for (int i = 0; i < SYNTH_CHANNELS; i++) { channels[i].on = false; }
+
+	pthread_mutex_unlock(&synth_lock);
+}
+
+bool synth_playing(void)
+{
+	bool playing;
+
+	pthread_mutex_lock(&synth_lock);
+	playing = (seq.song != NULL);
+	pthread_mutex_unlock(&synth_lock);
+
+	return playing;
+}
+
+void synth_note(synth_channel_e channel, unsigned note, const synth_instrument_t *instrument)
+{
+	noway((unsigned)channel >= SYNTH_CHANNELS);
+	noway((note == SYNTH_NOTE_NONE)
+	      || ((note > SYNTH_NOTE_MAX) && (note != SYNTH_NOTE_OFF)));
+	check_instrument(instrument);
+	noway((channel == SYNTH_WAVE) && (instrument->wave == NULL));
+
+	pthread_mutex_lock(&synth_lock);
+	channels[channel].inst = *instrument;
+	start_note(&channels[channel], note);
+	pthread_mutex_unlock(&synth_lock);
+}
+
+void synth_set_master(unsigned volume)
+{
+	noway(volume > SYNTH_MASTER_MAX);
+
+	pthread_mutex_lock(&synth_lock);
+	master = volume;
+	pthread_mutex_unlock(&synth_lock);
+}
+
+void synth_render(int8_t *out, unsigned len)
+{
+	int32_t acc[APU_BUF_MAX] = { 0 };
+	unsigned done, n;
+	int32_t gain;
+
+	noway(out == NULL);
+	noway(len > APU_BUF_MAX);
+
+	pthread_mutex_lock(&synth_lock);
+
+	for (done = 0; done < len; done += n) {
+		if (seq.tick_samples == 0) { tick(); }
+
+		n = len - done;
+		if (n > seq.tick_samples) { n = seq.tick_samples; }
+		seq.tick_samples -= n;
+
+		if (channels[SYNTH_PULSE1].on) {
+			render_pulse(&channels[SYNTH_PULSE1], &acc[done], n);
+		}
+		if (channels[SYNTH_PULSE2].on) {
+			render_pulse(&channels[SYNTH_PULSE2], &acc[done], n);
+		}
+		if (channels[SYNTH_TRIANGLE].on) {
+			render_triangle(&channels[SYNTH_TRIANGLE], &acc[done], n);
+		}
+		if (channels[SYNTH_NOISE].on) {
+			render_noise(&channels[SYNTH_NOISE], &acc[done], n);
+		}
+		if (channels[SYNTH_WAVE].on) {
+			render_wave(&channels[SYNTH_WAVE], &acc[done], n);
+		}
+	}
+
+	gain = master;
+	pthread_mutex_unlock(&synth_lock);
+
+	narrow(out, acc, len, gain);
+}
+
+void synth_callback(const int8_t **buf, int *buf_size)
+{
+	static int8_t samples[APU_BUF_MAX];
+
+	synth_render(samples, APU_BUF_MAX);
+
+	*buf = samples;
+	*buf_size = APU_BUF_MAX;
+}
+
+/**
+ * @brief Checks that an instrument is valid.
+ * @param inst The instrument to check.
+ */
+static void check_instrument(const synth_instrument_t *inst)
+{
+	noway(inst == NULL);
+	noway(inst->volume > SYNTH_VOLUME_MAX);
+	noway((inst->sweep_dir < -1) || (inst->sweep_dir > 1));
+	noway((inst->sweep_dir != 0) && (inst->sweep_period == 0));
+	noway(inst->sweep_shift > 31);
+	noway((unsigned)inst->duty > SYNTH_DUTY_75);
+}
+
+/**
+ * @brief Checks that a song is valid, so that it can be played unchecked.
+ * @param song The song to check.
+ */
+static void check_song(const synth_song_t *song)
+{
+	noway(song == NULL);
+	noway((song->instruments == NULL) && (song->instrument_count > 0));
+	noway((song->patterns == NULL) || (song->pattern_count == 0));
+	noway((song->order == NULL) || (song->order_length == 0));
+	noway(song->loop && (song->loop_start >= song->order_length));
+	noway(song->speed == 0);
+
+	for (unsigned i = 0; i < song->instrument_count; i++) {
+		check_instrument(&song->instruments[i]);
+	}
+
+	for (unsigned i = 0; i < song->order_length; i++) {
+		nowaymsg(song->order[i] >= song->pattern_count, "Bad song order!");
+	}
+
+	for (unsigned i = 0; i < song->pattern_count; i++) {
+		const synth_pattern_t *p = &song->patterns[i];
+
+		noway((p->rows == NULL) || (p->length == 0));
+		for (unsigned r = 0; r < p->length; r++) {
+			for (int ch = 0; ch < SYNTH_CHANNELS; ch++) {
+				const synth_cell_t *cell = &p->rows[r][ch];
+
+				nowaymsg((cell->note > SYNTH_NOTE_MAX)
+				         && (cell->note != SYNTH_NOTE_OFF), "Bad song note!");
+				nowaymsg(cell->instrument > song->instrument_count,
+				         "Bad song instrument!");
+				nowaymsg((ch == SYNTH_WAVE) && (cell->instrument > 0)
+				         && (song->instruments[cell->instrument - 1].wave == NULL),
+				         "Wave channel instrument has no wave!");
+			}
+		}
+	}
+}
+
+/**
+ * @brief Starts a note on a channel, with the channel's instrument.
+ * @param c The channel.
+ * @param note The note number, or SYNTH_NOTE_OFF.
+ */
+static void start_note(struct channel *c, unsigned note)
+{
+	unsigned octave, semitone;
+
+	/* The wave channel is silent until it is given a wave. */
+	if ((note == SYNTH_NOTE_OFF)
+	    || ((c == &channels[SYNTH_WAVE]) && (c->inst.wave == NULL))) {
+		c->on = false;
+		return;
+	}
+
+	octave = (note - 1) / 12;
+	semitone = (note - 1) % 12;
+
+	c->on = true;
+	c->phase = 0;
+	c->step = octave_steps[semitone] >> (7 - octave);
+	c->volume = c->inst.volume;
+	c->env_count = c->inst.env_period;
+	c->sweep_count = c->inst.sweep_period;
+	c->lfsr = LFSR_SEED;
+}
+
+/**
+ * @brief Plays the next row of the song, or ends the song if there are none.
+ */
+static void play_row(void)
+{
+	const synth_song_t *song = seq.song;
+	const synth_pattern_t *p;
+
+	if (seq.order == song->order_length) {
+		seq.song = NULL;
+		for (int i = 0; i < SYNTH_CHANNELS; i++) { channels[i].on = false; }
+		return;
+	}
+
+	p = &song->patterns[song->order[seq.order]];
+	for (int i = 0; i < SYNTH_CHANNELS; i++) {
+		const synth_cell_t *cell = &p->rows[seq.row][i];
+
+		if (cell->instrument > 0) {
+			channels[i].inst = song->instruments[cell->instrument - 1];
+		}
+		if (cell->note != SYNTH_NOTE_NONE) { start_note(&channels[i], cell->note); }
+	}
+
+	if (++seq.row == p->length) {
+		seq.row = 0;
+		if ((++seq.order == song->order_length) && song->loop) {
+			seq.order = song->loop_start;
+		}
+	}
+	seq.row_ticks = song->speed;
+}
+
+/**
+ * @brief Advances the sequencer, envelopes and sweeps by one tick, and starts
+ *        the next tick.
+ */
+static void tick(void)
+{
+	if ((seq.song != NULL) && (seq.row_ticks == 0)) { play_row(); }
+	if (seq.song != NULL) { seq.row_ticks--; }
+
+	for (int i = 0; i < SYNTH_CHANNELS; i++) {
+		struct channel *c = &channels[i];
+
+		if (!c->on) { continue; }
+
+		if ((c->inst.env_period != 0) && (--c->env_count == 0)) {
+			c->env_count = c->inst.env_period;
+			c->volume += c->inst.env_step;
+			if (c->volume < 0) { c->volume = 0; }
+			if (c->volume > SYNTH_VOLUME_MAX) { c->volume = SYNTH_VOLUME_MAX; }
+		}
+
+		if ((c->inst.sweep_dir != 0) && (--c->sweep_count == 0)) {
+			uint32_t delta = c->step >> c->inst.sweep_shift;
+
+			c->sweep_count = c->inst.sweep_period;
+			c->step = (c->inst.sweep_dir > 0) ? c->step + delta : c->step - delta;
+
+			/* Mute once the note passes the Nyquist frequency. */
+			if (c->step >= 0x80000000) { c->on = false; }
+		}
+	}
+
+	seq.tick_samples = APU_SAMPLE_RATE / SYNTH_TICK_RATE;
+	seq.tick_error += APU_SAMPLE_RATE % SYNTH_TICK_RATE;
+	if (seq.tick_error >= SYNTH_TICK_RATE) {
+		seq.tick_error -= SYNTH_TICK_RATE;
+		seq.tick_samples++;
+	}
+}
+
+/**
+ * @brief Renders a pulse channel into the accumulator.
+ * @param c The channel.
+ * @param acc The accumulator.
+ * @param len The number of samples.
+ */
+static void render_pulse(struct channel *c, int32_t *acc, unsigned len)
+{
+	const uint32_t threshold = duty_thresholds[c->inst.duty];
+	const uint32_t step = c->step;
+	const int32_t amp = c->volume * 128;
+	uint32_t phase = c->phase;
+
+	for (unsigned i = 0; i < len; i++) {
+		acc[i] += (phase < threshold) ? amp : -amp;
+		phase += step;
+	}
+
+	c->phase = phase;
+}
+
+/**
+ * @brief Renders a triangle channel into the accumulator.
+ *
+ * The triangle climbs through 16 levels over the first half of its period and
+ * falls back through them over the second.
+ *
+ * @param c The channel.
+ * @param acc The accumulator.
+ * @param len The number of samples.
+ */
+static void render_triangle(struct channel *c, int32_t *acc, unsigned len)
+{
+	const uint32_t step = c->step;
+	const int32_t volume = c->volume;
+	uint32_t phase = c->phase;
+
+	for (unsigned i = 0; i < len; i++) {
+		uint32_t t = phase >> 27;
+		int32_t level = (t & 15) ^ ((t >> 4) * 15);
+
+		acc[i] += (level * 16 - 120) * volume;
+		phase += step;
+	}
+
+	c->phase = phase;
+}
+
+/**
+ * @brief Renders a noise channel into the accumulator.
+ *
+ * The LFSR shifts each time the phase wraps, taking the XOR of its low bit and
+ * bit 1 (or bit 6, for short noise) as the new high bit. Its low bit selects
+ * the output level.
+ *
+ * @param c The channel.
+ * @param acc The accumulator.
+ * @param len The number of samples.
+ */
+static void render_noise(struct channel *c, int32_t *acc, unsigned len)
+{
+	const uint32_t step = (c->step >= 0x40000000) ? UINT32_MAX : c->step << 2;
+	const unsigned tap = (c->inst.noise_short) ? 6 : 1;
+	const int32_t amp = c->volume * 128;
+	uint32_t phase = c->phase, lfsr = c->lfsr;
+
+	for (unsigned i = 0; i < len; i++) {
+		uint32_t next = phase + step;
+		uint32_t shifted = (lfsr >> 1) | (((lfsr ^ (lfsr >> tap)) & 1) << 14);
+
+		lfsr = (next < phase) ? shifted : lfsr;
+		phase = next;
+		acc[i] += (lfsr & 1) ? -amp : amp;
+	}
+
+	c->phase = phase;
+	c->lfsr = lfsr;
+}
+
+/**
+ * @brief Renders a wavetable channel into the accumulator.
+ * @param c The channel.
+ * @param acc The accumulator.
+ * @param len The number of samples.
+ */
+static void render_wave(struct channel *c, int32_t *acc, unsigned len)
+{
+	const int8_t *wave = c->inst.wave;
+	const uint32_t step = c->step;
+	const int32_t volume = c->volume;
+	uint32_t phase = c->phase;
+
+	for (unsigned i = 0; i < len; i++) {
+		acc[i] += wave[phase >> 27] * volume;
+		phase += step;
+	}
+
+	c->phase = phase;
+}
+
+/**
+ * @brief Scales the accumulator by the master volume and narrows it to int8
+ *        samples, saturating.
+ * @param out Where to store the samples.
+ * @param acc The accumulator.
+ * @param len The number of samples.
+ * @param gain The master volume, [0, SYNTH_MASTER_MAX].
+ */
+static void narrow(int8_t *out, const int32_t *acc, unsigned len, int32_t gain)
+{
+	unsigned i = 0;
+
+#ifdef __ARM_NEON
+	for (; i + 8 <= len; i += 8) {
+		int16x8_t s = vcombine_s16(vqshrn_n_s32(vmulq_n_s32(vld1q_s32(&acc[i]), gain),
+		                                        OUT_SHIFT),
+		                           vqshrn_n_s32(vmulq_n_s32(vld1q_s32(&acc[i + 4]), gain),
+		                                        OUT_SHIFT));
+		vst1_s8(&out[i], vqmovn_s16(s));
+	}
+#endif
+
+	for (; i < len; i++) {
+		int32_t s = (acc[i] * gain) >> OUT_SHIFT;
+
+		out[i] = (s > INT8_MAX) ? INT8_MAX : (s < INT8_MIN) ? INT8_MIN : s;
+	}
+}
@@ -0,0 +1,33 @@
+/**
+ * @file bench.h
+ * @author Joseph Yankel
+ * @brief Timing helpers shared by the host benchmarks and fpgame-apu-shim.so in this folder.
+ *
+ * The APU buffer period below needs fp-game/apu.h, which benchmarks of audio code include first.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+
+/** @brief Gets the monotonic time, in nanoseconds. */
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** @brief The time one full APU buffer takes to play, in ns and in us. */
+//@{
+#define BUF_NS (1000000000ULL * APU_BUF_MAX / APU_SAMPLE_RATE)
+#define BUF_US (BUF_NS / 1000.0)
+//@}
+
+/** @brief The load of work taking @p us per APU buffer, as a % of the time the buffer plays for. */
+#define BUF_LOAD(us) (100 * (us) / BUF_US)
+
+#endif /* BENCH_H */
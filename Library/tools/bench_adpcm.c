@@ -0,0 +1,146 @@
+/**
+ * @file bench_adpcm.c
+ * @author Andrew Spaulding
+ * @brief Host benchmark of decoding IMA-ADPCM streams.
+ *
+ * Usage: bench-adpcm [passes]
+ *
+ * Writes ten seconds of reproducible audio (two tones and some noise) as a
+ * WAV file in a temporary folder, and encodes it with fpgame-adpcm, which must
+ * be built next to this program. The stream is then decoded from start to end
+ * with adpcm_decode(), a few samples per call and a full APU buffer per call,
+ * and the time per sample and the load are printed. The stream stays in the
+ * page cache, so the numbers leave out the storage.
+ *
+ * The decoded samples are also compared with the source, and the SNR printed,
+ * so that a faster decoder can be seen to decode the same thing.
+ */
+
+#define _GNU_SOURCE /* For mkdtemp */
+
+#include <fp-game/adpcm.h>
+#include <fp-game/apu.h>
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+/** @brief The length of the stream, in samples. */
+#define LENGTH (10 * APU_SAMPLE_RATE)
+
+static char dir[] = "/tmp/bench-adpcm-XXXXXX";
+static char path[256];
+static int16_t source[LENGTH];
+static int8_t decoded[LENGTH];
+
+/** @brief Gets the path of a file in the temporary folder. */
+static const char *file(const char *name)
+{
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	return path;
+}
+
+/** @brief Writes a little-endian value of len bytes. */
+static void put(FILE *fp, uint32_t value, unsigned len)
+{
+	for (unsigned i = 0; i < len; i++) { fputc((value >> (8 * i)) & 0xFF, fp); }
+}
+
+/** @brief Writes the source audio as a 16-bit mono WAV file. */
+static void write_wav(void)
+{
+	FILE *fp = fopen(file("in.wav"), "wb");
+	uint32_t seed = 1;
+
+	if (fp == NULL) {
+		perror("in.wav");
+		exit(EXIT_FAILURE);
+	}
+
+	for (unsigned i = 0; i < LENGTH; i++) {
+		double t = (double)i / APU_SAMPLE_RATE;
+
+		seed = seed * 1664525 + 1013904223;
+		source[i] = 12000 * sin(2 * M_PI * 440 * t)
+		            + 6000 * sin(2 * M_PI * 1250 * t)
+		            + (int16_t)(seed >> 16) / 32;
+	}
+
+	fputs("RIFF", fp);
+	put(fp, 36 + 2 * LENGTH, 4);
+	fputs("WAVEfmt ", fp);
+	put(fp, 16, 4);
+	put(fp, 1, 2);                   /* PCM */
+	put(fp, 1, 2);                   /* Mono */
+	put(fp, APU_SAMPLE_RATE, 4);
+	put(fp, 2 * APU_SAMPLE_RATE, 4); /* Bytes per second */
+	put(fp, 2, 2);                   /* Bytes per frame */
+	put(fp, 16, 2);
+	fputs("data", fp);
+	put(fp, 2 * LENGTH, 4);
+	for (unsigned i = 0; i < LENGTH; i++) { put(fp, (uint16_t)source[i], 2); }
+
+	fclose(fp);
+}
+
+/** @brief Decodes the stream in calls of len samples, and prints the time. */
+static void run(adpcm_stream_t *stream, unsigned len, unsigned passes)
+{
+	uint64_t start;
+	double ns;
+
+	start = now_ns();
+	for (unsigned p = 0; p < passes; p++) {
+		unsigned pos = 0, n;
+
+		adpcm_rewind(stream);
+		while ((n = adpcm_decode(stream, &decoded[pos], len)) != 0) { pos += n; }
+		if (pos != LENGTH) {
+			fprintf(stderr, "bench-adpcm: decoded %u of %u samples\n", pos, LENGTH);
+			exit(EXIT_FAILURE);
+		}
+	}
+	ns = (double)(now_ns() - start) / passes / LENGTH;
+
+	printf("%3u samples/call %6.2f ns/sample %7.1f Msamples/s %6.3f%% of real time\n",
+	       len, ns, 1000 / ns, BUF_LOAD(ns * APU_BUF_MAX / 1000));
+}
+
+int main(int argc, char **argv)
+{
+	unsigned passes = (argc > 1) ? (unsigned)atoi(argv[1]) : 50;
+	adpcm_stream_t *stream;
+	double signal = 0, noise = 0;
+	char cmd[128];
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+
+	write_wav();
+	snprintf(cmd, sizeof(cmd), "./fpgame-adpcm %s/in.wav %s/out.fad", dir, dir);
+	if (system(cmd) != 0) {
+		fprintf(stderr, "bench-adpcm: fpgame-adpcm failed (build it first)\n");
+		return EXIT_FAILURE;
+	}
+
+	stream = adpcm_open(file("out.fad"));
+	run(stream, 8, passes);
+	run(stream, APU_BUF_MAX, passes);
+	adpcm_close(stream);
+
+	/* The APU plays the top 8 bits, so compare against those. */
+	for (unsigned i = 0; i < LENGTH; i++) {
+		double want = source[i] / 256.0;
+
+		signal += want * want;
+		noise += (decoded[i] - want) * (decoded[i] - want);
+	}
+	printf("SNR against the source %.1f dB\n", 10 * log10(signal / noise));
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	return (system(cmd) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,163 @@
+/**
+ * @file bench_apu_feeder.c
+ * @author Andrew Spaulding
+ * @brief Host benchmark of the APU feeder thread's latency and jitter.
+ *
+ * Usage: FPGAME_APU_WAV= LD_PRELOAD=./fpgame-apu-shim.so bench-apu-feeder [seconds]
+ *
+ * Plays silence through apu_enable_feeder() with the default 2-buffer ring,
+ * with an idle main thread, a busy one, and a busy one with a SCHED_FIFO
+ * feeder. For each, prints the callback-to-buffer latency (bucket upper bounds
+ * from apu_get_stats()), the jitter of the callback interval, and the
+ * driver's underruns.
+ *
+ * Then feeds the APU from the sample queue a 60Hz frame's worth of samples at
+ * a time, at a few ring depths, and prints the queue's and driver's underruns.
+ */
+
+#include <fp-game/apu.h>
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+
+/** @brief The most callbacks recorded per scenario. */
+#define MAX_CALLS 4096
+
+static uint64_t calls[MAX_CALLS];
+static volatile unsigned ncalls;
+static double jitter[MAX_CALLS];
+
+/** @brief The APU callback. Records when it ran, and hands back silence. */
+static void callback(const int8_t **buf, int *buf_size)
+{
+	static const int8_t silence[APU_BUF_MAX];
+
+	if (ncalls < MAX_CALLS) { calls[ncalls++] = now_ns(); }
+	*buf = silence;
+	*buf_size = APU_BUF_MAX;
+}
+
+/**
+ * @brief Gets the upper bound, in us, of the bucket holding a percentile of
+ *        the latency histogram.
+ */
+static unsigned percentile(const apu_stats_t *stats, double p)
+{
+	unsigned total = 0, seen = 0;
+
+	for (int i = 0; i < APU_STATS_BUCKETS; i++) { total += stats->latency[i]; }
+	for (int i = 0; i < APU_STATS_BUCKETS; i++) {
+		seen += stats->latency[i];
+		if (seen >= p * total) { return 64u << i; }
+	}
+	return 64u << (APU_STATS_BUCKETS - 1);
+}
+
+/** @brief Orders doubles, for qsort(). */
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/** @brief Plays for a while with the given feeder, and prints what it saw. */
+static void run(const char *name, const apu_feeder_t *attr, bool busy,
+                unsigned seconds)
+{
+	apu_stats_t stats;
+	uint64_t end;
+	unsigned n;
+
+	ncalls = 0;
+	if (apu_enable_feeder(callback, attr) != 0) {
+		printf("%-12s unavailable (could not start the feeder)\n", name);
+		return;
+	}
+
+	end = now_ns() + seconds * 1000000000ULL;
+	while (now_ns() < end) {
+		if (!busy) {
+			struct timespec ts = { 0, 1000000 };
+			nanosleep(&ts, NULL);
+		}
+	}
+
+	apu_get_stats(&stats);
+	apu_disable();
+
+	/* The first callbacks fill the ring all at once, so skip the ring's worth. */
+	n = 0;
+	for (unsigned i = stats.depth + 1; i < ncalls; i++) {
+		jitter[n++] = fabs((double)(calls[i] - calls[i - 1]) - BUF_NS) / 1000;
+	}
+	if (n == 0) { jitter[n++] = 0; }
+	qsort(jitter, n, sizeof(jitter[0]), cmp_double);
+
+	printf("%-10s latency p50 <%uus p99 <%uus | jitter p50 %.0fus p99 %.0fus max %.0fus"
+	       " | %u underruns\n", name, percentile(&stats, 0.5),
+	       percentile(&stats, 0.99), jitter[n / 2], jitter[n * 99 / 100],
+	       jitter[n - 1], stats.underruns);
+}
+
+/** @brief Feeds the APU from the sample queue at 60 frames a second. */
+static void run_queue(const char *name, const apu_feeder_t *attr,
+                      unsigned seconds)
+{
+	static const int8_t samples[APU_SAMPLE_RATE / 60 + 1];
+	apu_queue_stats_t qstats;
+	apu_stats_t stats;
+	struct timespec ts = { 0, 0 };
+	uint64_t frame_time;
+
+	if (apu_queue_enable(50, attr) != 0) {
+		printf("%-10s unavailable (could not start the feeder)\n", name);
+		return;
+	}
+
+	frame_time = now_ns();
+	for (unsigned f = 0; f < seconds * 60; f++) {
+		/* 32000 / 60 samples per frame, spread evenly. */
+		unsigned len = (f + 1) * APU_SAMPLE_RATE / 60 - f * APU_SAMPLE_RATE / 60;
+
+		apu_queue_samples(samples, len);
+
+		frame_time += 1000000000ULL / 60;
+		ts.tv_sec = frame_time / 1000000000;
+		ts.tv_nsec = frame_time % 1000000000;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+
+	apu_queue_stats(&qstats);
+	apu_get_stats(&stats);
+	apu_disable();
+
+	printf("%-10s queue underruns %lu, silence %lu samples | %u driver underruns\n",
+	       name, qstats.underruns, qstats.silence, stats.underruns);
+}
+
+int main(int argc, char **argv)
+{
+	const apu_feeder_t normal = { .priority = 0, .cpu = -1, .depth = 0 };
+	const apu_feeder_t fifo = { .priority = 10, .cpu = -1, .depth = 0 };
+	unsigned seconds = (argc > 1) ? (unsigned)atoi(argv[1]) : 2;
+
+	run("idle", &normal, false, seconds);
+	run("busy", &normal, true, seconds);
+	run("busy, fifo", &fifo, true, seconds);
+
+	for (unsigned depth = 2; depth <= 8; depth *= 2) {
+		const apu_feeder_t attr = { .priority = 0, .cpu = -1, .depth = depth };
+		char name[16];
+
+		snprintf(name, sizeof(name), "queue, %u", depth);
+		run_queue(name, &attr, seconds);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,200 @@
+/**
+ * @file bench_asset.c
+ * @author Joseph Yankel
+ * @brief Host benchmark of loading assets from a pack against loading them from the text files.
+ *
+ * Usage: bench-asset [loads]
+ *
+ * A level's worth of text assets (a full tilemap layer, all of Pattern RAM, and every palette) is
+ *   written to a temporary folder and packed with fpgame-pack, which must be built next to this
+ *   program. Each load then brings every asset into a buffer both ways: with ppu_load_tilemap(),
+ *   ppu_load_pattern() and ppu_load_palette(), and with asset_open() and the lookups. The files
+ *   stay in the page cache, so the numbers leave out the storage.
+ *
+ * Both ways must give the same bytes; the benchmark fails if they do not.
+ */
+
+#define _GNU_SOURCE /* For mkdtemp */
+
+#include <fp-game/asset.h>
+#include <fp-game/ppu.h>
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TILES (64 * 64)  ///< One full tilemap layer
+#define PATTERN_W 32     ///< Width of the pattern graphics, in patterns
+#define PATTERN_H 32     ///< Height of the pattern graphics, in patterns
+#define PALETTES 32      ///< Palettes in the level
+
+/** @brief Everything a level loads. */
+typedef struct {
+    tile_t tiles[TILES];
+    pattern_t patterns[PATTERN_W * PATTERN_H];
+    palette_t palettes[PALETTES];
+} level_t;
+
+static char dir[] = "/tmp/bench-asset-XXXXXX";
+static char path[256];
+
+/** @brief Gets the path of a file in the temporary folder. */
+static const char *file(const char *name)
+{
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return path;
+}
+
+/** @brief Opens a file in the temporary folder for writing, exiting on failure. */
+static FILE *create(const char *name)
+{
+    FILE *fp = fopen(file(name), "w");
+
+    if (fp == NULL)
+    {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+    return fp;
+}
+
+/** @brief Writes the text assets of the level, filled with reproducible noise. */
+static void write_text(void)
+{
+    uint32_t seed = 1;
+    char name[32];
+    FILE *fp;
+
+#define NEXT() (seed = seed * 1664525 + 1013904223)
+
+    fp = create("level.tilemap");
+    for (unsigned i = 0; i < TILES; i++)
+    {
+        NEXT();
+        fprintf(fp, "(%03X,%01X,%01X) ", (seed >> 8) % PATTERNRAM_COUNT, (seed >> 20) % 16,
+                (seed >> 28) % 4);
+    }
+    fclose(fp);
+
+    fp = create("level.pattern");
+    for (unsigned row = 0; row < PATTERN_H * TILEPATTERN_HEIGHT; row++)
+    {
+        for (unsigned col = 0; col < PATTERN_W; col++)
+        {
+            fprintf(fp, col == PATTERN_W - 1 ? "%08X\n" : "%08X ", NEXT());
+        }
+    }
+    fclose(fp);
+
+    for (unsigned p = 0; p < PALETTES; p++)
+    {
+        snprintf(name, sizeof(name), "level%u.palette", p);
+        fp = create(name);
+        for (unsigned c = 0; c < PALETTE_COLORS; c++) { fprintf(fp, "%06X\n", NEXT() >> 8); }
+        fclose(fp);
+    }
+
+#undef NEXT
+}
+
+/** @brief Packs the text assets of the level with fpgame-pack. */
+static void write_pack(void)
+{
+    char cmd[8192];
+    int len;
+
+    len = snprintf(cmd, sizeof(cmd), "./fpgame-pack %s/level.fpk tilemap map %s/level.tilemap "
+                   "pattern gfx %d %d %s/level.pattern", dir, dir, PATTERN_W, PATTERN_H, dir);
+    for (unsigned p = 0; p < PALETTES; p++)
+    {
+        len += snprintf(&cmd[len], sizeof(cmd) - len, " palette pal%u %s/level%u.palette", p, dir,
+                        p);
+    }
+
+    if (system(cmd) != 0)
+    {
+        fprintf(stderr, "bench-asset: fpgame-pack failed (build it first)\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/** @brief Loads the level from the text files. */
+static void load_text(level_t *level)
+{
+    char name[32];
+
+    ppu_load_tilemap(level->tiles, TILES, file("level.tilemap"));
+    ppu_load_pattern(level->patterns, file("level.pattern"), PATTERN_W, PATTERN_H);
+    for (unsigned p = 0; p < PALETTES; p++)
+    {
+        snprintf(name, sizeof(name), "level%u.palette", p);
+        ppu_load_palette(&level->palettes[p], file(name));
+    }
+}
+
+/** @brief Loads the level from the pack. The assets are copied out so that both ways end with the
+ *    same buffers; a game would usually write them to the PPU straight from the mapping instead.
+ */
+static void load_pack(level_t *level)
+{
+    asset_pack_t *pack = asset_open(file("level.fpk"));
+    char name[ASSET_NAME_MAX];
+    unsigned len, width, height;
+
+    memcpy(level->tiles, asset_tilemap(pack, "map", &len), sizeof(level->tiles));
+    memcpy(level->patterns, asset_patterns(pack, "gfx", &width, &height), sizeof(level->patterns));
+    for (unsigned p = 0; p < PALETTES; p++)
+    {
+        snprintf(name, sizeof(name), "pal%u", p);
+        memcpy(&level->palettes[p], asset_palette(pack, name), sizeof(palette_t));
+    }
+
+    asset_close(pack);
+}
+
+/** @brief Times a way of loading the level, and prints the time per load. */
+static void run(const char *name, unsigned loads, void (*load)(level_t *), level_t *level)
+{
+    uint64_t start;
+    double ns;
+
+    load(level); // Warm the page cache
+    start = now_ns();
+    for (unsigned i = 0; i < loads; i++) { load(level); }
+    ns = (double)(now_ns() - start) / loads;
+
+    printf("%-5s %10.1f us/load\n", name, ns / 1000);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned loads = (argc > 1) ? (unsigned)atoi(argv[1]) : 200;
+    static level_t text, pack;
+    char cmd[64];
+
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    write_text();
+    write_pack();
+
+    run("text", loads, load_text, &text);
+    run("pack", loads, load_pack, &pack);
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0) { fprintf(stderr, "bench-asset: could not remove %s\n", dir); }
+
+    if (memcmp(&text, &pack, sizeof(level_t)) != 0)
+    {
+        fprintf(stderr, "bench-asset: the pack and the text files differ\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
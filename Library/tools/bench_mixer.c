@@ -0,0 +1,66 @@
+/**
+ * @file bench_mixer.c
+ * @author Andrew Spaulding
+ * @brief Host benchmark of the software mixer.
+ *
+ * Usage: bench-mixer [blocks]
+ *
+ * Renders full APU buffers with 1, 2, 4, 8 and 16 voices playing looping
+ * sounds (alternately mono PCM8 and stereo PCM16, at uneven pitches), and
+ * prints the time per buffer, the voices mixed per ms (each a full buffer of
+ * one voice) and the load. On the host, this times the scalar mixer.
+ */
+
+#include <fp-game/mixer.h>
+#include <fp-game/apu.h>
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/** @brief The length of each sound, in frames. */
+#define FRAMES 4096
+
+static int8_t pcm8[FRAMES];
+static int16_t pcm16[FRAMES * 2];
+
+int main(int argc, char **argv)
+{
+	const mixer_sound_t mono = { pcm8, MIXER_PCM8, 1, FRAMES, true, 0 };
+	const mixer_sound_t stereo = { pcm16, MIXER_PCM16, 2, FRAMES, true, 0 };
+	unsigned blocks = (argc > 1) ? (unsigned)atoi(argv[1]) : 20000;
+	static int8_t out[APU_BUF_MAX];
+	uint32_t seed = 1;
+
+	for (unsigned i = 0; i < FRAMES * 2; i++) {
+		seed = seed * 1664525 + 1013904223;
+		if (i < FRAMES) { pcm8[i] = seed >> 24; }
+		pcm16[i] = seed >> 16;
+	}
+
+	for (int voices = 1; voices <= MIXER_VOICES; voices *= 2) {
+		uint64_t start;
+		double us;
+
+		mixer_init();
+		for (int v = 0; v < voices; v++) {
+			const mixer_params_t params = {
+				.volume = MIXER_VOLUME_MAX / 2, .pan = v * 8 - 64,
+				.pitch = MIXER_PITCH_1X + v * 0x1234, .priority = 0,
+			};
+
+			mixer_play((v % 2) ? &stereo : &mono, &params);
+		}
+
+		mixer_render(out, APU_BUF_MAX); /* Warm up */
+		start = now_ns();
+		for (unsigned b = 0; b < blocks; b++) { mixer_render(out, APU_BUF_MAX); }
+		us = (double)(now_ns() - start) / blocks / 1000;
+
+		printf("voices %2d %7.2f us/buffer %7.0f voices/ms %6.2f%% of real time\n",
+		       voices, us, voices * 1000 / us, BUF_LOAD(us));
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,52 @@
+/**
+ * @file bench_ppu_ref.c
+ * @author Joseph Yankel
+ * @brief Host benchmark of the reference renderer.
+ *
+ * Usage: bench-ppu-ref [frames]
+ *
+ * Renders a VRAM image of random bytes (every layer enabled, so every row has tiles on both layers
+ *   and up to 16 sprites) with renderers of 1, 2, 4 and 8 threads, and prints the time per frame.
+ *   Beyond one thread, the gain depends on the cores of the host, and once there are more threads
+ *   than cores, the numbers show the cost of handing a frame to the workers.
+ */
+
+#include <fp-game/ppu_ref.h>
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+int main(int argc, char **argv)
+{
+    static const unsigned threads[] = { 1, 2, 4, 8 };
+    static vram_t vram;
+    static uint32_t frame[PPU_REF_WIDTH * PPU_REF_HEIGHT];
+    const ppu_ref_regs_t regs = { 3, 5, 7, 9, LAYER_BG | LAYER_FG | LAYER_SPR, 0x123456 };
+    unsigned frames = (argc > 1) ? (unsigned)atoi(argv[1]) : 2000;
+    uint32_t seed = 1;
+
+    for (size_t i = 0; i < sizeof(vram); i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        ((uint8_t *)&vram)[i] = seed >> 24;
+    }
+
+    for (unsigned t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+    {
+        ppu_ref_t *ref = ppu_ref_create(threads[t]);
+        uint64_t start;
+        double us;
+
+        ppu_ref_render(ref, &vram, &regs, frame); // Warm up
+        start = now_ns();
+        for (unsigned f = 0; f < frames; f++) { ppu_ref_render(ref, &vram, &regs, frame); }
+        us = (double)(now_ns() - start) / frames / 1000;
+
+        printf("threads %u %8.1f us/frame %8.0f frames/s\n", threads[t], us, 1000000 / us);
+        ppu_ref_destroy(ref);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file bench_resample.c
+ * @author Andrew Spaulding
+ * @brief Host benchmark of the resampler's speed and quality.
+ *
+ * Usage: bench-resample [seconds]
+ *
+ * Converts a few seconds of reproducible noise from 22.05kHz, 44.1kHz and
+ * 48kHz to the APU rate, one APU buffer at a time, and prints the time per
+ * output sample and the load. Next to each, it prints the worst attenuation of
+ * a tone which would alias (from 16.5kHz up to the input's Nyquist frequency).
+ */
+
+#include <fp-game/resample.h>
+#include <fp-game/apu.h>
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+/** @brief The length of each tone used to measure the attenuation, in samples. */
+#define TONE_LENGTH 24000
+
+/**
+ * @brief Gets the worst attenuation, in dB, of a tone which would alias.
+ *        The input's Nyquist frequency must be above 16.5kHz.
+ */
+static double worst_stopband(resampler_t *r, unsigned rate)
+{
+	static int16_t in[TONE_LENGTH], out[TONE_LENGTH];
+	double worst = -INFINITY;
+
+	for (double freq = 16500; freq < rate / 2; freq += 250) {
+		double in_sum = 0, out_sum = 0;
+		unsigned len, used;
+
+		for (unsigned i = 0; i < TONE_LENGTH; i++) {
+			in[i] = lrint(16000 * sin(2 * M_PI * freq * i / rate));
+			in_sum += (double)in[i] * in[i];
+		}
+
+		resample_reset(r);
+		len = resample_process(r, in, TONE_LENGTH, &used, out, TONE_LENGTH);
+
+		/* Leave out the ends, while the filter fills and empties. */
+		for (unsigned i = RESAMPLE_TAPS; i < len - RESAMPLE_TAPS; i++) {
+			out_sum += (double)out[i] * out[i];
+		}
+		out_sum /= len - 2 * RESAMPLE_TAPS;
+		in_sum /= TONE_LENGTH;
+
+		if (10 * log10(out_sum / in_sum) > worst) { worst = 10 * log10(out_sum / in_sum); }
+	}
+
+	return worst;
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned rates[] = { 22050, 44100, 48000 };
+	unsigned seconds = (argc > 1) ? (unsigned)atoi(argv[1]) : 20;
+	int16_t out[APU_BUF_MAX];
+	int16_t *in;
+	uint32_t seed = 1;
+
+	in = malloc(seconds * 48000 * sizeof(int16_t));
+	if (in == NULL) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	for (unsigned i = 0; i < seconds * 48000; i++) {
+		seed = seed * 1664525 + 1013904223;
+		in[i] = seed >> 16;
+	}
+
+	for (unsigned i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+		resampler_t *r = resample_create(rates[i]);
+		unsigned in_pos = 0, in_len = seconds * rates[i], total = 0, n, used;
+		uint64_t start;
+		double ns;
+
+		start = now_ns();
+		while ((n = resample_process(r, &in[in_pos], in_len - in_pos, &used,
+		                             out, APU_BUF_MAX)) != 0) {
+			in_pos += used;
+			total += n;
+		}
+		ns = (double)(now_ns() - start) / total;
+
+		printf("%5uHz %6.2f ns/sample %6.3f%% of real time", rates[i], ns,
+		       BUF_LOAD(ns * APU_BUF_MAX / 1000));
+		if (rates[i] / 2 > 16500) {
+			printf(" | aliasing %6.1f dB\n", worst_stopband(r, rates[i]));
+		} else {
+			printf(" | nothing to alias\n");
+		}
+		resample_destroy(r);
+	}
+
+	free(in);
+	return EXIT_SUCCESS;
+}
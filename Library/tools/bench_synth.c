@@ -0,0 +1,92 @@
+/**
+ * @file bench_synth.c
+ * @author Andrew Spaulding
+ * @brief Host benchmark of the chiptune synthesizer.
+ *
+ * Usage: bench-synth [seconds]
+ *
+ * Renders a few seconds of audio with the synthesizer silent, with one pulse
+ * note held, and playing a looping song which keeps every channel busy with
+ * envelopes, sweeps and a new row every third tick. Each is rendered a full
+ * APU buffer per call and 64 samples per call, and the CPU time per buffer
+ * and the load are printed.
+ */
+
+#include <fp-game/synth.h>
+#include <fp-game/apu.h>
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/** @brief The rows of the song's pattern. */
+#define ROWS 16
+
+static const int8_t wave[SYNTH_WAVE_SIZE] = {
+	0, 40, 80, 110, 127, 110, 80, 40, 0, -40, -80, -110, -127, -110, -80, -40,
+	0, 60, 0, -60, 0, 60, 0, -60, 90, 30, -30, -90, 90, 30, -30, -90,
+};
+
+static const synth_instrument_t instruments[] = {
+	{ .volume = 15, .env_step = -1, .env_period = 2, .duty = SYNTH_DUTY_25 },
+	{ .volume = 12, .sweep_dir = 1, .sweep_shift = 3, .sweep_period = 1,
+	  .duty = SYNTH_DUTY_50 },
+	{ .volume = 15 },
+	{ .volume = 15, .env_step = -2, .env_period = 1, .noise_short = true },
+	{ .volume = 10, .env_step = 1, .env_period = 4, .wave = wave },
+};
+
+static synth_cell_t rows[ROWS][SYNTH_CHANNELS];
+static const synth_pattern_t pattern = { rows, ROWS };
+static const uint8_t order[] = { 0 };
+
+static const synth_song_t song = {
+	.instruments = instruments, .instrument_count = 5,
+	.patterns = &pattern, .pattern_count = 1,
+	.order = order, .order_length = 1,
+	.loop = true, .loop_start = 0, .speed = 3,
+};
+
+/** @brief Renders for a while in calls of len samples, and prints the time. */
+static void run(const char *name, unsigned len, unsigned seconds)
+{
+	static int8_t out[APU_BUF_MAX];
+	unsigned calls = seconds * APU_SAMPLE_RATE / len;
+	uint64_t start;
+	double us;
+
+	start = now_ns();
+	for (unsigned i = 0; i < calls; i++) { synth_render(out, len); }
+	us = (double)(now_ns() - start) / ((double)calls * len / APU_BUF_MAX) / 1000;
+
+	printf("%-8s %3u samples/call %6.2f us/buffer %6.3f%% of real time\n",
+	       name, len, us, BUF_LOAD(us));
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned lens[] = { APU_BUF_MAX, 64 };
+	unsigned seconds = (argc > 1) ? (unsigned)atoi(argv[1]) : 60;
+
+	/* Every channel gets a note every row, from its own instrument. */
+	for (unsigned r = 0; r < ROWS; r++) {
+		for (unsigned c = 0; c < SYNTH_CHANNELS; c++) {
+			rows[r][c].note = SYNTH_NOTE_C4 - 12 + (r * 7 + c * 5) % 36;
+			rows[r][c].instrument = 1 + c;
+		}
+	}
+
+	for (unsigned l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+		synth_stop();
+		run("silent", lens[l], seconds);
+
+		synth_note(SYNTH_PULSE1, SYNTH_NOTE_C4, &instruments[2]);
+		run("one note", lens[l], seconds);
+
+		synth_play(&song);
+		run("song", lens[l], seconds);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,143 @@
+/**
+ * @file bench_vram.c
+ * @author Joseph Yankel
+ * @brief Host benchmark of pwrite() against mapped writes for building a frame in VRAM.
+ *
+ * Usage: bench-vram [frames]
+ *
+ * A memfd the size of VRAM stands in for the PPU device file. Like the driver, pwrite() on it
+ *   copies the user's data into kernel pages, and mmap() maps those pages into the process, so the
+ *   difference between the two paths is the cost of a system call per change.
+ *
+ * Each frame makes the same changes both ways: a few typical per-frame updates (every sprite, a
+ *   scattered set of tiles, one palette), and then a rewrite of all of VRAM.
+ */
+
+#define _GNU_SOURCE /* For memfd_create */
+
+#include <fp-game/drv_ppu.h>
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/** @brief Offsets of the VRAM regions, as in the PPU driver. */
+//@{
+#define TILES_OFFSET 0x0000
+#define PALETTES_OFFSET 0xC000
+#define SPRITES_OFFSET 0xD000
+//@}
+
+#define SPRITES 64       ///< Sprites in Sprite RAM, one 32-bit word each
+#define TILE_CHANGES 256 ///< Scattered tiles changed per frame
+#define PALETTE_BSIZE 64 ///< Size of one palette
+
+/** @brief A way of changing VRAM. */
+typedef void (*write_fn)(const void *buf, size_t len, off_t offset);
+
+static int vram_fd;
+static uint8_t *vram_map;
+
+/** @brief Changes VRAM through pwrite(), as ppu_write_vram() does. */
+static void write_pwrite(const void *buf, size_t len, off_t offset)
+{
+    if (pwrite(vram_fd, buf, len, offset) != (ssize_t)len)
+    {
+        perror("pwrite");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/** @brief Changes VRAM through the mapping, as a user of ppu_map_vram() does. */
+static void write_mapped(const void *buf, size_t len, off_t offset)
+{
+    memcpy(&vram_map[offset], buf, len);
+}
+
+/** @brief Makes the typical per-frame changes: every sprite, scattered tiles and one palette.
+ * @return The number of changes made.
+ */
+static unsigned frame_updates(write_fn write, unsigned frame)
+{
+    static const uint8_t palette[PALETTE_BSIZE];
+    uint32_t sprite;
+    uint16_t tile;
+    unsigned i;
+
+    for (i = 0; i < SPRITES; i++)
+    {
+        sprite = frame + i;
+        write(&sprite, sizeof(sprite), SPRITES_OFFSET + i * sizeof(sprite));
+    }
+
+    for (i = 0; i < TILE_CHANGES; i++)
+    {
+        tile = (uint16_t)(frame ^ i);
+        write(&tile, sizeof(tile), TILES_OFFSET + ((i * 37 + frame) % 0x2000) * sizeof(tile));
+    }
+
+    write(palette, sizeof(palette), PALETTES_OFFSET + (frame % 32) * PALETTE_BSIZE);
+
+    return SPRITES + TILE_CHANGES + 1;
+}
+
+/** @brief Runs a scenario both ways and prints the time per frame and per change. */
+static void run(const char *name, unsigned frames, unsigned (*scenario)(write_fn, unsigned))
+{
+    static const struct { const char *name; write_fn write; } paths[] = {
+        { "pwrite", write_pwrite },
+        { "mmap", write_mapped },
+    };
+    unsigned changes = 0;
+
+    for (unsigned p = 0; p < sizeof(paths) / sizeof(paths[0]); p++)
+    {
+        uint64_t start = now_ns();
+
+        for (unsigned f = 0; f < frames; f++) { changes = scenario(paths[p].write, f); }
+
+        double ns = (double)(now_ns() - start) / frames;
+        printf("%-10s %-7s %10.0f ns/frame %8.1f ns/change\n", name, paths[p].name, ns,
+               ns / changes);
+    }
+}
+
+/** @brief Rewrites all of VRAM in one go. */
+static unsigned frame_full(write_fn write, unsigned frame)
+{
+    static uint8_t vram[VRAM_SIZE];
+
+    vram[frame % VRAM_SIZE] = (uint8_t)frame;
+    write(vram, sizeof(vram), 0);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned frames = (argc > 1) ? (unsigned)atoi(argv[1]) : 20000;
+
+    vram_fd = memfd_create("fpgame-vram", 0);
+    if (vram_fd < 0 || ftruncate(vram_fd, VRAM_SIZE) < 0)
+    {
+        perror("memfd");
+        return EXIT_FAILURE;
+    }
+
+    vram_map = mmap(NULL, VRAM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, vram_fd, 0);
+    if (vram_map == MAP_FAILED)
+    {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    run("updates", frames, frame_updates);
+    run("full", frames, frame_full);
+
+    munmap(vram_map, VRAM_SIZE);
+    close(vram_fd);
+    return EXIT_SUCCESS;
+}
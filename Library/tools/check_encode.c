@@ -0,0 +1,120 @@
+/**
+ * @file check_encode.c
+ * @author Joseph Yankel
+ * @brief Host check of the bulk encoders in encode.c.
+ *
+ * Usage: check-encode
+ *
+ * Encodes reproducible random tiles and patterns of many lengths, so that both the vector loops and
+ *   their scalar remainders are covered, and checks each result against the encoding written out
+ *   here one element at a time. A digest of every result is printed.
+ */
+
+#include <fp-game/ppu.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <ppu_internal.h>
+
+#define MAX_LEN 1024 ///< Longest array encoded
+
+static uint32_t seed = 1;
+
+/** @brief Gets the next reproducible random number. */
+static uint32_t next(void)
+{
+    seed = seed * 1664525 + 1013904223;
+    return seed >> 8;
+}
+
+/** @brief Hashes bytes into a running FNV-1a digest. */
+static uint64_t digest(uint64_t hash, const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+
+    for (size_t i = 0; i < len; i++) { hash = (hash ^ bytes[i]) * 0x100000001B3ULL; }
+    return hash;
+}
+
+/** @brief Reports a mismatch against the reference encoding and exits. */
+static void fail(const char *what, unsigned len, unsigned i)
+{
+    fprintf(stderr, "check-encode: %s of length %u is wrong at %u\n", what, len, i);
+    exit(EXIT_FAILURE);
+}
+
+/** @brief Checks ppu_make_tiles() on one length. */
+static void check_tiles(unsigned len)
+{
+    static uint16_t pattern_addrs[MAX_LEN];
+    static uint8_t palette_ids[MAX_LEN], mirrors[MAX_LEN];
+    static tile_t tiles[MAX_LEN];
+
+    for (unsigned i = 0; i < len; i++)
+    {
+        pattern_addrs[i] = next() % (PATTERN_MAXADDR + 1);
+        palette_ids[i] = next() % TILELAYER_MAX_PALETTES;
+        mirrors[i] = next() % (MIRROR_MAXVAL + 1);
+    }
+
+    ppu_make_tiles(tiles, pattern_addrs, palette_ids, mirrors, len);
+
+    for (unsigned i = 0; i < len; i++)
+    {
+        if (tiles[i] != ppu_make_tile(pattern_addrs[i], palette_ids[i], mirrors[i]))
+        {
+            fail("ppu_make_tiles", len, i);
+        }
+    }
+
+    printf("make_tiles      %4u %016llx\n", len,
+           (unsigned long long)digest(0xCBF29CE484222325ULL, tiles, len * sizeof(tile_t)));
+}
+
+/** @brief Checks ppu_encode_patterns() on one count. */
+static void check_patterns(unsigned count)
+{
+    static uint32_t rows[MAX_LEN * TILEPATTERN_HEIGHT];
+    static pattern_t patterns[MAX_LEN];
+    uint32_t want;
+
+    for (unsigned i = 0; i < count * TILEPATTERN_HEIGHT; i++)
+    {
+        rows[i] = next() ^ (next() << 16);
+    }
+
+    ppu_encode_patterns(patterns, rows, count);
+
+    for (unsigned i = 0; i < count * TILEPATTERN_HEIGHT; i++)
+    {
+        // The text order has the first pixel in the most significant nibble; the PPU has it in the
+        //   least significant one.
+        want = 0;
+        for (unsigned px = 0; px < 8; px++)
+        {
+            want |= ((rows[i] >> (28 - 4 * px)) & 0xF) << (4 * px);
+        }
+
+        if (patterns[i / TILEPATTERN_HEIGHT].pxrow[i % TILEPATTERN_HEIGHT] != want)
+        {
+            fail("ppu_encode_patterns", count, i / TILEPATTERN_HEIGHT);
+        }
+    }
+
+    printf("encode_patterns %4u %016llx\n", count,
+           (unsigned long long)digest(0xCBF29CE484222325ULL, patterns, count * sizeof(pattern_t)));
+}
+
+int main(void)
+{
+    // Every length up to a few vectors, to catch remainder handling, then a full Pattern RAM.
+    for (unsigned len = 0; len <= 40; len++) { check_tiles(len); }
+    check_tiles(MAX_LEN);
+
+    for (unsigned count = 0; count <= 9; count++) { check_patterns(count); }
+    check_patterns(MAX_LEN);
+
+    return EXIT_SUCCESS;
+}
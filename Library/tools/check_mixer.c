@@ -0,0 +1,202 @@
+/**
+ * @file check_mixer.c
+ * @author Andrew Spaulding
+ * @brief Host check of the software mixer.
+ *
+ * Usage: check-mixer
+ *
+ * Plays reproducible random voices (every format, channel count, pan, pitch,
+ * volume and loop setting) and renders them in blocks of many lengths, so
+ * that both the vector loops of the mixer and their scalar remainders are
+ * covered. Each block is checked against a mix written out here one sample at
+ * a time. The last scene plays every voice at full volume, so that the output
+ * saturates both ways. A digest of every scene is printed.
+ */
+
+#include <fp-game/mixer.h>
+#include <fp-game/apu.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** @brief The longest sound played, in frames. */
+#define MAX_FRAMES 2048
+
+/** @brief The blocks rendered per scene. */
+#define BLOCKS 8
+
+/** @brief A voice as the reference mix sees it. */
+struct ref_voice {
+	mixer_sound_t sound;
+	mixer_params_t params;
+	uint64_t pos;
+	bool playing;
+};
+
+static int16_t pcm16[MIXER_VOICES][MAX_FRAMES * 2];
+static int8_t pcm8[MIXER_VOICES][MAX_FRAMES * 2];
+static struct ref_voice refs[MIXER_VOICES];
+static unsigned master;
+static uint32_t seed = 1;
+
+/** @brief Gets the next reproducible random number. */
+static uint32_t next(void)
+{
+	seed = seed * 1664525 + 1013904223;
+	return seed >> 8;
+}
+
+/** @brief Hashes bytes into a running FNV-1a digest. */
+static uint64_t digest(uint64_t hash, const void *data, size_t len)
+{
+	const uint8_t *bytes = data;
+
+	for (size_t i = 0; i < len; i++) { hash = (hash ^ bytes[i]) * 0x100000001B3ULL; }
+	return hash;
+}
+
+/** @brief Gets the next sample of a voice as Q15, advancing it. */
+static int32_t ref_sample(struct ref_voice *r)
+{
+	const mixer_sound_t *s = &r->sound;
+	const int8_t *p8 = s->samples;
+	const int16_t *p16 = s->samples;
+	unsigned frame;
+	int32_t sample;
+
+	/* Past the end, a looping sound goes back by whole loop lengths. */
+	while ((r->pos >> 16) >= s->length) {
+		if (!s->loop) {
+			r->playing = false;
+			return 0;
+		}
+		r->pos -= (uint64_t)(s->length - s->loop_start) << 16;
+	}
+
+	frame = r->pos >> 16;
+	if (s->channels == 1) {
+		sample = (s->format == MIXER_PCM8) ? p8[frame] * 256 : p16[frame];
+	} else if (s->format == MIXER_PCM8) {
+		sample = p8[2 * frame] * (128 - r->params.pan)
+		         + p8[2 * frame + 1] * (128 + r->params.pan);
+	} else {
+		sample = (p16[2 * frame] * (128 - r->params.pan)
+		          + p16[2 * frame + 1] * (128 + r->params.pan)) >> 8;
+	}
+
+	r->pos += r->params.pitch;
+	return sample;
+}
+
+/** @brief Mixes the next samples of the reference voices. */
+static void ref_render(int8_t *out, unsigned len)
+{
+	for (unsigned i = 0; i < len; i++) {
+		int32_t acc = 0;
+
+		for (int v = 0; v < MIXER_VOICES; v++) {
+			struct ref_voice *r = &refs[v];
+			int32_t sample;
+
+			if (!r->playing) { continue; }
+			sample = ref_sample(r);
+			if (r->playing) {
+				acc += sample * (int32_t)(r->params.volume * master
+				                          / MIXER_VOLUME_MAX);
+			}
+		}
+
+		/* Q23 to Q15, saturating, then to int8. */
+		acc >>= 8;
+		acc = (acc > INT16_MAX) ? INT16_MAX : (acc < INT16_MIN) ? INT16_MIN : acc;
+		out[i] = acc >> 8;
+	}
+}
+
+/** @brief Starts a voice, on the mixer and in the reference. */
+static void play(int v, bool loud)
+{
+	struct ref_voice *r = &refs[v];
+	mixer_sound_t *s = &r->sound;
+	mixer_params_t *p = &r->params;
+
+	s->format = loud ? MIXER_PCM16 : (mixer_format_e)(next() % 2);
+	s->channels = loud ? 1 : 1 + next() % 2;
+	s->length = 1 + next() % MAX_FRAMES;
+	s->loop = loud || (next() % 2);
+	s->loop_start = next() % s->length;
+	s->samples = (s->format == MIXER_PCM8) ? (const void *)pcm8[v]
+	                                       : (const void *)pcm16[v];
+
+	p->volume = loud ? MIXER_VOLUME_MAX : next() % (MIXER_VOLUME_MAX + 1);
+	p->pan = (int)(next() % 257) - 128;
+	p->pitch = loud ? MIXER_PITCH_1X : next() % (4 * MIXER_PITCH_1X);
+	p->priority = 0;
+
+	r->pos = 0;
+	r->playing = true;
+
+	if (mixer_play(s, p) < 0) {
+		fprintf(stderr, "check-mixer: could not play voice %d\n", v);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Plays some voices, renders blocks of one length, and checks each
+ *        against the reference.
+ */
+static void check_scene(unsigned len, int nvoices, bool loud)
+{
+	static int8_t got[APU_BUF_MAX], want[APU_BUF_MAX];
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	mixer_init();
+	master = loud ? MIXER_VOLUME_MAX : next() % (MIXER_VOLUME_MAX + 1);
+	mixer_set_master(master);
+
+	for (int v = 0; v < MIXER_VOICES; v++) { refs[v].playing = false; }
+	for (int v = 0; v < nvoices; v++) { play(v, loud); }
+
+	for (unsigned b = 0; b < BLOCKS; b++) {
+		mixer_render(got, len);
+		ref_render(want, len);
+
+		for (unsigned i = 0; i < len; i++) {
+			if (got[i] != want[i]) {
+				fprintf(stderr, "check-mixer: %d voices, block %u of length %u"
+				        " is wrong at %u\n", nvoices, b, len, i);
+				exit(EXIT_FAILURE);
+			}
+		}
+		hash = digest(hash, got, len);
+	}
+
+	printf("mix %2d voices %3u %016llx\n", nvoices, len, (unsigned long long)hash);
+}
+
+int main(void)
+{
+	for (int v = 0; v < MIXER_VOICES; v++) {
+		for (unsigned i = 0; i < MAX_FRAMES * 2; i++) {
+			pcm16[v][i] = next();
+			pcm8[v][i] = next();
+		}
+	}
+
+	/* Every length up to a few vectors, to catch remainder handling, then full buffers. */
+	for (unsigned len = 0; len <= 40; len++) {
+		check_scene(len, 1 + next() % MIXER_VOICES, false);
+	}
+	for (int nvoices = 1; nvoices <= MIXER_VOICES; nvoices++) {
+		check_scene(APU_BUF_MAX, nvoices, false);
+	}
+
+	/* Every voice at full volume on random PCM16 clips, both ways. */
+	check_scene(APU_BUF_MAX, MIXER_VOICES, true);
+	check_scene(37, MIXER_VOICES, true);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,239 @@
+/**
+ * @file check_ppu_ref.c
+ * @author Joseph Yankel
+ * @brief Host check of the reference renderer against golden frames.
+ *
+ * Usage: check-ppu-ref [--update]
+ *
+ * Builds a few reproducible scenes in a vram_t, renders each with renderers of 1, 3 and 7 threads,
+ *   and checks that every renderer gives the same frame, and that it matches the golden frame in
+ *   golden/ppu_ref_<scene>.ppm. A digest of every frame is printed.
+ *
+ * The golden frames are the renderer's own output from when it was checked by hand against the
+ *   hardware's rules (see ppu_ref.h), so this catches changes in what it renders. After a change
+ *   which is meant to alter the output, look at the new frames and rewrite them with --update.
+ */
+
+#include <fp-game/ppu.h>
+#include <fp-game/ppu_ref.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define GOLDEN_DIR "golden"
+#define FRAME_PIXELS (PPU_REF_WIDTH * PPU_REF_HEIGHT)
+
+/** @brief A scene to render. */
+typedef struct {
+    const char *name;
+    ppu_ref_regs_t regs;
+} scene_t;
+
+// Each scene has the same VRAM, with different registers.
+static const scene_t scenes[] = {
+    // Every layer, with both tile layers scrolled across their wrap point.
+    { "all_layers",   { 509, 3, 250, 507, LAYER_BG | LAYER_FG | LAYER_SPR, 0x204060 } },
+    // Sprites over the bgcolor alone.
+    { "sprites_only", { 0, 0, 0, 0, LAYER_SPR, 0x102030 } },
+    // The BG behind the sprites, without the FG.
+    { "bg_sprites",   { 4, 300, 0, 0, LAYER_BG | LAYER_SPR, 0x000000 } },
+};
+
+static uint32_t seed = 1;
+
+/** @brief Gets the next reproducible random number. */
+static uint32_t next(void)
+{
+    seed = seed * 1664525 + 1013904223;
+    return seed >> 8;
+}
+
+/** @brief Hashes bytes into a running FNV-1a digest. */
+static uint64_t digest(const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for (size_t i = 0; i < len; i++) { hash = (hash ^ bytes[i]) * 0x100000001B3ULL; }
+    return hash;
+}
+
+/** @brief Fills VRAM with a reproducible scene.
+ *
+ * Patterns are about half transparent, so the layers show through each other. The sprites cover
+ *   every size, mirror and priority, and the first 20 are all on rows 100 to 107, so the 16-sprite
+ *   limit of a row is hit.
+ */
+static void build_vram(vram_t *vram)
+{
+    sprite_t sprites[SPRRAM_COUNT];
+
+    memset(vram, 0, sizeof(vram_t));
+
+    for (unsigned i = 0; i < PATTERNRAM_COUNT; i++)
+    {
+        for (unsigned row = 0; row < TILEPATTERN_HEIGHT; row++)
+        {
+            for (unsigned px = 0; px < 8; px++)
+            {
+                if (next() % 2) vram->patterns[i].pxrow[row] |= (1 + next() % 15) << (4 * px);
+            }
+        }
+    }
+
+    for (unsigned y = 0; y < TILELAYER_HEIGHT; y++)
+    {
+        for (unsigned x = 0; x < TILELAYER_WIDTH; x++)
+        {
+            vram->bg_tiles[y][x] = ppu_make_tile(next() % PATTERNRAM_COUNT,
+                                                 next() % TILELAYER_MAX_PALETTES, next() % 4);
+            vram->fg_tiles[y][x] = ppu_make_tile(next() % PATTERNRAM_COUNT,
+                                                 next() % TILELAYER_MAX_PALETTES, next() % 4);
+        }
+    }
+
+    for (unsigned p = 0; p < PALETTERAM_TILEMAX; p++)
+    {
+        for (unsigned c = 0; c < PALETTE_COLORS; c++)
+        {
+            vram->bg_palettes[p][c] = next();
+            vram->fg_palettes[p][c] = next();
+        }
+    }
+    for (unsigned p = 0; p < PALETTERAM_SPRITEMAX; p++)
+    {
+        for (unsigned c = 0; c < PALETTE_COLORS; c++) { vram->spr_palettes[p][c] = next(); }
+    }
+
+    for (unsigned i = 0; i < SPRRAM_COUNT; i++)
+    {
+        sprites[i].pattern_addr = next() % PATTERNRAM_COUNT;
+        sprites[i].palette_id = next() % SPRLAYER_MAX_PALETTES;
+        sprites[i].mirror = next() % 4;
+        sprites[i].prio = next() % 3;
+        sprites[i].width = 1 + next() % 4;
+        sprites[i].height = 1 + next() % 4;
+        sprites[i].x = (i < 20) ? i * 16 : next() % 512;
+        sprites[i].y = (i < 20) ? 100 : next() % 256;
+    }
+    ppu_pack_sprites(vram->sprites, vram->sprite_extra, sprites, SPRRAM_COUNT);
+}
+
+/** @brief Gets the path of the golden frame of a scene. */
+static const char *golden_path(const scene_t *scene)
+{
+    static char path[256];
+
+    snprintf(path, sizeof(path), GOLDEN_DIR "/ppu_ref_%s.ppm", scene->name);
+    return path;
+}
+
+/** @brief Writes a frame as a binary PPM image. */
+static void write_ppm(const char *path, const uint32_t *frame)
+{
+    FILE *fp = fopen(path, "wb");
+
+    if (fp == NULL)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(fp, "P6\n%d %d\n255\n", PPU_REF_WIDTH, PPU_REF_HEIGHT);
+    for (unsigned i = 0; i < FRAME_PIXELS; i++)
+    {
+        uint8_t rgb[3] = { frame[i] >> 16, frame[i] >> 8, frame[i] };
+        fwrite(rgb, 1, sizeof(rgb), fp);
+    }
+    fclose(fp);
+}
+
+/** @brief Reads a frame written by write_ppm().
+ * @return 0 on success; -1 if the file is missing or is not a frame.
+ */
+static int read_ppm(const char *path, uint32_t *frame)
+{
+    FILE *fp = fopen(path, "rb");
+    uint8_t rgb[3];
+    int width, height, max;
+
+    if (fp == NULL) return -1;
+
+    if (fscanf(fp, "P6 %d %d %d", &width, &height, &max) != 3 || fgetc(fp) != '\n'
+        || width != PPU_REF_WIDTH || height != PPU_REF_HEIGHT || max != 255)
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    for (unsigned i = 0; i < FRAME_PIXELS; i++)
+    {
+        if (fread(rgb, 1, sizeof(rgb), fp) != sizeof(rgb))
+        {
+            fclose(fp);
+            return -1;
+        }
+        frame[i] = (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned threads[] = { 1, 3, 7 };
+    static vram_t vram;
+    static uint32_t frame[FRAME_PIXELS], other[FRAME_PIXELS], golden[FRAME_PIXELS];
+    ppu_ref_t *refs[sizeof(threads) / sizeof(threads[0])];
+    int update = (argc > 1 && strcmp(argv[1], "--update") == 0);
+    int failed = 0;
+
+    build_vram(&vram);
+    for (unsigned r = 0; r < sizeof(threads) / sizeof(threads[0]); r++)
+    {
+        refs[r] = ppu_ref_create(threads[r]);
+    }
+
+    for (unsigned s = 0; s < sizeof(scenes) / sizeof(scenes[0]); s++)
+    {
+        const scene_t *scene = &scenes[s];
+
+        ppu_ref_render(refs[0], &vram, &scene->regs, frame);
+
+        for (unsigned r = 1; r < sizeof(threads) / sizeof(threads[0]); r++)
+        {
+            ppu_ref_render(refs[r], &vram, &scene->regs, other);
+            if (memcmp(frame, other, sizeof(frame)) != 0)
+            {
+                fprintf(stderr, "check-ppu-ref: %s differs with %u threads\n", scene->name,
+                        threads[r]);
+                failed = 1;
+            }
+        }
+
+        if (update)
+        {
+            write_ppm(golden_path(scene), frame);
+        }
+        else if (read_ppm(golden_path(scene), golden) != 0)
+        {
+            fprintf(stderr, "check-ppu-ref: cannot read %s\n", golden_path(scene));
+            failed = 1;
+        }
+        else if (memcmp(frame, golden, sizeof(frame)) != 0)
+        {
+            fprintf(stderr, "check-ppu-ref: %s does not match %s\n", scene->name,
+                    golden_path(scene));
+            failed = 1;
+        }
+
+        printf("%-12s %016llx\n", scene->name, (unsigned long long)digest(frame, sizeof(frame)));
+    }
+
+    for (unsigned r = 0; r < sizeof(threads) / sizeof(threads[0]); r++) ppu_ref_destroy(refs[r]);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,169 @@
+/**
+ * @file check_resample.c
+ * @author Andrew Spaulding
+ * @brief Host check of the resampler's response and its block handling.
+ *
+ * Usage: check-resample
+ *
+ * For 44.1kHz and 48kHz input, checks that:
+ *  - Tones of 1kHz and 10kHz pass at unity gain (within 0.1dB).
+ *  - Tones from 16.5kHz up to the input's Nyquist frequency, which the APU
+ *    can not play, are attenuated by more than 60dB instead of aliasing.
+ *  - Converting a stream in blocks of random sizes gives the same samples as
+ *    converting it in one go.
+ *  - A sine converted with resample_sound() matches the ideal sine at the APU
+ *    rate with an SNR of at least 80dB.
+ *
+ * The figures and a digest of every output are printed.
+ */
+
+#include <fp-game/resample.h>
+#include <fp-game/apu.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+/** @brief The length of each test tone, in input samples. */
+#define LENGTH 24000
+
+/** @brief Output samples skipped at each end, while the filter fills. */
+#define EDGE RESAMPLE_TAPS
+
+/** @brief The amplitude of each test tone. */
+#define AMPLITUDE 16000
+
+static int16_t in[LENGTH];
+static int16_t out[LENGTH], blocks[LENGTH];
+static int failed;
+static uint32_t seed = 1;
+
+/** @brief Gets the next reproducible random number. */
+static uint32_t next(void)
+{
+	seed = seed * 1664525 + 1013904223;
+	return seed >> 8;
+}
+
+/** @brief Hashes bytes into a running FNV-1a digest. */
+static uint64_t digest(const void *data, size_t len)
+{
+	const uint8_t *bytes = data;
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	for (size_t i = 0; i < len; i++) { hash = (hash ^ bytes[i]) * 0x100000001B3ULL; }
+	return hash;
+}
+
+/** @brief Reports a failed check, and carries on. */
+static void fail(const char *what, unsigned rate, double freq)
+{
+	fprintf(stderr, "check-resample: %s at %uHz, %.0fHz\n", what, rate, freq);
+	failed = 1;
+}
+
+/** @brief Fills the input with a tone. */
+static void tone(unsigned rate, double freq)
+{
+	for (unsigned i = 0; i < LENGTH; i++) {
+		in[i] = lrint(AMPLITUDE * sin(2 * M_PI * freq * i / rate));
+	}
+}
+
+/** @brief Gets the RMS of samples. */
+static double rms(const int16_t *x, unsigned len)
+{
+	double sum = 0;
+
+	for (unsigned i = 0; i < len; i++) { sum += (double)x[i] * x[i]; }
+	return sqrt(sum / len);
+}
+
+/**
+ * @brief Converts the input tone, in one go and in random blocks.
+ * @return The gain of the tone, in dB.
+ */
+static double gain(resampler_t *r, unsigned rate, double freq)
+{
+	unsigned len, used, in_pos = 0, done = 0;
+
+	tone(rate, freq);
+
+	resample_reset(r);
+	len = resample_process(r, in, LENGTH, &used, out, LENGTH);
+
+	resample_reset(r);
+	while (done < len) {
+		unsigned in_len = next() % 700, want = 1 + next() % APU_BUF_MAX;
+
+		if (in_len > LENGTH - in_pos) { in_len = LENGTH - in_pos; }
+		if (want > len - done) { want = len - done; }
+		done += resample_process(r, &in[in_pos], in_len, &used, &blocks[done], want);
+		in_pos += used;
+	}
+	if (memcmp(out, blocks, len * sizeof(int16_t)) != 0) {
+		fail("blocks differ from one go", rate, freq);
+	}
+
+	printf("%5u %5.0f %016llx", rate, freq,
+	       (unsigned long long)digest(out, len * sizeof(int16_t)));
+	return 20 * log10(rms(&out[EDGE], len - 2 * EDGE) / rms(in, LENGTH));
+}
+
+/** @brief Converts a sine with resample_sound(). @return The SNR, in dB. */
+static double sound_snr(unsigned rate, double freq)
+{
+	const mixer_sound_t sound = { in, MIXER_PCM16, 1, LENGTH, false, 0 };
+	mixer_sound_t conv;
+	const int16_t *x;
+	double signal = 0, noise = 0;
+
+	tone(rate, freq);
+	resample_sound(&sound, rate, &conv);
+	x = conv.samples;
+
+	for (unsigned i = EDGE; i < conv.length - EDGE; i++) {
+		double want = AMPLITUDE * sin(2 * M_PI * freq * i / APU_SAMPLE_RATE);
+
+		signal += want * want;
+		noise += (x[i] - want) * (x[i] - want);
+	}
+
+	printf("%5u %5.0f %016llx", rate, freq,
+	       (unsigned long long)digest(x, conv.length * sizeof(int16_t)));
+	free((void *)conv.samples);
+	return 10 * log10(signal / noise);
+}
+
+int main(void)
+{
+	static const unsigned rates[] = { 44100, 48000 };
+
+	for (unsigned i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+		unsigned rate = rates[i];
+		resampler_t *r = resample_create(rate);
+		double db, snr;
+
+		for (double freq = 1000; freq <= 10000; freq += 9000) {
+			db = gain(r, rate, freq);
+			printf(" pass %+6.2f dB\n", db);
+			if (fabs(db) > 0.1) { fail("the passband is not unity", rate, freq); }
+		}
+
+		for (double freq = 16500; freq < rate / 2; freq += 500) {
+			db = gain(r, rate, freq);
+			printf(" stop %+6.1f dB\n", db);
+			if (db > -60) { fail("the stopband is not 60dB down", rate, freq); }
+		}
+
+		resample_destroy(r);
+
+		snr = sound_snr(rate, 1000);
+		printf(" sound SNR %.1f dB\n", snr);
+		if (snr < 80) { fail("resample_sound() is not within 80dB", rate, 1000); }
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
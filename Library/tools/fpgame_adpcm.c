@@ -0,0 +1,237 @@
+/**
+ * @file fpgame_adpcm.c
+ * @author Andrew Spaulding
+ * @brief Host tool which converts WAV files into IMA-ADPCM streams.
+ *
+ * Usage: fpgame-adpcm [-l <loop start>] <in.wav> <out.fad>
+ *
+ * The input must be uncompressed 8 or 16-bit PCM, mono or stereo, at the APU
+ * sample rate (32000Hz). Stereo input is mixed down to mono. If a loop start
+ * (in samples) is given, the stream loops back to it when it ends.
+ *
+ * See fp-game/adpcm.h for the stream format.
+ */
+
+#include <fp-game/adpcm.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <adpcm_codec.h>
+
+/** @brief The sample rate streams must be encoded at; see APU_SAMPLE_RATE. */
+#define SAMPLE_RATE 32000
+
+static const char *progname;
+
+/** @brief Prints an error message and exits. */
+static void die(const char *fmt, const char *arg)
+{
+	fprintf(stderr, "%s: ", progname);
+	fprintf(stderr, fmt, arg);
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
+
+/** @brief Reads a little-endian 16-bit value. */
+static unsigned get16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+/** @brief Reads a little-endian 32-bit value. */
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * @brief Reads a WAV file as mono 16-bit samples.
+ * @param file The file to read.
+ * @param length Set to the number of samples read.
+ * @return The samples.
+ */
+static int16_t *read_wav(const char *file, uint32_t *length)
+{
+	uint8_t hdr[12], chunk[8], fmt[16];
+	unsigned channels = 0, bits = 0, frame;
+	int16_t *samples;
+	uint8_t *data;
+	uint32_t size, i;
+	FILE *fp;
+
+	if ((fp = fopen(file, "rb")) == NULL) { die("cannot open %s", file); }
+
+	if ((fread(hdr, sizeof(hdr), 1, fp) != 1) || memcmp(hdr, "RIFF", 4)
+	    || memcmp(&hdr[8], "WAVE", 4)) {
+		die("%s is not a WAV file", file);
+	}
+
+	/* Walk the chunks until the samples, checking the format on the way. */
+	while (true) {
+		if (fread(chunk, sizeof(chunk), 1, fp) != 1) {
+			die("%s has no samples", file);
+		}
+		size = get32(&chunk[4]);
+
+		if (!memcmp(chunk, "fmt ", 4)) {
+			if ((size < sizeof(fmt)) || (fread(fmt, sizeof(fmt), 1, fp) != 1)) {
+				die("%s has a malformed format", file);
+			}
+			if (get16(fmt) != 1) { die("%s is not PCM", file); }
+			if (get32(&fmt[4]) != SAMPLE_RATE) {
+				die("%s is not sampled at 32000Hz", file);
+			}
+
+			channels = get16(&fmt[2]);
+			bits = get16(&fmt[14]);
+			if ((channels != 1) && (channels != 2)) {
+				die("%s is not mono or stereo", file);
+			}
+			if ((bits != 8) && (bits != 16)) {
+				die("%s is not 8 or 16-bit", file);
+			}
+			size -= sizeof(fmt);
+		} else if (!memcmp(chunk, "data", 4)) {
+			break;
+		}
+
+		/* Chunks are padded to an even size. */
+		if (fseek(fp, size + (size & 1), SEEK_CUR) != 0) {
+			die("%s is truncated", file);
+		}
+	}
+
+	if (channels == 0) { die("%s has samples before its format", file); }
+
+	frame = channels * bits / 8;
+	if ((data = malloc(size)) == NULL) { die("out of memory%s", ""); }
+	size = fread(data, 1, size, fp) / frame;
+	fclose(fp);
+
+	if ((samples = malloc(size * sizeof(int16_t))) == NULL) {
+		die("out of memory%s", "");
+	}
+
+	for (i = 0; i < size; i++) {
+		const uint8_t *p = &data[i * frame];
+		int32_t sum = 0;
+
+		/* 8-bit WAV samples are unsigned. */
+		for (unsigned c = 0; c < channels; c++) {
+			sum += (bits == 8) ? (p[c] - 128) * 256
+			                   : (int16_t)get16(&p[2 * c]);
+		}
+		samples[i] = sum / (int32_t)channels;
+	}
+
+	free(data);
+	*length = size;
+	return samples;
+}
+
+/**
+ * @brief Picks the nibble which best encodes a sample, and decodes it.
+ * @param predictor The decoder predictor, updated as the decoder would.
+ * @param index The decoder step index, updated as the decoder would.
+ * @param sample The sample to encode.
+ * @return The nibble.
+ */
+static unsigned encode(int16_t *predictor, uint8_t *index, int16_t sample)
+{
+	int diff = sample - *predictor;
+	int step = adpcm_steps[*index];
+	unsigned nibble = 0;
+
+	if (diff < 0) {
+		nibble = 8;
+		diff = -diff;
+	}
+	if (diff >= step) { nibble |= 4; diff -= step; }
+	step >>= 1;
+	if (diff >= step) { nibble |= 2; diff -= step; }
+	step >>= 1;
+	if (diff >= step) { nibble |= 1; }
+
+	/* Track the decoder exactly, so errors never accumulate. */
+	adpcm_step(predictor, index, nibble);
+	return nibble;
+}
+
+int main(int argc, char **argv)
+{
+	const uint32_t endian_check = 1;
+	adpcm_header_t header = { 0 };
+	adpcm_block_t *blocks;
+	uint32_t length, count, i;
+	const char *in, *out;
+	int16_t *samples;
+	int16_t predictor = 0;
+	uint8_t index = 0;
+	long loop = -1;
+	char *end;
+	FILE *fp;
+
+	progname = argv[0];
+
+	if ((argc == 5) && !strcmp(argv[1], "-l")) {
+		loop = strtol(argv[2], &end, 0);
+		if ((*end != '\0') || (loop < 0)) { die("bad loop start %s", argv[2]); }
+		argv += 2;
+		argc -= 2;
+	}
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s [-l <loop start>] <in.wav> <out.fad>\n", progname);
+		return EXIT_FAILURE;
+	}
+	in = argv[1];
+	out = argv[2];
+
+	/* Streams are mapped directly on the (little-endian) ARM. */
+	if (*(const uint8_t *)&endian_check != 1) { die("host must be little-endian%s", ""); }
+
+	samples = read_wav(in, &length);
+	if ((loop >= 0) && ((uint32_t)loop >= length)) {
+		die("loop start is past the end of %s", in);
+	}
+
+	count = (length + ADPCM_BLOCK_SAMPLES - 1) / ADPCM_BLOCK_SAMPLES;
+	if ((blocks = calloc(count, sizeof(adpcm_block_t))) == NULL) {
+		die("out of memory%s", "");
+	}
+
+	header.magic = ADPCM_MAGIC;
+	header.version = ADPCM_VERSION;
+	header.length = length;
+	header.flags = (loop >= 0) ? ADPCM_LOOP : 0;
+	header.loop_start = (loop >= 0) ? loop : 0;
+
+	for (i = 0; i < length; i++) {
+		adpcm_block_t *block = &blocks[i / ADPCM_BLOCK_SAMPLES];
+		unsigned offset = i % ADPCM_BLOCK_SAMPLES;
+
+		if (offset == 0) {
+			block->predictor = predictor;
+			block->index = index;
+		}
+		if (i == header.loop_start) {
+			header.loop_predictor = predictor;
+			header.loop_index = index;
+		}
+
+		block->data[offset / 2] |= encode(&predictor, &index, samples[i])
+		                           << ((offset & 1) * 4);
+	}
+
+	if ((fp = fopen(out, "wb")) == NULL) { die("cannot create %s", out); }
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(blocks, sizeof(adpcm_block_t), count, fp);
+	if (fclose(fp) != 0) { die("cannot write %s", out); }
+
+	free(blocks);
+	free(samples);
+	return EXIT_SUCCESS;
+}
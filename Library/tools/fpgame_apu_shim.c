@@ -0,0 +1,796 @@
+/**
+ * @file fpgame_apu_shim.c
+ * @author Andrew Spaulding
+ * @brief Host stand-in for the APU driver, loaded with LD_PRELOAD.
+ *
+ * Usage: FPGAME_APU_WAV=<out.wav> LD_PRELOAD=./fpgame-apu-shim.so <program>
+ *
+ * Lets programs built for the host against the library play audio without the
+ * board. The shim intercepts open() of the APU device file, and the write(),
+ * ioctl(), poll(), mmap(), munmap() and close() calls made on it, and answers
+ * them as the driver would, with a thread standing in for the APU itself.
+ *
+ * The stand-in APU plays as the hardware does: it starts one 512 sample buffer
+ * every 16ms (32000Hz), paced against CLOCK_MONOTONIC, taking the buffer the
+ * driver queued in it, and raises its "irq" whenever it has no queued buffer.
+ * The driver side answers those irqs from its ring just as the kernel does, so
+ * poll(), blocking writes and the statistics from IOCTL_APU_GET_STATS behave
+ * as they do on the board.
+ *
+ * Every buffer the APU plays (and silence, while the ring is dry) is recorded
+ * to a 32000Hz 8-bit mono WAV file, fpgame-apu.wav unless FPGAME_APU_WAV says
+ * otherwise (or is empty, to record nothing). Each time the APU starves is
+ * logged to stderr as it happens, and a summary of the underruns, overruns
+ * and refill latencies is printed when the device file is closed.
+ *
+ * Only poll() is intercepted, so programs must wait on the APU with poll(),
+ * as the library's feeder thread does, rather than select() or epoll.
+ */
+
+#define _GNU_SOURCE /* For RTLD_NEXT */
+
+#include <fp-game/drv_apu.h>
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+
+#include "bench.h"
+
+/** @brief The time taken to play one sample buffer (512 samples at 32KHz). */
+#define BUF_TIME_NS 16000000
+
+/** @brief The sample rate of the APU; see APU_SAMPLE_RATE. */
+#define SAMPLE_RATE 32000
+
+/** @brief The ring depth used until the user sets one. */
+#define RING_DEFAULT 2
+
+/** @brief The size of the WAV file header. */
+#define WAV_HEADER_SIZE 44
+
+/** @brief The real versions of the intercepted functions. */
+//@{
+static int (*real_open)(const char *path, int flags, ...);
+static int (*real_close)(int fd);
+static ssize_t (*real_write)(int fd, const void *buf, size_t len);
+static int (*real_ioctl)(int fd, unsigned long request, ...);
+static int (*real_poll)(struct pollfd *fds, nfds_t nfds, int timeout);
+static void *(*real_mmap)(void *addr, size_t len, int prot, int flags, int fd, off_t off);
+static int (*real_munmap)(void *addr, size_t len);
+//@}
+
+/**
+ * @brief The state of the stand-in APU and its driver.
+ *
+ * The driver half (head, filled, hw, requested and the statistics) is the
+ * kernel driver's state, and is updated the same way. The hardware half (the
+ * queued buffer, irq_en and the play clock) is the APU's, and is only used by
+ * the APU thread and to decide when the irq fires.
+ *
+ * The eventfd standing in for the device file is kept readable exactly when
+ * the ring has a free slot, so that a poll() for POLLOUT on the device file
+ * can be turned into a poll() for POLLIN on the eventfd.
+ */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;    // Signalled whenever a slot is freed or sent.
+	int fd;                 // The eventfd returned by open(), or -1.
+	int flags;              // The flags the device was opened with.
+	bool ready;             // Whether fd is readable.
+
+	// Driver state.
+	unsigned depth;
+	unsigned head;
+	unsigned filled;
+	unsigned hw;
+	bool started;
+	bool requested;
+	bool req_playing;
+	uint64_t req_time;
+	uint64_t drain_time;
+	uint32_t underruns;
+	uint32_t overruns;
+	uint32_t latency[APU_LATENCY_BUCKETS];
+
+	// Hardware state.
+	bool queued;            // Whether the apu holds a buffer to play next.
+	unsigned queued_slot;
+	bool irq_en;
+	bool stopping;          // Tells the apu thread to exit.
+	pthread_t apu;
+	uint64_t played;        // Buffers played.
+	uint64_t starved;       // Times the apu ran out of buffers to play.
+	uint64_t max_wait;      // Longest refill latency, in ns.
+	uint64_t start_time;
+
+	FILE *wav;
+	uint64_t wav_bytes;
+} shim = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.fd = -1,
+};
+
+/** @brief The sample buffers, handed out by mmap(). */
+static int8_t slots[APU_MMAP_SIZE] __attribute__((aligned(4096)));
+
+/* Helper Functions */
+static void shim_init(void);
+static int shim_open(int flags);
+static int shim_close(void);
+static ssize_t shim_write(const void *buf, size_t len);
+static int shim_ioctl(unsigned long request, unsigned long arg);
+static void ring_reset(unsigned depth);
+static unsigned ring_free(void);
+static int ring_wait(void);
+static void ring_commit(unsigned len);
+static void ring_send(void);
+static void ring_refilled(uint64_t now);
+static void check_irq(uint64_t now);
+static void update_ready(void);
+static void *apu_thread(void *arg);
+static void wav_open(void);
+static void wav_write(const int8_t *buf);
+static void wav_silence(uint64_t ns);
+static void wav_finish(void);
+static void put16(uint8_t *p, unsigned v);
+static void put32(uint8_t *p, uint32_t v);
+static void print_summary(void);
+
+int open(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list args;
+
+	shim_init();
+
+	va_start(args, flags);
+	if (flags & (O_CREAT | O_TMPFILE)) { mode = va_arg(args, mode_t); }
+	va_end(args);
+
+	if (strcmp(path, APU_DEV_FILE) == 0) {
+		return shim_open(flags);
+	}
+
+	return real_open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list args;
+
+	va_start(args, flags);
+	if (flags & (O_CREAT | O_TMPFILE)) { mode = va_arg(args, mode_t); }
+	va_end(args);
+
+	return open(path, flags | O_LARGEFILE, mode);
+}
+
+int close(int fd)
+{
+	shim_init();
+	if ((fd >= 0) && (fd == shim.fd)) { return shim_close(); }
+	return real_close(fd);
+}
+
+ssize_t write(int fd, const void *buf, size_t len)
+{
+	shim_init();
+	if ((fd >= 0) && (fd == shim.fd)) { return shim_write(buf, len); }
+	return real_write(fd, buf, len);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	unsigned long arg;
+	va_list args;
+
+	shim_init();
+
+	va_start(args, request);
+	arg = va_arg(args, unsigned long);
+	va_end(args);
+
+	if ((fd >= 0) && (fd == shim.fd)) { return shim_ioctl(request, arg); }
+	return real_ioctl(fd, request, arg);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	nfds_t apu = nfds;
+	short events = 0;
+	int ret;
+
+	shim_init();
+
+	/* Wait for the eventfd to be readable instead of the device writable. */
+	for (nfds_t i = 0; i < nfds; i++) {
+		if ((fds[i].fd >= 0) && (fds[i].fd == shim.fd)) {
+			apu = i;
+			events = fds[i].events;
+			fds[i].events = (events & (POLLOUT | POLLWRNORM)) ? POLLIN : 0;
+			break;
+		}
+	}
+
+	ret = real_poll(fds, nfds, timeout);
+
+	if (apu < nfds) {
+		fds[apu].events = events;
+		if (fds[apu].revents & POLLIN) {
+			fds[apu].revents = (fds[apu].revents & ~POLLIN)
+			                   | (events & (POLLOUT | POLLWRNORM));
+		}
+	}
+
+	return ret;
+}
+
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off)
+{
+	shim_init();
+
+	if ((fd >= 0) && (fd == shim.fd)) {
+		if ((off != 0) || (len > APU_MMAP_SIZE)) {
+			errno = EINVAL;
+			return MAP_FAILED;
+		}
+		if ((shim.flags & O_ACCMODE) != O_RDWR) {
+			errno = EACCES;
+			return MAP_FAILED;
+		}
+		return slots;
+	}
+
+	return real_mmap(addr, len, prot, flags, fd, off);
+}
+
+void *mmap64(void *addr, size_t len, int prot, int flags, int fd, off64_t off)
+{
+	return mmap(addr, len, prot, flags, fd, off);
+}
+
+int munmap(void *addr, size_t len)
+{
+	shim_init();
+	if (addr == slots) { return 0; }
+	return real_munmap(addr, len);
+}
+
+/**
+ * @brief Looks up the real versions of the intercepted functions.
+ */
+static void shim_init(void)
+{
+	if (real_open != NULL) { return; }
+
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_write = dlsym(RTLD_NEXT, "write");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_poll = dlsym(RTLD_NEXT, "poll");
+	real_mmap = dlsym(RTLD_NEXT, "mmap");
+	real_munmap = dlsym(RTLD_NEXT, "munmap");
+	real_open = dlsym(RTLD_NEXT, "open");
+}
+
+/**
+ * @brief Opens the stand-in device, if no one else has it open.
+ * @param flags The flags given to open().
+ * @return The device's file descriptor, or -1 on error.
+ */
+static int shim_open(int flags)
+{
+	int fd;
+
+	pthread_mutex_lock(&shim.lock);
+
+	if (shim.fd != -1) {
+		pthread_mutex_unlock(&shim.lock);
+		errno = EBUSY;
+		return -1;
+	}
+
+	if ((fd = eventfd(0, EFD_NONBLOCK | ((flags & O_CLOEXEC) ? EFD_CLOEXEC : 0))) < 0) {
+		pthread_mutex_unlock(&shim.lock);
+		return -1;
+	}
+
+	shim.fd = fd;
+	shim.flags = flags;
+	shim.ready = false;
+	shim.stopping = false;
+	shim.played = 0;
+	shim.starved = 0;
+	shim.max_wait = 0;
+	ring_reset(RING_DEFAULT);
+	if (shim.wav == NULL) { wav_open(); }
+
+	pthread_mutex_unlock(&shim.lock);
+	return fd;
+}
+
+/**
+ * @brief Closes the stand-in device, stopping the apu and printing the summary.
+ * @return 0.
+ */
+static int shim_close(void)
+{
+	int fd;
+
+	pthread_mutex_lock(&shim.lock);
+	shim.stopping = true;
+	pthread_cond_broadcast(&shim.cond);
+	pthread_mutex_unlock(&shim.lock);
+
+	if (shim.started) { pthread_join(shim.apu, NULL); }
+
+	pthread_mutex_lock(&shim.lock);
+	print_summary();
+	wav_finish();
+	ring_reset(RING_DEFAULT);
+	fd = shim.fd;
+	shim.fd = -1;
+	pthread_mutex_unlock(&shim.lock);
+
+	return real_close(fd);
+}
+
+/**
+ * @brief Copies samples into the next free slot, as the driver's write() does.
+ * @param buf The samples.
+ * @param len The number of samples, at most APU_SLOT_SIZE.
+ * @return len on success, or -1 on error.
+ */
+static ssize_t shim_write(const void *buf, size_t len)
+{
+	int ret;
+
+	if ((len > APU_SLOT_SIZE) || (buf == NULL)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&shim.lock);
+
+	if ((ret = ring_wait()) != 0) {
+		pthread_mutex_unlock(&shim.lock);
+		errno = ret;
+		return -1;
+	}
+
+	memcpy(&slots[shim.head * APU_SLOT_SIZE], buf, len);
+	ring_commit(len);
+
+	pthread_mutex_unlock(&shim.lock);
+	return len;
+}
+
+/**
+ * @brief Handles an ioctl on the stand-in device, as the driver does.
+ * @param request The ioctl command.
+ * @param arg The argument of the command.
+ * @return 0 on success, or -1 on error.
+ */
+static int shim_ioctl(unsigned long request, unsigned long arg)
+{
+	struct apu_commit *commit = (struct apu_commit *)arg;
+	struct apu_stats *stats = (struct apu_stats *)arg;
+	int ret = 0;
+
+	pthread_mutex_lock(&shim.lock);
+
+	switch (request) {
+	case IOCTL_APU_START:
+		if (!shim.started) {
+			shim.started = true;
+			shim.start_time = now_ns();
+			shim.drain_time = shim.start_time
+			                  + (uint64_t)shim.filled * BUF_TIME_NS;
+			if (pthread_create(&shim.apu, NULL, apu_thread, NULL) != 0) {
+				shim.started = false;
+				ret = EAGAIN;
+				break;
+			}
+
+			/* The apu has nothing queued, so it asks at once. */
+			shim.irq_en = true;
+			check_irq(shim.start_time);
+		}
+		break;
+	case IOCTL_APU_SET_DEPTH:
+		if ((arg < APU_RING_MIN) || (arg > APU_RING_MAX)) {
+			ret = EINVAL;
+		} else if (shim.started) {
+			ret = EBUSY;
+		} else {
+			ring_reset(arg);
+		}
+		break;
+	case IOCTL_APU_GET_STATS:
+		stats->depth = shim.depth;
+		stats->queued = shim.filled + shim.hw;
+		stats->underruns = shim.underruns;
+		stats->overruns = shim.overruns;
+		stats->drain_us = (shim.started && (shim.drain_time > now_ns()))
+		                  ? (shim.drain_time - now_ns()) / 1000 : 0;
+		memcpy(stats->latency, shim.latency, sizeof(stats->latency));
+		break;
+	case IOCTL_APU_GET_SLOT:
+		if ((ret = ring_wait()) == 0) { *(__u32 *)arg = shim.head; }
+		break;
+	case IOCTL_APU_COMMIT:
+		if ((commit->len > APU_SLOT_SIZE) || (commit->slot != shim.head)
+		    || (ring_free() == 0)) {
+			ret = EINVAL;
+		} else {
+			ring_commit(commit->len);
+		}
+		break;
+	default:
+		ret = EINVAL;
+		break;
+	}
+
+	pthread_mutex_unlock(&shim.lock);
+
+	if (ret != 0) {
+		errno = ret;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Empties the ring, clears the statistics, and sets the ring depth.
+ *        The apu must be stopped, and the lock held.
+ * @param depth The new depth of the ring.
+ */
+static void ring_reset(unsigned depth)
+{
+	shim.depth = depth;
+	shim.head = 0;
+	shim.filled = 0;
+	shim.hw = 0;
+	shim.started = false;
+	shim.requested = false;
+	shim.queued = false;
+	shim.irq_en = false;
+	shim.underruns = 0;
+	shim.overruns = 0;
+	memset(shim.latency, 0, sizeof(shim.latency));
+
+	if (shim.fd != -1) { update_ready(); }
+}
+
+/**
+ * @brief Gets the number of free slots in the ring, as the driver sees it.
+ *        The lock must be held.
+ * @return The number of free slots.
+ */
+static unsigned ring_free(void)
+{
+	return shim.depth - shim.filled - shim.hw;
+}
+
+/**
+ * @brief Waits for the ring to have a free slot, counting an overrun if it is
+ *        full. The lock must be held.
+ * @return 0 once a slot is free, or EAGAIN if the device is non-blocking.
+ */
+static int ring_wait(void)
+{
+	if (ring_free() > 0) { return 0; }
+
+	shim.overruns++;
+	if (shim.flags & O_NONBLOCK) { return EAGAIN; }
+
+	while (ring_free() == 0) { pthread_cond_wait(&shim.cond, &shim.lock); }
+	return 0;
+}
+
+/**
+ * @brief Adds the head slot to the ring, sending it now if the apu asked for
+ *        it, as the driver does. The lock must be held, and the ring must have
+ *        a free slot.
+ * @param len The number of samples filled in the head slot.
+ */
+static void ring_commit(unsigned len)
+{
+	int8_t *slot = &slots[shim.head * APU_SLOT_SIZE];
+	uint64_t now = now_ns();
+
+	if (len < APU_SLOT_SIZE) { memset(&slot[len], 0, APU_SLOT_SIZE - len); }
+
+	shim.head = (shim.head + 1) % shim.depth;
+	shim.filled++;
+	if (shim.requested) { ring_refilled(now); }
+
+	/* Each slot given to the apu extends how long it can play for. */
+	if (shim.started) {
+		if (now > shim.drain_time) { shim.drain_time = now; }
+		shim.drain_time += BUF_TIME_NS;
+	}
+
+	update_ready();
+}
+
+/**
+ * @brief Queues the oldest filled slot in the apu, and re-enables its irq.
+ *        The lock must be held, and there must be a filled slot.
+ */
+static void ring_send(void)
+{
+	shim.queued_slot = (shim.head + shim.depth - shim.filled) % shim.depth;
+	shim.queued = true;
+	shim.filled--;
+	shim.hw++;
+	shim.irq_en = true;
+
+	/* Wake the apu, in case it is idle. */
+	pthread_cond_broadcast(&shim.cond);
+}
+
+/**
+ * @brief Answers the pending apu request with a filled slot, recording its
+ *        latency and counting an underrun if the apu ran dry waiting, as the
+ *        driver does. The lock must be held, and there must be a filled slot.
+ * @param now The time, in ns.
+ */
+static void ring_refilled(uint64_t now)
+{
+	uint64_t wait = now - shim.req_time;
+	unsigned bucket = 0;
+
+	/* Bucket 0 is under 64us, and each bucket after it doubles. */
+	for (uint64_t w = wait / 1000 >> 6; w != 0; w >>= 1) { bucket++; }
+	if (bucket >= APU_LATENCY_BUCKETS) { bucket = APU_LATENCY_BUCKETS - 1; }
+	shim.latency[bucket]++;
+	if (wait > shim.max_wait) { shim.max_wait = wait; }
+
+	if (shim.req_playing && (wait > BUF_TIME_NS)) { shim.underruns++; }
+
+	shim.requested = false;
+	ring_send();
+}
+
+/**
+ * @brief Raises the apu's irq if it is enabled and the apu has no queued
+ *        buffer, and handles it as the driver does. The lock must be held.
+ * @param now The time, in ns.
+ */
+static void check_irq(uint64_t now)
+{
+	if (!shim.started || !shim.irq_en || shim.queued) { return; }
+
+	/* Acknowledging the irq also turns it off until the next send. */
+	shim.irq_en = false;
+
+	/* The apu took its queued buffer, so the one before it has finished. */
+	if (shim.hw == 2) { shim.hw--; }
+
+	shim.requested = true;
+	shim.req_playing = (shim.hw > 0);
+	shim.req_time = now;
+	if (shim.filled > 0) { ring_refilled(now); }
+
+	pthread_cond_broadcast(&shim.cond);
+	update_ready();
+}
+
+/**
+ * @brief Makes the eventfd readable exactly when the ring has a free slot.
+ *        The lock must be held.
+ */
+static void update_ready(void)
+{
+	bool ready = (ring_free() > 0);
+	uint64_t val = 1;
+
+	if (ready == shim.ready) { return; }
+
+	if (ready) {
+		if (real_write(shim.fd, &val, sizeof(val)) != sizeof(val)) { return; }
+	} else {
+		if (read(shim.fd, &val, sizeof(val)) != sizeof(val)) { return; }
+	}
+	shim.ready = ready;
+}
+
+/**
+ * @brief Plays the ring in real time, as the apu does.
+ *
+ * When a buffer finishes, the one queued in the apu (if any) is started, and
+ * the irq checked. If none is queued, the apu starves: it is idle until a
+ * buffer is queued, which then starts at once, and the time in between is
+ * recorded as silence.
+ *
+ * @param arg Ignored.
+ * @return NULL, once the device is closed.
+ */
+static void *apu_thread(void *arg)
+{
+	uint64_t end = 0;       // When the playing buffer ends, or 0 while idle.
+	uint64_t idle = 0;      // When the apu went idle, once it has played.
+	(void)arg;
+
+	pthread_mutex_lock(&shim.lock);
+
+	while (!shim.stopping) {
+		uint64_t now = now_ns();
+		struct timespec ts;
+
+		if (shim.queued) {
+			if (end == 0) {
+				if (idle != 0) { wav_silence(now - idle); }
+				end = now;
+			}
+			wav_write(&slots[shim.queued_slot * APU_SLOT_SIZE]);
+			shim.queued = false;
+			shim.played++;
+			end += BUF_TIME_NS;
+			check_irq(now);
+		} else if ((end != 0) && (now >= end)) {
+			shim.starved++;
+			fprintf(stderr, "fpgame-apu-shim: starved at %.3fs\n",
+			        (end - shim.start_time) / 1e9);
+			idle = end;
+			end = 0;
+		}
+
+		/* While idle, wait for a buffer. Otherwise, for this one to end. */
+		if (end == 0) {
+			pthread_cond_wait(&shim.cond, &shim.lock);
+			continue;
+		}
+
+		ts.tv_sec = end / 1000000000;
+		ts.tv_nsec = end % 1000000000;
+		pthread_mutex_unlock(&shim.lock);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) { }
+		pthread_mutex_lock(&shim.lock);
+	}
+
+	pthread_mutex_unlock(&shim.lock);
+	return NULL;
+}
+
+/**
+ * @brief Opens the WAV file to record to, and writes a placeholder header.
+ */
+static void wav_open(void)
+{
+	const char *path = getenv("FPGAME_APU_WAV");
+	uint8_t hdr[WAV_HEADER_SIZE] = { 0 };
+
+	if (path == NULL) { path = "fpgame-apu.wav"; }
+	if (path[0] == '\0') { return; }
+
+	if ((shim.wav = fopen(path, "wb")) == NULL) {
+		perror("fpgame-apu-shim: cannot record");
+		return;
+	}
+
+	memcpy(&hdr[0], "RIFF", 4);
+	memcpy(&hdr[8], "WAVEfmt ", 8);
+	put32(&hdr[16], 16);
+	put16(&hdr[20], 1);
+	put16(&hdr[22], 1);
+	put32(&hdr[24], SAMPLE_RATE);
+	put32(&hdr[28], SAMPLE_RATE);
+	put16(&hdr[32], 1);
+	put16(&hdr[34], 8);
+	memcpy(&hdr[36], "data", 4);
+	fwrite(hdr, 1, sizeof(hdr), shim.wav);
+	shim.wav_bytes = 0;
+}
+
+/**
+ * @brief Records a buffer of samples to the WAV file.
+ * @param buf APU_SLOT_SIZE samples.
+ */
+static void wav_write(const int8_t *buf)
+{
+	uint8_t pcm[APU_SLOT_SIZE];
+
+	if (shim.wav == NULL) { return; }
+
+	/* 8-bit WAV samples are unsigned. */
+	for (int i = 0; i < APU_SLOT_SIZE; i++) { pcm[i] = buf[i] + 128; }
+	shim.wav_bytes += fwrite(pcm, 1, sizeof(pcm), shim.wav);
+}
+
+/**
+ * @brief Records silence to the WAV file.
+ * @param ns How long the silence lasts.
+ */
+static void wav_silence(uint64_t ns)
+{
+	uint64_t len = ns * SAMPLE_RATE / 1000000000;
+	uint8_t pcm[APU_SLOT_SIZE];
+
+	if (shim.wav == NULL) { return; }
+
+	/* 8-bit WAV samples are unsigned, so silence is 128. */
+	memset(pcm, 128, sizeof(pcm));
+	while (len > 0) {
+		size_t n = (len < APU_SLOT_SIZE) ? len : APU_SLOT_SIZE;
+
+		shim.wav_bytes += fwrite(pcm, 1, n, shim.wav);
+		len -= n;
+	}
+}
+
+/**
+ * @brief Fills in the sizes in the WAV header, so the file is valid so far.
+ *
+ * Recording continues if the device is opened again.
+ */
+static void wav_finish(void)
+{
+	uint8_t size[4];
+
+	if (shim.wav == NULL) { return; }
+
+	put32(size, WAV_HEADER_SIZE - 8 + shim.wav_bytes);
+	fseek(shim.wav, 4, SEEK_SET);
+	fwrite(size, 1, sizeof(size), shim.wav);
+
+	put32(size, shim.wav_bytes);
+	fseek(shim.wav, 40, SEEK_SET);
+	fwrite(size, 1, sizeof(size), shim.wav);
+
+	fseek(shim.wav, 0, SEEK_END);
+	fflush(shim.wav);
+}
+
+/** @brief Writes a little-endian 16-bit value. */
+static void put16(uint8_t *p, unsigned v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+/** @brief Writes a little-endian 32-bit value. */
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/**
+ * @brief Prints what happened while the device was open to stderr.
+ */
+static void print_summary(void)
+{
+	fprintf(stderr, "fpgame-apu-shim: played %llu buffers (%.2fs), starved %llu times\n",
+	        (unsigned long long)shim.played, shim.played * (BUF_TIME_NS / 1e9),
+	        (unsigned long long)shim.starved);
+	fprintf(stderr, "fpgame-apu-shim: depth %u: %u underruns, %u overruns\n",
+	        shim.depth, shim.underruns, shim.overruns);
+	fprintf(stderr, "fpgame-apu-shim: refill latency (max %.3fms):",
+	        shim.max_wait / 1e6);
+	for (int i = 0; i < APU_LATENCY_BUCKETS; i++) {
+		if (shim.latency[i] == 0) { continue; }
+		fprintf(stderr, " <%uus %u", 64u << i, shim.latency[i]);
+	}
+	fprintf(stderr, "\n");
+}
@@ -0,0 +1,269 @@
+/** @file fpgame_pack.c
+ * @author Joseph Yankel
+ * @brief Host tool which builds binary asset packs from the PPU text asset formats
+ *
+ * Usage: fpgame-pack <out.fpk> <asset>...
+ *
+ * Where each asset is one of:
+ *   tilemap <name> <file>                  A tilemap, as read by ppu_load_tilemap()
+ *   pattern <name> <width> <height> <file> Pattern graphics, as read by ppu_load_pattern()
+ *   palette <name> <file>                  A palette, as read by ppu_load_palette()
+ *
+ * The assets are encoded exactly as the text loaders encode them, so the pack can be used in place
+ *   of the text files with no change in what is written to the PPU. See fp-game/asset.h for the
+ *   pack format.
+ */
+
+#include <fp-game/asset.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** @brief An asset read from a text file, waiting to be written to the pack */
+typedef struct {
+    asset_pack_entry_t entry; ///< Index entry (offset is filled in when the pack is written)
+    void *data;               ///< Encoded asset data
+    size_t size;              ///< Size of data in bytes
+} pending_asset_t;
+
+static const char *progname;
+
+/** @brief Prints an error message and exits */
+static void die(const char *fmt, const char *arg)
+{
+    fprintf(stderr, "%s: ", progname);
+    fprintf(stderr, fmt, arg);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+/** @brief Opens a text asset for reading, exiting on failure */
+static FILE *open_text(const char *file)
+{
+    FILE *fp = fopen(file, "r");
+    if (fp == NULL) die("cannot open %s", file);
+    return fp;
+}
+
+/** @brief Grows a buffer of elements, exiting on failure */
+static void *grow(void *buf, size_t count, size_t elem_size)
+{
+    buf = realloc(buf, count * elem_size);
+    if (buf == NULL) die("out of memory%s", "");
+    return buf;
+}
+
+/** @brief Reads a tilemap in the format of ppu_load_tilemap() */
+static void read_tilemap(pending_asset_t *asset, const char *file)
+{
+    FILE *fp = open_text(file);
+    unsigned pattern_addr, palette_id, mirror;
+    tile_t *tiles = NULL;
+    unsigned count = 0;
+
+    while (fscanf(fp, " (%3X,%1X,%1X)", &pattern_addr, &palette_id, &mirror) == 3)
+    {
+        if (pattern_addr >= PATTERNRAM_COUNT || palette_id >= TILELAYER_MAX_PALETTES
+            || mirror > MIRROR_XY)
+        {
+            die("malformed tile in %s", file);
+        }
+
+        // Same encoding as ppu_make_tile()
+        tiles = grow(tiles, count + 1, sizeof(tile_t));
+        tiles[count++] = (pattern_addr << 6) | (palette_id << 2) | mirror;
+    }
+
+    if (!feof(fp)) die("malformed tile in %s", file);
+    fclose(fp);
+
+    asset->entry.type = ASSET_TILEMAP;
+    asset->entry.count = count;
+    asset->data = tiles;
+    asset->size = count * sizeof(tile_t);
+}
+
+/** @brief Reads pattern graphics in the format of ppu_load_pattern() */
+static void read_pattern(pending_asset_t *asset, const char *file, unsigned width, unsigned height)
+{
+    FILE *fp = open_text(file);
+    pattern_t *patterns;
+    uint32_t row_pattern;
+
+    patterns = grow(NULL, width * height, sizeof(pattern_t));
+
+    for (unsigned tile = 0; tile < height; tile++)
+    {
+        for (unsigned row = 0; row < TILEPATTERN_HEIGHT; row++)
+        {
+            for (unsigned col = 0; col < width; col++)
+            {
+                if (fscanf(fp, " %8X", &row_pattern) != 1) die("%s is truncated", file);
+
+                // The text format has the first pixel in the most significant nibble; the PPU
+                //   expects it in the least significant nibble.
+                row_pattern = ((row_pattern & 0x0F0F0F0F) << 4) |
+                              ((row_pattern & 0xF0F0F0F0) >> 4);
+                row_pattern = ((row_pattern & 0x00FF00FF) << 8) |
+                              ((row_pattern & 0xFF00FF00) >> 8);
+                row_pattern = (row_pattern << 16) | (row_pattern >> 16);
+
+                patterns[col + tile * width].pxrow[row] = row_pattern;
+            }
+        }
+    }
+
+    fclose(fp);
+
+    asset->entry.type = ASSET_PATTERN;
+    asset->entry.count = width * height;
+    asset->entry.width = width;
+    asset->entry.height = height;
+    asset->data = patterns;
+    asset->size = width * height * sizeof(pattern_t);
+}
+
+/** @brief Reads a palette in the format of ppu_load_palette() */
+static void read_palette(pending_asset_t *asset, const char *file)
+{
+    FILE *fp = open_text(file);
+    palette_t *palette;
+    unsigned color;
+
+    palette = grow(NULL, 1, sizeof(palette_t));
+    memset(palette, 0, sizeof(palette_t));
+
+    // The first color is always transparent and is skipped, as in ppu_load_palette().
+    for (unsigned count = 0; count < PALETTE_COLORS; count++)
+    {
+        if (fscanf(fp, " %6X", &color) != 1) break;
+        if (count > 0) palette->color[count - 1] = color;
+    }
+
+    fclose(fp);
+
+    asset->entry.type = ASSET_PALETTE;
+    asset->entry.count = 1;
+    asset->data = palette;
+    asset->size = sizeof(palette_t);
+}
+
+/** @brief Parses a pattern dimension argument */
+static unsigned parse_dim(const char *arg)
+{
+    char *end;
+    unsigned long val = strtoul(arg, &end, 0);
+
+    if (*arg == '\0' || *end != '\0' || val == 0 || val > PATTERNRAM_COUNT)
+    {
+        die("bad pattern dimension %s", arg);
+    }
+    return val;
+}
+
+/** @brief Writes zero bytes to pad the pack to ASSET_PACK_ALIGN, advancing @p pos */
+static void write_padding(FILE *fp, size_t *pos)
+{
+    static const uint8_t zero[ASSET_PACK_ALIGN];
+    size_t len = (ASSET_PACK_ALIGN - (*pos % ASSET_PACK_ALIGN)) % ASSET_PACK_ALIGN;
+
+    fwrite(zero, 1, len, fp);
+    *pos += len;
+}
+
+int main(int argc, char **argv)
+{
+    pending_asset_t *assets;
+    unsigned count = 0;
+    asset_pack_header_t header;
+    const uint32_t endian_check = 1;
+    size_t pos;
+    FILE *fp;
+    int i;
+
+    progname = argv[0];
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <out.fpk> <asset>...\n"
+                        "  tilemap <name> <file>\n"
+                        "  pattern <name> <width> <height> <file>\n"
+                        "  palette <name> <file>\n", progname);
+        return EXIT_FAILURE;
+    }
+
+    // Packs are mapped directly on the (little-endian) ARM, so they are written in host order.
+    if (*(const uint8_t *)&endian_check != 1) die("host must be little-endian%s", "");
+
+    assets = grow(NULL, argc, sizeof(pending_asset_t));
+    memset(assets, 0, argc * sizeof(pending_asset_t));
+
+    // Read every asset first, so a bad input never leaves a partial pack behind.
+    for (i = 2; i < argc; count++)
+    {
+        pending_asset_t *asset = &assets[count];
+        const char *kind = argv[i];
+
+        if (i + 2 >= argc) die("missing arguments for %s", kind);
+        if (strlen(argv[i + 1]) >= ASSET_NAME_MAX) die("asset name %s is too long", argv[i + 1]);
+        strcpy(asset->entry.name, argv[i + 1]);
+
+        if (strcmp(kind, "tilemap") == 0)
+        {
+            read_tilemap(asset, argv[i + 2]);
+            i += 3;
+        }
+        else if (strcmp(kind, "palette") == 0)
+        {
+            read_palette(asset, argv[i + 2]);
+            i += 3;
+        }
+        else if (strcmp(kind, "pattern") == 0)
+        {
+            if (i + 4 >= argc) die("missing arguments for %s", kind);
+            read_pattern(asset, argv[i + 4], parse_dim(argv[i + 2]), parse_dim(argv[i + 3]));
+            i += 5;
+        }
+        else
+        {
+            die("unknown asset kind %s", kind);
+        }
+    }
+
+    fp = fopen(argv[1], "wb");
+    if (fp == NULL) die("cannot create %s", argv[1]);
+
+    // Header first (index_offset is filled in once the data is written), then the data, then the
+    //   index.
+    memset(&header, 0, sizeof(header));
+    fwrite(&header, sizeof(header), 1, fp);
+    pos = sizeof(header);
+
+    for (unsigned a = 0; a < count; a++)
+    {
+        write_padding(fp, &pos);
+        assets[a].entry.offset = pos;
+        fwrite(assets[a].data, 1, assets[a].size, fp);
+        pos += assets[a].size;
+    }
+
+    write_padding(fp, &pos);
+    header.magic = ASSET_PACK_MAGIC;
+    header.version = ASSET_PACK_VERSION;
+    header.count = count;
+    header.index_offset = pos;
+
+    for (unsigned a = 0; a < count; a++)
+    {
+        fwrite(&assets[a].entry, sizeof(asset_pack_entry_t), 1, fp);
+        free(assets[a].data);
+    }
+    free(assets);
+
+    rewind(fp);
+    fwrite(&header, sizeof(header), 1, fp);
+
+    if (ferror(fp) || fclose(fp) == EOF) die("error writing %s", argv[1]);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""
+@file fpgame_trace.py
+@brief Summarizes a trace of the FP-GAme frame pipeline.
+
+Reads the text output of `trace-cmd report` or `perf script` for a recording of
+the fpgame_ppu, fpgame_apu and fpgame_con tracepoints, and optionally the
+library's fpgame USDT probes (see docs/tracing.md), and reports:
+
+ - The time from an update request to its DMA starting, and from the DMA
+   starting to the PPU accepting the frame.
+ - The frame intervals, and every hitch: an interval longer than the hitch
+   factor times the median, along with what happened during it.
+ - The APU's refill latency (irq to the slot which answers it), its underruns
+   and rejected fills, and how long the library's refills took.
+ - The input lag from a controller change to the next input_update() frame.
+
+Usage: fpgame_trace.py [--hitch FACTOR] [TRACE]
+The trace is read from stdin if no file is given.
+"""
+
+import argparse
+import re
+import statistics
+import sys
+
+# "<timestamp>: [system:]event: fields", as printed by both trace-cmd and perf.
+LINE_RE = re.compile(r'(\d+\.\d+):\s+(?:\w+:)?(\w+):\s*(.*)$')
+FIELD_RE = re.compile(r'(\w+)=(\S+)')
+
+
+def parse(lines):
+    """Yields (time in seconds, event name, fields) for each event line."""
+    for line in lines:
+        m = LINE_RE.search(line)
+        if m is None:
+            continue
+        fields = {k: int(v, 0) for k, v in FIELD_RE.findall(m.group(3))
+                  if re.fullmatch(r'-?(0x[0-9a-fA-F]+|\d+)', v)}
+        yield float(m.group(1)), m.group(2), fields
+
+
+def ms(seconds):
+    return '%.3f ms' % (seconds * 1000)
+
+
+def summary(name, values):
+    """Prints the count and spread of a list of durations, in seconds."""
+    if not values:
+        print('  %-28s none' % name)
+        return
+    values = sorted(values)
+    p99 = values[min(len(values) - 1, int(len(values) * 0.99))]
+    print('  %-28s n=%-6d median %s  p99 %s  max %s'
+          % (name, len(values), ms(statistics.median(values)), ms(p99), ms(values[-1])))
+
+
+def latencies(events, start, end, key=None):
+    """Pairs each start event with the next end event (matching on a field, if
+    key is given), and returns the durations."""
+    out = []
+    pending = {}
+    for t, name, f in events:
+        k = f.get(key) if key else None
+        if name == start:
+            pending.setdefault(k, t)
+        elif name == end and k in pending:
+            out.append(t - pending.pop(k))
+    return out
+
+
+def report(events, hitch_factor):
+    print('== PPU ==')
+    # Each update request is paired with the next DMA start.
+    summary('update -> dma_start', latencies(
+        [e for e in events if e[1] in ('ppu_update', 'ppu_dma_start')],
+        'ppu_update', 'ppu_dma_start'))
+    summary('dma_start -> irq', latencies(
+        events, 'ppu_dma_start', 'ppu_dma_irq', key='frame'))
+    summary('library sync wait', latencies(events, 'ppu_sync_start', 'ppu_sync_done'))
+    summary('library ready wait', latencies(events, 'ppu_wait_start', 'ppu_wait_done'))
+    busy = sum(1 for e in events if e[1] == 'ppu_update_busy')
+    stray = sum(1 for e in events if e[1] == 'ppu_dma_irq' and e[2].get('in_flight') == 0)
+    written = sum(e[2].get('len', 0) for e in events if e[1] == 'ppu_vram_write')
+    print('  updates rejected (EBUSY)     %d' % busy)
+    print('  irqs with no frame in flight %d' % stray)
+    print('  bytes written to VRAM        %d' % written)
+
+    irqs = [t for t, name, f in events if name == 'ppu_dma_irq' and f.get('in_flight', 1)]
+    intervals = [(b - a, a, b) for a, b in zip(irqs, irqs[1:])]
+    if intervals:
+        median = statistics.median(i for i, _, _ in intervals)
+        summary('frame interval', [i for i, _, _ in intervals])
+        hitches = [x for x in intervals if x[0] > median * hitch_factor]
+        print('  hitches (> %.2fx median)     %d' % (hitch_factor, len(hitches)))
+        for length, a, b in hitches:
+            window = [e for e in events if a < e[0] <= b]
+            counts = {}
+            for _, name, _ in window:
+                counts[name] = counts.get(name, 0) + 1
+            detail = ', '.join('%s x%d' % kv for kv in sorted(counts.items()))
+            print('    at %.6f: %s (%s)' % (a, ms(length), detail or 'nothing traced'))
+
+    print('== APU ==')
+    summary('irq -> refill', [e[2].get('wait_us', 0) / 1e6
+                              for e in events if e[1] == 'apu_refill'])
+    summary('library refill', latencies(events, 'apu_refill_start', 'apu_refill_done'))
+    summary('library render', latencies(events, 'apu_render_start', 'apu_render_done'))
+    late = sum(1 for e in events if e[1] == 'apu_refill' and e[2].get('late'))
+    rejects = [e[2].get('err') for e in events if e[1] == 'apu_reject']
+    dry = sum(1 for e in events if e[1] == 'apu_queue_underrun')
+    print('  underruns (late refills)     %d' % late)
+    print('  overruns (EAGAIN)            %d' % rejects.count(-11))
+    print('  bad commits (EINVAL)         %d' % rejects.count(-22))
+    print('  sample queue underruns       %d' % dry)
+
+    print('== Controller ==')
+    changes = [t for t, name, _ in events if name == 'con_change']
+    frames = [t for t, name, _ in events if name == 'input_frame']
+    lag = []
+    j = 0
+    for t in changes:
+        while j < len(frames) and frames[j] < t:
+            j += 1
+        if j < len(frames):
+            lag.append(frames[j] - t)
+    print('  changes sampled              %d' % len(changes))
+    summary('change -> input frame', lag)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Summarize an FP-GAme pipeline trace.')
+    parser.add_argument('trace', nargs='?', help='trace-cmd report or perf script output')
+    parser.add_argument('--hitch', type=float, default=1.5,
+                        help='frame interval, as a multiple of the median, counted as a hitch')
+    args = parser.parse_args()
+
+    with (open(args.trace) if args.trace else sys.stdin) as f:
+        events = sorted(parse(f), key=lambda e: e[0])
+
+    if not events:
+        sys.exit('No FP-GAme events found in the trace.')
+    report(events, args.hitch)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,301 @@
+/**
+ * @file arm_neon.h
+ * @author Joseph Yankel
+ * @brief Plain C stand-in for the NEON intrinsics used by the library, for host checks.
+ *
+ * The host checks build the library a second time with __ARM_NEON defined and this folder first
+ *   on the include path, so the NEON paths run on the development machine and can be compared
+ *   with the scalar paths bit for bit. Each intrinsic is written lane by lane from its definition
+ *   in the ARM NEON Intrinsics Reference, saturation and all. Only the intrinsics the library uses
+ *   are here; add to it as the library grows.
+ *
+ * This says nothing about the speed of the NEON paths, only about what they compute.
+ */
+
+#ifndef _FP_GAME_TOOLS_ARM_NEON_H_
+#define _FP_GAME_TOOLS_ARM_NEON_H_
+
+#include <stdint.h>
+
+/* ============= */
+/* === Types === */
+/* ============= */
+typedef struct { int8_t v[8]; } int8x8_t;
+typedef struct { uint8_t v[8]; } uint8x8_t;
+typedef struct { uint8_t v[16]; } uint8x16_t;
+typedef struct { int16_t v[4]; } int16x4_t;
+typedef struct { int16_t v[8]; } int16x8_t;
+typedef struct { uint16_t v[4]; } uint16x4_t;
+typedef struct { uint16_t v[8]; } uint16x8_t;
+typedef struct { int32_t v[4]; } int32x4_t;
+typedef struct { int64_t v[2]; } int64x2_t;
+
+/** @brief Loops over the lanes of a vector. */
+#define LANES(r) (unsigned i = 0; i < sizeof((r).v) / sizeof((r).v[0]); i++)
+
+/** @brief Saturates a value to a signed range. */
+static inline int64_t neon_sat(int64_t x, int64_t min, int64_t max)
+{
+    return (x < min) ? min : (x > max) ? max : x;
+}
+
+/* ============================ */
+/* === Loads, Stores, Lanes === */
+/* ============================ */
+static inline uint8x8_t vld1_u8(const uint8_t *p)
+{
+    uint8x8_t r;
+    for LANES(r) { r.v[i] = p[i]; }
+    return r;
+}
+
+static inline uint8x16_t vld1q_u8(const uint8_t *p)
+{
+    uint8x16_t r;
+    for LANES(r) { r.v[i] = p[i]; }
+    return r;
+}
+
+static inline uint16x8_t vld1q_u16(const uint16_t *p)
+{
+    uint16x8_t r;
+    for LANES(r) { r.v[i] = p[i]; }
+    return r;
+}
+
+static inline int16x8_t vld1q_s16(const int16_t *p)
+{
+    int16x8_t r;
+    for LANES(r) { r.v[i] = p[i]; }
+    return r;
+}
+
+static inline int32x4_t vld1q_s32(const int32_t *p)
+{
+    int32x4_t r;
+    for LANES(r) { r.v[i] = p[i]; }
+    return r;
+}
+
+static inline void vst1q_u8(uint8_t *p, uint8x16_t a)
+{
+    for LANES(a) { p[i] = a.v[i]; }
+}
+
+static inline void vst1q_u16(uint16_t *p, uint16x8_t a)
+{
+    for LANES(a) { p[i] = a.v[i]; }
+}
+
+static inline void vst1q_s32(int32_t *p, int32x4_t a)
+{
+    for LANES(a) { p[i] = a.v[i]; }
+}
+
+static inline void vst1_s8(int8_t *p, int8x8_t a)
+{
+    for LANES(a) { p[i] = a.v[i]; }
+}
+
+static inline uint16x8_t vdupq_n_u16(uint16_t x)
+{
+    uint16x8_t r;
+    for LANES(r) { r.v[i] = x; }
+    return r;
+}
+
+static inline int32x4_t vdupq_n_s32(int32_t x)
+{
+    int32x4_t r;
+    for LANES(r) { r.v[i] = x; }
+    return r;
+}
+
+static inline int64x2_t vdupq_n_s64(int64_t x)
+{
+    int64x2_t r;
+    for LANES(r) { r.v[i] = x; }
+    return r;
+}
+
+static inline uint16x4_t vget_low_u16(uint16x8_t a)
+{
+    uint16x4_t r;
+    for LANES(r) { r.v[i] = a.v[i]; }
+    return r;
+}
+
+static inline uint16x4_t vget_high_u16(uint16x8_t a)
+{
+    uint16x4_t r;
+    for LANES(r) { r.v[i] = a.v[i + 4]; }
+    return r;
+}
+
+static inline int16x4_t vget_low_s16(int16x8_t a)
+{
+    int16x4_t r;
+    for LANES(r) { r.v[i] = a.v[i]; }
+    return r;
+}
+
+static inline int16x4_t vget_high_s16(int16x8_t a)
+{
+    int16x4_t r;
+    for LANES(r) { r.v[i] = a.v[i + 4]; }
+    return r;
+}
+
+static inline int16x8_t vcombine_s16(int16x4_t lo, int16x4_t hi)
+{
+    int16x8_t r;
+    for LANES(lo) { r.v[i] = lo.v[i]; r.v[i + 4] = hi.v[i]; }
+    return r;
+}
+
+static inline uint16_t vget_lane_u16(uint16x4_t a, int lane)
+{
+    return a.v[lane];
+}
+
+static inline int64_t vgetq_lane_s64(int64x2_t a, int lane)
+{
+    return a.v[lane];
+}
+
+/* ========================= */
+/* === Bits and Ordering === */
+/* ========================= */
+static inline uint16x8_t vmovl_u8(uint8x8_t a)
+{
+    uint16x8_t r;
+    for LANES(r) { r.v[i] = a.v[i]; }
+    return r;
+}
+
+static inline uint16x8_t vorrq_u16(uint16x8_t a, uint16x8_t b)
+{
+    uint16x8_t r;
+    for LANES(r) { r.v[i] = a.v[i] | b.v[i]; }
+    return r;
+}
+
+static inline uint16x8_t vshlq_n_u16(uint16x8_t a, int n)
+{
+    uint16x8_t r;
+    for LANES(r) { r.v[i] = (uint16_t)(a.v[i] << n); }
+    return r;
+}
+
+static inline uint8x16_t vshrq_n_u8(uint8x16_t a, int n)
+{
+    uint8x16_t r;
+    for LANES(r) { r.v[i] = a.v[i] >> n; }
+    return r;
+}
+
+/** @brief Shift left and insert: b << n, keeping the low n bits of a. */
+static inline uint8x16_t vsliq_n_u8(uint8x16_t a, uint8x16_t b, int n)
+{
+    uint8x16_t r;
+    for LANES(r) { r.v[i] = (uint8_t)((b.v[i] << n) | (a.v[i] & ((1 << n) - 1))); }
+    return r;
+}
+
+/** @brief Reverses the bytes of each 32-bit word. */
+static inline uint8x16_t vrev32q_u8(uint8x16_t a)
+{
+    uint8x16_t r;
+    for LANES(r) { r.v[i] = a.v[(i & ~3u) + 3 - (i & 3)]; }
+    return r;
+}
+
+/* ================== */
+/* === Arithmetic === */
+/* ================== */
+static inline uint16x8_t vmaxq_u16(uint16x8_t a, uint16x8_t b)
+{
+    uint16x8_t r;
+    for LANES(r) { r.v[i] = (a.v[i] > b.v[i]) ? a.v[i] : b.v[i]; }
+    return r;
+}
+
+/** @brief Pairwise maximum: the pairs of a, then the pairs of b. */
+static inline uint16x4_t vpmax_u16(uint16x4_t a, uint16x4_t b)
+{
+    uint16x4_t r;
+    for LANES(r)
+    {
+        const uint16x4_t *src = (i < 2) ? &a : &b;
+        unsigned j = (i & 1) * 2;
+        r.v[i] = (src->v[j] > src->v[j + 1]) ? src->v[j] : src->v[j + 1];
+    }
+    return r;
+}
+
+/** @brief Multiplies each lane by a scalar, wrapping on overflow. */
+static inline int32x4_t vmulq_n_s32(int32x4_t a, int32_t b)
+{
+    int32x4_t r;
+    for LANES(r) { r.v[i] = (int32_t)((uint32_t)a.v[i] * (uint32_t)b); }
+    return r;
+}
+
+static inline int32x4_t vmull_s16(int16x4_t a, int16x4_t b)
+{
+    int32x4_t r;
+    for LANES(r) { r.v[i] = (int32_t)a.v[i] * b.v[i]; }
+    return r;
+}
+
+/** @brief Widening multiply-accumulate, wrapping on overflow. */
+static inline int32x4_t vmlal_s16(int32x4_t a, int16x4_t b, int16x4_t c)
+{
+    int32x4_t r;
+    for LANES(r) { r.v[i] = (int32_t)((uint32_t)a.v[i] + (uint32_t)((int32_t)b.v[i] * c.v[i])); }
+    return r;
+}
+
+/** @brief Widening multiply-accumulate by a scalar, wrapping on overflow. */
+static inline int32x4_t vmlal_n_s16(int32x4_t a, int16x4_t b, int16_t c)
+{
+    int32x4_t r;
+    for LANES(r) { r.v[i] = (int32_t)((uint32_t)a.v[i] + (uint32_t)((int32_t)b.v[i] * c)); }
+    return r;
+}
+
+/** @brief Adds pairs of lanes of b, widened, to the lanes of a. */
+static inline int64x2_t vpadalq_s32(int64x2_t a, int32x4_t b)
+{
+    int64x2_t r;
+    for LANES(r) { r.v[i] = a.v[i] + (int64_t)b.v[2 * i] + b.v[2 * i + 1]; }
+    return r;
+}
+
+/** @brief Shifts right (arithmetic) and saturates each lane to 16 bits. */
+static inline int16x4_t vqshrn_n_s32(int32x4_t a, int n)
+{
+    int16x4_t r;
+    for LANES(r) { r.v[i] = (int16_t)neon_sat(a.v[i] >> n, INT16_MIN, INT16_MAX); }
+    return r;
+}
+
+/** @brief Shifts right (arithmetic) and saturates each lane to 8 bits. */
+static inline int8x8_t vqshrn_n_s16(int16x8_t a, int n)
+{
+    int8x8_t r;
+    for LANES(r) { r.v[i] = (int8_t)neon_sat(a.v[i] >> n, INT8_MIN, INT8_MAX); }
+    return r;
+}
+
+/** @brief Saturates each lane to 8 bits. */
+static inline int8x8_t vqmovn_s16(int16x8_t a)
+{
+    int8x8_t r;
+    for LANES(r) { r.v[i] = (int8_t)neon_sat(a.v[i], INT8_MIN, INT8_MAX); }
+    return r;
+}
+
+#undef LANES
+
+#endif /* _FP_GAME_TOOLS_ARM_NEON_H_ */
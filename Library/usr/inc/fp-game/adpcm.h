@@ -0,0 +1,128 @@
+/**
+ * @file adpcm.h
+ * @author Andrew Spaulding
+ * @brief Streaming playback of IMA-ADPCM compressed audio.
+ *
+ * IMA-ADPCM stores each sample in 4 bits, so a track takes a quarter of the
+ * space of 16-bit PCM (or half that of the APU's own 8-bit samples). Streams
+ * are mapped into memory rather than read in, and are decoded incrementally,
+ * a few samples at a time, so only the pages being played need to be in
+ * memory at any time.
+ *
+ * Streams are made on the host from WAV files by the fpgame-adpcm tool found
+ * in Library/tools.
+ *
+ * @attention Malformed streams and invalid arguments will result in a console
+ * warning and exiting of the program, as with the rest of the library.
+ */
+
+#ifndef _FP_GAME_ADPCM_H_
+#define _FP_GAME_ADPCM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* ========================== */
+/* === Stream File Format === */
+/* ========================== */
+/*
+ * A stream is an adpcm_header_t followed by ceil(length / ADPCM_BLOCK_SAMPLES)
+ * adpcm_block_t. All fields are little-endian.
+ *
+ * Each block holds the decoder state at its first sample, followed by one
+ * nibble per sample, low nibble first. The state carries over from one block
+ * to the next, so the block headers are only needed to start decoding at a
+ * block. The header holds the decoder state at the loop start, so looping
+ * never needs to decode from the start of a block.
+ */
+#define ADPCM_MAGIC 0x50444146    ///< "FADP" read as a little-endian 32-bit word
+#define ADPCM_VERSION 1           ///< Stream format version written by this library version
+#define ADPCM_BLOCK_SAMPLES 512   ///< Samples per block
+#define ADPCM_LOOP 0x1            ///< Header flag: the stream loops back to loop_start at its end
+
+/** @brief Header at the start of every stream */
+typedef struct {
+	uint32_t magic;         ///< Always ADPCM_MAGIC
+	uint32_t version;       ///< Always ADPCM_VERSION
+	uint32_t length;        ///< Number of samples in the stream
+	uint32_t flags;         ///< ADPCM_LOOP, or 0
+	uint32_t loop_start;    ///< Sample to continue from after the last sample, if looping
+	int16_t loop_predictor; ///< Decoder predictor before decoding sample loop_start
+	uint8_t loop_index;     ///< Decoder step index before decoding sample loop_start
+	uint8_t reserved;       ///< Always 0
+} adpcm_header_t;
+
+/** @brief A block of ADPCM_BLOCK_SAMPLES samples */
+typedef struct {
+	int16_t predictor; ///< Decoder predictor before decoding the first sample of the block
+	uint8_t index;     ///< Decoder step index before decoding the first sample of the block
+	uint8_t reserved;  ///< Always 0
+	uint8_t data[ADPCM_BLOCK_SAMPLES / 2]; ///< The samples, two per byte, low nibble first
+} adpcm_block_t;
+
+/* ================== */
+/* === Stream API === */
+/* ================== */
+/** @brief An open stream. Obtain using @ref adpcm_open */
+typedef struct adpcm_stream adpcm_stream_t;
+
+/** @brief Open a stream and map it into memory
+ * @param file Path of the stream to open.
+ * @return The open stream, positioned at its first sample.
+ */
+adpcm_stream_t *adpcm_open(const char *file);
+
+/** @brief Close a stream, unmapping it
+ *
+ * The stream must not be playing (see @ref adpcm_play).
+ *
+ * @param stream The stream to close.
+ */
+void adpcm_close(adpcm_stream_t *stream);
+
+/** @brief Move a stream back to its first sample
+ * @param stream The stream to rewind.
+ */
+void adpcm_rewind(adpcm_stream_t *stream);
+
+/** @brief Decode the next samples of a stream
+ *
+ * Looping streams continue from their loop start without a gap, so they never
+ * end. Decoding takes the same time for every sample, so the time taken is
+ * bounded by @p len alone.
+ *
+ * @param stream The stream to decode.
+ * @param out Where to store the decoded samples.
+ * @param len The number of samples to decode.
+ * @return The number of samples decoded, which is less than @p len only if the
+ *         stream ended.
+ */
+unsigned adpcm_decode(adpcm_stream_t *stream, int8_t *out, unsigned len);
+
+/** @brief Play a stream through @ref adpcm_callback
+ *
+ * Replaces the stream being played (if any). The new stream plays from its
+ * current position.
+ *
+ * @param stream The stream to play, or NULL to play silence.
+ */
+void adpcm_play(adpcm_stream_t *stream);
+
+/** @brief An APU callback which plays the stream given to @ref adpcm_play
+ *
+ * Decodes one APU buffer of samples per call. Once a stream without a loop
+ * ends, silence is played.
+ *
+ * @param buf Set to the decoded samples.
+ * @param buf_size Set to APU_BUF_MAX.
+ */
+void adpcm_callback(const int8_t **buf, int *buf_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FP_GAME_ADPCM_H_ */
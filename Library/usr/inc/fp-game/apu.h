@@ -7,9 +7,11 @@
  * and registers a callback function to enq more buffer data whenever necessary.
  * The second disables the APU.
  *
- * Note that the first function will run the callback in a signal handler. The
- * user must manage the SIGRTMAX signal if they need to disable the APU
- * callback, though this may result in silence for the user.
+ * Note that the callback is run on a dedicated feeder thread, which sleeps
+ * until the APU needs more samples. The callback must therefore be safe to run
+ * concurrently with the rest of the program; see apu_callback_disable() for
+ * briefly keeping it from running. Programs using the APU must be linked with
+ * -pthread.
  *
  * Additionally, it is important to note that only one process may hold
  * access to the APU at a given time. The APU is released from this lock
@@ -31,6 +33,54 @@ extern "C" {
 /** @brief The sampling rate of the APU. */
 #define APU_SAMPLE_RATE 32000
 
+/** @brief Scheduling of the thread which runs the APU callback. */
+typedef struct {
+	/**
+	 * @brief SCHED_FIFO priority of the thread, [1, 99], or 0 to use the
+	 *        default scheduling policy.
+	 */
+	int priority;
+
+	/** @brief The core to pin the thread to, or -1 to allow any core. */
+	int cpu;
+
+	/**
+	 * @brief Number of APU buffers the driver may hold, including the one
+	 *        playing, [2, 16], or 0 for the default of 2.
+	 *
+	 * Each buffer is 16ms, so deeper rings survive longer stalls of the
+	 * feeder thread at the cost of more delay before samples are played.
+	 */
+	unsigned depth;
+} apu_feeder_t;
+
+/** @brief The number of buckets in apu_stats_t's latency histogram. */
+#define APU_STATS_BUCKETS 16
+
+/** @brief Statistics of the driver's buffer ring. See apu_get_stats(). */
+typedef struct {
+	unsigned depth;     ///< Number of buffers in the ring.
+	unsigned queued;    ///< Buffers written and not yet finished playing.
+	unsigned underruns; ///< Times the APU ran out of samples.
+	unsigned overruns;  ///< Writes which found the ring full.
+
+	/**
+	 * @brief Time until the APU runs out of samples, in us, or 0 if it has
+	 *        none left to play (or has not been given any yet).
+	 */
+	unsigned drain_us;
+
+	/**
+	 * @brief Histogram of the time from the APU asking for a buffer to
+	 *        being given one.
+	 *
+	 * Bucket 0 counts waits under 64us, and bucket i counts waits in
+	 * [64us << (i - 1), 64us << i). The last bucket also counts anything
+	 * longer.
+	 */
+	unsigned latency[APU_STATS_BUCKETS];
+} apu_stats_t;
+
 /**
  * @brief Enables the APU.
  *
@@ -43,10 +93,14 @@ extern "C" {
  * must be placed inside of buf_size.
  *
  * Note that the samples provided by the callback function will not be played
- * immediately. The APU will attempt to maintain a "queued" buffer while it
- * plays the samples in its active buffer. Therefore, there will be up to a
- * 16ms delay between the callback supplying the samples and the samples
- * being played.
+ * immediately. The driver holds a ring of buffers (2 by default, see
+ * apu_feeder_t) and the callback is called whenever one is free, so the APU
+ * always has a "queued" buffer while it plays the samples in its active
+ * buffer. Therefore, with the default ring there will be up to a 16ms delay
+ * between the callback supplying the samples and the samples being played.
+ *
+ * The callback runs on a feeder thread with the default scheduling policy.
+ * Use apu_enable_feeder() to give it real-time priority instead.
  *
  * Fails if the APU is already owned by another process.
  * It is illegal to provide this function with an invalid callback.
@@ -59,10 +113,50 @@ extern "C" {
  */
 int apu_enable(void (*callback)(const int8_t **buf, int *buf_size));
 
+/**
+ * @brief Enables the APU, running the callback on a feeder thread with the
+ *        given scheduling.
+ *
+ * Behaves as apu_enable(), except that the feeder thread is created with the
+ * scheduling policy and core affinity in attr. A SCHED_FIFO feeder on a core
+ * which the render loop does not use keeps late callbacks (and so audible
+ * dropouts) to a minimum.
+ *
+ * Fails if the APU is already owned by another process, or if the feeder
+ * thread could not be created (for example, if the process may not use
+ * SCHED_FIFO, or the core does not exist).
+ *
+ * @param callback The callback function to be called for more samples.
+ * @param attr The scheduling of the feeder thread.
+ * @return 0 on success, or -1 on error.
+ */
+int apu_enable_feeder(void (*callback)(const int8_t **buf, int *buf_size),
+                      const apu_feeder_t *attr);
+
+/**
+ * @brief Enables the APU, rendering samples straight into the driver's buffers.
+ *
+ * Behaves as apu_enable_feeder(), except that instead of handing back a
+ * buffer of samples which is then copied to the driver, the render function
+ * writes APU_BUF_MAX samples directly into the buffer the APU will play, which
+ * is mapped from the driver. mixer_render() may be used as the render
+ * function.
+ *
+ * The buffer is uncached, so the render function should write it in order,
+ * once, and never read it back.
+ *
+ * @param render The function to be called to fill each buffer.
+ * @param attr The scheduling of the feeder thread.
+ * @return 0 on success, or -1 on error.
+ */
+int apu_enable_render(void (*render)(int8_t *buf, unsigned len),
+                      const apu_feeder_t *attr);
+
 /**
  * @brief Disables the APU.
  *
- * After the current buffer finishing playing, the APU will be silenced.
+ * After the current buffer finishing playing, the APU will be silenced. The
+ * feeder thread is stopped before this function returns.
  *
  * Calling this function makes the APU available to other processing running
  * on the system.
@@ -83,11 +177,83 @@ void apu_callback_enable(void);
 /**
  * @brief Disables the APU callback function, temporarily.
  *
+ * If the callback is running, this waits for it to return. Every call must be
+ * followed by a call to apu_callback_enable() from the same thread.
+ *
  * Note that, as this is akin to disabling an interrupt, it should
  * be done only sparingly and briefly.
  */
 void apu_callback_disable(void);
 
+/**
+ * @brief Reads the statistics of the driver's buffer ring.
+ *
+ * It is illegal to call this function if the APU is not currently enabled and
+ * owned by the calling process.
+ *
+ * @param stats Filled in with the statistics.
+ */
+void apu_get_stats(apu_stats_t *stats);
+
+/** @brief Statistics of the sample queue. See apu_queue_stats(). */
+typedef struct {
+	unsigned fill;           ///< Samples currently queued.
+	unsigned size;           ///< Samples the queue can hold.
+	unsigned long underruns; ///< APU buffers which the queue could not fill.
+	unsigned long silence;   ///< Samples of silence played due to underruns.
+} apu_queue_stats_t;
+
+/**
+ * @brief Enables the APU, feeding it from a sample queue.
+ *
+ * Instead of providing samples from a callback, the program pushes samples
+ * with apu_queue_samples() whenever convenient (for example, once per frame),
+ * and the feeder thread takes them from the queue APU_BUF_MAX at a time. The
+ * queue is lock-free, so apu_queue_samples() never waits on the feeder.
+ *
+ * The queue holds at least ms milliseconds of samples (rounded up, to at least
+ * APU_BUF_MAX samples). It must hold enough to cover the longest gap between
+ * two calls to apu_queue_samples(), plus one APU buffer.
+ *
+ * Fewer than APU_BUF_MAX queued samples are held back until the rest arrive.
+ * Only if the APU is about to run out of samples meanwhile is the rest of the
+ * APU buffer played as silence, and an underrun counted. Playback begins once
+ * two APU buffers of samples are queued (or as many as the queue holds).
+ *
+ * Fails under the same conditions as apu_enable_feeder(). The APU is disabled,
+ * and the queue freed, with apu_disable().
+ *
+ * @param ms The length of the queue, in milliseconds.
+ * @param attr The scheduling of the feeder thread.
+ * @return 0 on success, or -1 on error.
+ */
+int apu_queue_enable(unsigned ms, const apu_feeder_t *attr);
+
+/**
+ * @brief Pushes samples onto the sample queue.
+ *
+ * Queues as many of the samples as fit. Samples which do not fit are not
+ * queued; the caller may retry them later.
+ *
+ * Only one thread may push samples. It is illegal to call this function if
+ * the APU was not enabled by apu_queue_enable().
+ *
+ * @param samples The samples to queue.
+ * @param len The number of samples to queue.
+ * @return The number of samples queued.
+ */
+unsigned apu_queue_samples(const int8_t *samples, unsigned len);
+
+/**
+ * @brief Reads the fill level and underrun counters of the sample queue.
+ *
+ * It is illegal to call this function if the APU was not enabled by
+ * apu_queue_enable().
+ *
+ * @param stats Filled in with the statistics.
+ */
+void apu_queue_stats(apu_queue_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
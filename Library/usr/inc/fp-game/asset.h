@@ -0,0 +1,128 @@
+/** @file asset.h
+ * @author Joseph Yankel
+ * @brief Binary asset packs holding pre-encoded PPU data
+ *
+ * An asset pack is a single file holding named tilemaps, patterns and palettes, already encoded
+ *   into the tile_t, pattern_t and palette_t formats used by @ref ppu.h. Opening a pack maps the
+ *   file into memory, so loading an asset is only a lookup in the pack's index: the returned
+ *   pointers point straight into the mapping and can be passed to the PPU write functions as-is.
+ *
+ * Packs are built on the host from the text formats read by @ref ppu_load_tilemap,
+ *   @ref ppu_load_pattern and @ref ppu_load_palette, using the fpgame-pack tool found in
+ *   Library/tools.
+ *
+ * @attention Malformed packs and invalid arguments will result in a console warning and exiting of
+ *   the program, as with the rest of the PPU library.
+ */
+
+#ifndef _FP_GAME_ASSET_H_
+#define _FP_GAME_ASSET_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <fp-game/ppu.h>
+
+/* ======================== */
+/* === Pack File Format === */
+/* ======================== */
+/* A pack is laid out as follows (all fields are little-endian):
+ *   1. An asset_pack_header_t at offset 0.
+ *   2. The asset data. Each asset is an array of tile_t, pattern_t or palette_t, and starts on a
+ *      ASSET_PACK_ALIGN byte boundary.
+ *   3. The index: header.count asset_pack_entry_t, starting at header.index_offset.
+ */
+#define ASSET_PACK_MAGIC 0x4B504746 ///< "FGPK" read as a little-endian 32-bit word
+#define ASSET_PACK_VERSION 1        ///< Pack format version written by this library version
+#define ASSET_PACK_ALIGN 4          ///< Alignment in bytes of the asset data in a pack
+#define ASSET_NAME_MAX 32           ///< Size of an asset name, including its null terminator
+
+/** @brief Type of an asset stored in a pack */
+typedef enum {
+    ASSET_TILEMAP = 1, ///< An array of tile_t
+    ASSET_PATTERN = 2, ///< An array of pattern_t, laid out row by row (see @ref asset_patterns)
+    ASSET_PALETTE = 3  ///< An array of palette_t
+} asset_type_e;
+
+/** @brief Header at the start of every pack */
+typedef struct {
+    uint32_t magic;        ///< Always ASSET_PACK_MAGIC
+    uint32_t version;      ///< Always ASSET_PACK_VERSION
+    uint32_t count;        ///< Number of entries in the index
+    uint32_t index_offset; ///< Byte offset of the index from the start of the pack
+} asset_pack_header_t;
+
+/** @brief A single entry of the pack index */
+typedef struct {
+    char name[ASSET_NAME_MAX]; ///< Null-terminated name of the asset
+    uint32_t type;             ///< An asset_type_e
+    uint32_t offset;           ///< Byte offset of the asset data from the start of the pack
+    uint32_t count;            ///< Number of tile_t, pattern_t or palette_t in the asset
+    uint16_t width;            ///< Width in patterns (ASSET_PATTERN only, otherwise 0)
+    uint16_t height;           ///< Height in patterns (ASSET_PATTERN only, otherwise 0)
+} asset_pack_entry_t;
+
+/* ======================= */
+/* === Asset Pack API === */
+/* ======================= */
+/** @brief An open asset pack. Obtain using @ref asset_open */
+typedef struct asset_pack asset_pack_t;
+
+/** @brief Open an asset pack and map it into memory
+ *
+ * The header and the whole index are checked when the pack is opened, so the lookup functions
+ *   never read outside of the file.
+ *
+ * @param file Path of the pack to open.
+ * @return The open pack. Close it with @ref asset_close once its assets are no longer needed.
+ */
+asset_pack_t *asset_open(const char *file);
+
+/** @brief Close an asset pack, unmapping it
+ *
+ * @warning Every pointer returned by the lookup functions for this pack becomes invalid.
+ *
+ * @param pack The pack to close.
+ */
+void asset_close(asset_pack_t *pack);
+
+/** @brief Look up a tilemap in an asset pack
+ * @param pack The pack to search.
+ * @param name Name of the tilemap.
+ * @param len Set to the number of tiles in the tilemap. May be NULL.
+ * @return Pointer to the tiles (valid until the pack is closed); NULL if there is no tilemap named
+ *         @p name
+ */
+const tile_t *asset_tilemap(const asset_pack_t *pack, const char *name, unsigned *len);
+
+/** @brief Look up pattern graphics in an asset pack
+ *
+ * The patterns are stored in the same order @ref ppu_load_pattern produces: row by row, so the
+ *   pattern in tile column x and tile row y is at index y * width + x. This is the order expected
+ *   by @ref ppu_write_pattern.
+ *
+ * @param pack The pack to search.
+ * @param name Name of the graphics.
+ * @param width Set to the width of the graphics, in patterns. May be NULL.
+ * @param height Set to the height of the graphics, in patterns. May be NULL.
+ * @return Pointer to the patterns (valid until the pack is closed); NULL if there are no pattern
+ *         graphics named @p name
+ */
+const pattern_t *asset_patterns(const asset_pack_t *pack, const char *name, unsigned *width,
+                                unsigned *height);
+
+/** @brief Look up a palette in an asset pack
+ * @param pack The pack to search.
+ * @param name Name of the palette.
+ * @return Pointer to the palette (valid until the pack is closed); NULL if there is no palette
+ *         named @p name
+ */
+const palette_t *asset_palette(const asset_pack_t *pack, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FP_GAME_ASSET_H_ */
@@ -3,8 +3,8 @@
  * @author Andrew Spaulding
  * @brief Exposes the controller interface to the user
  *
- * The controller interface consists of a single function, which can be
- * called to get the current controller state.
+ * The main controller function, get_con_state(), can be called to get the
+ * current controller state.
  *
  * The controller state is returned as an integer, with each button represented
  * in a single bit. Masks are provided to access the bits which represent each
@@ -13,6 +13,15 @@
  *
  * In addition to the masks provided, macros are provided to check if a button
  * is currently pressed or released given a button mask and a state.
+ *
+ * Polling the state once a frame can miss a press and release which both
+ * happen between two polls. To catch these, the controller driver samples the
+ * controller on its own (at 1000Hz, unless changed with con_set_rate()), and
+ * queues an event with a timestamp each time the state changes. These events
+ * can be drained with con_get_events(). Sampling starts with the first call to
+ * any controller function, and events are only queued from then on.
+ *
+ * Programs using the controller must be linked with -pthread.
  */
 
 #ifndef _FP_GAME_CON_H_
@@ -22,6 +31,8 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+
 /** @brief These masks define the bit in which each button state is stored. */
 /**@{*/
 #define CON_BUT_B (1 << 15)
@@ -56,11 +67,55 @@ extern "C" {
 
 /**
  * @brief Gets the current controller state.
+ *
+ * The state is the latest sample taken by the driver, which is read from
+ * shared memory without a system call, and so may be called as often as
+ * needed, from any thread.
+ *
  * @return The current controller state on success, or a
  *         negative integer on failure.
  */
 int get_con_state(void);
 
+/**
+ * @brief Gets the current controller state, and when it was sampled.
+ * @param time Set to the CLOCK_MONOTONIC time of the sample, in nanoseconds.
+ * @return The current controller state on success, or a negative integer
+ *         on failure.
+ */
+int get_con_state_time(uint64_t *time);
+
+/** @brief A change in the controller state. */
+typedef struct {
+	uint64_t time; ///< CLOCK_MONOTONIC time the change was seen, in nanoseconds.
+	int state;     ///< The state after the change, as from get_con_state().
+	int pressed;   ///< The masks of the buttons pressed by this change.
+	int released;  ///< The masks of the buttons released by this change.
+} con_event_t;
+
+/**
+ * @brief Sets how often the driver samples the controller for events.
+ *
+ * Higher rates catch shorter presses and timestamp them more precisely, at
+ * the cost of more cpu time in the kernel.
+ *
+ * @param rate The sampling rate, in Hz, between 60 and 8000.
+ * @return 0 on success, or a negative integer on failure.
+ */
+int con_set_rate(unsigned rate);
+
+/**
+ * @brief Takes the oldest queued controller events, without waiting.
+ *
+ * The driver queues up to 256 events, and drops the oldest if more arrive
+ * before they are taken, so games should drain the queue every frame.
+ *
+ * @param events Where to store the events, oldest first.
+ * @param max The largest number of events to take.
+ * @return The number of events taken, or a negative integer on failure.
+ */
+int con_get_events(con_event_t *events, int max);
+
 #ifdef __cplusplus
 }
 #endif
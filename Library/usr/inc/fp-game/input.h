@@ -0,0 +1,140 @@
+/**
+ * @file input.h
+ * @author Andrew Spaulding
+ * @brief Per-frame controller input, with edges, hold timers and record/replay.
+ *
+ * Games should call input_update() once per frame, and then read everything
+ * they need from the input_t it returns, instead of calling get_con_state()
+ * wherever input is needed. Unlike the raw controller state, the input_t is
+ * active high: a 1 in the bit for a button (using the CON_BUT_* masks) means
+ * the button is *pressed*.
+ *
+ * Each update also drains the driver's controller events (see
+ * con_get_events()), so a button which is pressed and released again between
+ * two updates is still reported as both pressed and released in the second.
+ * Programs using the input module should not take controller events
+ * themselves.
+ *
+ * The input of each frame may be recorded to a file, and the file later
+ * replayed in place of the controller. Since a replay gives exactly the same
+ * input_t on exactly the same frames, a game whose logic only depends on its
+ * input plays back identically, which makes replays useful for reproducing
+ * bugs and for performance regression runs, on the board or on the host
+ * (where no controller is needed).
+ *
+ * The input functions must all be called from the same thread.
+ *
+ * @attention Malformed replays and invalid arguments will result in a console
+ * warning and exiting of the program, as with the rest of the library.
+ */
+
+#ifndef _FP_GAME_INPUT_H_
+#define _FP_GAME_INPUT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* ========================== */
+/* === Replay File Format === */
+/* ========================== */
+/*
+ * A replay is an input_header_t followed by input_run_t records until the end
+ * of the file. All fields are little-endian.
+ *
+ * Each run gives the sample of one or more consecutive frames. Input rarely
+ * changes from one frame to the next, so a replay usually takes a few bytes
+ * per second of play.
+ */
+#define INPUT_MAGIC 0x4E495046  ///< "FPIN" read as a little-endian 32-bit word
+#define INPUT_VERSION 1         ///< Replay format version written by this library version
+
+/** @brief Header at the start of every replay */
+typedef struct {
+	uint32_t magic;   ///< Always INPUT_MAGIC
+	uint32_t version; ///< Always INPUT_VERSION
+} input_header_t;
+
+/** @brief A run of frames with the same sample */
+typedef struct {
+	uint16_t down;   ///< Buttons pressed when the frames were sampled
+	uint16_t taps;   ///< Buttons pressed and released again since the frame before
+	uint16_t frames; ///< The number of frames in the run, at least 1
+} input_run_t;
+
+/* ================= */
+/* === Input API === */
+/* ================= */
+/** @brief The number of bits in a controller state */
+#define INPUT_BITS 16
+
+/** @brief The input of one frame. All masks are active high. */
+typedef struct {
+	uint32_t frame;           ///< Frames since input started, or since the replay started
+	uint16_t down;            ///< Buttons which are pressed
+	uint16_t pressed;         ///< Buttons which were pressed since the last frame
+	uint16_t released;        ///< Buttons which were released since the last frame
+	uint16_t held;            ///< Buttons which were also pressed on the last frame
+	uint32_t hold[INPUT_BITS]; ///< Frames each button has been pressed for, by bit
+} input_t;
+
+/** @brief Get the number of frames a button has been pressed for
+ * @param input The input of the frame.
+ * @param but The button mask (a single CON_BUT_* mask).
+ * @return The number of consecutive frames, up to and including this one, the
+ *         button has been pressed for, or 0 if it is not pressed.
+ */
+#define INPUT_HOLD(input, but) ((input)->hold[__builtin_ctz(but)])
+
+/** @brief Sample the input for the next frame
+ *
+ * When replaying, the next frame of the replay is used instead of the
+ * controller, and once the replay runs out, every button is released. When
+ * recording, the frame is added to the recording.
+ *
+ * @return The input of the frame, which is valid until the next update.
+ */
+const input_t *input_update(void);
+
+/** @brief Start recording the input of each frame to a file
+ *
+ * Replaces the file if it exists. Any recording or replay in progress is
+ * stopped first. The input is reset, as by input_replay(), so that replaying
+ * the recording gives exactly the frames recorded.
+ *
+ * @param file Path of the replay to write.
+ * @return 0 on success, or -1 if the file could not be created.
+ */
+int input_record(const char *file);
+
+/** @brief Start replaying a recording in place of the controller
+ *
+ * The input is reset, so the first update after this gives the first frame
+ * of the replay, as frame 0. Any recording or replay in progress is stopped
+ * first.
+ *
+ * @param file Path of the replay to read.
+ * @return 0 on success, or -1 if the file could not be opened.
+ */
+int input_replay(const char *file);
+
+/** @brief Check whether a replay is still playing
+ * @return True if replaying, and the replay has frames left.
+ */
+bool input_replaying(void);
+
+/** @brief Stop recording or replaying
+ *
+ * A recording is completed and closed. After a replay, the controller is
+ * used again. Does nothing if neither is in progress.
+ */
+void input_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FP_GAME_INPUT_H_ */
@@ -0,0 +1,144 @@
+/**
+ * @file mixer.h
+ * @author Andrew Spaulding
+ * @brief A software mixer for playing several sounds through the APU.
+ *
+ * The mixer has a fixed pool of MIXER_VOICES voices. Each voice plays one
+ * sound (8 or 16-bit PCM, mono or stereo, at APU_SAMPLE_RATE or any other
+ * rate through its pitch) at its own volume, and optionally loops it. When
+ * every voice is busy, a new sound steals the voice with the lowest priority,
+ * if that priority is no higher than its own.
+ *
+ * The mixer produces APU samples with mixer_render(). Most programs simply
+ * give mixer_callback() to apu_enable(), or mixer_render() to
+ * apu_enable_render() to mix straight into the driver's buffers, and then
+ * start and stop sounds as the game runs. The mixer functions may be called
+ * from any thread, but not from inside the APU callback.
+ *
+ * Programs using the mixer must be linked with -pthread.
+ */
+
+#ifndef _FP_GAME_MIXER_H_
+#define _FP_GAME_MIXER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** @brief The number of voices in the mixer. */
+#define MIXER_VOICES 16
+
+/** @brief The volume which plays a voice at its original loudness. */
+#define MIXER_VOLUME_MAX 256
+
+/** @brief The pitch which plays a sound at APU_SAMPLE_RATE (16.16 fixed point). */
+#define MIXER_PITCH_1X 0x10000
+
+/** @brief Handle to a voice, returned by mixer_play(). */
+typedef int mixer_voice_t;
+
+/** @brief Sample formats supported by the mixer. */
+typedef enum {
+	MIXER_PCM8,  ///< Signed 8-bit samples.
+	MIXER_PCM16, ///< Signed 16-bit samples, in native byte order.
+} mixer_format_e;
+
+/**
+ * @brief A sound which can be played by the mixer.
+ *
+ * The samples are read in place, so they must remain valid for as long as the
+ * sound is playing.
+ */
+typedef struct {
+	const void *samples;   ///< The samples. Stereo samples are interleaved, left first.
+	mixer_format_e format; ///< The format of each sample.
+	unsigned channels;     ///< 1 for mono, or 2 for stereo.
+	unsigned length;       ///< The length of the sound, in frames (one sample per channel).
+	bool loop;             ///< If true, the sound repeats from loop_start when it ends.
+	unsigned loop_start;   ///< The frame to repeat from, if looping.
+} mixer_sound_t;
+
+/**
+ * @brief Playback settings of a voice.
+ */
+typedef struct {
+	unsigned volume;   ///< Volume, [0, MIXER_VOLUME_MAX].
+	int pan;           ///< Balance of a stereo sound when mixed to mono, [-128, 128]. -128 plays
+	                   ///< only the left channel, 128 only the right, and 0 both equally.
+	uint32_t pitch;    ///< Frames of the sound to advance per APU sample (16.16 fixed point).
+	unsigned priority; ///< Voices with a lower priority are stolen first.
+} mixer_params_t;
+
+/**
+ * @brief Stops every voice and resets the master volume.
+ */
+void mixer_init(void);
+
+/**
+ * @brief Starts playing a sound on a free (or stolen) voice.
+ *
+ * If every voice is busy, the voice with the lowest priority (and among
+ * those, the one playing the longest) is stolen, provided its priority is no
+ * higher than params->priority.
+ *
+ * @param sound The sound to play.
+ * @param params The playback settings of the voice.
+ * @return The voice playing the sound, or -1 if no voice could be stolen.
+ */
+mixer_voice_t mixer_play(const mixer_sound_t *sound, const mixer_params_t *params);
+
+/**
+ * @brief Changes the playback settings of a voice.
+ *
+ * Does nothing if the voice has finished or been stolen.
+ *
+ * @param voice The voice to change.
+ * @param params The new playback settings.
+ */
+void mixer_set(mixer_voice_t voice, const mixer_params_t *params);
+
+/**
+ * @brief Stops a voice. Does nothing if the voice has finished or been stolen.
+ * @param voice The voice to stop.
+ */
+void mixer_stop(mixer_voice_t voice);
+
+/**
+ * @brief Checks whether a voice is still playing.
+ * @param voice The voice to check.
+ * @return True if the voice has not finished, been stopped, or been stolen.
+ */
+bool mixer_playing(mixer_voice_t voice);
+
+/**
+ * @brief Sets the master volume, which scales every voice.
+ * @param volume The master volume, [0, MIXER_VOLUME_MAX].
+ */
+void mixer_set_master(unsigned volume);
+
+/**
+ * @brief Mixes the next samples of every voice into APU samples.
+ *
+ * Voices are summed and the result is saturated to the int8 range, so loud
+ * mixes clip rather than wrap.
+ *
+ * @param out Where to store the samples.
+ * @param len The number of samples to mix, at most APU_BUF_MAX.
+ */
+void mixer_render(int8_t *out, unsigned len);
+
+/**
+ * @brief An APU callback which plays the mixer. See apu_enable().
+ * @param buf Set to APU_BUF_MAX freshly mixed samples.
+ * @param buf_size Set to APU_BUF_MAX.
+ */
+void mixer_callback(const int8_t **buf, int *buf_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FP_GAME_MIXER_H_ */
@@ -2,10 +2,11 @@
  * @author Joseph Yankel
  * @brief User Library for the FP-GAme PPU
  *
- * @attention Modifications to the PPU will not be accepted during certain busy states managed by
- *   the Kernel. Any functions which attempt to modify PPU data will return -1 if the modification
- *   could not be made. You are encouraged to poll these functions until they return 0 (success) if
- *   you want to ensure your changes are made.
+ * @attention A new frame will not be accepted while the PPU is still receiving the last one.
+ *   @ref ppu_update and @ref ppu_update_regions return -1 (errno == EBUSY) in that case, and you
+ *   are encouraged to poll them until they return 0 (success), or to use @ref ppu_update_sync.
+ *   Writes to VRAM and the control registers never wait on the PPU. They only fail (returning -1)
+ *   if the kernel runs out of memory or cannot read your buffers (errno == ENOMEM or EFAULT).
  * @attention Invalid arguments (see the function's documentation) will result in a console warning
  *   and exiting of the program. This is to help you (the user) find bugs and unwanted behaviours.
  */
@@ -37,6 +38,9 @@ extern "C" {
 #define PALETTERAM_SPRITEMAX 32   ///< Maximum number of palettes for sprites to access
 #define PALETTERAM_TILEMAX 16     ///< Maximum number of palettes for a tile layer to access
 #define SPRRAM_EXTRAOFFSET 0x100  ///< Byte offset from VRAM_SPRITEOFFSET of the extra data in Sprite RAM
+#define PATTERNRAM_COUNT 1024     ///< Number of 8x8 tile-patterns held by Pattern RAM (32x32)
+#define PALETTE_COLORS 16         ///< Colors per palette in Palette RAM (including transparent)
+#define SPRRAM_COUNT 64           ///< Number of sprites held by Sprite RAM
 
 /* ======================= */
 /* === Types and Enums === */
@@ -51,6 +55,15 @@ typedef enum {
     LAYER_SPR    = 4  ///< Denotes the sprite render layer
 } layer_e;
 
+/** @brief VRAM regions, which can be ORed together. See @ref ppu_update_regions */
+typedef enum {
+    REGION_TILES    = 1,  ///< Tile RAM (both tile layers)
+    REGION_PATTERNS = 2,  ///< Pattern RAM
+    REGION_PALETTES = 4,  ///< Palette RAM
+    REGION_SPRITES  = 8,  ///< Sprite RAM
+    REGION_ALL      = 15  ///< All of VRAM
+} region_e;
+
 /** @brief Mirror state for graphics */
 typedef enum {
     MIRROR_NONE = 0, ///< Pattern is not mirrored
@@ -94,6 +107,23 @@ typedef struct {
     uint8_t width;          ///< Width of sprite in terms of 8x8-pixel tiles. Legal values: [1, 4]
 } sprite_t;
 
+/** @brief The layout of VRAM, as seen through @ref ppu_map_vram
+ *
+ * This mirrors the VRAM_*OFFSET constants above. Note that entries here are in their raw hardware
+ *   format: tiles should be made with @ref ppu_make_tile, and Palette RAM entries include the
+ *   (ignored) transparent color 0 of each palette.
+ */
+typedef struct {
+    tile_t bg_tiles[TILELAYER_HEIGHT][TILELAYER_WIDTH];  ///< Background Tile RAM, indexed [y][x]
+    tile_t fg_tiles[TILELAYER_HEIGHT][TILELAYER_WIDTH];  ///< Foreground Tile RAM, indexed [y][x]
+    pattern_t patterns[PATTERNRAM_COUNT]; ///< Pattern RAM, indexed by pattern_addr_t
+    uint32_t bg_palettes[PALETTERAM_TILEMAX][PALETTE_COLORS];    ///< Background Palette RAM
+    uint32_t fg_palettes[PALETTERAM_TILEMAX][PALETTE_COLORS];    ///< Foreground Palette RAM
+    uint32_t spr_palettes[PALETTERAM_SPRITEMAX][PALETTE_COLORS]; ///< Sprite Palette RAM
+    uint32_t sprites[SPRRAM_COUNT];       ///< Packed main sprite data (pattern, palette, y, x)
+    uint8_t sprite_extra[SPRRAM_COUNT];   ///< Packed extra sprite data (mirror, size, priority)
+} vram_t;
+
 
 /* ========================= */
 /* === PPU Main Controls === */
@@ -128,11 +158,56 @@ void ppu_disable(void);
  * If you want to ensure your frame gets sent out to the PPU, and also want to synchronize to the
  *   PPU's internal 60FPS timing, keep polling this function until 0 (success) is returned.
  *
+ * If VRAM shadowing is enabled (see @ref ppu_shadow_enable), the changes made to the shadow VRAM
+ *   since the last successful update are sent to the kernel first.
+ *
  * @pre PPU is currently locked by this process. See @ref ppu_enable.
- * @return 0 on success; -1 if PPU busy
+ * @return 0 on success; -1 if PPU busy (errno == EBUSY), or if the shadow VRAM flush failed
  */
 int ppu_update(void);
 
+/** @brief Sleep until the PPU is ready to accept a new frame
+ *
+ * This is a sleeping alternative to polling @ref ppu_update until it succeeds. It returns once the
+ *   PPU has finished receiving the last frame sent by @ref ppu_update. No CPU time is spent while
+ *   waiting.
+ *
+ * @pre PPU is currently locked by this process. See @ref ppu_enable.
+ * @param frame If not NULL, set to the number of frames the PPU has accepted so far. This number
+ *              increases by one every frame (wrapping around after 2^32 frames).
+ * @return 0 on success; -1 on error
+ */
+int ppu_wait_ready(uint32_t *frame);
+
+/** @brief Send the current frame changes to the PPU, sleeping until the PPU can accept them
+ *
+ * This is the blocking version of @ref ppu_update. Use it to write a frame loop which is locked to
+ *   the PPU's internal 60FPS timing without spinning.
+ *
+ * @pre PPU is currently locked by this process. See @ref ppu_enable.
+ * @param frame If not NULL, set to the sequence number of the submitted frame. The frame has been
+ *              received by the PPU once @ref ppu_wait_ready reports this number.
+ * @return 0 on success; -1 on error
+ */
+int ppu_update_sync(uint32_t *frame);
+
+/** @brief Send VRAM to the PPU on the next available frame, naming the regions that changed
+ *
+ * This behaves like @ref ppu_update, but the kernel only copies the selected regions of VRAM into
+ *   the frame it sends, which takes much less time than copying all of it. Regions which are not
+ *   copied keep their contents from earlier frames. A frame where only sprites move, for example,
+ *   only needs REGION_SPRITES.
+ *
+ * Regions changed through the ppu_write functions (including the shadow VRAM) are always copied,
+ *   so @p regions only needs to name the regions changed through @ref ppu_map_vram. Pass 0 if
+ *   nothing was changed through the mapping.
+ *
+ * @pre PPU is currently locked by this process. See @ref ppu_enable.
+ * @param regions Regions changed through @ref ppu_map_vram: a combination of region_e values.
+ * @return 0 on success; -1 if PPU busy (errno == EBUSY), or if the shadow VRAM flush failed
+ */
+int ppu_update_regions(unsigned regions);
+
 /** @brief Write directly to the VRAM buffer
  *
  * @attention This gives a lower-level access to the VRAM buffer! See the higher-level write
@@ -143,10 +218,53 @@ int ppu_update(void);
  * @param buf Pointer to a buffer to write to the VRAM.
  * @param len Size of buf in bytes.
  * @param offset Byte offset into VRAM.
- * @return 0 on success; -1 if PPU busy
+ * @return 0 on success; -1 on error (errno == ENOMEM or EFAULT)
  */
 int ppu_write_vram(const void *buf, size_t len, off_t offset);
 
+/** @brief Map the VRAM buffer into this process for direct, zero-copy access
+ *
+ * The returned pointer refers to the very same VRAM buffer that the ppu_write functions modify, so
+ *   a frame can be built in place without a system call per change. The mapping stays valid until
+ *   @ref ppu_disable is called. Calling this function more than once returns the same mapping.
+ *
+ * The kernel takes a copy of VRAM for the PPU whenever a frame is submitted, so it is safe to keep
+ *   modifying VRAM through this pointer while the previous frame is being sent to the PPU.
+ *
+ * @attention Do not modify VRAM through this pointer from one thread while another thread calls
+ *   @ref ppu_update, or the PPU may be sent a partially-changed frame.
+ *
+ * @pre PPU is currently locked by this process. See @ref ppu_enable.
+ * @return A pointer to the mapped VRAM on success; NULL on error
+ */
+vram_t *ppu_map_vram(void);
+
+/** @brief Route all PPU writes through a process-local shadow copy of VRAM
+ *
+ * While shadowing is enabled, the ppu_write functions (and @ref ppu_write_vram) only modify a copy
+ *   of VRAM held by this process, and never fail. The parts of VRAM that were changed are tracked,
+ *   and are sent to the kernel in a single batch by the next @ref ppu_update. If nothing changed
+ *   since the last update, nothing is sent.
+ *
+ * The shadow copy starts out as a copy of the current VRAM.
+ *
+ * @warning Do not mix shadowing with direct changes through @ref ppu_map_vram. Changes made
+ *   through the mapping may be overwritten by the next @ref ppu_update.
+ *
+ * @pre PPU is currently locked by this process. See @ref ppu_enable.
+ * @return 0 on success; -1 on error
+ */
+int ppu_shadow_enable(void);
+
+/** @brief Stop shadowing VRAM, sending any pending changes to the kernel
+ *
+ * @see ppu_shadow_enable
+ *
+ * @pre PPU is currently locked by this process. See @ref ppu_enable.
+ * @return 0 on success; -1 on error (shadowing remains enabled, and nothing is lost)
+ */
+int ppu_shadow_disable(void);
+
 
 /* =========================== */
 /* === PPU Data Generators === */
@@ -181,6 +299,48 @@ pattern_addr_t ppu_pattern_addr(unsigned x, unsigned y);
  */
 tile_t ppu_make_tile(pattern_addr_t pattern_addr, unsigned palette_id, mirror_e mirror);
 
+/** @brief Generate many tiles at once
+ *
+ * Produces the same tiles as calling @ref ppu_make_tile for each element, but in a single
+ *   (vectorized, on NEON-capable targets) pass, which is much faster for building whole tile layers
+ *   at runtime. Tile i is made from pattern_addrs[i], palette_ids[i] and mirrors[i].
+ *
+ * @param tiles Array of @p len tile_t to write the tiles to.
+ * @param pattern_addrs Array of @p len pattern addresses. Each must be in range [0, 1023].
+ * @param palette_ids Array of @p len palette ids. Each must be in range [0, 15].
+ * @param mirrors Array of @p len mirror_e values.
+ * @param len Number of tiles to generate.
+ */
+void ppu_make_tiles(tile_t *tiles, const uint16_t *pattern_addrs, const uint8_t *palette_ids,
+                    const uint8_t *mirrors, unsigned len);
+
+/** @brief Encode pattern rows written in text order into pattern_t
+ *
+ * In text order, a row of 8 pixels reads left to right as hex digits, so the first pixel is in the
+ *   most significant nibble (0x12345678 has pixel colors 1, 2, ..., 8). The PPU expects the first
+ *   pixel in the least significant nibble. This is the conversion done by @ref ppu_load_pattern.
+ *
+ * @param patterns Array of @p count pattern_t to write to. May be the same memory as @p rows.
+ * @param rows Array of @p count * 8 rows in text order: the 8 rows of the first pattern, then the
+ *             8 rows of the second, and so on.
+ * @param count Number of patterns to encode.
+ */
+void ppu_encode_patterns(pattern_t *patterns, const uint32_t *rows, unsigned count);
+
+/** @brief Pack sprites into their Sprite RAM format
+ *
+ * Produces the main and extra sprite data that @ref ppu_write_sprites sends to Sprite RAM, laid
+ *   out as in the sprites and sprite_extra fields of @ref vram_t.
+ *
+ * @param sprite_data Array of @p len words to write the main sprite data to.
+ * @param sprite_extra Array of @p len bytes to write the extra sprite data to.
+ * @param sprites Array of @p len sprites to pack. Must pass the same checks as
+ *                @ref ppu_write_sprites.
+ * @param len Number of sprites to pack.
+ */
+void ppu_pack_sprites(uint32_t *sprite_data, uint8_t *sprite_extra, const sprite_t *sprites,
+                      unsigned len);
+
 /** @brief Loads tile-data from a file into an linear array of tile_t
  *
  * The text file contains tile_t entries specified in the following format:
@@ -194,6 +354,10 @@ tile_t ppu_make_tile(pattern_addr_t pattern_addr, unsigned palette_id, mirror_e
  *     * 3 -> Both Horizontal AND Vertical Mirroring
  *   * Each entry is separated either by a space or by a newline.
  *
+ * @note The text loaders are slow, since every value is parsed at load time. The fpgame-pack tool
+ *   can convert tilemaps, patterns and palettes into a single pre-encoded asset pack, which loads
+ *   almost instantly. See @ref asset.h.
+ *
  * @param tilemap Array of tile_t to load into.
  * @param len Number of tiles to copy to @p tilemap.
  * @param file Path of the text file to open and read from.
@@ -269,7 +433,7 @@ void ppu_load_palette(palette_t *palette, const char *file);
  * @param y_i Vertical position of the first tile to write. Must be in the range [0, 63]
  * @param count The number of tiles to overwrite (horizontally) in Tile RAM. @p count will be set to
  *              64 if count > 64.
- * @return 0 on success; -1 if PPU busy
+ * @return 0 on success; -1 on error (errno == ENOMEM or EFAULT)
  */
 int ppu_write_tiles_horizontal(const tile_t *tiles, unsigned len, layer_e layer, unsigned x_i,
                                unsigned y_i, unsigned count);
@@ -291,7 +455,7 @@ int ppu_write_tiles_horizontal(const tile_t *tiles, unsigned len, layer_e layer,
  * @param y_i Vertical position of the first tile to write. Must be in the range [0, 63].
  * @param count The number of tiles to overwrite (vertically) in Tile RAM. @p count will be set to
  *              64 if count > 64.
- * @return 0 on success; -1 if PPU busy
+ * @return 0 on success; -1 on error (errno == ENOMEM or EFAULT)
  */
 int ppu_write_tiles_vertical(const tile_t *tiles, unsigned len, layer_e layer, unsigned x_i,
                              unsigned y_i, unsigned count);
@@ -327,7 +491,7 @@ int ppu_write_tiles_vertical(const tile_t *tiles, unsigned len, layer_e layer, u
  * @param width The width (in 8x8-pixel tiles) of @p patterns. Supports >= 1
  * @param height The height (in 8x8-pixel tiles) of @p patterns. Supports >= 1
  * @param pattern_addr The pattern address to start at.
- * @return 0 on success; -1 if PPU busy
+ * @return 0 on success; -1 on error (errno == ENOMEM or EFAULT)
  */
 int ppu_write_pattern(const pattern_t *pattern, unsigned width, unsigned height,
                       pattern_addr_t pattern_addr);
@@ -347,7 +511,7 @@ int ppu_write_pattern(const pattern_t *pattern, unsigned width, unsigned height,
  * @param layer_id The target section of Palette RAM to start copying the @p palette to.
  * @param palette_id The id of the palette to overwrite within the given layer. This must be within
  *                   bounds of the palette layer section indicated by @p layer_id.
- * @return 0 on success; -1 if PPU busy
+ * @return 0 on success; -1 on error (errno == ENOMEM or EFAULT)
  */
 int ppu_write_palette(const palette_t *palette, layer_e layer_id, unsigned palette_id);
 
@@ -358,7 +522,7 @@ int ppu_write_palette(const palette_t *palette, layer_e layer_id, unsigned palet
  * @param len Length of @p sprites array.
  * @param sprite_id_i The starting index of the first sprite to overwrite in Sprite RAM. This number
  *                    must fall in range [0, 63 - @p len ].
- * @return 0 on success; -1 if PPU busy
+ * @return 0 on success; -1 on error (errno == ENOMEM or EFAULT)
  */
 int ppu_write_sprites(const sprite_t *sprites, unsigned len, unsigned sprite_id_i);
 
@@ -371,7 +535,7 @@ int ppu_write_sprites(const sprite_t *sprites, unsigned len, unsigned sprite_id_
  * @remark Any higher-order bits [31:24] in @p color will be ignored!
  * @pre PPU is currently locked by this process. See @ref ppu_enable.
  * @param color 32-bit color holding a 24-bit RRGGBB hex color value. For example, 0xFF0000 for red.
- * @return 0 on success; -1 if PPU busy
+ * @return 0 on success; -1 on error (this never waits on the PPU)
  */
 int ppu_set_bgcolor(unsigned color);
 
@@ -381,7 +545,7 @@ int ppu_set_bgcolor(unsigned color);
  * @param tile_layer Either LAYER_BG or LAYER_FG. LAYER_SPR doesn't support layer scrolling.
  * @param scroll_x Horizontal pixel scroll. Values must be [0, 511].
  * @param scroll_y Vertical pixel scroll. Values must be [0, 511].
- * @return 0 on success; -1 if PPU busy
+ * @return 0 on success; -1 on error (this never waits on the PPU)
  */
 int ppu_set_scroll(layer_e tile_layer, unsigned scroll_x, unsigned scroll_y);
 
@@ -400,10 +564,86 @@ int ppu_set_scroll(layer_e tile_layer, unsigned scroll_x, unsigned scroll_y);
  * @remark Any higher-order bits in enable_mask not specified above will be ignored!
  * @pre PPU is currently locked by this process. See @ref ppu_enable.
  * @param enable_mask Bit-mask used to enable/disable PPU rendering layers.
- * @return 0 on success; -1 if PPU busy
+ * @return 0 on success; -1 on error (this never waits on the PPU)
  */
 int ppu_set_layer_enable(unsigned enable_mask);
 
+
+/* ======================= */
+/* === PPU Sprite Pool === */
+/* ======================= */
+/** @brief A handle to a sprite in the sprite pool. Negative values are invalid handles.
+ *
+ * Handles stay unique after their sprite is freed, so using a stale handle exits the program
+ *   instead of changing whichever sprite took its place. Every handle becomes invalid when the PPU
+ *   is enabled again (see @ref ppu_enable), since the pool starts over with VRAM.
+ */
+typedef int sprite_handle_t;
+
+/** @brief Sprite y coordinate used to hide sprites: the first row below the visible screen. */
+#define SPRITE_HIDDEN_Y 240
+
+/** @brief Create a sprite in the retained sprite pool
+ *
+ * The sprite pool keeps its own copy of all 64 sprites in Sprite RAM. Sprites are created, changed,
+ *   and freed through handles, and only the sprites which changed are packed and sent to Sprite RAM
+ *   by @ref ppu_sprite_flush.
+ *
+ * The lowest free slot in Sprite RAM is used. Sprites in lower slots are drawn on top of sprites in
+ *   higher slots which have the same priority.
+ *
+ * @warning Do not mix the sprite pool with @ref ppu_write_sprites. The pool assumes it owns all of
+ *   Sprite RAM, and will overwrite sprites written by other means.
+ *
+ * @param sprite The initial state of the new sprite. Must pass the same checks as
+ *               @ref ppu_write_sprites.
+ * @return A handle to the new sprite; -1 if all 64 sprites are in use
+ */
+sprite_handle_t ppu_sprite_create(const sprite_t *sprite);
+
+/** @brief Free a sprite, hiding it and making its slot available to @ref ppu_sprite_create
+ * @param handle A valid sprite handle.
+ */
+void ppu_sprite_free(sprite_handle_t handle);
+
+/** @brief Replace every attribute of a sprite
+ * @param handle A valid sprite handle.
+ * @param sprite The new state of the sprite.
+ */
+void ppu_sprite_set(sprite_handle_t handle, const sprite_t *sprite);
+
+/** @brief Move a sprite
+ * @param handle A valid sprite handle.
+ * @param x New x coordinate. Range [0, 511].
+ * @param y New y coordinate. Range [0, 255].
+ */
+void ppu_sprite_move(sprite_handle_t handle, unsigned x, unsigned y);
+
+/** @brief Change the pattern and palette used by a sprite
+ * @param handle A valid sprite handle.
+ * @param pattern_addr Address of the sprite's starting pattern in Pattern RAM.
+ * @param palette_id Palette to use for this sprite. Range [0, 31].
+ */
+void ppu_sprite_set_pattern(sprite_handle_t handle, pattern_addr_t pattern_addr,
+                            unsigned palette_id);
+
+/** @brief Change the mirroring and render priority of a sprite
+ * @param handle A valid sprite handle.
+ * @param mirror Graphics mirror functionality for this sprite.
+ * @param prio Render priority of this sprite.
+ */
+void ppu_sprite_set_attr(sprite_handle_t handle, mirror_e mirror, render_prio_e prio);
+
+/** @brief Send all sprite pool changes made since the last flush to Sprite RAM
+ *
+ * Call this before @ref ppu_update to have the sprite changes appear in the next frame. The first
+ *   flush also hides all sprites in Sprite RAM which are not in use by the pool.
+ *
+ * @pre PPU is currently locked by this process. See @ref ppu_enable.
+ * @return 0 on success; -1 on error (the changes are kept for the next flush)
+ */
+int ppu_sprite_flush(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,88 @@
+/** @file ppu_ref.h
+ * @author Joseph Yankel
+ * @brief Software reference renderer for the FP-GAme PPU
+ *
+ * Renders a frame from a VRAM image and the PPU control registers exactly as the PPU hardware
+ *   would display it: the same layer priorities and transparency, tile and sprite mirroring, tile
+ *   layer scrolling (wrapping at 512 pixels), and the limit of 16 sprites per row (the first 16
+ *   sprites in Sprite RAM which cover the row, whether or not they are visible on it).
+ *
+ * The renderer does not touch the PPU, so it can be used anywhere the library builds, including
+ *   the host. It is meant for regression testing and offline profiling of games without hardware.
+ *
+ * Rendering is done through a renderer, which owns its per-frame state and a pool of worker
+ *   threads started once, when it is created. Any number of renderers may be used at the same time.
+ *
+ * @remark Renderers use POSIX threads. Link with -pthread.
+ * @attention Invalid arguments will result in a console warning and exiting of the program, as
+ *   with the rest of the PPU library.
+ */
+
+#ifndef _FP_GAME_PPU_REF_H_
+#define _FP_GAME_PPU_REF_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <fp-game/ppu.h>
+
+#define PPU_REF_WIDTH 320  ///< Width in pixels of a rendered frame
+#define PPU_REF_HEIGHT 240 ///< Height in pixels of a rendered frame
+
+/** @brief The PPU control registers, as set by ppu_set_scroll, ppu_set_bgcolor and
+ *         ppu_set_layer_enable
+ *
+ * Like the hardware, only the low 9 bits of each scroll value and the low 24 bits of the bgcolor
+ *   are used.
+ */
+typedef struct {
+    unsigned bg_scroll_x; ///< Horizontal pixel scroll of the background tile layer
+    unsigned bg_scroll_y; ///< Vertical pixel scroll of the background tile layer
+    unsigned fg_scroll_x; ///< Horizontal pixel scroll of the foreground tile layer
+    unsigned fg_scroll_y; ///< Vertical pixel scroll of the foreground tile layer
+    unsigned enable;      ///< Layer enable mask (an OR of layer_e)
+    uint32_t bgcolor;     ///< 24-bit color shown where no layer has an opaque pixel
+} ppu_ref_regs_t;
+
+/** @brief A reference renderer. Obtain using @ref ppu_ref_create */
+typedef struct ppu_ref ppu_ref_t;
+
+/** @brief Create a reference renderer
+ *
+ * The rows of each frame are split evenly between @p threads threads, one of which is the thread
+ *   calling @ref ppu_ref_render. The other threads are started here and wait between frames, so
+ *   rendering a frame starts no threads. If fewer threads can be started than asked for, the
+ *   renderer uses the ones it has.
+ *
+ * @param threads Number of threads to render with. 0 and 1 both render on the calling thread
+ *                alone.
+ * @return The renderer. Destroy it with @ref ppu_ref_destroy once it is no longer needed.
+ */
+ppu_ref_t *ppu_ref_create(unsigned threads);
+
+/** @brief Destroy a reference renderer, stopping its threads
+ * @param ref The renderer to destroy.
+ */
+void ppu_ref_destroy(ppu_ref_t *ref);
+
+/** @brief Render a frame from a VRAM image
+ *
+ * The function returns once the whole frame has been rendered. A renderer renders one frame at a
+ *   time, so it must not be used by two threads at once; use a renderer per thread instead.
+ *
+ * @param ref The renderer to render with.
+ * @param vram The VRAM image to render, in the layout written to the PPU.
+ * @param regs The control registers to render with.
+ * @param frame Output frame of PPU_REF_HEIGHT rows of PPU_REF_WIDTH pixels. Each pixel is set to
+ *              the 24-bit color the PPU would output for it.
+ */
+void ppu_ref_render(ppu_ref_t *ref, const vram_t *vram, const ppu_ref_regs_t *regs,
+                    uint32_t *frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FP_GAME_PPU_REF_H_ */
@@ -0,0 +1,107 @@
+/**
+ * @file resample.h
+ * @author Andrew Spaulding
+ * @brief Sample rate conversion to the APU sample rate.
+ *
+ * Audio is usually authored at 44.1kHz or 48kHz, but the APU plays at
+ * APU_SAMPLE_RATE. A resampler converts a stream of 16-bit mono samples from
+ * its input rate to APU_SAMPLE_RATE with a windowed-sinc polyphase filter,
+ * which, unlike stepping through the samples (as the mixer's pitch does),
+ * keeps the high frequencies of the input from aliasing into the output.
+ *
+ * The filter keeps its state between calls, so a stream may be converted in
+ * blocks of any size (for example, APU_BUF_MAX samples per APU callback). The
+ * output is delayed by RESAMPLE_TAPS / 2 input samples.
+ *
+ * To resample a whole sound before giving it to the mixer, use
+ * resample_sound().
+ */
+
+#ifndef _FP_GAME_RESAMPLE_H_
+#define _FP_GAME_RESAMPLE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <fp-game/mixer.h>
+
+/** @brief The number of input samples each output sample is filtered from. */
+#define RESAMPLE_TAPS 48
+
+/**
+ * @brief The largest number of filter phases a resampler may use.
+ *
+ * A conversion from rate to APU_SAMPLE_RATE uses
+ * APU_SAMPLE_RATE / gcd(rate, APU_SAMPLE_RATE) phases; 44.1kHz uses 320 and
+ * 48kHz uses 2.
+ */
+#define RESAMPLE_MAX_PHASES 1024
+
+/** @brief A resampler. Obtain using resample_create(). */
+typedef struct resampler resampler_t;
+
+/**
+ * @brief Creates a resampler.
+ *
+ * It is illegal to give a rate which needs more than RESAMPLE_MAX_PHASES
+ * filter phases.
+ *
+ * @param rate The sample rate of the input, in Hz.
+ * @return The resampler.
+ */
+resampler_t *resample_create(unsigned rate);
+
+/**
+ * @brief Destroys a resampler.
+ * @param r The resampler to destroy.
+ */
+void resample_destroy(resampler_t *r);
+
+/**
+ * @brief Clears the state of a resampler, so it may convert a new stream.
+ * @param r The resampler to reset.
+ */
+void resample_reset(resampler_t *r);
+
+/**
+ * @brief Converts the next samples of a stream.
+ *
+ * Produces as many output samples as possible, up to out_len, using as many
+ * input samples as needed. Input samples which are not used must be given
+ * again in the next call.
+ *
+ * @param r The resampler.
+ * @param in The input samples.
+ * @param in_len The number of input samples.
+ * @param used Set to the number of input samples used.
+ * @param out Where to store the output samples.
+ * @param out_len The number of output samples wanted.
+ * @return The number of output samples produced.
+ */
+unsigned resample_process(resampler_t *r, const int16_t *in, unsigned in_len,
+                          unsigned *used, int16_t *out, unsigned out_len);
+
+/**
+ * @brief Converts a whole sound to APU_SAMPLE_RATE.
+ *
+ * The converted sound is 16-bit mono (stereo sounds are mixed down, evenly),
+ * and so may be played by the mixer at MIXER_PITCH_1X. Its loop start is moved
+ * to the matching sample. The filter delay is removed, so the converted sound
+ * lines up with the original.
+ *
+ * The converted samples are allocated with malloc(), and must be freed with
+ * free() once the sound is no longer playing.
+ *
+ * @param in The sound to convert.
+ * @param rate The sample rate of the sound, in Hz.
+ * @param out Filled in with the converted sound.
+ */
+void resample_sound(const mixer_sound_t *in, unsigned rate, mixer_sound_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FP_GAME_RESAMPLE_H_ */
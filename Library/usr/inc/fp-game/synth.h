@@ -0,0 +1,181 @@
+/**
+ * @file synth.h
+ * @author Andrew Spaulding
+ * @brief A chiptune synthesizer and pattern sequencer for the APU.
+ *
+ * The synthesizer has SYNTH_CHANNELS channels in the style of 8-bit consoles:
+ * two pulse channels with selectable duty cycles, a triangle channel, a noise
+ * channel, and a wavetable channel which loops a 32 sample waveform. Each
+ * channel plays one note at a time, shaped by its instrument's volume
+ * envelope and pitch sweep.
+ *
+ * Songs are tracker-style: a list of patterns to play in order, where each
+ * pattern is a grid of rows with one cell (a note and an instrument) per
+ * channel. A song's data is a few bytes per row, so a whole soundtrack takes
+ * kilobytes rather than the megabytes its PCM would. Songs are plain constant
+ * data, and so are usually compiled into the program.
+ *
+ * Envelopes, sweeps and the sequencer advance once per tick, SYNTH_TICK_RATE
+ * times per second. Between ticks, each channel's samples are generated by a
+ * short fixed-point loop, so the time taken to render a block of samples
+ * depends only on its length.
+ *
+ * The synthesizer produces APU samples with synth_render(). Give
+ * synth_callback() to apu_enable(), or synth_render() to apu_enable_render(),
+ * and then start songs with synth_play(). The synth functions may be called
+ * from any thread, but not from inside the APU callback.
+ *
+ * Programs using the synthesizer must be linked with -pthread.
+ */
+
+#ifndef _FP_GAME_SYNTH_H_
+#define _FP_GAME_SYNTH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** @brief The channels of the synthesizer. */
+typedef enum {
+	SYNTH_PULSE1,   ///< Pulse wave, with a duty cycle set by the instrument.
+	SYNTH_PULSE2,   ///< A second pulse wave.
+	SYNTH_TRIANGLE, ///< 16 step triangle wave.
+	SYNTH_NOISE,    ///< Noise from a 15-bit LFSR, clocked at 4x the note frequency.
+	SYNTH_WAVE,     ///< Loops the instrument's 32 sample waveform.
+	SYNTH_CHANNELS, ///< The number of channels.
+} synth_channel_e;
+
+/** @brief The number of times per second envelopes, sweeps and songs advance. */
+#define SYNTH_TICK_RATE 60
+
+/** @brief The loudest channel volume. */
+#define SYNTH_VOLUME_MAX 15
+
+/** @brief The master volume which plays the synthesizer at its original loudness. */
+#define SYNTH_MASTER_MAX 256
+
+/** @brief The number of samples in a wavetable waveform. */
+#define SYNTH_WAVE_SIZE 32
+
+/** @brief Note numbers. Note n (1 to 96) is semitone (n - 1) % 12 of octave (n - 1) / 12. */
+//@{
+#define SYNTH_NOTE_NONE 0   ///< Leaves the channel as it is.
+#define SYNTH_NOTE_C4 49    ///< Middle C; other notes are counted from here.
+#define SYNTH_NOTE_MAX 96   ///< B7, the highest note.
+#define SYNTH_NOTE_OFF 255  ///< Silences the channel.
+//@}
+
+/** @brief Pulse duty cycles. */
+typedef enum {
+	SYNTH_DUTY_12, ///< 12.5%
+	SYNTH_DUTY_25, ///< 25%
+	SYNTH_DUTY_50, ///< 50%
+	SYNTH_DUTY_75, ///< 75%
+} synth_duty_e;
+
+/**
+ * @brief How a channel plays its notes.
+ *
+ * Each field is only used by the channels it applies to.
+ */
+typedef struct {
+	uint8_t volume;       ///< Volume at the start of a note, [0, SYNTH_VOLUME_MAX].
+	int8_t env_step;      ///< Added to the volume every env_period ticks (clamped).
+	uint8_t env_period;   ///< Ticks between envelope steps, or 0 for a constant volume.
+	int8_t sweep_dir;     ///< 1 to sweep the pitch up, -1 down, or 0 not at all.
+	uint8_t sweep_shift;  ///< Each sweep step changes the frequency by 1 / 2^sweep_shift.
+	uint8_t sweep_period; ///< Ticks between sweep steps.
+	synth_duty_e duty;    ///< Duty cycle of the pulse channels.
+	bool noise_short;     ///< Noise channel: use a 93 step LFSR sequence, for metallic tones.
+	const int8_t *wave;   ///< Wavetable channel: SYNTH_WAVE_SIZE samples to loop.
+} synth_instrument_t;
+
+/** @brief One channel of one row of a pattern. */
+typedef struct {
+	uint8_t note;       ///< A note number, SYNTH_NOTE_NONE, or SYNTH_NOTE_OFF.
+	uint8_t instrument; ///< 1 + the index of the instrument to switch to, or 0 to keep it.
+} synth_cell_t;
+
+/** @brief A pattern: rows of SYNTH_CHANNELS cells each. */
+typedef struct {
+	const synth_cell_t (*rows)[SYNTH_CHANNELS]; ///< The rows of the pattern.
+	unsigned length;                            ///< The number of rows.
+} synth_pattern_t;
+
+/** @brief A song. */
+typedef struct {
+	const synth_instrument_t *instruments; ///< The instruments cells may switch to.
+	unsigned instrument_count;             ///< The number of instruments.
+	const synth_pattern_t *patterns;       ///< The patterns the order may play.
+	unsigned pattern_count;                ///< The number of patterns.
+	const uint8_t *order;                  ///< Indexes of the patterns to play, in order.
+	unsigned order_length;                 ///< The number of patterns to play.
+	bool loop;                             ///< If true, the order repeats from loop_start.
+	unsigned loop_start;                   ///< The order position to repeat from, if looping.
+	unsigned speed;                        ///< Ticks per row.
+} synth_song_t;
+
+/**
+ * @brief Starts playing a song from its first row, replacing any song playing.
+ *
+ * The song is checked in full, and must remain valid for as long as it is
+ * playing.
+ *
+ * @param song The song to play.
+ */
+void synth_play(const synth_song_t *song);
+
+/**
+ * @brief Stops the song playing (if any), and silences every channel.
+ */
+void synth_stop(void);
+
+/**
+ * @brief Checks whether a song is playing.
+ * @return True if a song is playing, and has not reached the end of its order.
+ */
+bool synth_playing(void);
+
+/**
+ * @brief Plays a note on a channel directly, as a song cell would.
+ *
+ * Useful for sound effects. If a song is playing, its next cell on the
+ * channel will replace the note.
+ *
+ * @param channel The channel to play the note on.
+ * @param note A note number, or SYNTH_NOTE_OFF.
+ * @param instrument The instrument to play the note with.
+ */
+void synth_note(synth_channel_e channel, unsigned note, const synth_instrument_t *instrument);
+
+/**
+ * @brief Sets the master volume, which scales every channel.
+ * @param volume The master volume, [0, SYNTH_MASTER_MAX].
+ */
+void synth_set_master(unsigned volume);
+
+/**
+ * @brief Renders the next samples of every channel into APU samples.
+ *
+ * The channels are summed and the result is saturated to the int8 range.
+ *
+ * @param out Where to store the samples.
+ * @param len The number of samples to render, at most APU_BUF_MAX.
+ */
+void synth_render(int8_t *out, unsigned len);
+
+/**
+ * @brief An APU callback which plays the synthesizer. See apu_enable().
+ * @param buf Set to APU_BUF_MAX freshly rendered samples.
+ * @param buf_size Set to APU_BUF_MAX.
+ */
+void synth_callback(const int8_t **buf, int *buf_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FP_GAME_SYNTH_H_ */